@@ -1,7 +1,24 @@
 #include "Collections.h"
+#include <climits>
 #include <cstring>
 #include <stdlib.h>
 
+//AVX2 is used only when the cpu has it, so it's code is compiled for it function by function
+#ifdef SYNCTL_SSE2
+#define SYNCTL_AVX2_KERNELS
+#include <immintrin.h>
+#if (defined __GNUC__) || (defined __clang__)
+#define SYNCTL_TARGET_AVX2	__attribute__((target("avx2")))
+#else
+#define SYNCTL_TARGET_AVX2
+#endif //__GNUC__
+#endif //SYNCTL_SSE2
+
+//POPCNT is checked at run time too. it does not need SSE2 builds, any x86 cpu may have it.
+#ifdef SYNCTL_X86
+#define SYNCTL_POPCNT_KERNELS
+#endif //SYNCTL_X86
+
 /*
 //Vector<int> tmp_v;
 SyncTL::BasicVector tmp_v;
@@ -83,7 +100,8 @@ BasicVector::BasicVector(BasicReadWriteLock* lock):
 	m_data(NULL),
 	m_count(0),
 	m_allocator(NULL),
-	m_rw_lock(lock)
+	m_rw_lock(lock),
+	m_sharing_enabled(false)
 	//and BasicVector object will be invalid until copy constructor or assignment operator execution.
 	//this is needed for tree iterators.
 {}
@@ -94,16 +112,25 @@ BasicVector::BasicVector(const BasicVector& another):
 	m_data(NULL),
 	m_count(0),
 	m_allocator(another.m_allocator),
-	m_rw_lock(NULL)	//lock by default is not copied because this is strange when access to one collection is denied 
+	m_rw_lock(NULL),	//lock by default is not copied because this is strange when access to one collection is denied 
 					//because another collection is locked.
+	m_sharing_enabled(another.m_sharing_enabled)
 {
+	if (m_sharing_enabled && (another.m_data != NULL))
+	{
+		GetRefCount(another.m_data)->fetch_add(1, std::memory_order_relaxed);
+		m_data = another.m_data;
+		m_data_array_size = another.m_data_array_size;
+		m_count = another.m_count;
+		return;
+	}
 	if (m_allocator != NULL)
 	{
 		if ((another.m_data != NULL) && (another.m_entry_size != 0) && (another.m_count != 0))
 		{
 			ResizeDataArray(another.m_data_array_size);
 			//copy data from another
-			memcpy(m_data, another.m_data, another.m_data_array_size);
+			memcpy(m_data, another.m_data, (size_t)another.m_count * m_entry_size);
 			m_data_array_size = another.m_data_array_size;
 			m_count = another.m_count;
 		}
@@ -119,7 +146,8 @@ BasicVector::BasicVector(unsigned int entry_size,
 	m_data(NULL),
 	m_count(0),
 	m_allocator(allocator),
-	m_rw_lock(lock)
+	m_rw_lock(lock),
+	m_sharing_enabled(false)
 {
 	ASSERT(m_entry_size != 0);
 	ASSERT(m_allocator != NULL);
@@ -139,7 +167,7 @@ BasicVector::~BasicVector()
 	{
 		if (m_allocator != NULL)
 		{
-			m_allocator->FreeDataArray(m_data);
+			ReleaseEntries(m_data, m_count);
 		}
 	}
 }
@@ -168,13 +196,7 @@ void BasicVector::ResizeDataArray(unsigned int n_entries)
 			L"Cannot increase data array because array must be reallocated and there is no allocator",
 			EXC_HERE);
 	}
-	char* new_data_array = m_allocator->AllocateDataArray(m_entry_size, n_entries * m_entry_size);
-	if (new_data_array == NULL)
-	{
-		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
-			L"Cannot increase data array because allocator could not allocate a new data array",
-			EXC_HERE);
-	}
+	char* new_data_array = AllocateBuffer(n_entries);
 	if (m_data != NULL)
 	{
 		char* src_ptr = m_data;
@@ -191,7 +213,7 @@ void BasicVector::ResizeDataArray(unsigned int n_entries)
 			dst_ptr += m_entry_size;
 			--count;
 		}
-		m_allocator->FreeDataArray(m_data);
+		ReleaseBuffer(m_data);
 	}
 	m_data = new_data_array;
 	m_data_array_size = n_entries;
@@ -254,6 +276,7 @@ char* BasicVector::InsertEntry(unsigned int index, const char* data)
 			L"Cannot insert a new entry because insertion index is far beyond the vector size",
 			EXC_HERE);
 	}
+	InternalDetach();
 	unsigned int new_size = m_count + 1;
 	if (new_size >= m_data_array_size)
 	{
@@ -264,13 +287,7 @@ char* BasicVector::InsertEntry(unsigned int index, const char* data)
 				L"Cannot increase data array because array must be reallocated and there is no allocator",
 				EXC_HERE);
 		}
-		char* array = m_allocator->AllocateDataArray(m_entry_size, m_data_array_size + m_allocator_increment);
-		if (array == NULL)
-		{
-			throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
-				L"Cannot allocate memory for the new vector",
-				EXC_HERE);
-		}
+		char* array = AllocateBuffer(m_data_array_size + m_allocator_increment);
 		const char* src_ptr = m_data;
 		char* dst_ptr = array;
 		//copy previous entries.. NO MEMCPY!
@@ -299,7 +316,10 @@ char* BasicVector::InsertEntry(unsigned int index, const char* data)
 			dst_ptr += m_entry_size;
 			--rest_count;
 		}
-		m_allocator->FreeDataArray(m_data);
+		if (m_data != NULL)
+		{
+			ReleaseBuffer(m_data);
+		}
 		m_data = array;
 		m_data_array_size += m_allocator_increment;
 	} else {
@@ -344,6 +364,7 @@ void BasicVector::RemoveEntry(unsigned int index)
 			L"Cannot remove entry from the vector because entry index is bigger than current vector size",
 			EXC_HERE);
 	}
+	InternalDetach();
 	//if new size is less then current size - allocation size
 	unsigned int new_size_in_entries = (m_count - 1);
 	//allocator increment is on terms of entries.
@@ -362,13 +383,7 @@ void BasicVector::RemoveEntry(unsigned int index)
 		}
 		ASSERT(new_size_in_allocator_increments != 0);
 		unsigned int new_data_array_size = new_size_in_allocator_increments * m_allocator_increment;
-		char* new_array = m_allocator->AllocateDataArray(m_entry_size, new_data_array_size);
-		if (new_array == NULL)
-		{
-			throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
-				L"Cannot decrease data array because allocator cannot allocate a new data array",
-				EXC_HERE);
-		}
+		char* new_array = AllocateBuffer(new_data_array_size);
 		//copy previous entries to new array
 		char* src_ptr = m_data;
 		char* dst_ptr = new_array;
@@ -401,7 +416,7 @@ void BasicVector::RemoveEntry(unsigned int index)
 			dst_ptr += m_entry_size;
 			--rest_count;
 		}// while (rest_count > 0);
-		m_allocator->FreeDataArray(m_data);
+		ReleaseBuffer(m_data);
 		m_data = new_array;
 		m_data_array_size = new_data_array_size;
 	} else {	//copy the rest of entries one step lower.
@@ -436,12 +451,10 @@ void BasicVector::Clear()
 		}
 	}*/
 	WriteSynchronizer sync(m_rw_lock);
-	for (unsigned int index = 0; index < GetCount(); ++index)
+	if (m_data != NULL)
 	{
-		char* entry_ptr = m_data + (index * m_entry_size);
-		DeinitEntry(entry_ptr);
+		ReleaseEntries(m_data, m_count);
 	}
-	m_allocator->FreeDataArray(m_data);
 	m_data = NULL;	//so ResizeDataArray have nothing to copy
 	ResizeDataArray(m_allocator_increment);	//to the same state as it was after construction.
 	m_count = 0;
@@ -472,21 +485,44 @@ BasicVector& BasicVector::operator = (const BasicVector& another)
 				EXC_HERE);
 		}
 	}*/
+	if ((this == &another) || ((m_data != NULL) && (m_data == another.m_data)))
+	{
+		return *this;	//the same vector or the same shared buffer
+	}
 	WriteSynchronizer this_sync(m_rw_lock);
 	ReadSynchronizer another_sync(another.m_rw_lock);
+	//a shared buffer is freed by whichever owner releases it last, so only vectors
+	//with the same allocator may share it. otherwise entries are copied.
+	if (another.m_sharing_enabled && (another.m_data != NULL) &&
+		((m_allocator == NULL) || (m_allocator == another.m_allocator)))
+	{
+		GetRefCount(another.m_data)->fetch_add(1, std::memory_order_relaxed);
+		if (m_data != NULL)
+		{
+			ReleaseBuffer(m_data);
+		}
+		m_sharing_enabled = true;
+		m_data = another.m_data;
+		m_data_array_size = another.m_data_array_size;
+		m_count = another.m_count;
+		m_entry_size = another.m_entry_size;
+		m_allocator = another.m_allocator;
+		return *this;
+	}
 	if ((another.m_data != NULL) && (another.m_data_array_size != 0) && (another.m_count != 0))
 	{
+		m_entry_size = another.m_entry_size;
 		ResizeDataArray(another.m_data_array_size);
 		//copy data from another
-		memcpy(m_data, another.m_data, another.m_data_array_size);
+		memcpy(m_data, another.m_data, (size_t)another.m_count * m_entry_size);
 		m_data_array_size = another.m_data_array_size;
 		m_count = another.m_count;
 		m_entry_size = another.m_entry_size;
 	} else {
 		//another is invalid. set this to NULL state
-		if (m_allocator != NULL)
+		if ((m_allocator != NULL) && (m_data != NULL))
 		{
-			m_allocator->FreeDataArray(m_data);
+			ReleaseBuffer(m_data);
 		}
 		m_data = NULL;
 		m_data_array_size = 0;
@@ -506,6 +542,7 @@ BasicVector& BasicVector::operator = (const BasicVector& another)
 
 BasicVector::Iterator BasicVector::Begin()
 {
+	Detach();
 	/*if ((m_rw_lock != NULL) && (m_rw_lock->TryLockForRead() == false))
 	{
 		throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
@@ -518,6 +555,7 @@ BasicVector::Iterator BasicVector::Begin()
 
 BasicVector::Iterator BasicVector::Last()
 {
+	Detach();
 	/*if ((m_rw_lock != NULL) && (m_rw_lock->TryLockForRead() == false))
 	{
 		throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
@@ -558,632 +596,834 @@ void BasicVector::Unlock()
 	}
 }
 
-void BasicVector::CopyEntry(const char* src, char* dst)
+void BasicVector::EnableSharing(bool enable)
 {
-	memcpy(dst, src, m_entry_size);
+	WriteSynchronizer sync(m_rw_lock);
+	if (enable == m_sharing_enabled)
+	{
+		return;
+	}
+	if (m_data == NULL)
+	{
+		m_sharing_enabled = enable;
+		return;
+	}
+	//buffers with and without the reference counter differ, so entries are copied to a new one
+	char* old_data = m_data;
+	m_sharing_enabled = enable;
+	char* new_data = AllocateBuffer(m_data_array_size);
+	for (unsigned int index = 0; index < m_count; ++index)
+	{
+		CopyEntry(old_data + (index * m_entry_size), new_data + (index * m_entry_size));
+	}
+	m_sharing_enabled = !enable;
+	ReleaseBuffer(old_data);
+	m_sharing_enabled = enable;
+	m_data = new_data;
 }
 
-void BasicVector::DeinitEntry(char* entry)
+void BasicVector::Detach()
 {
-	//nothing
+	//a buffer nobody else shares needs no copy and no lock, so callers holding the read lock are fine then
+	if (IsBufferShared() == false)
+	{
+		return;
+	}
+	WriteSynchronizer sync(m_rw_lock);
+	InternalDetach();
 }
 
-void BasicStack::PushFront(const char* data)
+char* BasicVector::AllocateBuffer(unsigned int n_entries)
 {
-	ASSERT(data != NULL);
-	//if caller passes here an invalid data ptr, it's caller's fault.
-	InsertEntry(0, data);
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot allocate data array because there is no allocator",
+			EXC_HERE);
+	}
+	char* ret_val = NULL;
+	if (m_sharing_enabled)
+	{
+		ret_val = m_allocator->AllocateDataArray(1, SHARED_HEADER_SIZE + n_entries * m_entry_size);
+		if (ret_val != NULL)
+		{
+			ret_val += SHARED_HEADER_SIZE;
+			new (GetRefCount(ret_val)) std::atomic<unsigned int>(1);
+		}
+	} else {
+		ret_val = m_allocator->AllocateDataArray(m_entry_size, n_entries);
+	}
+	if (ret_val == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate data array for the vector",
+			EXC_HERE);
+	}
+	return ret_val;
 }
 
-void BasicStack::PushBack(const char* data)
+void BasicVector::ReleaseBuffer(char* data)
 {
 	ASSERT(data != NULL);
-	//if caller passes here an invalid data ptr, it's caller's fault.
-	InsertEntry(m_count, data);
+	if (m_sharing_enabled == false)
+	{
+		m_allocator->FreeDataArray(data);
+		return;
+	}
+	if (GetRefCount(data)->fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		m_allocator->FreeDataArray(data - SHARED_HEADER_SIZE);
+	}
 }
 
-void BasicStack::PopFront()
+void BasicVector::ReleaseEntries(char* data, unsigned int count)
 {
-	RemoveEntry(0);
+	ASSERT(data != NULL);
+	if (m_sharing_enabled)
+	{
+		//the reference is dropped first, so only the owner that saw the last one deinits entries.
+		//checking IsBufferShared() before releasing would let two owners both skip them.
+		if (GetRefCount(data)->fetch_sub(1, std::memory_order_acq_rel) != 1)
+		{
+			return;
+		}
+	}
+	for (unsigned int index = 0; index < count; ++index)
+	{
+		DeinitEntry(data + (index * m_entry_size));
+	}
+	if (m_sharing_enabled)
+	{
+		m_allocator->FreeDataArray(data - SHARED_HEADER_SIZE);
+	} else {
+		m_allocator->FreeDataArray(data);
+	}
 }
 
-void BasicStack::PopBack()
+char* BasicVector::LockEntries()
 {
-	RemoveEntry(m_count - 1);
+	if (LockForWrite() == false)
+	{
+		throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
+			L"Cannot lock for write",
+			EXC_HERE);
+	}
+	try
+	{
+		InternalDetach();
+	} catch (...)
+	{
+		Unlock();
+		throw;
+	}
+	return m_data;
 }
 
-char* BasicStack::Top()
+void BasicVector::InternalDetach()
 {
-	/*if ((m_rw_lock != NULL) && (m_rw_lock->TryLockForRead() == false))
+	if (IsBufferShared() == false)
 	{
-		throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
-			L"vector is locked for read",
-			EXC_HERE);
-	}*/
-	TryReadSynchronizer sync(m_rw_lock);
-	if (m_count > 0)
+		return;
+	}
+	char* new_data = AllocateBuffer(m_data_array_size);
+	for (unsigned int index = 0; index < m_count; ++index)
 	{
-		ASSERT(m_data != NULL);
-		return m_data + ((m_count - 1) * m_entry_size);
-	} else {
-		return NULL;
+		CopyEntry(m_data + (index * m_entry_size), new_data + (index * m_entry_size));
 	}
+	//other owners may have released the buffer meanwhile, then the old entries are ours to deinit
+	ReleaseEntries(m_data, m_count);
+	m_data = new_data;
 }
 
-BasicList::BasicList(BasicReadWriteLock* lock):
-	m_head(NULL),
-	m_last(NULL),
+void BasicVector::CopyEntry(const char* src, char* dst)
+{
+	memcpy(dst, src, m_entry_size);
+}
+
+void BasicVector::DeinitEntry(char* entry)
+{
+	//nothing
+}
+
+BasicDeque::BasicDeque(unsigned int entry_size, unsigned int n_preallocated, Allocator* allocator,
+					   BasicReadWriteLock* lock):
+	m_entry_size(entry_size),
+	m_data(NULL),
+	m_capacity(0),
+	m_head(0),
 	m_count(0),
+	m_allocator(allocator),
 	m_rw_lock(lock)
 {
-	int i = 0;
-	int j = i;
+	ASSERT(entry_size != 0);
+	if (n_preallocated != 0)
+	{
+		Grow(n_preallocated);
+	}
 }
 
-BasicList::~BasicList()
+BasicDeque::BasicDeque(BasicReadWriteLock* lock):
+	m_entry_size(0),
+	m_data(NULL),
+	m_capacity(0),
+	m_head(0),
+	m_count(0),
+	m_allocator(NULL),
+	m_rw_lock(lock)
+{}
+
+BasicDeque::BasicDeque(const BasicDeque& another):
+	m_entry_size(another.m_entry_size),
+	m_data(NULL),
+	m_capacity(0),
+	m_head(0),
+	m_count(0),
+	m_allocator(another.m_allocator),
+	m_rw_lock(NULL)	//like in BasicVector, the lock is not copied
+{}
+
+BasicDeque& BasicDeque::operator = (const BasicDeque& another)
 {
-	/*if (m_rw_lock != NULL)
+	if (this == &another)
 	{
-		m_rw_lock->LockForWrite();	//cannot throw exceptions here,
-	}*/
-	WriteSynchronizer sync(m_rw_lock);
-	if (m_count != 0)
+		return *this;
+	}
+	Clear();
+	if (m_entry_size != another.m_entry_size)
 	{
-		ASSERT(m_head != NULL);
-		Entry* current_entry = m_head;
-		bool exit_flag = false;
-		while (exit_flag == false)
+		if (m_data != NULL)
 		{
-			Entry* next_entry = current_entry->m_next;
-			current_entry->Remove();
-			current_entry = next_entry;
-			if (current_entry == NULL)
-			{
-				exit_flag = true;
-			}
+			m_allocator->FreeDataArray(m_data);
 		}
+		m_data = NULL;
+		m_capacity = 0;
+		m_head = 0;
+		m_entry_size = another.m_entry_size;
 	}
-#ifdef _DEBUG
-	else {
-		ASSERT(m_head == NULL);
-		ASSERT(m_last == NULL);
-	}
-#endif //_DEBUG
-	/*if (m_rw_lock != NULL)
+	if (m_allocator == NULL)
 	{
-		m_rw_lock->Unlock();
-	}*/
+		m_allocator = another.m_allocator;
+	}
+	AppendFrom(another);
+	return *this;
 }
 
-void BasicList::Entry::Remove()
+void BasicDeque::AppendFrom(const BasicDeque& another)
 {
-	/*if (m_list != NULL)
+	ASSERT(m_entry_size == another.m_entry_size);
+	ReadSynchronizer sync(another.m_rw_lock);
+	if (another.m_count == 0)
 	{
-		if (m_list->LockForWrite() == false)
-		{
-			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
-				L"Cannot lock the list for write",
-				EXC_HERE);
-		}
-	}*/
-	//TemplateWriteSynchronizer<BasicList> sync(m_list);
-	TemplateWriteSynchronizer<BasicReadWriteLock> sync(m_list->m_rw_lock);
-	if(m_list == NULL)
+		return;
+	}
+	//the ring of another is at most two runs
+	unsigned int first_run = another.m_capacity - another.m_head;
+	if (first_run > another.m_count)
 	{
-		throw Exception(UTILS_ERROR_NOT_IN_COLLECTION,
-			L"Cannot remove entry from the list because this entry is not in list",
-			EXC_HERE);
+		first_run = another.m_count;
 	}
-	if ((m_prev == NULL) && (m_next == NULL) && (m_list->GetCount() > 1))
+	PushBackArray(another.GetSlot(0), first_run);
+	PushBackArray(another.m_data, another.m_count - first_run);
+}
+
+BasicDeque::~BasicDeque()
+{
+	//entries are destroyed by the typed deque
+	if (m_data != NULL)
 	{
-		throw Exception(UTILS_ERROR_NOT_IN_COLLECTION,
-			L"Cannot remove entry from the list because this entry looks like to be the last in the list but it is not (list->GetCount() > 1)",
+		m_allocator->FreeDataArray(m_data);
+	}
+}
+
+void BasicDeque::Grow(unsigned int min_capacity)
+{
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot grow deque because there is no allocator",
 			EXC_HERE);
 	}
-	if (m_prev != NULL)
+	unsigned int new_capacity = (m_capacity != 0) ? m_capacity : 4;
+	while (new_capacity < min_capacity)
 	{
-		if (m_next != NULL)
+		if (new_capacity > (UINT_MAX >> 1))
 		{
-			m_next->m_prev = m_prev;
-			m_prev->m_next = m_next;
-		}
-		else {
-			m_prev->m_next = NULL;
+			throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+				L"Cannot grow deque because capacity is too big",
+				EXC_HERE);
 		}
+		new_capacity <<= 1;
 	}
-	else {
-		if (m_next != NULL)
+	if (new_capacity == m_capacity)
+	{
+		return;
+	}
+	char* new_data = m_allocator->AllocateDataArray(m_entry_size, new_capacity);
+	if (m_data != NULL)
+	{
+		//unwrap the ring, the first entry goes to the start of the new buffer
+		unsigned int first_run = m_capacity - m_head;
+		if (first_run > m_count)
 		{
-			m_next->m_prev = NULL;
+			first_run = m_count;
 		}
+		RelocateEntries(m_data + (size_t)m_head * m_entry_size, new_data, first_run);
+		RelocateEntries(m_data, new_data + (size_t)first_run * m_entry_size, m_count - first_run);
+		m_allocator->FreeDataArray(m_data);
 	}
-	/*if (m_list != NULL)
-	{
-		m_list->Unlock();
-	}*/
+	m_data = new_data;
+	m_capacity = new_capacity;
+	m_head = 0;
 }
 
-bool BasicList::LockForRead()
+char* BasicDeque::PushBack(const char* data)
 {
-	if (m_rw_lock != NULL)
+	ASSERT(data != NULL);
+	WriteSynchronizer sync(m_rw_lock);
+	if (m_count == m_capacity)
 	{
-		return m_rw_lock->LockForRead();
+		Grow(m_count + 1);
 	}
-	return true;
+	char* ret_val = GetSlot(m_count);
+	CopyEntries(data, ret_val, 1);
+	++m_count;
+	return ret_val;
 }
 
-bool BasicList::LockForWrite()
+char* BasicDeque::PushFront(const char* data)
 {
-	if (m_rw_lock != NULL)
+	ASSERT(data != NULL);
+	WriteSynchronizer sync(m_rw_lock);
+	if (m_count == m_capacity)
 	{
-		return m_rw_lock->LockForWrite();
+		Grow(m_count + 1);
 	}
-	return true;
+	unsigned int new_head = (m_head - 1) & (m_capacity - 1);
+	char* ret_val = m_data + (size_t)new_head * m_entry_size;
+	CopyEntries(data, ret_val, 1);
+	m_head = new_head;
+	++m_count;
+	return ret_val;
 }
 
-void BasicList::Unlock()
+void BasicDeque::PopBack()
 {
-	if (m_rw_lock != NULL)
+	WriteSynchronizer sync(m_rw_lock);
+	if (m_count == 0)
 	{
-		m_rw_lock->Unlock();
+		throw Exception(UTILS_ERROR_INDEX_BIGGER_THAN_ARRAY_SIZE,
+			L"Cannot pop entry because deque is empty",
+			EXC_HERE);
 	}
+	DeinitEntries(GetSlot(m_count - 1), 1);
+	--m_count;
 }
 
-BasicList::Entry* BasicList::InternalInsert(BasicList::Entry* entry,
-	BasicList::Entry* before_this_entry /*may be NULL, this means PushBack*/)
+void BasicDeque::PopFront()
 {
-	/*if (m_rw_lock != NULL)
-	{
-		if (m_rw_lock->LockForWrite() == false)
-		{
-			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
-				L"Cannot lock a list for write",
-				EXC_HERE);
-		}
-	}*/
 	WriteSynchronizer sync(m_rw_lock);
-	if ((entry->m_prev != NULL) || (entry->m_next != NULL) || (entry->m_list != NULL))
+	if (m_count == 0)
 	{
-		//add unlock here
-		throw Exception(UTILS_ERROR_CANNOT_INSERT_ALREADY_INSERTED,
-			L"Cannot insert a new list entry because it is already inserted somewhere",
+		throw Exception(UTILS_ERROR_INDEX_BIGGER_THAN_ARRAY_SIZE,
+			L"Cannot pop entry because deque is empty",
 			EXC_HERE);
 	}
-	if (before_this_entry == NULL)
-	{
-		if (m_last == NULL)
-		{	//this means the list is still empty
-			ASSERT(m_head == NULL);
-			ASSERT(m_count == 0);
-			m_head = entry;
-			m_last = entry;
-			++m_count;
-			if (m_rw_lock != NULL)
-			{
-				m_rw_lock->Unlock();
-			}
-			entry->m_list = this;
-			return entry;
-		}
-		else {
-			//this means PushBack
-			ASSERT(m_count != 0);
-			ASSERT(m_head != NULL);
-			m_last->m_next = entry;
-			entry->m_prev = m_last;
-			m_last = entry;
-			++m_count;
-			entry->m_list = this;
-			if (m_rw_lock != NULL)
-			{
-				m_rw_lock->Unlock();
-			}
-			return entry;
-		}
-	}
-	ASSERT(before_this_entry != NULL);	//already checked it just above
-	Entry* prev_entry = before_this_entry->m_prev;
-	if (prev_entry != NULL)
-	{
-		prev_entry->m_next = entry;
-		entry->m_prev = prev_entry;
-	}
-	before_this_entry->m_prev = entry;
-	entry->m_next = before_this_entry;
-	++m_count;
-	entry->m_list = this;
-	/*if (m_rw_lock != NULL)
-	{
-		m_rw_lock->Unlock();
-	}*/
-	return entry;
+	RemoveFront(1);
 }
 
-BasicList::Entry* BasicList::InternalRemove(BasicList::Entry* entry)
+void BasicDeque::RemoveFront(unsigned int count)
 {
-	ASSERT(entry != NULL);
-	/*if (m_rw_lock != NULL)
+	ASSERT(count <= m_count);
+	unsigned int done = 0;
+	while (done < count)
 	{
-		if (m_rw_lock->LockForWrite() == false)
+		unsigned int position = (m_head + done) & (m_capacity - 1);
+		unsigned int run = m_capacity - position;
+		if (run > count - done)
 		{
-			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
-				L"cannot lock a list for write",
-				EXC_HERE);
+			run = count - done;
 		}
-	}*/
+		DeinitEntries(m_data + (size_t)position * m_entry_size, run);
+		done += run;
+	}
+	m_count -= count;
+	m_head = (m_count != 0) ? ((m_head + count) & (m_capacity - 1)) : 0;
+}
+
+void BasicDeque::PushBackArray(const char* data, unsigned int count)
+{
+	ASSERT(((data != NULL) || (count == 0)));
 	WriteSynchronizer sync(m_rw_lock);
-	if(entry->m_list != this)
+	if (count > UINT_MAX - m_count)
 	{
-		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
-			L"Cannot remove entry because it's m_list != this",
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Cannot push entries because deque would be too big",
 			EXC_HERE);
 	}
-	if ((entry->m_prev == NULL) && (entry->m_next == NULL) && ((entry != m_head) && (entry != m_last)))
+	if (m_count + count > m_capacity)
 	{
-		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
-			L"Cannot remove entry because it is not in list",
-			EXC_HERE);
+		Grow(m_count + count);
 	}
-	Entry* prev = entry->m_prev;
-	Entry* next = entry->m_next;
-	if (prev != NULL)
+	//at most two runs, before and after the end of the buffer
+	unsigned int done = 0;
+	while (done < count)
 	{
-		if (next != NULL)
+		unsigned int position = (m_head + m_count) & (m_capacity - 1);
+		unsigned int run = m_capacity - position;
+		if (run > count - done)
 		{
-			next->m_prev = prev;
-			prev->m_next = next;
+			run = count - done;
 		}
-		else {
-			//this may be the last
-			if (entry != m_last)
+		CopyEntries(data + (size_t)done * m_entry_size, m_data + (size_t)position * m_entry_size, run);
+		m_count += run;	//so an exception in the next run leaves the copied entries in place
+		done += run;
+	}
+}
+
+unsigned int BasicDeque::PopFrontArray(char* out, unsigned int count)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (count > m_count)
+	{
+		count = m_count;
+	}
+	if (out != NULL)
+	{
+		unsigned int done = 0;
+		while (done < count)
+		{
+			unsigned int position = (m_head + done) & (m_capacity - 1);
+			unsigned int run = m_capacity - position;
+			if (run > count - done)
 			{
-				throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
-					L"Cannot remove entry because it is not in list",
-					EXC_HERE);
+				run = count - done;
 			}
-			prev->m_next = NULL;
-			m_last = prev;
+			CopyEntries(m_data + (size_t)position * m_entry_size, out + (size_t)done * m_entry_size, run);
+			done += run;
 		}
 	}
-	else {
-		//this may be the first
-		if (entry != m_head)
-		{
-			throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
-				L"Cannot remove entry because it is not in list",
-				EXC_HERE);
-		}
-		if (next != NULL)
-		{
-			next->m_prev = NULL;
-			m_head = next;
-		}  //else this was the only one entry in the list.
-		else {
-			ASSERT(m_count == 1);
-			ASSERT((m_head == m_last) && (m_head == entry));
-			m_head = NULL;
-			m_last = NULL;
-		}
+	RemoveFront(count);
+	return count;
+}
+
+void BasicDeque::Reserve(unsigned int capacity)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (capacity > m_capacity)
+	{
+		Grow(capacity);
 	}
-	entry->m_list = NULL;
-	--m_count;
-	/*if (m_rw_lock != NULL)
+}
+
+void BasicDeque::Clear()
+{
+	WriteSynchronizer sync(m_rw_lock);
+	RemoveFront(m_count);
+}
+
+char* BasicDeque::Front() const
+{
+	ReadSynchronizer sync(m_rw_lock);
+	return (m_count != 0) ? GetSlot(0) : NULL;
+}
+
+char* BasicDeque::Back() const
+{
+	ReadSynchronizer sync(m_rw_lock);
+	return (m_count != 0) ? GetSlot(m_count - 1) : NULL;
+}
+
+char* BasicDeque::operator [] (unsigned int index) const
+{
+	ReadSynchronizer sync(m_rw_lock);
+	return (index < m_count) ? GetSlot(index) : NULL;
+}
+
+void BasicDeque::CopyEntries(const char* src, char* dst, unsigned int count)
+{
+	memcpy(dst, src, (size_t)count * m_entry_size);
+}
+
+void BasicDeque::DeinitEntries(char* entries, unsigned int count)
+{
+	//nothing
+}
+
+void BasicDeque::RelocateEntries(char* src, char* dst, unsigned int count)
+{
+	memcpy(dst, src, (size_t)count * m_entry_size);
+}
+
+bool BasicDeque::LockForRead()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForRead();
+	}
+	return true;
+}
+
+bool BasicDeque::LockForWrite()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForWrite();
+	}
+	return true;
+}
+
+void BasicDeque::Unlock()
+{
+	if (m_rw_lock != NULL)
 	{
 		m_rw_lock->Unlock();
-	}*/
-	return next;	//may be NULL if removed entry was the last.
+	}
 }
 
-void BasicList::Iterator::Advance(bool forward)
+BasicColony::BasicColony(unsigned int entry_size, Allocator* allocator, BasicReadWriteLock* lock):
+	m_entry_size(entry_size),
+	m_slot_size(entry_size < sizeof(unsigned int) ? (unsigned int)sizeof(unsigned int) : entry_size),
+	m_first(NULL),
+	m_last(NULL),
+	m_first_free(NULL),
+	m_count(0),
+	m_capacity(0),
+	m_allocator(allocator),
+	m_rw_lock(lock)
 {
-	/*if (m_rw_lock != NULL)
+	ASSERT(entry_size != 0);
+}
+
+BasicColony::~BasicColony()
+{
+	//entries are destroyed by the typed colony
+	while (m_first != NULL)
 	{
-		if (m_rw_lock->TryLockForRead() == false)
-		{
-			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
-				L"List cannot be locked for read",
-				EXC_HERE);
-		}
-	}*/
-	TryReadSynchronizer sync(m_rw_lock);
-	if (m_entry == NULL)
+		Bucket* next = m_first->m_next;
+		m_allocator->FreeDataArray((char*)m_first);
+		m_first = next;
+	}
+}
+
+BasicColony::Bucket* BasicColony::AllocateBucket(unsigned int capacity)
+{
+	if (m_allocator == NULL)
 	{
-		throw Exception(UTILS_ERROR_NULL_ITERATOR,
-			L"Cannot move an iterator because iterator does not point to any element",
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot add colony bucket because there is no allocator",
 			EXC_HERE);
 	}
-	Entry* next_entry = NULL;
-	if (forward)
+	ASSERT((capacity % (BIT_SIZEOF_INT)) == 0);
+	//one block: header, occupancy bits and slots aligned to a cache line
+	size_t occupancy_size = capacity / 8;
+	size_t header_size = (sizeof(Bucket) + occupancy_size + CACHE_LINE_SIZE - 1) & ~((size_t)CACHE_LINE_SIZE - 1);
+	size_t size = header_size + (size_t)capacity * m_slot_size + CACHE_LINE_SIZE;
+	if (size > UINT_MAX)
 	{
-		next_entry = m_entry->m_next;
-	}
-	else {
-		next_entry = m_entry->m_prev;
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Cannot add colony bucket because entries are too big",
+			EXC_HERE);
 	}
-	//now it's OK for iterator to reach end. it just becomes invalid and caller have to chech it.
-	m_entry = next_entry;
-	/*if (m_rw_lock != NULL)
+	char* block = m_allocator->AllocateDataArray(1, (unsigned int)size);
+	if (block == NULL)
 	{
-		m_rw_lock->Unlock();
-	}*/
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate colony bucket",
+			EXC_HERE);
+	}
+	Bucket* ret_val = (Bucket*)block;
+	ret_val->m_next = NULL;
+	ret_val->m_prev = NULL;
+	ret_val->m_next_free = NULL;
+	ret_val->m_prev_free = NULL;
+	ret_val->m_capacity = capacity;
+	ret_val->m_count = 0;
+	ret_val->m_first_free = NO_SLOT;
+	ret_val->m_used = 0;
+	ret_val->m_occupancy = (unsigned int*)(block + sizeof(Bucket));
+	memset(ret_val->m_occupancy, 0, occupancy_size);
+	//the allocator does not promise cache line alignment, so the slots are aligned inside the block
+	size_t slots = ((size_t)block + header_size + CACHE_LINE_SIZE - 1) & ~((size_t)CACHE_LINE_SIZE - 1);
+	ret_val->m_slots = (char*)slots;
+	return ret_val;
 }
 
-bool BasicTree::Entry::ChildrenIterator::Advance(bool forward)
+void BasicColony::FreeBucket(Bucket* bucket)
 {
-	BasicTree::Entry* next = NULL;
-	if (forward)
+	ASSERT(bucket->m_count == 0);
+	UnlinkFree(bucket);
+	if (bucket->m_prev != NULL)
 	{
-		next = m_child->m_next_sibling;
+		bucket->m_prev->m_next = bucket->m_next;
 	} else {
-		next = m_child->m_prev_sibling;
+		m_first = bucket->m_next;
 	}
-	if (next != NULL)
+	if (bucket->m_next != NULL)
 	{
-		m_child = next;
-		return true;
+		bucket->m_next->m_prev = bucket->m_prev;
 	} else {
-		return false;
+		m_last = bucket->m_prev;
 	}
+	m_capacity -= bucket->m_capacity;
+	m_allocator->FreeDataArray((char*)bucket);
 }
 
-BasicTree::Entry::~Entry()
+void BasicColony::LinkFree(Bucket* bucket)
 {
-	//bool exit_flag = false;
-	/*while (exit_flag == false)
+	ASSERT(((bucket->m_prev_free == NULL) && (m_first_free != bucket)));
+	bucket->m_prev_free = NULL;
+	bucket->m_next_free = m_first_free;
+	if (m_first_free != NULL)
 	{
-		//TODO: use iterator here to traverse all children.
-	}*/
+		m_first_free->m_prev_free = bucket;
+	}
+	m_first_free = bucket;
 }
 
-bool BasicTree::Entry::AddChild(BasicTree::Entry* new_child, BasicTree::Entry* child_before)
+void BasicColony::UnlinkFree(Bucket* bucket)
 {
-	if (new_child == NULL)
+	if ((bucket->m_prev_free == NULL) && (m_first_free != bucket))
 	{
-		throw Exception(UTILS_ERROR_CANNOT_INSERT_NULL_ENTRY,
-			L"Cannot add a child entry to the entry because the child entry parameter == NULL",
-			EXC_HERE);
-		return false;
+		return;	//it is not there
 	}
-	if ((new_child->m_prev_sibling != NULL) || (new_child->m_next_sibling != NULL))
+	if (bucket->m_prev_free != NULL)
 	{
-		throw Exception(UTILS_ERROR_CANNOT_INSERT_ALREADY_INSERTED,
-			L"Cannot add a child entry to the entry because new child entry is already added somewhere",
-			EXC_HERE);
-		return false;
-	}
-	if (m_first_child == NULL)
-	{	//this is the case when entry has no children.
-		ASSERT(m_last_child == NULL);
-		ASSERT(m_children_count == 0);
-		m_first_child = new_child;
-		m_last_child = new_child;
-		new_child->m_parent = this;
+		bucket->m_prev_free->m_next_free = bucket->m_next_free;
 	} else {
-		Entry* prev_child_entry = NULL;
-		if (child_before != NULL)
+		m_first_free = bucket->m_next_free;
+	}
+	if (bucket->m_next_free != NULL)
+	{
+		bucket->m_next_free->m_prev_free = bucket->m_prev_free;
+	}
+	bucket->m_next_free = NULL;
+	bucket->m_prev_free = NULL;
+}
+
+char* BasicColony::Insert(const char* data)
+{
+	ASSERT(data != NULL);
+	WriteSynchronizer sync(m_rw_lock);
+	Bucket* bucket = m_first_free;
+	if (bucket == NULL)
+	{
+		unsigned int capacity = MIN_BUCKET_SIZE;
+		if (m_last != NULL)
 		{
-			prev_child_entry = child_before->m_prev_sibling;
+			capacity = m_last->m_capacity * 2;
+			if (capacity > MAX_BUCKET_SIZE)
+			{
+				capacity = MAX_BUCKET_SIZE;
+			}
 		}
-		if (prev_child_entry == NULL)
+		bucket = AllocateBucket(capacity);
+		bucket->m_prev = m_last;
+		if (m_last != NULL)
 		{
-			prev_child_entry = m_last_child;
-		}
-		//here some children must be, so assert see below.
-		ASSERT(prev_child_entry != NULL);
-		ASSERT(m_children_count != 0);
-		prev_child_entry->m_next_sibling = new_child;
-		new_child->m_prev_sibling = prev_child_entry;
-		if (child_before != NULL)
-		{
-			child_before->m_prev_sibling = new_child;
-			new_child->m_next_sibling = child_before;
+			m_last->m_next = bucket;
 		} else {
-			new_child->m_next_sibling = NULL;
-			m_last_child = new_child;
+			m_first = bucket;
 		}
-		new_child->m_parent = this;
+		m_last = bucket;
+		m_capacity += capacity;
+		LinkFree(bucket);
 	}
-	++m_children_count;
-	return true;
-}
-
-BasicTree::Entry* /*next child*/ BasicTree::Entry::RemoveChild(BasicTree::Entry* child)
-{
-	if (child == NULL)
+	unsigned int slot = bucket->m_first_free;
+	if (slot == NO_SLOT)
 	{
-		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
-			L"Cannot remove a child from the tree entry because child == NULL",
-			EXC_HERE);
+		slot = bucket->m_used;
 	}
-	if (child->m_parent != this)
+	char* ret_val = bucket->m_slots + (size_t)slot * m_slot_size;
+	unsigned int next_free = NO_SLOT;
+	if (slot != bucket->m_used)
 	{
-		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
-			L"Cannot remova a child from the tree entry because it's parent != this",
-			EXC_HERE);
+		memcpy(&next_free, ret_val, sizeof(next_free));
 	}
-	Entry* prev_sibling = child->m_prev_sibling;
-	Entry* next_sibling = child->m_next_sibling;
-	if (prev_sibling != NULL)
+	CopyEntry(data, ret_val);	//may throw, nothing is changed yet
+	if (slot == bucket->m_used)
 	{
-		if (next_sibling != NULL)
-		{	//somewhere in the middle
-			prev_sibling->m_next_sibling = next_sibling;
-			next_sibling->m_prev_sibling = prev_sibling;
-		} else {	//in the end
-			prev_sibling->m_next_sibling = NULL;
-			m_last_child = prev_sibling;
-		}
-	} else {	//in the beginning
-		if (next_sibling != NULL)
-		{
-			next_sibling->m_prev_sibling = NULL;
-			m_first_child = next_sibling;
-		} else {
-			//this was the last child of the entry.
-			ASSERT(m_children_count == 1);
-			m_first_child = NULL;
-			m_last_child = NULL;
-		}
+		++bucket->m_used;
+	} else {
+		bucket->m_first_free = next_free;
 	}
-	child->m_parent = NULL;
-	child->m_prev_sibling = NULL;
-	child->m_next_sibling = NULL;
-	ASSERT(m_children_count > 0);
-	--m_children_count;
-	return next_sibling;
+	bucket->m_occupancy[slot / (BIT_SIZEOF_INT)] |= (1u << (slot % (BIT_SIZEOF_INT)));
+	++bucket->m_count;
+	++m_count;
+	if (bucket->m_count == bucket->m_capacity)
+	{
+		UnlinkFree(bucket);
+	}
+	return ret_val;
 }
 
-/*if parent == NULL, then root is parent. if child == NULL, then the first child of parent.*/
-BasicTree::ChildrenIterator BasicTree::GetChildrenIterator(unsigned int flags,
-														BasicTree::Entry* parent,
-													   BasicTree::Entry* child,
-													   bool is_first)
+BasicColony::Iterator BasicColony::InternalErase(const Iterator& it)
 {
-	Entry* actual_parent = parent;
-	if (actual_parent == NULL)
+	ASSERT(it.IsValid());
+	Bucket* bucket = it.m_bucket;
+	unsigned int slot = it.m_slot;
+	unsigned int* word = bucket->m_occupancy + slot / (BIT_SIZEOF_INT);
+	unsigned int bit = 1u << (slot % (BIT_SIZEOF_INT));
+	ASSERT((*word & bit) != 0);
+	Iterator ret_val(it);
+	++ret_val;
+	char* entry = it.Data();
+	DeinitEntry(entry);
+	*word &= ~bit;
+	--bucket->m_count;
+	--m_count;
+	if (bucket->m_count == 0)
 	{
-		actual_parent = m_root;
+		FreeBucket(bucket);
+		return ret_val;
 	}
-	if (actual_parent == NULL)
-	{	//OK, empty tree
-		return ChildrenIterator();	//return invalid iterator.
+	memcpy(entry, &bucket->m_first_free, sizeof(bucket->m_first_free));
+	bucket->m_first_free = slot;
+	if (bucket->m_count == bucket->m_capacity - 1)
+	{
+		LinkFree(bucket);
 	}
-	if (child == NULL)
+	return ret_val;
+}
+
+BasicColony::Iterator BasicColony::Erase(const Iterator& it)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (it.IsValid() == false)
 	{
-		if (is_first)
-		{
-			child = actual_parent->m_first_child;
-		} else {
-			child = actual_parent->m_last_child;
-		}
+		throw Exception(UTILS_ERROR_NULL_ITERATOR,
+			L"Cannot erase colony entry because iterator is invalid",
+			EXC_HERE);
 	}
-	return ChildrenIterator(this, actual_parent, child, flags);
+	return InternalErase(it);
 }
 
-BasicTree::TopLevelIterator BasicTree::GetTopLevelIterator(bool is_begin, Entry* basic_entry)
+void BasicColony::Erase(char* entry)
 {
-	//find nearest top level
-	if (basic_entry == NULL)
+	WriteSynchronizer sync(m_rw_lock);
+	Iterator it = GetIterator(entry);
+	if (it.IsValid() == false)
 	{
-		basic_entry = m_root;
+		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+			L"Cannot erase entry because it is not in the colony",
+			EXC_HERE);
 	}
-	ChildrenIterator ch_it = GetChildrenIterator(0, /*NULL*/basic_entry, NULL, is_begin);
-	Entry* entry = NULL;
-	while (ch_it.IsValid())
+	InternalErase(it);
+}
+
+BasicColony::Iterator BasicColony::GetIterator(char* entry)
+{
+	for (Bucket* bucket = m_first; bucket != NULL; bucket = bucket->m_next)
 	{
-		entry = ch_it.GetCurrentChild();
-		ASSERT(entry != NULL);
-		if (entry->GetChildrenCount() == 0)
-		{
-			break;
-		}
-		if (is_begin)
+		if ((entry >= bucket->m_slots) && (entry < bucket->m_slots + (size_t)bucket->m_used * m_slot_size))
 		{
-			++ch_it;
-		} else {
-			--ch_it;
+			size_t offset = entry - bucket->m_slots;
+			unsigned int slot = (unsigned int)(offset / m_slot_size);
+			if (((offset % m_slot_size) != 0) ||
+				((bucket->m_occupancy[slot / (BIT_SIZEOF_INT)] & (1u << (slot % (BIT_SIZEOF_INT)))) == 0))
+			{
+				break;
+			}
+			return Iterator(bucket, slot, m_slot_size);
 		}
 	}
-	//create ret_val
-	TopLevelIterator ret_val;
-	if (entry != NULL)
-	{
-		ret_val.m_it = ch_it;
-		ret_val.SetValid(true);
-	} else {
-		ret_val.SetValid(false);
-	}
-	return ret_val;
+	return Iterator();
 }
 
-//this method adds entry as a child to parent. entry may have it's own children.
-BasicTree::Entry* BasicTree::AddEntry(BasicTree::Entry* entry, BasicTree::Entry* parent, BasicTree::Entry* child_before)
+void BasicColony::Clear()
 {
-	if (entry == NULL)
+	WriteSynchronizer sync(m_rw_lock);
+	for (Iterator it = Begin(); it.IsValid(); ++it)
 	{
-		throw Exception(UTILS_ERROR_CANNOT_INSERT_NULL_ENTRY,
-			L"Cannot insert a new entry to the tree because new entry == NULL",
-			EXC_HERE);
+		DeinitEntry(it.Data());
 	}
-	if (parent == NULL)
+	while (m_first != NULL)
 	{
-		if (m_root != NULL)
-		{
-			throw Exception(UTILS_ERROR_CANNOT_INSERT_ROOT_ALREADY_IS_SET,
-				L"Cannot insert a new entry because this was an attempt to set a root while root already exitts",
-				EXC_HERE);
-		} else {
-			m_root = entry;
-			entry->m_parent = NULL;
-		}
-	} else {
-		bool ok = parent->AddChild(entry, child_before);
-		ASSERT(ok == true);
+		Bucket* next = m_first->m_next;
+		m_allocator->FreeDataArray((char*)m_first);
+		m_first = next;
 	}
-	return entry;
+	m_last = NULL;
+	m_first_free = NULL;
+	m_count = 0;
+	m_capacity = 0;
 }
 
-//this method just cuts off the branch
-BasicTree::Entry* BasicTree::RemoveEntry(BasicTree::Entry* entry)
+BasicColony::Iterator BasicColony::Begin()
 {
-	if (entry == NULL)
+	Iterator ret_val(m_first, 0, m_slot_size);
+	if (m_first != NULL)
 	{
-		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
-			L"Cannot remove a child entry from this entry because entry == NULL",
-			EXC_HERE);
+		ret_val.Seek(0);
 	}
-	/*if (m_rw_lock != NULL)
+	return ret_val;
+}
+
+void BasicColony::Iterator::Seek(unsigned int slot)
+{
+	while (m_bucket != NULL)
 	{
-		if (m_rw_lock->LockForWrite() == false)
+		unsigned int word_index = slot / (BIT_SIZEOF_INT);
+		unsigned int word_count = (m_bucket->m_used + (BIT_SIZEOF_INT) - 1) / (BIT_SIZEOF_INT);
+		if (word_index < word_count)
 		{
-			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
-				L"Cannot get lock for write",
-				EXC_HERE);
+			//bits before slot are masked off in the first word
+			unsigned int word = m_bucket->m_occupancy[word_index] & (~0u << (slot % (BIT_SIZEOF_INT)));
+			while (true)
+			{
+				if (word != 0)
+				{
+					m_slot = word_index * (BIT_SIZEOF_INT) + CountTrailingZeros(word);
+					return;
+				}
+				if (++word_index == word_count)
+				{
+					break;
+				}
+				word = m_bucket->m_occupancy[word_index];
+			}
 		}
-	}*/
-	WriteSynchronizer sync(m_rw_lock);
-	BasicTree::Entry* ret_val = NULL;
-	if (entry == m_root)
-	{
-		ASSERT(entry->GetParent() == NULL);
-		ASSERT(entry->m_prev_sibling == NULL);
-		ASSERT(entry->m_next_sibling == NULL);
-		m_root = NULL;
-		ret_val = entry;
-	}
-	else {
-		Entry* parent = entry->GetParent();
-		ASSERT(parent != NULL);
-		ret_val = parent->RemoveChild(entry);
+		m_bucket = m_bucket->m_next;
+		slot = 0;
 	}
-	/*if (m_rw_lock != NULL)
-	{
-		m_rw_lock->Unlock();
-	}*/
-	return ret_val;
+	m_slot = 0;
 }
 
-bool BasicTree::LockForRead()
+BasicColony::Iterator& BasicColony::Iterator::operator ++ ()
+{
+	ASSERT(m_bucket != NULL);
+	Seek(m_slot + 1);
+	return *this;
+}
+
+void BasicColony::CopyEntry(const char* src, char* dst)
+{
+	memcpy(dst, src, m_entry_size);
+}
+
+void BasicColony::DeinitEntry(char* entry)
+{
+	//nothing
+}
+
+bool BasicColony::LockForRead()
 {
 	if (m_rw_lock != NULL)
 	{
 		return m_rw_lock->LockForRead();
-	} else {
-		return true;
 	}
+	return true;
 }
 
-bool BasicTree::LockForWrite()
+bool BasicColony::LockForWrite()
 {
 	if (m_rw_lock != NULL)
 	{
 		return m_rw_lock->LockForWrite();
-	} else {
-		return true;
 	}
+	return true;
 }
 
-void BasicTree::Unlock()
+void BasicColony::Unlock()
 {
 	if (m_rw_lock != NULL)
 	{
@@ -1191,203 +1431,6336 @@ void BasicTree::Unlock()
 	}
 }
 
-bool BasicTree::ChildrenIterator::Advance(bool forward)
+BasicList::BasicList(BasicReadWriteLock* lock):
+	m_head(NULL),
+	m_last(NULL),
+	m_count(0),
+	m_rw_lock(lock)
 {
-	enum
+	int i = 0;
+	int j = i;
+}
+
+BasicList::~BasicList()
+{
+	/*if (m_rw_lock != NULL)
 	{
-		FIRST_CHILD,
-		NEXT_CHILD,
-		PARENT
-	};
-	ASSERT(m_tree != NULL);
-	/*if (m_tree->m_rw_lock != NULL)
+		m_rw_lock->LockForWrite();	//cannot throw exceptions here,
+	}*/
+	WriteSynchronizer sync(m_rw_lock);
+	if (m_count != 0)
 	{
-		if (m_tree->m_rw_lock->LockForRead() == false)
+		ASSERT(m_head != NULL);
+		Entry* current_entry = m_head;
+		bool exit_flag = false;
+		while (exit_flag == false)
 		{
-			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
-				L"cannot lock the tree for read",
-				EXC_HERE);
+			Entry* next_entry = current_entry->m_next;
+			current_entry->Remove();
+			current_entry = next_entry;
+			if (current_entry == NULL)
+			{
+				exit_flag = true;
+			}
 		}
-	}*/
-	ReadSynchronizer sync(m_tree->m_rw_lock);
-	bool from_above = false;
-	if ((m_prev_entry != NULL) &&
-		(m_prev_entry->m_parent == m_current_entry))
-	{
-		from_above = true;
 	}
-	//if came to m_current_entry from above
-	if (from_above)
+#ifdef _DEBUG
+	else {
+		ASSERT(m_head == NULL);
+		ASSERT(m_last == NULL);
+	}
+#endif //_DEBUG
+	/*if (m_rw_lock != NULL)
 	{
-		//	if m_current_entry has another children
-		Entry* next_child = NULL;
-		//note that here prev entry is the entry above, the child entry where iterator just returned from.
-		if (forward)
+		m_rw_lock->Unlock();
+	}*/
+}
+
+void BasicList::Entry::Remove()
+{
+	/*if (m_list != NULL)
+	{
+		if (m_list->LockForWrite() == false)
 		{
-			if (m_flags & RETURN_TO_PARENTS)
-			{
-				ASSERT(m_prev_entry != NULL);
-				next_child = m_prev_entry->m_next_sibling;
-			} else {
-				next_child = m_current_entry->m_next_sibling;
-			}
-		} else {
-			if (m_flags & RETURN_TO_PARENTS)
-			{
-				ASSERT(m_prev_entry != NULL);
-				next_child = m_prev_entry->m_prev_sibling;
-			} else {
-				next_child = m_current_entry->m_prev_sibling;
-			}
+			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
+				L"Cannot lock the list for write",
+				EXC_HERE);
 		}
-		//     goto next child
-		if (next_child != NULL)
+	}*/
+	//TemplateWriteSynchronizer<BasicList> sync(m_list);
+	TemplateWriteSynchronizer<BasicReadWriteLock> sync(m_list->m_rw_lock);
+	if(m_list == NULL)
+	{
+		throw Exception(UTILS_ERROR_NOT_IN_COLLECTION,
+			L"Cannot remove entry from the list because this entry is not in list",
+			EXC_HERE);
+	}
+	if ((m_prev == NULL) && (m_next == NULL) && (m_list->GetCount() > 1))
+	{
+		throw Exception(UTILS_ERROR_NOT_IN_COLLECTION,
+			L"Cannot remove entry from the list because this entry looks like to be the last in the list but it is not (list->GetCount() > 1)",
+			EXC_HERE);
+	}
+	if (m_prev != NULL)
+	{
+		if (m_next != NULL)
 		{
-			m_prev_entry = m_current_entry;
-			m_current_entry = next_child;
-			return true;
-		} else {	//  else 
-			//     if(return to parent)
-			if (m_flags & RETURN_TO_PARENTS)
-			{	//        return to parent
-				if (m_current_entry->m_parent != NULL)
-				{
-					m_prev_entry = m_current_entry;
-					m_current_entry = m_current_entry->m_parent;
-					return true;
-				} else {
-					//exit
-					return false;
-				}
-			} else {
-				//     else find nearest grandparent with entries I havent seen yet
-				Entry* next_unseen_child = NULL;
-				Entry* grandparent = FindGrandparentWithNextUnseenChild(forward, &next_unseen_child);
-				if (next_unseen_child != NULL)
-				{	//    if found, goto grandparent's next child
-					m_prev_entry = m_current_entry;
-					m_current_entry = next_unseen_child;
-					return true;
-				}
-				else {	//  else exit
-					return false;
-				}
-			} 
+			m_next->m_prev = m_prev;
+			m_prev->m_next = m_next;
+		}
+		else {
+			m_prev->m_next = NULL;
 		}
 	}
 	else {
-		//else //from below, see current entry for the first time
-		//  if m_current_entry has children
-		Entry* next_unseen_child = NULL;
-		if (forward)
-		{
-			if (m_current_entry->m_first_child != NULL)
-			{
-				next_unseen_child = m_current_entry->m_first_child;
-			}
-		} else {
-			if (m_current_entry->m_last_child != NULL)
-			{
-				next_unseen_child = m_current_entry->m_last_child;
-			}
-		}
-		if (next_unseen_child != NULL)
+		if (m_next != NULL)
 		{
-			m_current_entry = next_unseen_child;
-			return true;
-		} else {
-			if (m_flags & RETURN_TO_PARENTS)
-			{
-				m_prev_entry = m_current_entry;
-				m_current_entry = m_current_entry->m_parent;
-				return true;
-			}
-			else {
-				//goto grandparent with next unseen child
-				Entry* grandparent = FindGrandparentWithNextUnseenChild(forward, &next_unseen_child);
-				if (next_unseen_child != NULL)
-				{
-					m_prev_entry = m_current_entry;
-					m_current_entry = next_unseen_child;
-					return true;
-				}
-				else {
-					return false;
-				}
-			}
+			m_next->m_prev = NULL;
 		}
 	}
-	/*if (m_tree->m_rw_lock != NULL)
+	/*if (m_list != NULL)
 	{
-		m_tree->m_rw_lock->Unlock();
+		m_list->Unlock();
 	}*/
 }
 
-BasicTree::Entry* BasicTree::ChildrenIterator::FindGrandparentWithNextUnseenChild(bool forward, Entry** unseen)
-{	//no need for locking here, this is protected internal method. all locking is above.
-	ASSERT(unseen != NULL);
-	Entry* nearest_grandparent = m_current_entry->m_parent;
-	Entry* child_in_current_entry_direction = m_current_entry;
-	Entry* next_unseen_child = NULL;
-	bool exit_flag = false;
-	while (exit_flag == false)
+bool BasicList::LockForRead()
+{
+	if (m_rw_lock != NULL)
 	{
-		if (nearest_grandparent == NULL)
-		{//this was root
-			return NULL;
-		}
-		//has unseen children?
-		next_unseen_child = NULL;
-		if (forward)
-		{
-			next_unseen_child = child_in_current_entry_direction->m_next_sibling;
-		} else {
-			next_unseen_child = child_in_current_entry_direction->m_prev_sibling;
-		}
-		if (next_unseen_child != NULL)
-		{
-			exit_flag = true;
-		}
-		child_in_current_entry_direction = nearest_grandparent;
-		nearest_grandparent = nearest_grandparent->m_parent;
+		return m_rw_lock->LockForRead();
 	}
-	*unseen = next_unseen_child;
-	return nearest_grandparent;
+	return true;
 }
 
-bool BasicTree::TopLevelIterator::Advance(bool forward)
+bool BasicList::LockForWrite()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForWrite();
+	}
+	return true;
+}
+
+void BasicList::Unlock()
+{
+	if (m_rw_lock != NULL)
+	{
+		m_rw_lock->Unlock();
+	}
+}
+
+BasicList::Entry* BasicList::InternalInsert(BasicList::Entry* entry,
+	BasicList::Entry* before_this_entry /*may be NULL, this means PushBack*/)
 {
 	/*if (m_rw_lock != NULL)
 	{
-		if (m_rw_lock->LockForRead() == false)
+		if (m_rw_lock->LockForWrite() == false)
 		{
-			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
-				L"cannot get lock for read",
+			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
+				L"Cannot lock a list for write",
 				EXC_HERE);
 		}
 	}*/
-	ReadSynchronizer sync(m_rw_lock);
-	ASSERT(m_it.GetCurrentChild() != NULL);
-	ASSERT(m_it.GetCurrentChild()->GetChildrenCount() == 0);	//because this is TOP LEVEL iterator
-	Entry* next_top_level = NULL;
-	//bool exit_flag = false;
-	BasicTree::ChildrenIterator it = m_it;
-	while (true)	//(exit_flag == false)
+	WriteSynchronizer sync(m_rw_lock);
+	if ((entry->m_prev != NULL) || (entry->m_next != NULL) || (entry->m_list != NULL))
 	{
-		if (it.Advance(forward) == false)
-		{
-			return false;
+		//add unlock here
+		throw Exception(UTILS_ERROR_CANNOT_INSERT_ALREADY_INSERTED,
+			L"Cannot insert a new list entry because it is already inserted somewhere",
+			EXC_HERE);
+	}
+	if (before_this_entry == NULL)
+	{
+		if (m_last == NULL)
+		{	//this means the list is still empty
+			ASSERT(m_head == NULL);
+			ASSERT(m_count == 0);
+			m_head = entry;
+			m_last = entry;
+			++m_count;
+			if (m_rw_lock != NULL)
+			{
+				m_rw_lock->Unlock();
+			}
+			entry->m_list = this;
+			return entry;
 		}
-		Entry* entry = it.GetCurrentChild();
-		if (entry->GetChildrenCount() == 0)	//ok, this is top level
-		{
-			m_it = it;
-			return true;
+		else {
+			//this means PushBack
+			ASSERT(m_count != 0);
+			ASSERT(m_head != NULL);
+			m_last->m_next = entry;
+			entry->m_prev = m_last;
+			m_last = entry;
+			++m_count;
+			entry->m_list = this;
+			if (m_rw_lock != NULL)
+			{
+				m_rw_lock->Unlock();
+			}
+			return entry;
 		}
 	}
+	ASSERT(before_this_entry != NULL);	//already checked it just above
+	Entry* prev_entry = before_this_entry->m_prev;
+	if (prev_entry != NULL)
+	{
+		prev_entry->m_next = entry;
+		entry->m_prev = prev_entry;
+	}
+	before_this_entry->m_prev = entry;
+	entry->m_next = before_this_entry;
+	++m_count;
+	entry->m_list = this;
 	/*if (m_rw_lock != NULL)
 	{
 		m_rw_lock->Unlock();
 	}*/
-	return false;	//no more children found
+	return entry;
+}
+
+BasicList::Entry* BasicList::InternalRemove(BasicList::Entry* entry)
+{
+	ASSERT(entry != NULL);
+	/*if (m_rw_lock != NULL)
+	{
+		if (m_rw_lock->LockForWrite() == false)
+		{
+			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
+				L"cannot lock a list for write",
+				EXC_HERE);
+		}
+	}*/
+	WriteSynchronizer sync(m_rw_lock);
+	if(entry->m_list != this)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+			L"Cannot remove entry because it's m_list != this",
+			EXC_HERE);
+	}
+	if ((entry->m_prev == NULL) && (entry->m_next == NULL) && ((entry != m_head) && (entry != m_last)))
+	{
+		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+			L"Cannot remove entry because it is not in list",
+			EXC_HERE);
+	}
+	Entry* prev = entry->m_prev;
+	Entry* next = entry->m_next;
+	if (prev != NULL)
+	{
+		if (next != NULL)
+		{
+			next->m_prev = prev;
+			prev->m_next = next;
+		}
+		else {
+			//this may be the last
+			if (entry != m_last)
+			{
+				throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+					L"Cannot remove entry because it is not in list",
+					EXC_HERE);
+			}
+			prev->m_next = NULL;
+			m_last = prev;
+		}
+	}
+	else {
+		//this may be the first
+		if (entry != m_head)
+		{
+			throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+				L"Cannot remove entry because it is not in list",
+				EXC_HERE);
+		}
+		if (next != NULL)
+		{
+			next->m_prev = NULL;
+			m_head = next;
+		}  //else this was the only one entry in the list.
+		else {
+			ASSERT(m_count == 1);
+			ASSERT((m_head == m_last) && (m_head == entry));
+			m_head = NULL;
+			m_last = NULL;
+		}
+	}
+	entry->m_list = NULL;
+	entry->m_prev = NULL;
+	entry->m_next = NULL;
+	--m_count;
+	/*if (m_rw_lock != NULL)
+	{
+		m_rw_lock->Unlock();
+	}*/
+	return next;	//may be NULL if removed entry was the last.
+}
+
+BasicList::PairSynchronizer::PairSynchronizer(BasicReadWriteLock* lock0, BasicReadWriteLock* lock1):
+	m_first(lock0),
+	m_second(lock1)
+{
+	if (m_first == m_second)
+	{
+		m_second = NULL;
+	} else if ((m_first == NULL) || ((m_second != NULL) && (m_second < m_first)))
+	{
+		BasicReadWriteLock* tmp = m_first;
+		m_first = m_second;
+		m_second = tmp;
+	}
+	if ((m_first != NULL) && (m_first->LockForWrite() == false))
+	{
+		throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
+			L"Cannot lock a list for write",
+			EXC_HERE);
+	}
+	if ((m_second != NULL) && (m_second->LockForWrite() == false))
+	{
+		if (m_first != NULL)
+		{
+			m_first->Unlock();
+		}
+		throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
+			L"Cannot lock a list for write",
+			EXC_HERE);
+	}
+}
+
+BasicList::PairSynchronizer::~PairSynchronizer()
+{
+	if (m_second != NULL)
+	{
+		m_second->Unlock();
+	}
+	if (m_first != NULL)
+	{
+		m_first->Unlock();
+	}
+}
+
+void BasicList::CutChain(BasicList::Entry* first, BasicList::Entry* last, unsigned int count)
+{
+	ASSERT(count <= m_count);
+	Entry* prev = first->m_prev;
+	Entry* next = last->m_next;
+	if (prev != NULL)
+	{
+		prev->m_next = next;
+	} else {
+		ASSERT(m_head == first);
+		m_head = next;
+	}
+	if (next != NULL)
+	{
+		next->m_prev = prev;
+	} else {
+		ASSERT(m_last == last);
+		m_last = prev;
+	}
+	first->m_prev = NULL;
+	last->m_next = NULL;
+	m_count -= count;
+}
+
+void BasicList::InsertChain(BasicList::Entry* first, BasicList::Entry* last, unsigned int count,
+							BasicList::Entry* before_this)
+{
+	for (Entry* entry = first; entry != NULL; entry = entry->m_next)
+	{
+		entry->m_list = this;
+	}
+	Entry* prev = (before_this != NULL) ? before_this->m_prev : m_last;
+	first->m_prev = prev;
+	last->m_next = before_this;
+	if (prev != NULL)
+	{
+		prev->m_next = first;
+	} else {
+		m_head = first;
+	}
+	if (before_this != NULL)
+	{
+		before_this->m_prev = last;
+	} else {
+		m_last = last;
+	}
+	m_count += count;
+}
+
+void BasicList::Splice(BasicList* from, BasicList::Entry* first, BasicList::Entry* last, const Iterator& before_here)
+{
+	ASSERT(from != NULL);
+	if ((first == NULL) || (last == NULL))
+	{
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Cannot splice list entries because the range is not set",
+			EXC_HERE);
+	}
+	PairSynchronizer sync(m_rw_lock, from->m_rw_lock);
+	Entry* before_this = before_here.m_entry;
+	if ((first->m_list != from) || (last->m_list != from) ||
+		((before_this != NULL) && (before_this->m_list != this)))
+	{
+		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+			L"Cannot splice list entries because they are not in the list",
+			EXC_HERE);
+	}
+	unsigned int count = 1;
+	for (Entry* entry = first; entry != last; entry = entry->m_next)
+	{
+		if ((entry == NULL) || ((from == this) && (entry == before_this)))
+		{
+			throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+				L"Cannot splice list entries because the range is invalid",
+				EXC_HERE);
+		}
+		++count;
+	}
+	if (last == before_this)
+	{
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Cannot splice list entries before one of them",
+			EXC_HERE);
+	}
+	from->CutChain(first, last, count);
+	InsertChain(first, last, count, before_this);
+}
+
+void BasicList::SpliceAll(BasicList* from)
+{
+	ASSERT(from != NULL);
+	if (from == this)
+	{
+		return;
+	}
+	PairSynchronizer sync(m_rw_lock, from->m_rw_lock);
+	if (from->m_count == 0)
+	{
+		return;
+	}
+	Entry* first = from->m_head;
+	Entry* last = from->m_last;
+	unsigned int count = from->m_count;
+	from->m_head = NULL;
+	from->m_last = NULL;
+	from->m_count = 0;
+	InsertChain(first, last, count, NULL);
+}
+
+BasicList::Entry* BasicList::PopAll(BasicList::Entry** out_last, unsigned int* out_count)
+{
+	Entry* first = NULL;
+	Entry* last = NULL;
+	unsigned int count = 0;
+	{
+		WriteSynchronizer sync(m_rw_lock);
+		first = m_head;
+		last = m_last;
+		count = m_count;
+		m_head = NULL;
+		m_last = NULL;
+		m_count = 0;
+		//entries are detached under the lock, so Remove on another thread never sees
+		//an entry that still points to this list but is not in it
+		for (Entry* entry = first; entry != NULL; entry = entry->m_next)
+		{
+			entry->m_list = NULL;
+		}
+	}
+	if (out_last != NULL)
+	{
+		*out_last = last;
+	}
+	if (out_count != NULL)
+	{
+		*out_count = count;
+	}
+	return first;
+}
+
+void BasicList::PushBackChain(BasicList::Entry* first, BasicList::Entry* last, unsigned int count)
+{
+	if ((first == NULL) || (last == NULL) || (count == 0))
+	{
+		ASSERT(((first == NULL) && (last == NULL) && (count == 0)));
+		return;
+	}
+	if ((first->m_prev != NULL) || (last->m_next != NULL))
+	{
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Cannot push a chain because it is a part of another one",
+			EXC_HERE);
+	}
+#ifdef _DEBUG
+	unsigned int chain_count = 1;
+	for (Entry* entry = first; entry != last; entry = entry->m_next)
+	{
+		ASSERT(entry != NULL);
+		ASSERT(entry->m_list == NULL);
+		++chain_count;
+	}
+	ASSERT(chain_count == count);
+#endif //_DEBUG
+	WriteSynchronizer sync(m_rw_lock);
+	InsertChain(first, last, count, NULL);
+}
+
+void BasicList::LinkChain(BasicList::Entry* prev, BasicList::Entry* next)
+{
+	ASSERT(((prev != NULL) && (next != NULL)));
+	ASSERT(((prev->m_list == NULL) && (next->m_list == NULL)));
+	ASSERT(((prev->m_next == NULL) && (next->m_prev == NULL)));
+	prev->m_next = next;
+	next->m_prev = prev;
+}
+
+BasicList::Entry* BasicList::Unlink(BasicList::Entry* entry)
+{
+	ASSERT(entry != NULL);
+	ASSERT(entry->m_list == NULL);
+	Entry* next = entry->m_next;
+	if (next != NULL)
+	{
+		next->m_prev = NULL;
+	}
+	if (entry->m_prev != NULL)
+	{
+		entry->m_prev->m_next = NULL;
+	}
+	entry->m_next = NULL;
+	entry->m_prev = NULL;
+	return next;
+}
+
+void BasicList::Iterator::Advance(bool forward)
+{
+	/*if (m_rw_lock != NULL)
+	{
+		if (m_rw_lock->TryLockForRead() == false)
+		{
+			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
+				L"List cannot be locked for read",
+				EXC_HERE);
+		}
+	}*/
+	TryReadSynchronizer sync(m_rw_lock);
+	if (m_entry == NULL)
+	{
+		throw Exception(UTILS_ERROR_NULL_ITERATOR,
+			L"Cannot move an iterator because iterator does not point to any element",
+			EXC_HERE);
+	}
+	Entry* next_entry = NULL;
+	if (forward)
+	{
+		next_entry = m_entry->m_next;
+	}
+	else {
+		next_entry = m_entry->m_prev;
+	}
+	//now it's OK for iterator to reach end. it just becomes invalid and caller have to chech it.
+	m_entry = next_entry;
+	/*if (m_rw_lock != NULL)
+	{
+		m_rw_lock->Unlock();
+	}*/
+}
+
+BasicUnrolledList::BasicUnrolledList(unsigned int entry_size, unsigned int node_capacity, Allocator* allocator,
+									 BasicReadWriteLock* lock):
+	m_entry_size(entry_size),
+	m_node_capacity(node_capacity),
+	m_first(NULL),
+	m_last(NULL),
+	m_count(0),
+	m_allocator(allocator),
+	m_rw_lock(lock)
+{
+	ASSERT(entry_size != 0);
+	if (m_node_capacity == 0)
+	{
+		m_node_capacity = CACHE_LINE_SIZE / entry_size;
+	}
+	if (m_node_capacity < MIN_NODE_CAPACITY)
+	{
+		m_node_capacity = MIN_NODE_CAPACITY;
+	}
+}
+
+BasicUnrolledList::~BasicUnrolledList()
+{
+	//entries are destroyed by the typed list
+	while (m_first != NULL)
+	{
+		Node* next = m_first->m_next;
+		m_allocator->FreeDataArray((char*)m_first);
+		m_first = next;
+	}
+}
+
+BasicUnrolledList::Node* BasicUnrolledList::AddNode(Node* after_this)
+{
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot add list node because there is no allocator",
+			EXC_HERE);
+	}
+	size_t size = GetHeaderSize() + (size_t)m_node_capacity * m_entry_size;
+	if (size > UINT_MAX)
+	{
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Cannot add list node because it is too big",
+			EXC_HERE);
+	}
+	Node* ret_val = (Node*)m_allocator->AllocateDataArray(1, (unsigned int)size);
+	ret_val->m_count = 0;
+	ret_val->m_prev = after_this;
+	ret_val->m_next = (after_this != NULL) ? after_this->m_next : m_first;
+	if (ret_val->m_next != NULL)
+	{
+		ret_val->m_next->m_prev = ret_val;
+	} else {
+		m_last = ret_val;
+	}
+	if (after_this != NULL)
+	{
+		after_this->m_next = ret_val;
+	} else {
+		m_first = ret_val;
+	}
+	return ret_val;
+}
+
+void BasicUnrolledList::FreeNode(Node* node)
+{
+	ASSERT(node->m_count == 0);
+	if (node->m_prev != NULL)
+	{
+		node->m_prev->m_next = node->m_next;
+	} else {
+		m_first = node->m_next;
+	}
+	if (node->m_next != NULL)
+	{
+		node->m_next->m_prev = node->m_prev;
+	} else {
+		m_last = node->m_prev;
+	}
+	m_allocator->FreeDataArray((char*)node);
+}
+
+BasicUnrolledList::Iterator BasicUnrolledList::InternalInsert(const char* data, Node* node, unsigned int index)
+{
+	ASSERT(data != NULL);
+	if (node == NULL)
+	{	//the end of the list
+		node = m_last;
+		index = (node != NULL) ? node->m_count : 0;
+	}
+	if ((node == NULL) || (node->m_count == m_node_capacity))
+	{
+		if ((node == NULL) || (index == node->m_count))
+		{	//appending to a full node starts the next one, so a list that grows at the back stays full
+			Node* next = (node != NULL) ? node->m_next : NULL;
+			if ((next == NULL) || (next->m_count == m_node_capacity))
+			{
+				next = AddNode(node);
+			}
+			node = next;
+			index = 0;
+		} else if ((index == 0) && ((node->m_prev == NULL) || (node->m_prev->m_count == m_node_capacity)))
+		{	//the same at the front
+			node = AddNode(node->m_prev);
+		} else if (index == 0)
+		{
+			node = node->m_prev;
+			index = node->m_count;
+		} else {
+			//split: the upper half goes to a new node
+			Node* new_node = AddNode(node);
+			unsigned int half = m_node_capacity / 2;
+			MoveEntries(GetEntry(node, half), GetEntries(new_node), node->m_count - half);
+			new_node->m_count = node->m_count - half;
+			node->m_count = half;
+			if (index > half)
+			{
+				node = new_node;
+				index -= half;
+			}
+		}
+	}
+	char* entry = GetEntry(node, index);
+	MoveEntries(entry, entry + m_entry_size, node->m_count - index);
+	try
+	{
+		CopyEntry(data, entry);
+	}
+	catch (...)
+	{
+		MoveEntries(entry + m_entry_size, entry, node->m_count - index);
+		if (node->m_count == 0)
+		{
+			FreeNode(node);
+		}
+		throw;
+	}
+	++node->m_count;
+	++m_count;
+	return Iterator(node, index, m_entry_size);
+}
+
+BasicUnrolledList::Iterator BasicUnrolledList::Insert(const char* data, const Iterator& before_here)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	return InternalInsert(data, before_here.m_node, before_here.m_index);
+}
+
+BasicUnrolledList::Iterator BasicUnrolledList::PushFront(const char* data)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (m_first == NULL)
+	{
+		return InternalInsert(data, NULL, 0);
+	}
+	return InternalInsert(data, m_first, 0);
+}
+
+BasicUnrolledList::Iterator BasicUnrolledList::PushBack(const char* data)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	return InternalInsert(data, NULL, 0);
+}
+
+void BasicUnrolledList::MergeNext(Node* node)
+{
+	Node* next = node->m_next;
+	ASSERT(next != NULL);
+	ASSERT(node->m_count + next->m_count <= m_node_capacity);
+	MoveEntries(GetEntries(next), GetEntry(node, node->m_count), next->m_count);
+	node->m_count += next->m_count;
+	next->m_count = 0;
+	FreeNode(next);
+}
+
+BasicUnrolledList::Iterator BasicUnrolledList::Erase(const Iterator& it)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if ((it.m_node == NULL) || (it.m_index >= it.m_node->m_count))
+	{
+		throw Exception(UTILS_ERROR_NULL_ITERATOR,
+			L"Cannot erase list entry because iterator is invalid",
+			EXC_HERE);
+	}
+	return InternalErase(it.m_node, it.m_index);
+}
+
+BasicUnrolledList::Iterator BasicUnrolledList::InternalErase(Node* node, unsigned int index)
+{
+	char* entry = GetEntry(node, index);
+	DeinitEntry(entry);
+	MoveEntries(entry + m_entry_size, entry, node->m_count - index - 1);
+	--node->m_count;
+	--m_count;
+	if (node->m_count == 0)
+	{
+		Node* next = node->m_next;
+		FreeNode(node);
+		return Iterator(next, 0, m_entry_size);
+	}
+	if ((node->m_prev != NULL) && (node->m_prev->m_count + node->m_count <= m_node_capacity))
+	{
+		Node* prev = node->m_prev;
+		index += prev->m_count;
+		MergeNext(prev);
+		node = prev;
+	}
+	if ((node->m_next != NULL) && (node->m_count + node->m_next->m_count <= m_node_capacity))
+	{
+		MergeNext(node);
+	}
+	if (index == node->m_count)
+	{
+		return Iterator(node->m_next, 0, m_entry_size);
+	}
+	return Iterator(node, index, m_entry_size);
+}
+
+void BasicUnrolledList::PopFront()
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (m_first != NULL)
+	{
+		InternalErase(m_first, 0);
+	}
+}
+
+void BasicUnrolledList::PopBack()
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (m_last != NULL)
+	{
+		InternalErase(m_last, m_last->m_count - 1);
+	}
+}
+
+char* BasicUnrolledList::Front() const
+{
+	ReadSynchronizer sync(m_rw_lock);
+	return (m_first != NULL) ? GetEntries(m_first) : NULL;
+}
+
+char* BasicUnrolledList::Back() const
+{
+	ReadSynchronizer sync(m_rw_lock);
+	return (m_last != NULL) ? GetEntry(m_last, m_last->m_count - 1) : NULL;
+}
+
+void BasicUnrolledList::Clear()
+{
+	WriteSynchronizer sync(m_rw_lock);
+	while (m_first != NULL)
+	{
+		Node* next = m_first->m_next;
+		for (unsigned int index = 0; index < m_first->m_count; ++index)
+		{
+			DeinitEntry(GetEntry(m_first, index));
+		}
+		m_allocator->FreeDataArray((char*)m_first);
+		m_first = next;
+	}
+	m_last = NULL;
+	m_count = 0;
+}
+
+void BasicUnrolledList::CopyEntry(const char* src, char* dst)
+{
+	memcpy(dst, src, m_entry_size);
+}
+
+void BasicUnrolledList::DeinitEntry(char* entry)
+{
+	//nothing
+}
+
+void BasicUnrolledList::MoveEntries(char* src, char* dst, unsigned int count)
+{
+	memmove(dst, src, (size_t)count * m_entry_size);
+}
+
+bool BasicUnrolledList::LockForRead()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForRead();
+	}
+	return true;
+}
+
+bool BasicUnrolledList::LockForWrite()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForWrite();
+	}
+	return true;
+}
+
+void BasicUnrolledList::Unlock()
+{
+	if (m_rw_lock != NULL)
+	{
+		m_rw_lock->Unlock();
+	}
+}
+
+BasicIntrusiveList::BasicIntrusiveList(BasicReadWriteLock* lock):
+	m_count(0),
+	m_rw_lock(lock)
+{
+	m_end.m_next = &m_end;
+	m_end.m_prev = &m_end;
+}
+
+BasicIntrusiveList::~BasicIntrusiveList()
+{
+	Clear();
+	m_end.m_next = NULL;
+	m_end.m_prev = NULL;
+}
+
+void BasicIntrusiveList::InternalInsert(ListHook* hook, ListHook* before_this)
+{
+	ASSERT(hook != NULL);
+	if (hook->m_next != NULL)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_INSERT_ALREADY_INSERTED,
+			L"Cannot insert a list hook because it is already linked",
+			EXC_HERE);
+	}
+	ListHook* prev = before_this->m_prev;
+	hook->m_prev = prev;
+	hook->m_next = before_this;
+	prev->m_next = hook;
+	before_this->m_prev = hook;
+	++m_count;
+}
+
+void BasicIntrusiveList::InternalRemove(ListHook* hook)
+{
+	ASSERT(hook != NULL);
+	ASSERT(hook != &m_end);
+	if (hook->m_next == NULL)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+			L"Cannot remove a list hook because it is not linked",
+			EXC_HERE);
+	}
+	ASSERT(m_count != 0);
+	hook->m_prev->m_next = hook->m_next;
+	hook->m_next->m_prev = hook->m_prev;
+	hook->m_prev = NULL;
+	hook->m_next = NULL;
+	--m_count;
+}
+
+void BasicIntrusiveList::PushFront(ListHook* hook)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	InternalInsert(hook, m_end.m_next);
+}
+
+void BasicIntrusiveList::PushBack(ListHook* hook)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	InternalInsert(hook, &m_end);
+}
+
+void BasicIntrusiveList::Insert(ListHook* hook, const Iterator& before_here)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	InternalInsert(hook, before_here.IsValid() ? before_here.m_hook : &m_end);
+}
+
+ListHook* BasicIntrusiveList::Remove(ListHook* hook)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	ListHook* next = hook->m_next;
+	InternalRemove(hook);
+	return (next != &m_end) ? next : NULL;
+}
+
+ListHook* BasicIntrusiveList::PopFront()
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (m_count == 0)
+	{
+		return NULL;
+	}
+	ListHook* ret_val = m_end.m_next;
+	InternalRemove(ret_val);
+	return ret_val;
+}
+
+ListHook* BasicIntrusiveList::PopBack()
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (m_count == 0)
+	{
+		return NULL;
+	}
+	ListHook* ret_val = m_end.m_prev;
+	InternalRemove(ret_val);
+	return ret_val;
+}
+
+void BasicIntrusiveList::Clear()
+{
+	WriteSynchronizer sync(m_rw_lock);
+	ListHook* hook = m_end.m_next;
+	while (hook != &m_end)
+	{
+		ListHook* next = hook->m_next;
+		hook->m_prev = NULL;
+		hook->m_next = NULL;
+		hook = next;
+	}
+	m_end.m_next = &m_end;
+	m_end.m_prev = &m_end;
+	m_count = 0;
+}
+
+bool BasicIntrusiveList::LockForRead()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForRead();
+	}
+	return true;
+}
+
+bool BasicIntrusiveList::LockForWrite()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForWrite();
+	}
+	return true;
+}
+
+void BasicIntrusiveList::Unlock()
+{
+	if (m_rw_lock != NULL)
+	{
+		m_rw_lock->Unlock();
+	}
+}
+
+MPSCQueue::MPSCQueue():
+	m_head(NULL),
+	m_pending(NULL),
+	m_pending_last(NULL)
+{
+	static_assert(sizeof(AtomicLink) == sizeof(ListHook*), "hook link cannot be used as atomic");
+}
+
+MPSCQueue::~MPSCQueue()
+{
+	//entries are not deleted here, just unlinked so they can be deleted or posted somewhere else.
+	ListHook* entry = PopAll();
+	while (entry != NULL)
+	{
+		entry = Unlink(entry);
+	}
+}
+
+bool MPSCQueue::Push(ListHook* entry)
+{
+	if (entry == NULL)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_INSERT_NULL_ENTRY,
+			L"Cannot push to the queue because entry == NULL",
+			EXC_HERE);
+	}
+	if ((entry->m_prev != NULL) || (entry->m_next != NULL))
+	{
+		throw Exception(UTILS_ERROR_CANNOT_INSERT_ALREADY_INSERTED,
+			L"Cannot push to the queue because entry is already inserted somewhere",
+			EXC_HERE);
+	}
+	entry->m_next = GetPendingLink();
+	ListHook* prev_head = m_head.exchange(entry, std::memory_order_acq_rel);
+	GetAtomicLink(entry)->store(prev_head, std::memory_order_release);
+	return (prev_head == NULL);
+}
+
+ListHook* MPSCQueue::PopAll()
+{
+	ListHook* first = TakePosted(NULL);
+	if (m_pending == NULL)
+	{
+		return first;
+	}
+	//entries left by Pop were posted earlier than anything taken now
+	m_pending_last->m_next = first;
+	first = m_pending;
+	m_pending = NULL;
+	m_pending_last = NULL;
+	return first;
+}
+
+ListHook* MPSCQueue::TakePosted(ListHook** out_last)
+{
+	ListHook* entry = m_head.exchange(NULL, std::memory_order_acquire);
+	if (out_last != NULL)
+	{
+		*out_last = entry;	//the last posted one ends the reversed chain
+	}
+	//entries are linked from the last posted to the first one, reverse the chain.
+	ListHook* first = NULL;
+	while (entry != NULL)
+	{
+		ListHook* next = GetAtomicLink(entry)->load(std::memory_order_acquire);
+		while (next == GetPendingLink())
+		{	//producer did the exchange but has not stored the link yet, it is a matter of a few instructions.
+			next = GetAtomicLink(entry)->load(std::memory_order_acquire);
+		}
+		entry->m_next = first;
+		first = entry;
+		entry = next;
+	}
+	return first;
+}
+
+ListHook* MPSCQueue::Pop()
+{
+	if (m_pending == NULL)
+	{
+		m_pending = TakePosted(&m_pending_last);
+		if (m_pending == NULL)
+		{
+			return NULL;
+		}
+	}
+	ListHook* ret_val = m_pending;
+	m_pending = Unlink(ret_val);
+	if (m_pending == NULL)
+	{
+		m_pending_last = NULL;
+	}
+	return ret_val;
+}
+
+ListHook* MPSCQueue::Unlink(ListHook* entry)
+{
+	ASSERT(entry != NULL);
+	ListHook* next = entry->m_next;
+	entry->m_next = NULL;
+	return next;
+}
+
+bool BasicTree::Entry::ChildrenIterator::Advance(bool forward)
+{
+	BasicTree::Entry* next = NULL;
+	if (forward)
+	{
+		next = m_child->m_next_sibling;
+	} else {
+		next = m_child->m_prev_sibling;
+	}
+	if (next != NULL)
+	{
+		m_child = next;
+		return true;
+	} else {
+		return false;
+	}
+}
+
+BasicTree::Entry::~Entry()
+{
+	//bool exit_flag = false;
+	/*while (exit_flag == false)
+	{
+		//TODO: use iterator here to traverse all children.
+	}*/
+	delete m_links;
+}
+
+bool BasicTree::Entry::AddChild(BasicTree::Entry* new_child, BasicTree::Entry* child_before, LeafList* leaves)
+{
+	if (new_child == NULL)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_INSERT_NULL_ENTRY,
+			L"Cannot add a child entry to the entry because the child entry parameter == NULL",
+			EXC_HERE);
+		return false;
+	}
+	if ((new_child->m_prev_sibling != NULL) || (new_child->m_next_sibling != NULL))
+	{
+		throw Exception(UTILS_ERROR_CANNOT_INSERT_ALREADY_INSERTED,
+			L"Cannot add a child entry to the entry because new child entry is already added somewhere",
+			EXC_HERE);
+		return false;
+	}
+	bool was_leaf = (m_first_child == NULL);
+	if (m_first_child == NULL)
+	{	//this is the case when entry has no children.
+		ASSERT(m_last_child == NULL);
+		ASSERT(m_children_count == 0);
+		m_first_child = new_child;
+		m_last_child = new_child;
+		new_child->m_parent = this;
+	} else {
+		Entry* prev_child_entry = m_last_child;
+		if (child_before != NULL)
+		{
+			prev_child_entry = child_before->m_prev_sibling;
+		}
+		ASSERT(m_children_count != 0);
+		if (prev_child_entry != NULL)
+		{
+			prev_child_entry->m_next_sibling = new_child;
+			new_child->m_prev_sibling = prev_child_entry;
+		} else {
+			//before the first child
+			ASSERT(child_before == m_first_child);
+			m_first_child = new_child;
+		}
+		if (child_before != NULL)
+		{
+			child_before->m_prev_sibling = new_child;
+			new_child->m_next_sibling = child_before;
+		} else {
+			new_child->m_next_sibling = NULL;
+			m_last_child = new_child;
+		}
+		new_child->m_parent = this;
+	}
+	++m_children_count;
+	if (leaves != NULL)
+	{
+		LinkLeaves(new_child, was_leaf, leaves);
+	}
+	return true;
+}
+
+BasicTree::Entry* /*next child*/ BasicTree::Entry::RemoveChild(BasicTree::Entry* child, LeafList* leaves)
+{
+	if (child == NULL)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+			L"Cannot remove a child from the tree entry because child == NULL",
+			EXC_HERE);
+	}
+	if (child->m_parent != this)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+			L"Cannot remova a child from the tree entry because it's parent != this",
+			EXC_HERE);
+	}
+	Entry* prev_sibling = child->m_prev_sibling;
+	Entry* next_sibling = child->m_next_sibling;
+	if (prev_sibling != NULL)
+	{
+		if (next_sibling != NULL)
+		{	//somewhere in the middle
+			prev_sibling->m_next_sibling = next_sibling;
+			next_sibling->m_prev_sibling = prev_sibling;
+		} else {	//in the end
+			prev_sibling->m_next_sibling = NULL;
+			m_last_child = prev_sibling;
+		}
+	} else {	//in the beginning
+		if (next_sibling != NULL)
+		{
+			next_sibling->m_prev_sibling = NULL;
+			m_first_child = next_sibling;
+		} else {
+			//this was the last child of the entry.
+			ASSERT(m_children_count == 1);
+			m_first_child = NULL;
+			m_last_child = NULL;
+		}
+	}
+	child->m_parent = NULL;
+	child->m_prev_sibling = NULL;
+	child->m_next_sibling = NULL;
+	ASSERT(m_children_count > 0);
+	--m_children_count;
+	if (leaves != NULL)
+	{
+		UnlinkLeaves(child, leaves);
+	}
+	return next_sibling;
+}
+
+void BasicTree::Entry::AttachLinks(BasicTree::Entry* subtree)
+{
+	ASSERT(subtree != NULL);
+	Entry* entry = subtree;
+	while (entry != NULL)
+	{
+		if (entry->m_links == NULL)
+		{
+			entry->m_links = new Links();
+		}
+		if (entry->m_first_child != NULL)
+		{
+			entry = entry->m_first_child;
+			continue;
+		}
+		while ((entry != subtree) && (entry->m_next_sibling == NULL))
+		{
+			entry = entry->m_parent;
+		}
+		entry = (entry != subtree) ? entry->m_next_sibling : NULL;
+	}
+}
+
+BasicTree::Entry* BasicTree::Entry::GetFirstLeaf(BasicTree::Entry* subtree)
+{
+	ASSERT(subtree != NULL);
+	while (subtree->m_first_child != NULL)
+	{
+		subtree = subtree->m_first_child;
+	}
+	return subtree;
+}
+
+BasicTree::Entry* BasicTree::Entry::GetLastLeaf(BasicTree::Entry* subtree)
+{
+	ASSERT(subtree != NULL);
+	while (subtree->m_last_child != NULL)
+	{
+		subtree = subtree->m_last_child;
+	}
+	return subtree;
+}
+
+unsigned int BasicTree::Entry::ChainLeaves(BasicTree::Entry* subtree, BasicTree::Entry** out_first,
+										   BasicTree::Entry** out_last)
+{
+	ASSERT(subtree != NULL);
+	unsigned int ret_val = 0;
+	Entry* last = NULL;
+	*out_first = NULL;
+	Entry* entry = subtree;
+	while (entry != NULL)
+	{
+		if (entry->m_first_child != NULL)
+		{
+			entry = entry->m_first_child;
+			continue;
+		}
+		entry->m_links->m_prev_leaf = last;
+		entry->m_links->m_next_leaf = NULL;
+		if (last != NULL)
+		{
+			last->m_links->m_next_leaf = entry;
+		} else {
+			*out_first = entry;
+		}
+		last = entry;
+		++ ret_val;
+		while ((entry != subtree) && (entry->m_next_sibling == NULL))
+		{
+			entry = entry->m_parent;
+		}
+		entry = (entry != subtree) ? entry->m_next_sibling : NULL;
+	}
+	*out_last = last;
+	return ret_val;
+}
+
+void BasicTree::Entry::LinkLeaves(BasicTree::Entry* new_child, bool was_leaf, LeafList* leaves)
+{
+	ASSERT(new_child->m_parent == this);
+	Entry* first = NULL;
+	Entry* last = NULL;
+	unsigned int count = ChainLeaves(new_child, &first, &last);
+	//find the leaves the new ones go between
+	Entry* prev = NULL;
+	Entry* next = NULL;
+	if (was_leaf)
+	{	//this entry is not a leaf any more, new leaves take it's place
+		prev = m_links->m_prev_leaf;
+		next = m_links->m_next_leaf;
+		m_links->m_prev_leaf = NULL;
+		m_links->m_next_leaf = NULL;
+		ASSERT(leaves->m_count > 0);
+		-- leaves->m_count;
+	} else if (new_child->m_prev_sibling != NULL)
+	{
+		prev = GetLastLeaf(new_child->m_prev_sibling);
+		next = prev->m_links->m_next_leaf;
+	} else {
+		ASSERT(new_child->m_next_sibling != NULL);
+		next = GetFirstLeaf(new_child->m_next_sibling);
+		prev = next->m_links->m_prev_leaf;
+	}
+	first->m_links->m_prev_leaf = prev;
+	if (prev != NULL)
+	{
+		prev->m_links->m_next_leaf = first;
+	} else {
+		leaves->m_first = first;
+	}
+	last->m_links->m_next_leaf = next;
+	if (next != NULL)
+	{
+		next->m_links->m_prev_leaf = last;
+	} else {
+		leaves->m_last = last;
+	}
+	leaves->m_count += count;
+}
+
+void BasicTree::Entry::UnlinkLeaves(BasicTree::Entry* child, LeafList* leaves)
+{
+	Entry* first = GetFirstLeaf(child);
+	Entry* last = GetLastLeaf(child);
+	unsigned int count = 1;
+	for (Entry* leaf = first; leaf != last; leaf = leaf->m_links->m_next_leaf)
+	{
+		++ count;
+	}
+	Entry* prev = first->m_links->m_prev_leaf;
+	Entry* next = last->m_links->m_next_leaf;
+	first->m_links->m_prev_leaf = NULL;
+	last->m_links->m_next_leaf = NULL;
+	ASSERT(leaves->m_count >= count);
+	leaves->m_count -= count;
+	//if this entry has no more children, it becomes a leaf in place of removed ones
+	Entry* after_prev = next;
+	Entry* before_next = prev;
+	if (m_first_child == NULL)
+	{
+		m_links->m_prev_leaf = prev;
+		m_links->m_next_leaf = next;
+		after_prev = this;
+		before_next = this;
+		++ leaves->m_count;
+	}
+	if (prev != NULL)
+	{
+		prev->m_links->m_next_leaf = after_prev;
+	} else {
+		leaves->m_first = after_prev;
+	}
+	if (next != NULL)
+	{
+		next->m_links->m_prev_leaf = before_next;
+	} else {
+		leaves->m_last = before_next;
+	}
+}
+
+/*if parent == NULL, then root is parent. if child == NULL, then the first child of parent.*/
+BasicTree::ChildrenIterator BasicTree::GetChildrenIterator(unsigned int flags,
+														BasicTree::Entry* parent,
+													   BasicTree::Entry* child,
+													   bool is_first)
+{
+	Entry* actual_parent = parent;
+	if (actual_parent == NULL)
+	{
+		actual_parent = m_root;
+	}
+	if (actual_parent == NULL)
+	{	//OK, empty tree
+		return ChildrenIterator();	//return invalid iterator.
+	}
+	if (child == NULL)
+	{
+		if (is_first)
+		{
+			child = actual_parent->m_first_child;
+		} else {
+			child = actual_parent->m_last_child;
+		}
+	}
+	return ChildrenIterator(this, actual_parent, child, flags);
+}
+
+BasicTree::TopLevelIterator BasicTree::GetTopLevelIterator(bool is_begin, Entry* basic_entry)
+{
+	//find nearest top level
+	if (basic_entry == NULL)
+	{
+		basic_entry = m_root;
+	}
+	if (m_leaf_list_enabled)
+	{
+		TopLevelIterator ret_val;
+		if ((basic_entry == NULL) || (basic_entry->m_first_child == NULL))
+		{
+			ret_val.SetValid(false);
+			return ret_val;
+		}
+		Entry* leaf = is_begin ? Entry::GetFirstLeaf(basic_entry) : Entry::GetLastLeaf(basic_entry);
+		ret_val.m_it = ChildrenIterator(this, leaf->m_parent, leaf);
+		ret_val.SetValid(true);
+		return ret_val;
+	}
+	ChildrenIterator ch_it = GetChildrenIterator(0, /*NULL*/basic_entry, NULL, is_begin);
+	Entry* entry = NULL;
+	while (ch_it.IsValid())
+	{
+		entry = ch_it.GetCurrentChild();
+		ASSERT(entry != NULL);
+		if (entry->GetChildrenCount() == 0)
+		{
+			break;
+		}
+		if (is_begin)
+		{
+			++ch_it;
+		} else {
+			--ch_it;
+		}
+	}
+	//create ret_val
+	TopLevelIterator ret_val;
+	if (entry != NULL)
+	{
+		ret_val.m_it = ch_it;
+		ret_val.SetValid(true);
+	} else {
+		ret_val.SetValid(false);
+	}
+	return ret_val;
+}
+
+//this method adds entry as a child to parent. entry may have it's own children.
+BasicTree::Entry* BasicTree::AddEntry(BasicTree::Entry* entry, BasicTree::Entry* parent, BasicTree::Entry* child_before)
+{
+	if (entry == NULL)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_INSERT_NULL_ENTRY,
+			L"Cannot insert a new entry to the tree because new entry == NULL",
+			EXC_HERE);
+	}
+	if (m_entry_locks_enabled)
+	{
+		//nobody sees the new branch yet, so it gets it's locks without any lock
+		Entry::AttachLinks(entry);
+		if (parent != NULL)
+		{
+			ReadSynchronizer sync(m_rw_lock);
+			WriteSynchronizer parent_sync(&parent->m_links->m_lock);
+			bool ok = parent->AddChild(entry, child_before);
+			ASSERT(ok == true);
+			return entry;
+		}
+		WriteSynchronizer sync(m_rw_lock);
+		if (m_root != NULL)
+		{
+			throw Exception(UTILS_ERROR_CANNOT_INSERT_ROOT_ALREADY_IS_SET,
+				L"Cannot insert a new entry because this was an attempt to set a root while root already exitts",
+				EXC_HERE);
+		}
+		m_root = entry;
+		entry->m_parent = NULL;
+		return entry;
+	}
+	if (parent == NULL)
+	{
+		if (m_root != NULL)
+		{
+			throw Exception(UTILS_ERROR_CANNOT_INSERT_ROOT_ALREADY_IS_SET,
+				L"Cannot insert a new entry because this was an attempt to set a root while root already exitts",
+				EXC_HERE);
+		} else {
+			m_root = entry;
+			entry->m_parent = NULL;
+		}
+	} else {
+		if (m_leaf_list_enabled)
+		{
+			Entry::AttachLinks(entry);
+		}
+		bool ok = parent->AddChild(entry, child_before, m_leaf_list_enabled ? &m_leaves : NULL);
+		ASSERT(ok == true);
+	}
+	if (m_leaf_list_enabled && (parent == NULL))
+	{
+		Entry::AttachLinks(entry);
+		m_leaves.m_count = Entry::ChainLeaves(entry, &m_leaves.m_first, &m_leaves.m_last);
+	}
+	if (m_aggregator != NULL)
+	{
+		UpdateBranchAggregates(entry);
+		if (parent != NULL)
+		{
+			UpdatePathAggregates(parent);
+		}
+	}
+	return entry;
+}
+
+//this method just cuts off the branch
+BasicTree::Entry* BasicTree::RemoveEntry(BasicTree::Entry* entry)
+{
+	if (entry == NULL)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+			L"Cannot remove a child entry from this entry because entry == NULL",
+			EXC_HERE);
+	}
+	/*if (m_rw_lock != NULL)
+	{
+		if (m_rw_lock->LockForWrite() == false)
+		{
+			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
+				L"Cannot get lock for write",
+				EXC_HERE);
+		}
+	}*/
+	if (m_entry_locks_enabled && (entry->GetParent() != NULL))
+	{
+		ReadSynchronizer sync(m_rw_lock);
+		while (true)
+		{
+			//the parent is read before it is locked, so the entry may be moved or removed meanwhile.
+			//it is checked again under the lock of the parent.
+			Entry* parent = entry->GetParent();
+			if (parent == NULL)
+			{
+				throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+					L"Cannot remove entry because it was removed from the tree by another thread",
+					EXC_HERE);
+			}
+			//parent is locked before the entry, as iterators go down, so nobody waits in a circle
+			WriteSynchronizer parent_sync(&parent->m_links->m_lock);
+			if (entry->GetParent() != parent)
+			{
+				continue;
+			}
+			WriteSynchronizer entry_sync(&entry->m_links->m_lock);
+			return parent->RemoveChild(entry);
+		}
+	}
+	WriteSynchronizer sync(m_rw_lock);
+	BasicTree::Entry* ret_val = NULL;
+	if (entry == m_root)
+	{
+		ASSERT(entry->GetParent() == NULL);
+		ASSERT(entry->m_prev_sibling == NULL);
+		ASSERT(entry->m_next_sibling == NULL);
+		m_root = NULL;
+		ret_val = entry;
+		m_leaves = LeafList();
+	}
+	else {
+		Entry* parent = entry->GetParent();
+		ASSERT(parent != NULL);
+		ret_val = parent->RemoveChild(entry, m_leaf_list_enabled ? &m_leaves : NULL);
+		if (m_aggregator != NULL)
+		{
+			UpdatePathAggregates(parent);
+		}
+	}
+	/*if (m_rw_lock != NULL)
+	{
+		m_rw_lock->Unlock();
+	}*/
+	return ret_val;
+}
+
+void BasicTree::EnableLeafList(bool enable)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (enable && m_entry_locks_enabled)
+	{
+		throw Exception(UTILS_ERROR_UNSUPPORTED_MODE,
+			L"Cannot enable leaf list while entry locks are enabled",
+			EXC_HERE);
+	}
+	m_leaves = LeafList();
+	m_leaf_list_enabled = enable;
+	if (enable && (m_root != NULL))
+	{
+		Entry::AttachLinks(m_root);
+		m_leaves.m_count = Entry::ChainLeaves(m_root, &m_leaves.m_first, &m_leaves.m_last);
+	}
+}
+
+unsigned int BasicTree::GetLeafCount()
+{
+	ReadSynchronizer sync(m_rw_lock);
+	if (m_leaf_list_enabled)
+	{
+		return m_leaves.m_count;
+	}
+	unsigned int ret_val = 0;
+	Entry* entry = m_root;
+	while (entry != NULL)
+	{
+		if (entry->m_first_child != NULL)
+		{
+			entry = entry->m_first_child;
+			continue;
+		}
+		++ ret_val;
+		while ((entry != m_root) && (entry->m_next_sibling == NULL))
+		{
+			entry = entry->m_parent;
+		}
+		entry = (entry != m_root) ? entry->m_next_sibling : NULL;
+	}
+	return ret_val;
+}
+
+void BasicTree::EnableEntryLocks(bool enable)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (enable && (m_leaf_list_enabled || (m_aggregator != NULL)))
+	{
+		throw Exception(UTILS_ERROR_UNSUPPORTED_MODE,
+			L"Cannot enable entry locks for a tree with leaf list or aggregates",
+			EXC_HERE);
+	}
+	if (enable && (m_root != NULL))
+	{
+		Entry::AttachLinks(m_root);
+	}
+	m_entry_locks_enabled = enable;
+}
+
+BasicTree::BranchIterator::BranchIterator(BasicTree* tree, Entry* branch):
+	m_rw_lock(tree->m_rw_lock),
+	m_branch(NULL),
+	m_current(NULL)
+{
+	if (m_rw_lock != NULL)
+	{
+		m_rw_lock->LockForRead();
+	}
+	if (branch == NULL)
+	{
+		branch = tree->m_root;
+	}
+	if (branch != NULL)
+	{
+		branch->m_links->m_lock.LockForRead();
+		m_branch = branch;
+		m_current = branch;
+	}
+}
+
+BasicTree::BranchIterator::~BranchIterator()
+{
+	//current entry and it's ancestors up to the branch are locked
+	while (m_current != NULL)
+	{
+		Entry* parent = (m_current != m_branch) ? m_current->m_parent : NULL;
+		m_current->m_links->m_lock.Unlock();
+		m_current = parent;
+	}
+	if (m_rw_lock != NULL)
+	{
+		m_rw_lock->Unlock();
+	}
+}
+
+void BasicTree::BranchIterator::Advance(bool into_children)
+{
+	ASSERT(m_current != NULL);
+	if (into_children)
+	{
+		Entry* child = m_current->m_first_child;
+		if (child != NULL)
+		{
+			child->m_links->m_lock.LockForRead();
+			m_current = child;
+			return;
+		}
+	}
+	while (m_current != m_branch)
+	{
+		//siblings are stable while the parent is locked
+		Entry* parent = m_current->m_parent;
+		Entry* sibling = m_current->m_next_sibling;
+		m_current->m_links->m_lock.Unlock();
+		if (sibling != NULL)
+		{
+			sibling->m_links->m_lock.LockForRead();
+			m_current = sibling;
+			return;
+		}
+		m_current = parent;
+	}
+	m_current->m_links->m_lock.Unlock();
+	m_current = NULL;
+}
+
+void BasicTree::BeginBatch()
+{
+	WriteSynchronizer sync(m_rw_lock);
+	++ m_batch_depth;
+}
+
+void BasicTree::EndBatch()
+{
+	WriteSynchronizer sync(m_rw_lock);
+	ASSERT(m_batch_depth > 0);
+	-- m_batch_depth;
+	if ((m_batch_depth == 0) && (m_aggregator != NULL))
+	{
+		UpdateDirtyAggregates();
+	}
+}
+
+void BasicTree::UpdateAggregates(Entry* entry)
+{
+	ASSERT(entry != NULL);
+	WriteSynchronizer sync(m_rw_lock);
+	if (m_aggregator != NULL)
+	{
+		UpdatePathAggregates(entry);
+	}
+}
+
+void BasicTree::UpdateBranchAggregates(Entry* branch)
+{
+	ASSERT(m_aggregator != NULL);
+	//post-order walk, a parent is updated when it's last child is done
+	Entry* entry = branch;
+	while (entry->m_first_child != NULL)
+	{
+		entry = entry->m_first_child;
+	}
+	while (true)
+	{
+		m_aggregator->Update(entry);
+		entry->m_flags &= (~Entry::AGGREGATE_DIRTY);
+		if (entry == branch)
+		{
+			break;
+		}
+		if (entry->m_next_sibling != NULL)
+		{
+			entry = entry->m_next_sibling;
+			while (entry->m_first_child != NULL)
+			{
+				entry = entry->m_first_child;
+			}
+		} else {
+			entry = entry->m_parent;
+		}
+	}
+}
+
+void BasicTree::UpdatePathAggregates(Entry* entry)
+{
+	ASSERT(m_aggregator != NULL);
+	if (m_batch_depth > 0)
+	{
+		//ancestors of a marked entry are marked already
+		while ((entry != NULL) && ((entry->m_flags & Entry::AGGREGATE_DIRTY) == 0))
+		{
+			entry->m_flags |= Entry::AGGREGATE_DIRTY;
+			entry = entry->m_parent;
+		}
+		return;
+	}
+	while (entry != NULL)
+	{
+		m_aggregator->Update(entry);
+		entry = entry->m_parent;
+	}
+}
+
+void BasicTree::UpdateDirtyAggregates()
+{
+	if ((m_root == NULL) || ((m_root->m_flags & Entry::AGGREGATE_DIRTY) == 0))
+	{
+		return;
+	}
+	//post-order walk through marked entries only, unmarked children keep valid aggregates
+	Entry* entry = m_root;
+	bool descend = true;
+	while (true)
+	{
+		if (descend)
+		{
+			Entry* child = entry->m_first_child;
+			while ((child != NULL) && ((child->m_flags & Entry::AGGREGATE_DIRTY) == 0))
+			{
+				child = child->m_next_sibling;
+			}
+			if (child != NULL)
+			{
+				entry = child;
+				continue;
+			}
+		}
+		m_aggregator->Update(entry);
+		entry->m_flags &= (~Entry::AGGREGATE_DIRTY);
+		if (entry == m_root)
+		{
+			break;
+		}
+		Entry* sibling = entry->m_next_sibling;
+		while ((sibling != NULL) && ((sibling->m_flags & Entry::AGGREGATE_DIRTY) == 0))
+		{
+			sibling = sibling->m_next_sibling;
+		}
+		if (sibling != NULL)
+		{
+			entry = sibling;
+			descend = true;
+		} else {
+			entry = entry->m_parent;
+			descend = false;
+		}
+	}
+}
+
+bool BasicTree::LockForRead()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForRead();
+	} else {
+		return true;
+	}
+}
+
+bool BasicTree::LockForWrite()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForWrite();
+	} else {
+		return true;
+	}
+}
+
+void BasicTree::Unlock()
+{
+	if (m_rw_lock != NULL)
+	{
+		m_rw_lock->Unlock();
+	}
+}
+
+bool BasicTree::ChildrenIterator::Advance(bool forward)
+{
+	enum
+	{
+		FIRST_CHILD,
+		NEXT_CHILD,
+		PARENT
+	};
+	ASSERT(m_tree != NULL);
+	/*if (m_tree->m_rw_lock != NULL)
+	{
+		if (m_tree->m_rw_lock->LockForRead() == false)
+		{
+			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
+				L"cannot lock the tree for read",
+				EXC_HERE);
+		}
+	}*/
+	ReadSynchronizer sync(m_tree->m_rw_lock);
+	bool from_above = false;
+	if ((m_prev_entry != NULL) &&
+		(m_prev_entry->m_parent == m_current_entry))
+	{
+		from_above = true;
+	}
+	//if came to m_current_entry from above
+	if (from_above)
+	{
+		//	if m_current_entry has another children
+		Entry* next_child = NULL;
+		//note that here prev entry is the entry above, the child entry where iterator just returned from.
+		if (forward)
+		{
+			if (m_flags & RETURN_TO_PARENTS)
+			{
+				ASSERT(m_prev_entry != NULL);
+				next_child = m_prev_entry->m_next_sibling;
+			} else {
+				next_child = m_current_entry->m_next_sibling;
+			}
+		} else {
+			if (m_flags & RETURN_TO_PARENTS)
+			{
+				ASSERT(m_prev_entry != NULL);
+				next_child = m_prev_entry->m_prev_sibling;
+			} else {
+				next_child = m_current_entry->m_prev_sibling;
+			}
+		}
+		//     goto next child
+		if (next_child != NULL)
+		{
+			m_prev_entry = m_current_entry;
+			m_current_entry = next_child;
+			return true;
+		} else {	//  else 
+			//     if(return to parent)
+			if (m_flags & RETURN_TO_PARENTS)
+			{	//        return to parent
+				if (m_current_entry->m_parent != NULL)
+				{
+					m_prev_entry = m_current_entry;
+					m_current_entry = m_current_entry->m_parent;
+					return true;
+				} else {
+					//exit
+					return false;
+				}
+			} else {
+				//     else find nearest grandparent with entries I havent seen yet
+				Entry* next_unseen_child = NULL;
+				Entry* grandparent = FindGrandparentWithNextUnseenChild(forward, &next_unseen_child);
+				if (next_unseen_child != NULL)
+				{	//    if found, goto grandparent's next child
+					m_prev_entry = m_current_entry;
+					m_current_entry = next_unseen_child;
+					return true;
+				}
+				else {	//  else exit
+					return false;
+				}
+			} 
+		}
+	}
+	else {
+		//else //from below, see current entry for the first time
+		//  if m_current_entry has children
+		Entry* next_unseen_child = NULL;
+		if (forward)
+		{
+			if (m_current_entry->m_first_child != NULL)
+			{
+				next_unseen_child = m_current_entry->m_first_child;
+			}
+		} else {
+			if (m_current_entry->m_last_child != NULL)
+			{
+				next_unseen_child = m_current_entry->m_last_child;
+			}
+		}
+		if (next_unseen_child != NULL)
+		{
+			m_current_entry = next_unseen_child;
+			return true;
+		} else {
+			if (m_flags & RETURN_TO_PARENTS)
+			{
+				m_prev_entry = m_current_entry;
+				m_current_entry = m_current_entry->m_parent;
+				return true;
+			}
+			else {
+				//goto grandparent with next unseen child
+				Entry* grandparent = FindGrandparentWithNextUnseenChild(forward, &next_unseen_child);
+				if (next_unseen_child != NULL)
+				{
+					m_prev_entry = m_current_entry;
+					m_current_entry = next_unseen_child;
+					return true;
+				}
+				else {
+					return false;
+				}
+			}
+		}
+	}
+	/*if (m_tree->m_rw_lock != NULL)
+	{
+		m_tree->m_rw_lock->Unlock();
+	}*/
+}
+
+BasicTree::Entry* BasicTree::ChildrenIterator::FindGrandparentWithNextUnseenChild(bool forward, Entry** unseen)
+{	//no need for locking here, this is protected internal method. all locking is above.
+	ASSERT(unseen != NULL);
+	Entry* nearest_grandparent = m_current_entry->m_parent;
+	Entry* child_in_current_entry_direction = m_current_entry;
+	Entry* next_unseen_child = NULL;
+	bool exit_flag = false;
+	while (exit_flag == false)
+	{
+		if (nearest_grandparent == NULL)
+		{//this was root
+			return NULL;
+		}
+		//has unseen children?
+		next_unseen_child = NULL;
+		if (forward)
+		{
+			next_unseen_child = child_in_current_entry_direction->m_next_sibling;
+		} else {
+			next_unseen_child = child_in_current_entry_direction->m_prev_sibling;
+		}
+		if (next_unseen_child != NULL)
+		{
+			exit_flag = true;
+		}
+		child_in_current_entry_direction = nearest_grandparent;
+		nearest_grandparent = nearest_grandparent->m_parent;
+	}
+	*unseen = next_unseen_child;
+	return nearest_grandparent;
+}
+
+bool BasicTree::TopLevelIterator::Advance(bool forward)
+{
+	/*if (m_rw_lock != NULL)
+	{
+		if (m_rw_lock->LockForRead() == false)
+		{
+			throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
+				L"cannot get lock for read",
+				EXC_HERE);
+		}
+	}*/
+	ReadSynchronizer sync(m_rw_lock);
+	ASSERT(m_it.GetCurrentChild() != NULL);
+	ASSERT(m_it.GetCurrentChild()->GetChildrenCount() == 0);	//because this is TOP LEVEL iterator
+	if ((m_it.m_tree != NULL) && m_it.m_tree->m_leaf_list_enabled)
+	{
+		Entry* next = forward ? m_it.m_current_entry->m_links->m_next_leaf : m_it.m_current_entry->m_links->m_prev_leaf;
+		if (next == NULL)
+		{
+			return false;
+		}
+		m_it.m_current_entry = next;
+		m_it.m_prev_entry = NULL;	//as if the iterator came to the leaf from it's parent
+		return true;
+	}
+	Entry* next_top_level = NULL;
+	//bool exit_flag = false;
+	BasicTree::ChildrenIterator it = m_it;
+	while (true)	//(exit_flag == false)
+	{
+		if (it.Advance(forward) == false)
+		{
+			return false;
+		}
+		Entry* entry = it.GetCurrentChild();
+		if (entry->GetChildrenCount() == 0)	//ok, this is top level
+		{
+			m_it = it;
+			return true;
+		}
+	}
+	/*if (m_rw_lock != NULL)
+	{
+		m_rw_lock->Unlock();
+	}*/
+	return false;	//no more children found
+}
+
+void BasicTree::Freeze(BasicFrozenTree* view, Entry* subtree_root)
+{
+	ASSERT(view != NULL);
+	view->Build(this, subtree_root);
+}
+
+BasicFrozenTree::PostorderIterator& BasicFrozenTree::PostorderIterator::operator ++ ()
+{
+	ASSERT(IsValid());
+	if (m_index == m_root)
+	{
+		m_index = INVALID_INDEX;
+		return *this;
+	}
+	//after an entry goes the first leaf of it's next sibling or, if there is no sibling, it's parent.
+	NodeIndex parent = m_view->m_parents[m_index];
+	NodeIndex next = m_index + m_view->m_subtree_sizes[m_index];
+	if (next < parent + m_view->m_subtree_sizes[parent])
+	{
+		m_index = m_view->FindNextLeaf(next, next + m_view->m_subtree_sizes[next]);
+		if (m_index + PREFETCH_DISTANCE < m_view->m_count)
+		{
+			Prefetch(m_view->m_entries[m_index + PREFETCH_DISTANCE]);
+		}
+	} else {
+		m_index = parent;
+	}
+	return *this;
+}
+
+BasicFrozenTree::BasicFrozenTree(BasicVector::Allocator* allocator):
+	m_allocator(allocator),
+	m_count(0),
+	m_entries(NULL),
+	m_subtree_sizes(NULL),
+	m_depths(NULL),
+	m_parents(NULL),
+	m_leaf_bits(NULL),
+	m_level_order(NULL),
+	m_level_starts(NULL),
+	m_level_count(0),
+	m_leaf_count(0)
+{
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot create frozen tree without allocator",
+			EXC_HERE);
+	}
+}
+
+BasicFrozenTree::~BasicFrozenTree()
+{
+	Clear();
+}
+
+void BasicFrozenTree::Clear()
+{
+	void* arrays[] = {m_entries, m_subtree_sizes, m_depths, m_parents, m_leaf_bits, m_level_order, m_level_starts};
+	for (unsigned int i = 0; i < sizeof(arrays) / sizeof(arrays[0]); ++ i)
+	{
+		if (arrays[i] != NULL)
+		{
+			m_allocator->FreeDataArray((char*)arrays[i]);
+		}
+	}
+	m_entries = NULL;
+	m_subtree_sizes = NULL;
+	m_depths = NULL;
+	m_parents = NULL;
+	m_leaf_bits = NULL;
+	m_level_order = NULL;
+	m_level_starts = NULL;
+	m_count = 0;
+	m_level_count = 0;
+	m_leaf_count = 0;
+}
+
+void* BasicFrozenTree::Allocate(unsigned int entry_size, unsigned int count)
+{
+	void* ret_val = m_allocator->AllocateDataArray(entry_size, count);
+	if (ret_val == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate frozen tree",
+			EXC_HERE);
+	}
+	return ret_val;
+}
+
+void BasicFrozenTree::Build(BasicTree* tree, BasicTree::Entry* subtree_root)
+{
+	ASSERT(tree != NULL);
+	Clear();
+	TemplateReadSynchronizer<BasicTree> sync(tree);
+	BasicTree::Entry* root = (subtree_root != NULL) ? subtree_root : tree->GetRoot();
+	if (root == NULL)
+	{
+		return;
+	}
+	//count entries first, so every array is allocated once
+	unsigned long long count = 0;
+	BasicTree::Entry* entry = root;
+	while (entry != NULL)
+	{
+		++ count;
+		if (entry->GetFirstChild() != NULL)
+		{
+			entry = entry->GetFirstChild();
+			continue;
+		}
+		while ((entry != root) && (entry->GetNextSibling() == NULL))
+		{
+			entry = entry->GetParent();
+		}
+		entry = (entry != root) ? entry->GetNextSibling() : NULL;
+	}
+	if (count >= INVALID_INDEX)
+	{
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Tree is too big to freeze",
+			EXC_HERE);
+	}
+	try
+	{
+		unsigned int n = (unsigned int)count;
+		m_entries = (BasicTree::Entry**)Allocate(sizeof(BasicTree::Entry*), n);
+		m_subtree_sizes = (unsigned int*)Allocate(sizeof(unsigned int), n);
+		m_depths = (unsigned int*)Allocate(sizeof(unsigned int), n);
+		m_parents = (NodeIndex*)Allocate(sizeof(NodeIndex), n);
+		m_leaf_bits = (unsigned int*)Allocate(sizeof(unsigned int), (n + 31) >> 5);
+		m_level_order = (NodeIndex*)Allocate(sizeof(NodeIndex), n);
+		//pre-order pass. going up needs no stack, parent indexes are already in the array.
+		NodeIndex current = 0;
+		NodeIndex last = 0;
+		m_entries[0] = root;
+		m_parents[0] = INVALID_INDEX;
+		m_depths[0] = 0;
+		entry = root;
+		while (true)
+		{
+			BasicTree::Entry* next = entry->GetFirstChild();
+			NodeIndex parent = current;
+			if (next == NULL)
+			{
+				while ((entry != root) && (entry->GetNextSibling() == NULL))
+				{
+					entry = entry->GetParent();
+					current = m_parents[current];
+				}
+				if (entry == root)
+				{
+					break;
+				}
+				next = entry->GetNextSibling();
+				parent = m_parents[current];
+			}
+			++ last;
+			ASSERT(last < n);
+			m_entries[last] = next;
+			m_parents[last] = parent;
+			m_depths[last] = m_depths[parent] + 1;
+			entry = next;
+			current = last;
+		}
+		ASSERT(last + 1 == n);
+		//children are always after their parent, so one backward pass sums subtree sizes.
+		for (NodeIndex i = 0; i < n; ++ i)
+		{
+			m_subtree_sizes[i] = 1;
+		}
+		for (NodeIndex i = n - 1; i > 0; -- i)
+		{
+			m_subtree_sizes[m_parents[i]] += m_subtree_sizes[i];
+		}
+		memset(m_leaf_bits, 0, ((n + 31) >> 5) * sizeof(unsigned int));
+		unsigned int max_depth = 0;
+		for (NodeIndex i = 0; i < n; ++ i)
+		{
+			if (m_subtree_sizes[i] == 1)
+			{
+				m_leaf_bits[i >> 5] |= (1U << (i & 31));
+				++ m_leaf_count;
+			}
+			if (m_depths[i] > max_depth)
+			{
+				max_depth = m_depths[i];
+			}
+		}
+		//level order is a counting sort by depth, stable, so each level is in the tree order.
+		//level d is counted in m_level_starts[d + 2], after the prefix sum m_level_starts[d + 1] is where it begins,
+		//and after placing m_level_starts[d + 1] is where it ends.
+		m_level_count = max_depth + 1;
+		m_level_starts = (unsigned int*)Allocate(sizeof(unsigned int), m_level_count + 2);
+		memset(m_level_starts, 0, (m_level_count + 2) * sizeof(unsigned int));
+		for (NodeIndex i = 0; i < n; ++ i)
+		{
+			++ m_level_starts[m_depths[i] + 2];
+		}
+		for (unsigned int d = 2; d < m_level_count + 2; ++ d)
+		{
+			m_level_starts[d] += m_level_starts[d - 1];
+		}
+		for (NodeIndex i = 0; i < n; ++ i)
+		{
+			m_level_order[m_level_starts[m_depths[i] + 1] ++] = i;
+		}
+		m_count = n;
+	} catch (...)
+	{
+		Clear();
+		throw;
+	}
+}
+
+BasicFrozenTree::NodeIndex BasicFrozenTree::GetNextSibling(NodeIndex entry) const
+{
+	NodeIndex parent = m_parents[entry];
+	if (parent == INVALID_INDEX)
+	{
+		return INVALID_INDEX;
+	}
+	NodeIndex next = entry + m_subtree_sizes[entry];
+	return (next < parent + m_subtree_sizes[parent]) ? next : INVALID_INDEX;
+}
+
+BasicFrozenTree::NodeIndex BasicFrozenTree::FindNextLeaf(NodeIndex from, NodeIndex end) const
+{
+	if (from >= end)
+	{
+		return end;
+	}
+	unsigned int word_index = from >> 5;
+	unsigned int last_word = (end - 1) >> 5;
+	unsigned int word = m_leaf_bits[word_index] & (0xFFFFFFFFU << (from & 31));
+	while (word == 0)
+	{
+		if (word_index == last_word)
+		{
+			return end;
+		}
+		++ word_index;
+		word = m_leaf_bits[word_index];
+	}
+	NodeIndex ret_val = (word_index << 5) + CountTrailingZeros(word);
+	return (ret_val < end) ? ret_val : end;
+}
+
+BasicFrozenTree::PreorderIterator BasicFrozenTree::GetPreorderIterator(NodeIndex subtree) const
+{
+	PreorderIterator ret_val;
+	ret_val.m_view = this;
+	if (subtree < m_count)
+	{
+		ret_val.m_index = subtree;
+		ret_val.m_end = subtree + m_subtree_sizes[subtree];
+		for (NodeIndex i = subtree; (i < ret_val.m_end) && (i <= subtree + PREFETCH_DISTANCE); ++ i)
+		{
+			Prefetch(m_entries[i]);
+		}
+	}
+	return ret_val;
+}
+
+BasicFrozenTree::PostorderIterator BasicFrozenTree::GetPostorderIterator(NodeIndex subtree) const
+{
+	PostorderIterator ret_val;
+	ret_val.m_view = this;
+	if (subtree < m_count)
+	{
+		ret_val.m_root = subtree;
+		ret_val.m_index = FindNextLeaf(subtree, subtree + m_subtree_sizes[subtree]);
+	}
+	return ret_val;
+}
+
+BasicFrozenTree::LevelOrderIterator BasicFrozenTree::GetLevelOrderIterator(unsigned int depth, bool one_level) const
+{
+	LevelOrderIterator ret_val;
+	ret_val.m_view = this;
+	if (depth < m_level_count)
+	{
+		ret_val.m_position = m_level_starts[depth];
+		ret_val.m_end = one_level ? m_level_starts[depth + 1] : m_count;
+		for (unsigned int i = ret_val.m_position; (i < ret_val.m_end) && (i <= ret_val.m_position + PREFETCH_DISTANCE); ++ i)
+		{
+			Prefetch(m_entries[m_level_order[i]]);
+		}
+	}
+	return ret_val;
+}
+
+BasicFrozenTree::LeafIterator BasicFrozenTree::GetLeafIterator(NodeIndex subtree) const
+{
+	LeafIterator ret_val;
+	ret_val.m_view = this;
+	if (subtree < m_count)
+	{
+		ret_val.m_end = subtree + m_subtree_sizes[subtree];
+		ret_val.m_index = FindNextLeaf(subtree, ret_val.m_end);
+	}
+	return ret_val;
+}
+
+BasicCompactTree::ChildrenIterator::ChildrenIterator(const BasicCompactTree* tree,
+													   NodeIndex parent,
+													   NodeIndex child,
+													   unsigned int flags):
+	m_tree(tree),
+	m_current_entry(child),
+	m_prev_entry(INVALID_INDEX),
+	m_flags(flags)
+{
+	if ((m_tree == NULL) || (parent == INVALID_INDEX))
+	{
+		m_flags |= INVALID;
+		return;
+	}
+	if (m_current_entry == INVALID_INDEX)
+	{
+		m_current_entry = m_tree->GetFirstChild(parent);
+	}
+	if (m_current_entry == INVALID_INDEX)
+	{
+		m_flags |= INVALID;
+	}
+}
+
+bool BasicCompactTree::ChildrenIterator::Advance(bool forward)
+{
+	ASSERT(m_tree != NULL);
+	ASSERT(m_current_entry != INVALID_INDEX);
+	ReadSynchronizer sync(m_tree->m_rw_lock);
+	const Node* nodes = m_tree->m_nodes;
+	NodeIndex next = INVALID_INDEX;
+	if ((m_prev_entry != INVALID_INDEX) && (nodes[m_prev_entry].m_parent == m_current_entry))
+	{	//came to m_current_entry from above
+		//note that here prev entry is the child entry where iterator just returned from.
+		NodeIndex seen = (m_flags & RETURN_TO_PARENTS) ? m_prev_entry : m_current_entry;
+		next = forward ? nodes[seen].m_next_sibling : m_tree->GetPrevSibling(seen);
+		if ((next == INVALID_INDEX) && (m_flags & RETURN_TO_PARENTS))
+		{
+			next = nodes[m_current_entry].m_parent;
+		}
+	} else {
+		//see current entry for the first time
+		next = forward ? nodes[m_current_entry].m_first_child : m_tree->GetLastChild(m_current_entry);
+		if ((next == INVALID_INDEX) && (m_flags & RETURN_TO_PARENTS))
+		{
+			next = nodes[m_current_entry].m_parent;
+		}
+	}
+	if ((next == INVALID_INDEX) && ((m_flags & RETURN_TO_PARENTS) == 0))
+	{
+		next = FindNextUnseenChild(forward);
+	}
+	if (next == INVALID_INDEX)
+	{
+		return false;
+	}
+	m_prev_entry = m_current_entry;
+	m_current_entry = next;
+	return true;
+}
+
+BasicCompactTree::NodeIndex BasicCompactTree::ChildrenIterator::FindNextUnseenChild(bool forward) const
+{
+	const Node* nodes = m_tree->m_nodes;
+	NodeIndex child_in_current_entry_direction = m_current_entry;
+	while (nodes[child_in_current_entry_direction].m_parent != INVALID_INDEX)
+	{
+		NodeIndex next_unseen_child = forward ? nodes[child_in_current_entry_direction].m_next_sibling :
+			m_tree->GetPrevSibling(child_in_current_entry_direction);
+		if (next_unseen_child != INVALID_INDEX)
+		{
+			return next_unseen_child;
+		}
+		child_in_current_entry_direction = nodes[child_in_current_entry_direction].m_parent;
+	}
+	return INVALID_INDEX;
+}
+
+bool BasicCompactTree::TopLevelIterator::Advance(bool forward)
+{
+	ASSERT(m_it.m_tree != NULL);
+	ReadSynchronizer sync(m_it.m_tree->m_rw_lock);
+	ASSERT(m_it.m_tree->IsLeaf(m_it.GetCurrentChild()));	//because this is TOP LEVEL iterator
+	ChildrenIterator it = m_it;
+	while (it.Advance(forward))
+	{
+		if (m_it.m_tree->IsLeaf(it.GetCurrentChild()))
+		{
+			m_it = it;
+			return true;
+		}
+	}
+	return false;
+}
+
+BasicCompactTree::BasicCompactTree(unsigned int data_size,
+								   unsigned int n_preallocated,
+								   BasicVector::Allocator* allocator,
+								   BasicReadWriteLock* lock):
+	m_data_size(data_size),
+	m_allocator(allocator),
+	m_rw_lock(lock),
+	m_nodes(NULL),
+	m_data(NULL),
+	m_capacity(0),
+	m_size(0),
+	m_count(0),
+	m_root(INVALID_INDEX),
+	m_free(INVALID_INDEX)
+{
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot create compact tree without allocator",
+			EXC_HERE);
+	}
+	if (n_preallocated != 0)
+	{
+		Grow(n_preallocated);
+	}
+}
+
+BasicCompactTree::BasicCompactTree(unsigned int data_size,
+								   const Node* nodes,
+								   const char* data,
+								   unsigned int count):
+	m_data_size(data_size),
+	m_allocator(NULL),
+	m_rw_lock(NULL),
+	m_nodes((Node*)nodes),
+	m_data((char*)data),
+	m_capacity(count),
+	m_size(count),
+	m_count(count),
+	m_root((count != 0) ? 0 : INVALID_INDEX),
+	m_free(INVALID_INDEX)
+{}
+
+BasicCompactTree::~BasicCompactTree()
+{
+	ASSERT(((m_count == 0) || (m_allocator == NULL)));	//descendant did not call Clear
+	if ((m_nodes != NULL) && (m_allocator != NULL))
+	{
+		m_allocator->FreeDataArray((char*)m_nodes);
+		m_allocator->FreeDataArray(m_data);
+	}
+}
+
+BasicCompactTree::ChildrenIterator BasicCompactTree::GetChildrenIterator(unsigned int flags,
+																		 NodeIndex parent,
+																		 NodeIndex child,
+																		 bool is_first) const
+{
+	NodeIndex actual_parent = (parent != INVALID_INDEX) ? parent : m_root;
+	if (actual_parent == INVALID_INDEX)
+	{	//OK, empty tree
+		return ChildrenIterator();
+	}
+	if (child == INVALID_INDEX)
+	{
+		child = is_first ? GetFirstChild(actual_parent) : GetLastChild(actual_parent);
+	}
+	return ChildrenIterator(this, actual_parent, child, flags);
+}
+
+BasicCompactTree::TopLevelIterator BasicCompactTree::GetTopLevelIterator(bool is_begin, NodeIndex basic_entry) const
+{
+	TopLevelIterator ret_val;
+	ChildrenIterator ch_it = GetChildrenIterator(0, basic_entry, INVALID_INDEX, is_begin);
+	while (ch_it.IsValid())
+	{
+		if (IsLeaf(ch_it.GetCurrentChild()))
+		{
+			ret_val.m_it = ch_it;
+			break;
+		}
+		if (is_begin)
+		{
+			++ch_it;
+		} else {
+			--ch_it;
+		}
+	}
+	return ret_val;
+}
+
+BasicCompactTree::NodeIndex BasicCompactTree::RemoveEntry(NodeIndex entry)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if (IsValidEntry(entry) == false)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
+			L"Cannot remove an entry which is not in the tree",
+			EXC_HERE);
+	}
+	NodeIndex ret_val = m_nodes[entry].m_next_sibling;
+	NodeIndex parent = m_nodes[entry].m_parent;
+	if (parent == INVALID_INDEX)
+	{
+		ASSERT(entry == m_root);
+		m_root = INVALID_INDEX;
+	} else {
+		NodeIndex prev_sibling = GetPrevSibling(entry);
+		if (prev_sibling == INVALID_INDEX)
+		{
+			m_nodes[parent].m_first_child = ret_val;
+		} else {
+			m_nodes[prev_sibling].m_next_sibling = ret_val;
+		}
+	}
+	//free the branch from the bottom: go down by first children, free a leaf, go on with its sibling or parent.
+	NodeIndex current = entry;
+	while (true)
+	{
+		while (m_nodes[current].m_first_child != INVALID_INDEX)
+		{
+			current = m_nodes[current].m_first_child;
+		}
+		if (current == entry)
+		{
+			FreeNode(current);
+			break;
+		}
+		NodeIndex next = m_nodes[current].m_next_sibling;
+		NodeIndex current_parent = m_nodes[current].m_parent;
+		m_nodes[current_parent].m_first_child = next;
+		FreeNode(current);
+		current = (next != INVALID_INDEX) ? next : current_parent;
+	}
+	return ret_val;
+}
+
+void BasicCompactTree::Clear()
+{
+	if (m_root != INVALID_INDEX)
+	{
+		RemoveEntry(m_root);
+	}
+	ASSERT(m_count == 0);
+	m_size = 0;
+	m_free = INVALID_INDEX;
+}
+
+void BasicCompactTree::Reserve(unsigned int count)
+{
+	if (count > m_capacity)
+	{
+		Grow(count);
+	}
+}
+
+BasicCompactTree::NodeIndex BasicCompactTree::GetPrevSibling(NodeIndex entry) const
+{
+	NodeIndex parent = m_nodes[entry].m_parent;
+	if (parent == INVALID_INDEX)
+	{
+		return INVALID_INDEX;
+	}
+	NodeIndex ret_val = INVALID_INDEX;
+	for (NodeIndex child = m_nodes[parent].m_first_child; child != entry; child = m_nodes[child].m_next_sibling)
+	{
+		ret_val = child;
+	}
+	return ret_val;
+}
+
+BasicCompactTree::NodeIndex BasicCompactTree::GetLastChild(NodeIndex entry) const
+{
+	NodeIndex ret_val = m_nodes[entry].m_first_child;
+	if (ret_val != INVALID_INDEX)
+	{
+		while (m_nodes[ret_val].m_next_sibling != INVALID_INDEX)
+		{
+			ret_val = m_nodes[ret_val].m_next_sibling;
+		}
+	}
+	return ret_val;
+}
+
+unsigned int BasicCompactTree::GetChildrenCount(NodeIndex entry) const
+{
+	unsigned int ret_val = 0;
+	for (NodeIndex child = m_nodes[entry].m_first_child; child != INVALID_INDEX; child = m_nodes[child].m_next_sibling)
+	{
+		++ret_val;
+	}
+	return ret_val;
+}
+
+bool BasicCompactTree::LockForRead()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForRead();
+	}
+	return true;
+}
+
+bool BasicCompactTree::LockForWrite()
+{
+	if (m_rw_lock != NULL)
+	{
+		return m_rw_lock->LockForWrite();
+	}
+	return true;
+}
+
+void BasicCompactTree::Unlock()
+{
+	if (m_rw_lock != NULL)
+	{
+		m_rw_lock->Unlock();
+	}
+}
+
+BasicCompactTree::NodeIndex BasicCompactTree::FindPrevSibling(NodeIndex parent, NodeIndex child_before) const
+{
+	if (parent == INVALID_INDEX)
+	{
+		if (m_root != INVALID_INDEX)
+		{
+			throw Exception(UTILS_ERROR_CANNOT_INSERT_ROOT_ALREADY_IS_SET,
+				L"Cannot insert a new entry because this was an attempt to set a root while root already exists",
+				EXC_HERE);
+		}
+		return INVALID_INDEX;
+	}
+	if (IsValidEntry(parent) == false)
+	{
+		throw Exception(UTILS_ERROR_CANNOT_INSERT_INVALID_PARENT,
+			L"Cannot insert a new entry because parent is not in the tree",
+			EXC_HERE);
+	}
+	if (child_before == INVALID_INDEX)
+	{
+		return GetLastChild(parent);
+	}
+	if ((IsValidEntry(child_before) == false) || (m_nodes[child_before].m_parent != parent))
+	{
+		throw Exception(UTILS_ERROR_CANNOT_INSERT_INVALID_ITERATOR,
+			L"Cannot insert a new entry because child_before is not a child of parent",
+			EXC_HERE);
+	}
+	return GetPrevSibling(child_before);
+}
+
+BasicCompactTree::NodeIndex BasicCompactTree::AllocateNode()
+{
+	NodeIndex ret_val = m_free;
+	if (ret_val != INVALID_INDEX)
+	{
+		m_free = m_nodes[ret_val].m_next_sibling;
+	} else {
+		if (m_size == m_capacity)
+		{
+			if (m_capacity >= INVALID_INDEX / 2)
+			{
+				throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+					L"Cannot add more entries to compact tree",
+					EXC_HERE);
+			}
+			Grow((m_capacity < 0x10) ? 0x10 : m_capacity * 2);
+		}
+		ret_val = m_size++;
+	}
+	m_nodes[ret_val].m_parent = FREE_MARK;	//until it is linked
+	m_nodes[ret_val].m_first_child = INVALID_INDEX;
+	m_nodes[ret_val].m_next_sibling = INVALID_INDEX;
+	return ret_val;
+}
+
+void BasicCompactTree::ReleaseNode(NodeIndex entry)
+{
+	m_nodes[entry].m_parent = FREE_MARK;
+	m_nodes[entry].m_next_sibling = m_free;
+	m_free = entry;
+}
+
+void BasicCompactTree::LinkNode(NodeIndex entry, NodeIndex parent, NodeIndex prev_sibling)
+{
+	Node& node = m_nodes[entry];
+	node.m_parent = parent;
+	if (parent == INVALID_INDEX)
+	{
+		m_root = entry;
+	} else if (prev_sibling == INVALID_INDEX) {
+		node.m_next_sibling = m_nodes[parent].m_first_child;
+		m_nodes[parent].m_first_child = entry;
+	} else {
+		node.m_next_sibling = m_nodes[prev_sibling].m_next_sibling;
+		m_nodes[prev_sibling].m_next_sibling = entry;
+	}
+	++m_count;
+}
+
+void BasicCompactTree::FreeNode(NodeIndex entry)
+{
+	DestroyData(GetDataPointer(entry));
+	ReleaseNode(entry);
+	--m_count;
+}
+
+void BasicCompactTree::Grow(unsigned int capacity)
+{
+	ASSERT(capacity > m_capacity);
+	Node* new_nodes = (Node*)m_allocator->AllocateDataArray(sizeof(Node), capacity);
+	char* new_data = m_allocator->AllocateDataArray(m_data_size, capacity);
+	if ((new_nodes == NULL) || (new_data == NULL))
+	{
+		if (new_nodes != NULL)
+		{
+			m_allocator->FreeDataArray((char*)new_nodes);
+		}
+		if (new_data != NULL)
+		{
+			m_allocator->FreeDataArray(new_data);
+		}
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate compact tree",
+			EXC_HERE);
+	}
+	if (m_nodes != NULL)
+	{
+		memcpy(new_nodes, m_nodes, m_size * sizeof(Node));
+		memcpy(new_data, m_data, (size_t)m_size * m_data_size);
+		m_allocator->FreeDataArray((char*)m_nodes);
+		m_allocator->FreeDataArray(m_data);
+	}
+	m_nodes = new_nodes;
+	m_data = new_data;
+	m_capacity = capacity;
+}
+
+BasicPersistentTree::Version::Version(const Version& another):
+	m_tree(another.m_tree),
+	m_root(another.m_root)
+{
+	if (m_root != NULL)
+	{
+		m_root->m_ref_count.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+BasicPersistentTree::Version& BasicPersistentTree::Version::operator = (const Version& another)
+{
+	if (another.m_root != NULL)
+	{
+		another.m_root->m_ref_count.fetch_add(1, std::memory_order_relaxed);
+	}
+	Reset();
+	m_tree = another.m_tree;
+	m_root = another.m_root;
+	return *this;
+}
+
+void BasicPersistentTree::Version::Reset()
+{
+	if (m_root != NULL)
+	{
+		m_tree->ReleaseNode(m_root);
+		m_root = NULL;
+	}
+}
+
+BasicPersistentTree::BasicPersistentTree(unsigned int data_size, BasicVector::Allocator* allocator,
+										 BasicReadWriteLock* lock):
+	m_data_size(data_size),
+	m_allocator(allocator),
+	m_rw_lock(lock),
+	m_root(NULL),
+	m_path_nodes(0x20, BasicVector::GetDefaultAllocator(), NULL)
+{
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot create persistent tree without allocator",
+			EXC_HERE);
+	}
+}
+
+BasicPersistentTree::~BasicPersistentTree()
+{
+	ASSERT(m_root == NULL);	//descendant did not call Clear
+}
+
+BasicPersistentTree::Version BasicPersistentTree::Snapshot()
+{
+	ReadSynchronizer sync(&m_root_lock);
+	if (m_root != NULL)
+	{
+		m_root->m_ref_count.fetch_add(1, std::memory_order_relaxed);
+	}
+	return Version(this, m_root);
+}
+
+void BasicPersistentTree::RemoveEntry(const unsigned int* path, unsigned int depth)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	FindPath(path, depth);
+	if (depth == 0)
+	{
+		SetRoot(NULL);
+		return;
+	}
+	Node* parent = m_path_nodes[depth - 1];
+	Publish(path, depth - 1, NewNode(parent->GetDataPointer(), parent, CHILD_REMOVE, path[depth - 1], NULL));
+}
+
+void BasicPersistentTree::Clear()
+{
+	WriteSynchronizer sync(m_rw_lock);
+	SetRoot(NULL);
+}
+
+unsigned int BasicPersistentTree::InternalAdd(const void* data, const unsigned int* parent_path, unsigned int depth,
+											  unsigned int child_before)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	if ((m_root == NULL) && (depth == 0))
+	{
+		SetRoot(NewNode((const char*)data, NULL, CHILD_NONE, 0, NULL));
+		return 0;
+	}
+	FindPath(parent_path, depth);
+	Node* parent = m_path_nodes[depth];
+	unsigned int index = child_before;
+	if (index > parent->m_children_count)
+	{
+		index = parent->m_children_count;
+	}
+	Node* entry = NewNode((const char*)data, NULL, CHILD_NONE, 0, NULL);
+	Node* replacement = NULL;
+	try
+	{
+		replacement = NewNode(parent->GetDataPointer(), parent, CHILD_INSERT, index, entry);
+	}
+	catch (...)
+	{
+		ReleaseNode(entry);
+		throw;
+	}
+	Publish(parent_path, depth, replacement);
+	return index;
+}
+
+void BasicPersistentTree::InternalSetData(const void* data, const unsigned int* path, unsigned int depth)
+{
+	WriteSynchronizer sync(m_rw_lock);
+	FindPath(path, depth);
+	Node* node = m_path_nodes[depth];
+	Publish(path, depth, NewNode((const char*)data, node, CHILD_NONE, 0, NULL));
+}
+
+BasicPersistentTree::Node* BasicPersistentTree::NewNode(const char* data, const Node* node, ChildChange change,
+														unsigned int index, Node* child)
+{
+	unsigned int old_count = (node != NULL) ? node->m_children_count : 0;
+	unsigned int count = old_count;
+	if (change == CHILD_INSERT)
+	{
+		++ count;
+	} else if (change == CHILD_REMOVE)
+	{
+		-- count;
+	}
+	char* memory = m_allocator->AllocateDataArray((unsigned int)(Node::GetDataOffset(count) + m_data_size), 1);
+	if (memory == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate persistent tree node",
+			EXC_HERE);
+	}
+	Node* ret_val = new (memory) Node(count);
+	try
+	{
+		CopyData(ret_val->GetDataPointer(), data);
+	}
+	catch (...)
+	{
+		ret_val->~Node();
+		m_allocator->FreeDataArray(memory);
+		throw;
+	}
+	Node** children = ret_val->GetChildren();
+	unsigned int old_index = 0;
+	for (unsigned int new_index = 0; new_index < count; ++ new_index)
+	{
+		if ((change == CHILD_INSERT) && (new_index == index))
+		{
+			children[new_index] = child;
+			continue;
+		}
+		if ((change == CHILD_REMOVE) && (old_index == index))
+		{
+			++ old_index;
+		}
+		ASSERT(old_index < old_count);
+		if ((change == CHILD_REPLACE) && (old_index == index))
+		{
+			children[new_index] = child;
+		} else {
+			children[new_index] = node->GetChildren()[old_index];
+			children[new_index]->m_ref_count.fetch_add(1, std::memory_order_relaxed);
+		}
+		++ old_index;
+	}
+	return ret_val;
+}
+
+void BasicPersistentTree::ReleaseNode(Node* node)
+{
+	if (node->m_ref_count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+	{
+		return;
+	}
+	//freed node releases it's children, the list of them is kept here instead of recursion
+	Vector<Node*>* pending = NULL;
+	while (true)
+	{
+		Node* const* children = node->GetChildren();
+		for (unsigned int index = 0; index < node->m_children_count; ++ index)
+		{
+			if (children[index]->m_ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				if (pending == NULL)
+				{
+					pending = new Vector<Node*>(0x20, BasicVector::GetDefaultAllocator(), NULL);
+				}
+				pending->PushBack(children[index]);
+			}
+		}
+		DestroyData(node->GetDataPointer());
+		node->~Node();
+		m_allocator->FreeDataArray((char*)node);
+		if ((pending == NULL) || (pending->GetCount() == 0))
+		{
+			break;
+		}
+		node = (*pending)[pending->GetCount() - 1];
+		pending->PopBack();
+	}
+	delete pending;
+}
+
+void BasicPersistentTree::FindPath(const unsigned int* path, unsigned int depth)
+{
+	if (m_root == NULL)
+	{
+		throw Exception(UTILS_ERROR_NOT_IN_COLLECTION,
+			L"Cannot find an entry in the empty persistent tree",
+			EXC_HERE);
+	}
+	m_path_nodes.Clear();
+	Node* node = m_root;
+	m_path_nodes.PushBack(node);
+	for (unsigned int level = 0; level < depth; ++ level)
+	{
+		if (path[level] >= node->m_children_count)
+		{
+			throw Exception(UTILS_ERROR_INDEX_BIGGER_THAN_ARRAY_SIZE,
+				L"Cannot find an entry because child index in the path is bigger than children count",
+				EXC_HERE);
+		}
+		node = node->GetChildren()[path[level]];
+		m_path_nodes.PushBack(node);
+	}
+}
+
+void BasicPersistentTree::Publish(const unsigned int* path, unsigned int depth, Node* replacement)
+{
+	//copies are made from the bottom, so the new root is ready when it is published
+	unsigned int level = depth;
+	try
+	{
+		while (level > 0)
+		{
+			-- level;
+			Node* node = m_path_nodes[level];
+			replacement = NewNode(node->GetDataPointer(), node, CHILD_REPLACE, path[level], replacement);
+		}
+	}
+	catch (...)
+	{
+		ReleaseNode(replacement);
+		throw;
+	}
+	SetRoot(replacement);
+}
+
+void BasicPersistentTree::SetRoot(Node* root)
+{
+	Node* old_root = NULL;
+	{
+		WriteSynchronizer sync(&m_root_lock);
+		old_root = m_root;
+		m_root = root;
+	}
+	if (old_root != NULL)
+	{
+		ReleaseNode(old_root);
+	}
+}
+
+char* BasicHashMap::DefaultAllocator::AllocateDataArray(unsigned int entry_size, unsigned int count)
+{
+	return (char*)malloc(entry_size * count);
+}
+
+void BasicHashMap::DefaultAllocator::FreeDataArray(char* data_array)
+{
+	free(data_array);
+}
+
+void* BasicHashMap::DefaultAllocator::AllocateEntry(unsigned int entry_size)
+{
+	return malloc(entry_size);
+}
+
+void BasicHashMap::DefaultAllocator::FreeEntry(void* entry)
+{
+	free(entry);
+}
+
+void BasicHashMap::Iterator::Advance()
+{
+	ASSERT(m_map != NULL);
+	if (m_entry != NULL)
+	{
+		m_entry = m_entry->m_next;
+		if (m_entry != NULL)
+		{
+			return;
+		}
+		++m_bucket_index;
+	}
+	while (true)
+	{
+		Table* table = &m_map->m_table;
+		if (m_table_index == 0)
+		{
+			table = &m_map->m_old_table;
+		}
+		if ((table->m_buckets == NULL) || (m_bucket_index > table->m_mask))
+		{
+			if (m_table_index == 0)
+			{	//old table is passed, go on with the current one
+				m_table_index = 1;
+				m_bucket_index = 0;
+				continue;
+			}
+			m_entry = NULL;	//end
+			return;
+		}
+		Entry* head = table->m_buckets[m_bucket_index];
+		if ((head != NULL) && (head != GetMovedMark()))
+		{
+			m_entry = head;
+			return;
+		}
+		++m_bucket_index;
+	}
+}
+
+BasicHashMap::BasicHashMap(unsigned int entry_size, unsigned int bucket_count, Allocator* allocator):
+	m_entry_size(entry_size),
+	m_allocator(allocator),
+	m_is_moving(false),
+	m_next_to_move(0),
+	m_moved_count(0)
+{
+	ASSERT(m_entry_size >= sizeof(Entry));
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot create hash map without allocator",
+			EXC_HERE);
+	}
+	//every table has at least one bucket per stripe, so old and new bucket of the same entry are in the same stripe.
+	size_t actual_bucket_count = STRIPE_COUNT;
+	while (actual_bucket_count < bucket_count)
+	{
+		actual_bucket_count <<= 1;
+	}
+	m_old_table.m_buckets = NULL;
+	m_old_table.m_mask = 0;
+	AllocateTable(&m_table, actual_bucket_count);
+	for (unsigned int index = 0; index < STRIPE_COUNT; ++index)
+	{
+		m_stripes[index].m_count.store(0, std::memory_order_relaxed);
+	}
+}
+
+BasicHashMap::~BasicHashMap()
+{
+	ASSERT(GetCount() == 0);	//descendant did not call Clear
+	FreeTable(&m_old_table);
+	FreeTable(&m_table);
+}
+
+unsigned int BasicHashMap::GetCount() const
+{
+	int ret_val = 0;
+	for (unsigned int index = 0; index < STRIPE_COUNT; ++index)
+	{
+		ret_val += m_stripes[index].m_count.load(std::memory_order_relaxed);
+	}
+	return (unsigned int)ret_val;
+}
+
+void BasicHashMap::Clear()
+{
+	LockAllStripes(true);
+	Table* tables[] = { &m_old_table, &m_table };
+	for (unsigned int table_index = 0; table_index < 2; ++table_index)
+	{
+		Table* table = tables[table_index];
+		if (table->m_buckets == NULL)
+		{
+			continue;
+		}
+		for (size_t bucket_index = 0; bucket_index <= table->m_mask; ++bucket_index)
+		{
+			Entry* entry = table->m_buckets[bucket_index];
+			if (entry == GetMovedMark())
+			{
+				continue;
+			}
+			while (entry != NULL)
+			{
+				Entry* next = entry->m_next;
+				DeinitEntry(entry);
+				m_allocator->FreeEntry(entry);
+				entry = next;
+			}
+			table->m_buckets[bucket_index] = NULL;
+		}
+	}
+	Table old_table = m_old_table;
+	m_old_table.m_buckets = NULL;
+	m_old_table.m_mask = 0;
+	m_is_moving.store(false, std::memory_order_relaxed);
+	for (unsigned int index = 0; index < STRIPE_COUNT; ++index)
+	{
+		m_stripes[index].m_count.store(0, std::memory_order_relaxed);
+	}
+	UnlockAllStripes();
+	FreeTable(&old_table);
+}
+
+bool BasicHashMap::LockForRead()
+{
+	LockAllStripes(false);
+	return true;
+}
+
+bool BasicHashMap::LockForWrite()
+{
+	LockAllStripes(true);
+	return true;
+}
+
+void BasicHashMap::Unlock()
+{
+	UnlockAllStripes();
+}
+
+BasicHashMap::Iterator BasicHashMap::Begin()
+{
+	Iterator ret_val(this);
+	ret_val.Advance();
+	return ret_val;
+}
+
+bool BasicHashMap::InternalFind(size_t hash, const void* key, void* out_value)
+{
+	ReadSynchronizer sync(&GetStripe(hash).m_lock);
+	Entry* entry = *FindBucket(hash);
+	while (entry != NULL)
+	{
+		if ((entry->m_hash == hash) && IsEqualKey(entry, key))
+		{
+			if (out_value != NULL)
+			{
+				CopyValue(entry, out_value);
+			}
+			return true;
+		}
+		entry = entry->m_next;
+	}
+	return false;
+}
+
+bool BasicHashMap::InternalInsert(size_t hash, const void* key, const void* value, bool replace)
+{
+	bool ret_val = false;
+	bool all_moved = false;
+	bool need_to_grow = false;
+	{
+		Stripe& stripe = GetStripe(hash);
+		WriteSynchronizer sync(&stripe.m_lock);
+		Entry** bucket = FindBucketForWrite(hash, &all_moved);
+		Entry* entry = *bucket;
+		while ((entry != NULL) && ((entry->m_hash != hash) || (IsEqualKey(entry, key) == false)))
+		{
+			entry = entry->m_next;
+		}
+		if (entry != NULL)
+		{
+			if (replace)
+			{
+				AssignValue(entry, value);
+			}
+		} else {
+			entry = (Entry*)m_allocator->AllocateEntry(m_entry_size);
+			if (entry == NULL)
+			{
+				throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+					L"Cannot allocate hash map entry",
+					EXC_HERE);
+			}
+			try
+			{
+				InitEntry(entry, key, value);
+			}
+			catch ( ... )
+			{
+				m_allocator->FreeEntry(entry);
+				throw;
+			}
+			entry->m_hash = hash;
+			entry->m_next = *bucket;
+			*bucket = entry;
+			stripe.m_count.fetch_add(1, std::memory_order_relaxed);
+			need_to_grow = ((m_old_table.m_buckets == NULL) && IsOverloaded(stripe));
+			ret_val = true;
+		}
+	}
+	if (all_moved)
+	{
+		FinishMoving();
+	}
+	if (need_to_grow)
+	{
+		Grow();
+	}
+	HelpToMove();
+	return ret_val;
+}
+
+bool BasicHashMap::InternalRemove(size_t hash, const void* key, void* out_value)
+{
+	Entry* removed = NULL;
+	bool all_moved = false;
+	{
+		Stripe& stripe = GetStripe(hash);
+		WriteSynchronizer sync(&stripe.m_lock);
+		Entry** link = FindBucketForWrite(hash, &all_moved);
+		while (*link != NULL)
+		{
+			Entry* entry = *link;
+			if ((entry->m_hash == hash) && IsEqualKey(entry, key))
+			{
+				if (out_value != NULL)
+				{
+					CopyValue(entry, out_value);
+				}
+				*link = entry->m_next;
+				stripe.m_count.fetch_sub(1, std::memory_order_relaxed);
+				removed = entry;
+				break;
+			}
+			link = &entry->m_next;
+		}
+	}
+	//entry is not reachable anymore, no need to keep the stripe locked while it is destroyed.
+	if (removed != NULL)
+	{
+		DeinitEntry(removed);
+		m_allocator->FreeEntry(removed);
+	}
+	if (all_moved)
+	{
+		FinishMoving();
+	}
+	HelpToMove();
+	return (removed != NULL);
+}
+
+BasicHashMap::Entry** BasicHashMap::FindBucket(size_t hash)
+{
+	if (m_old_table.m_buckets != NULL)
+	{
+		Entry** old_bucket = &m_old_table.m_buckets[hash & m_old_table.m_mask];
+		if (*old_bucket != GetMovedMark())
+		{
+			return old_bucket;
+		}
+	}
+	return &m_table.m_buckets[hash & m_table.m_mask];
+}
+
+BasicHashMap::Entry** BasicHashMap::FindBucketForWrite(size_t hash, bool* out_all_moved)
+{
+	ASSERT(out_all_moved != NULL);
+	if (m_old_table.m_buckets != NULL)
+	{
+		//new entries go only to the new table, so bucket is moved before it is changed.
+		*out_all_moved = MoveBucket(hash & m_old_table.m_mask);
+	}
+	return &m_table.m_buckets[hash & m_table.m_mask];
+}
+
+bool BasicHashMap::MoveBucket(size_t old_bucket_index)
+{
+	ASSERT(m_old_table.m_buckets != NULL);
+	ASSERT(old_bucket_index <= m_old_table.m_mask);
+	Entry* entry = m_old_table.m_buckets[old_bucket_index];
+	if (entry == GetMovedMark())
+	{
+		return false;
+	}
+	while (entry != NULL)
+	{
+		Entry* next = entry->m_next;
+		Entry** new_bucket = &m_table.m_buckets[entry->m_hash & m_table.m_mask];
+		entry->m_next = *new_bucket;
+		*new_bucket = entry;
+		entry = next;
+	}
+	m_old_table.m_buckets[old_bucket_index] = GetMovedMark();
+	size_t moved_count = m_moved_count.fetch_add(1, std::memory_order_acq_rel) + 1;
+	return (moved_count == m_old_table.m_mask + 1);
+}
+
+void BasicHashMap::Grow()
+{
+	//new buckets are allocated and zeroed before the stripes are locked, so nobody waits for it.
+	size_t bucket_count = 0;
+	{
+		ReadSynchronizer sync(&m_stripes[0].m_lock);
+		bucket_count = m_table.m_mask + 1;
+	}
+	Table new_table;
+	AllocateTable(&new_table, bucket_count << 1);
+	LockAllStripes(true);
+	bool still_overloaded = false;
+	for (unsigned int index = 0; (index < STRIPE_COUNT) && (still_overloaded == false); ++index)
+	{
+		still_overloaded = IsOverloaded(m_stripes[index]);
+	}
+	//another thread may have grown the map already
+	if ((m_old_table.m_buckets == NULL) && (m_table.m_mask + 1 == bucket_count) && still_overloaded)
+	{
+		m_old_table = m_table;
+		m_table = new_table;
+		new_table.m_buckets = NULL;
+		m_next_to_move.store(0, std::memory_order_relaxed);
+		m_moved_count.store(0, std::memory_order_relaxed);
+		m_is_moving.store(true, std::memory_order_release);
+	}
+	UnlockAllStripes();
+	FreeTable(&new_table);
+}
+
+void BasicHashMap::HelpToMove()
+{
+	if (m_is_moving.load(std::memory_order_acquire) == false)
+	{
+		return;
+	}
+	bool all_moved = false;
+	size_t first = m_next_to_move.fetch_add(MIGRATION_CHUNK, std::memory_order_relaxed);
+	for (size_t index = first; index < first + MIGRATION_CHUNK; ++index)
+	{
+		//old bucket index and hash of it's entries are the same in lower bits, so this is their stripe.
+		WriteSynchronizer sync(&m_stripes[index & (STRIPE_COUNT - 1)].m_lock);
+		if ((m_old_table.m_buckets == NULL) || (index > m_old_table.m_mask))
+		{
+			break;
+		}
+		if (MoveBucket(index))
+		{
+			all_moved = true;
+		}
+	}
+	if (all_moved)
+	{
+		FinishMoving();
+	}
+}
+
+void BasicHashMap::FinishMoving()
+{
+	Table old_table;
+	old_table.m_buckets = NULL;
+	LockAllStripes(true);
+	if ((m_old_table.m_buckets != NULL) &&
+		(m_moved_count.load(std::memory_order_acquire) == m_old_table.m_mask + 1))
+	{
+		old_table = m_old_table;
+		m_old_table.m_buckets = NULL;
+		m_old_table.m_mask = 0;
+		m_is_moving.store(false, std::memory_order_relaxed);
+	}
+	UnlockAllStripes();
+	FreeTable(&old_table);
+}
+
+void BasicHashMap::LockAllStripes(bool exclusive)
+{
+	//always in the same order, so two threads locking all stripes do not deadlock.
+	for (unsigned int index = 0; index < STRIPE_COUNT; ++index)
+	{
+		if (exclusive)
+		{
+			m_stripes[index].m_lock.LockForWrite();
+		} else {
+			m_stripes[index].m_lock.LockForRead();
+		}
+	}
+}
+
+void BasicHashMap::UnlockAllStripes()
+{
+	for (unsigned int index = STRIPE_COUNT; index > 0; --index)
+	{
+		m_stripes[index - 1].m_lock.Unlock();
+	}
+}
+
+void BasicHashMap::AllocateTable(Table* table, size_t bucket_count)
+{
+	ASSERT(table != NULL);
+	table->m_buckets = (Entry**)m_allocator->AllocateDataArray(sizeof(Entry*), (unsigned int)bucket_count);
+	if (table->m_buckets == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate hash map buckets",
+			EXC_HERE);
+	}
+	memset(table->m_buckets, 0, bucket_count * sizeof(Entry*));
+	table->m_mask = bucket_count - 1;
+}
+
+void BasicHashMap::FreeTable(Table* table)
+{
+	ASSERT(table != NULL);
+	if (table->m_buckets != NULL)
+	{
+		m_allocator->FreeDataArray((char*)table->m_buckets);
+		table->m_buckets = NULL;
+	}
+}
+
+void BasicFlatHashTable::Iterator::Advance()
+{
+	ASSERT(IsValid());
+	do
+	{
+		++m_index;
+	} while ((m_index < m_table->m_capacity) && (m_table->m_ctrl[m_index] < 0));
+}
+
+BasicFlatHashTable::BasicFlatHashTable(unsigned int entry_size, unsigned int count, BasicVector::Allocator* allocator):
+	m_entry_size(entry_size),
+	m_allocator(allocator),
+	m_ctrl(NULL),
+	m_slots(NULL),
+	m_capacity(0),
+	m_count(0),
+	m_growth_left(0)
+{
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot create hash table without allocator",
+			EXC_HERE);
+	}
+	if (count != 0)
+	{
+		Rehash(GetCapacityFor(count));
+	}
+}
+
+BasicFlatHashTable::~BasicFlatHashTable()
+{
+	ASSERT(m_count == 0);	//descendant did not call Clear
+	if (m_capacity != 0)
+	{
+		m_allocator->FreeDataArray((char*)m_ctrl);
+		m_allocator->FreeDataArray(m_slots);
+	}
+}
+
+void BasicFlatHashTable::Reserve(unsigned int count)
+{
+	if (count > m_count + m_growth_left)
+	{
+		Rehash(GetCapacityFor(count));
+	}
+}
+
+void BasicFlatHashTable::Clear()
+{
+	if (m_capacity == 0)
+	{
+		return;
+	}
+	for (size_t index = 0; (index < m_capacity) && (m_count != 0); ++index)
+	{
+		if (m_ctrl[index] >= 0)
+		{
+			DestroyEntry(GetSlot(index));
+			--m_count;
+		}
+	}
+	memset(m_ctrl, CTRL_EMPTY, m_capacity + GROUP_WIDTH);
+	m_growth_left = GetMaxCount(m_capacity);
+}
+
+BasicFlatHashTable::Iterator BasicFlatHashTable::Begin()
+{
+	Iterator ret_val(this, 0);
+	if ((m_capacity != 0) && (m_ctrl[0] < 0))
+	{
+		ret_val.Advance();
+	}
+	return ret_val;
+}
+
+size_t BasicFlatHashTable::PrepareInsert(size_t hash)
+{
+	if (m_capacity == 0)
+	{
+		Rehash(MIN_CAPACITY);
+	}
+	size_t index = FindFreeSlot(hash);
+	//a deleted slot can be reused without growing, an empty one costs growth.
+	if ((m_growth_left == 0) && (m_ctrl[index] == CTRL_EMPTY))
+	{
+		//if the table is full mostly with deleted slots, it is cleaned at the same capacity.
+		if (m_count * 32 <= GetMaxCount(m_capacity) * 25)
+		{
+			Rehash(m_capacity);
+		} else {
+			Rehash(m_capacity * 2);
+		}
+		index = FindFreeSlot(hash);
+	}
+	if (m_ctrl[index] == CTRL_EMPTY)
+	{
+		--m_growth_left;
+	}
+	SetCtrl(index, GetH2(hash));
+	++m_count;
+	return index;
+}
+
+void BasicFlatHashTable::CancelInsert(size_t index)
+{
+	EraseAt(index);
+}
+
+void BasicFlatHashTable::EraseAt(size_t index)
+{
+	ASSERT(index < m_capacity);
+	ASSERT(m_ctrl[index] >= 0);
+	//if there are empty slots both before and after this one closer than a group width, no group that contains
+	//this slot was ever seen full by a probe sequence, so nobody went past it and it can be empty again.
+	Group before(m_ctrl + ((index - GROUP_WIDTH) & (m_capacity - 1)));
+	Group after(m_ctrl + index);
+	unsigned int empty_before = before.MatchEmpty();
+	unsigned int empty_after = after.MatchEmpty();
+	bool was_never_full = false;
+	if ((empty_before != 0) && (empty_after != 0))
+	{
+		unsigned int leading = GROUP_WIDTH - 1 - FindHighestBit(empty_before);
+		unsigned int trailing = CountTrailingZeros(empty_after);
+		was_never_full = (leading + trailing < GROUP_WIDTH);
+	}
+	if (was_never_full)
+	{
+		SetCtrl(index, CTRL_EMPTY);
+		++m_growth_left;
+	} else {
+		SetCtrl(index, CTRL_DELETED);
+	}
+	--m_count;
+}
+
+size_t BasicFlatHashTable::FindFreeSlot(size_t hash) const
+{
+	ASSERT(m_capacity != 0);
+	ProbeSequence seq(hash, m_capacity - 1);
+	while (true)
+	{
+		unsigned int free_mask = Group(m_ctrl + seq.GetOffset()).MatchFree();
+		if (free_mask != 0)
+		{
+			return seq.GetOffset(CountTrailingZeros(free_mask));
+		}
+		seq.Next();
+	}
+}
+
+void BasicFlatHashTable::SetCtrl(size_t index, signed char value)
+{
+	m_ctrl[index] = value;
+	if (index < GROUP_WIDTH)
+	{
+		m_ctrl[m_capacity + index] = value;
+	}
+}
+
+void BasicFlatHashTable::Rehash(size_t capacity)
+{
+	ASSERT(capacity >= MIN_CAPACITY);
+	ASSERT((capacity & (capacity - 1)) == 0);
+	ASSERT(GetMaxCount(capacity) >= m_count);
+	signed char* new_ctrl = (signed char*)m_allocator->AllocateDataArray(1, (unsigned int)(capacity + GROUP_WIDTH));
+	char* new_slots = m_allocator->AllocateDataArray(m_entry_size, (unsigned int)capacity);
+	if ((new_ctrl == NULL) || (new_slots == NULL))
+	{
+		if (new_ctrl != NULL)
+		{
+			m_allocator->FreeDataArray((char*)new_ctrl);
+		}
+		if (new_slots != NULL)
+		{
+			m_allocator->FreeDataArray(new_slots);
+		}
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate hash table",
+			EXC_HERE);
+	}
+	memset(new_ctrl, CTRL_EMPTY, capacity + GROUP_WIDTH);
+	signed char* old_ctrl = m_ctrl;
+	char* old_slots = m_slots;
+	size_t old_capacity = m_capacity;
+	m_ctrl = new_ctrl;
+	m_slots = new_slots;
+	m_capacity = capacity;
+	//entries are moved one by one into a table with no deleted slots, so the first free slot is the right one.
+	for (size_t index = 0; index < old_capacity; ++index)
+	{
+		if (old_ctrl[index] >= 0)
+		{
+			char* src = old_slots + index * m_entry_size;
+			size_t hash = HashEntry(src);
+			size_t new_index = FindFreeSlot(hash);
+			SetCtrl(new_index, GetH2(hash));
+			MoveEntry(GetSlot(new_index), src);
+		}
+	}
+	m_growth_left = GetMaxCount(capacity) - m_count;
+	if (old_capacity != 0)
+	{
+		m_allocator->FreeDataArray((char*)old_ctrl);
+		m_allocator->FreeDataArray(old_slots);
+	}
+}
+
+size_t BasicFlatHashTable::GetCapacityFor(size_t count)
+{
+	size_t ret_val = MIN_CAPACITY;
+	while (GetMaxCount(ret_val) < count)
+	{
+		ret_val <<= 1;
+	}
+	return ret_val;
+}
+
+void BasicBPlusTree::Iterator::Advance()
+{
+	ASSERT(IsValid());
+	++m_index;
+	if (m_index >= m_leaf->m_count)
+	{
+		m_leaf = m_leaf->m_next;
+		m_index = 0;
+	}
+}
+
+void BasicBPlusTree::Iterator::Retreat()
+{
+	ASSERT(IsValid());
+	if (m_index == 0)
+	{
+		m_leaf = m_leaf->m_prev;
+		m_index = (m_leaf != NULL) ? m_leaf->m_count - 1 : 0;
+	} else {
+		--m_index;
+	}
+}
+
+BasicBPlusTree::BasicBPlusTree(unsigned int key_size,
+							   unsigned int key_alignment,
+							   unsigned int value_size,
+							   unsigned int value_alignment,
+							   unsigned int node_size,
+							   BasicVector::Allocator* allocator):
+	m_key_size(key_size),
+	m_value_size(value_size),
+	m_allocator(allocator),
+	m_root(NULL),
+	m_first_leaf(NULL),
+	m_last_leaf(NULL),
+	m_count(0),
+	m_height(0),
+	m_separators(NULL)
+{
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot create B+ tree without allocator",
+			EXC_HERE);
+	}
+	ComputeLayout(node_size, key_alignment, value_alignment);
+	m_separators = m_allocator->AllocateDataArray(m_key_size, 2);
+	if (m_separators == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate B+ tree",
+			EXC_HERE);
+	}
+}
+
+BasicBPlusTree::~BasicBPlusTree()
+{
+	ASSERT(m_root == NULL);	//descendant did not call Clear
+	m_allocator->FreeDataArray(m_separators);
+}
+
+void BasicBPlusTree::Clear()
+{
+	if (m_root != NULL)
+	{
+		DestroySubtree(m_root);
+	}
+	m_root = NULL;
+	m_first_leaf = NULL;
+	m_last_leaf = NULL;
+	m_count = 0;
+	m_height = 0;
+}
+
+static unsigned int AlignOffset(unsigned int offset, unsigned int alignment)
+{
+	return ((offset + alignment - 1) / alignment * alignment);
+}
+
+void BasicBPlusTree::ComputeLayout(unsigned int node_size, unsigned int key_alignment, unsigned int value_alignment)
+{
+	ASSERT(m_key_size != 0);
+	m_node_size = AlignOffset((node_size != 0) ? node_size : (unsigned int)CACHE_LINE_SIZE, CACHE_LINE_SIZE);
+	while (true)
+	{
+		m_leaf_keys_offset = AlignOffset(sizeof(Leaf), key_alignment);
+		m_leaf_capacity = (m_node_size - m_leaf_keys_offset) / (m_key_size + m_value_size);
+		while (m_leaf_capacity > 0)
+		{
+			m_leaf_values_offset = AlignOffset(m_leaf_keys_offset + m_leaf_capacity * m_key_size, value_alignment);
+			if (m_leaf_values_offset + m_leaf_capacity * m_value_size <= m_node_size)
+			{
+				break;
+			}
+			--m_leaf_capacity;
+		}
+		m_inner_keys_offset = AlignOffset(sizeof(Node), key_alignment);
+		m_inner_capacity = (m_node_size - m_inner_keys_offset) / (m_key_size + sizeof(Node*));
+		while (m_inner_capacity > 0)
+		{
+			m_inner_children_offset = AlignOffset(m_inner_keys_offset + m_inner_capacity * m_key_size, sizeof(Node*));
+			if (m_inner_children_offset + (m_inner_capacity + 1) * sizeof(Node*) <= m_node_size)
+			{
+				break;
+			}
+			--m_inner_capacity;
+		}
+		if ((m_leaf_capacity >= MIN_NODE_CAPACITY) && (m_inner_capacity >= MIN_NODE_CAPACITY))
+		{
+			break;
+		}
+		m_node_size += CACHE_LINE_SIZE;
+	}
+}
+
+BasicBPlusTree::Node* BasicBPlusTree::AllocateNode(bool is_leaf)
+{
+	Node* ret_val = (Node*)m_allocator->AllocateDataArray(m_node_size, 1);
+	if (ret_val == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate B+ tree node",
+			EXC_HERE);
+	}
+	ret_val->m_count = 0;
+	ret_val->m_is_leaf = is_leaf;
+	if (is_leaf)
+	{
+		((Leaf*)ret_val)->m_prev = NULL;
+		((Leaf*)ret_val)->m_next = NULL;
+	}
+	return ret_val;
+}
+
+void BasicBPlusTree::FreeNode(Node* node)
+{
+	m_allocator->FreeDataArray((char*)node);
+}
+
+void BasicBPlusTree::DestroySubtree(Node* node)
+{
+	if (node->m_is_leaf)
+	{
+		for (unsigned int index = 0; index < node->m_count; ++index)
+		{
+			DestroyKey(GetLeafKey(node, index));
+			DestroyValue(GetLeafValue(node, index));
+		}
+	} else {
+		Node** children = GetChildren(node);
+		for (unsigned int index = 0; index < node->m_count; ++index)
+		{
+			DestroyKey(GetInnerKey(node, index));
+			DestroySubtree(children[index]);
+		}
+		DestroySubtree(children[node->m_count]);
+	}
+	FreeNode(node);
+}
+
+BasicBPlusTree::Node* BasicBPlusTree::GetLeftmostLeaf(Node* node) const
+{
+	while (node->m_is_leaf == false)
+	{
+		node = GetChildren(node)[0];
+	}
+	return node;
+}
+
+void BasicBPlusTree::InsertIntoLeaf(Node* leaf, unsigned int index, const char* key, const char* value)
+{
+	ASSERT(leaf->m_count < m_leaf_capacity);
+	unsigned int tail = leaf->m_count - index;
+	memmove(GetLeafKey(leaf, index + 1), GetLeafKey(leaf, index), tail * m_key_size);
+	memcpy(GetLeafKey(leaf, index), key, m_key_size);
+	if (m_value_size != 0)
+	{
+		memmove(GetLeafValue(leaf, index + 1), GetLeafValue(leaf, index), tail * m_value_size);
+		memcpy(GetLeafValue(leaf, index), value, m_value_size);
+	}
+	++leaf->m_count;
+}
+
+void BasicBPlusTree::InsertIntoInner(Node* node, unsigned int index, const char* key, Node* right)
+{
+	ASSERT(node->m_count < m_inner_capacity);
+	Node** children = GetChildren(node);
+	memmove(GetInnerKey(node, index + 1), GetInnerKey(node, index), (node->m_count - index) * m_key_size);
+	memcpy(GetInnerKey(node, index), key, m_key_size);
+	memmove(children + index + 2, children + index + 1, (node->m_count - index) * sizeof(Node*));
+	children[index + 1] = right;
+	++node->m_count;
+}
+
+void BasicBPlusTree::RemoveFromInner(Node* node, unsigned int key_index)
+{
+	Node** children = GetChildren(node);
+	memmove(GetInnerKey(node, key_index), GetInnerKey(node, key_index + 1), (node->m_count - key_index - 1) * m_key_size);
+	memmove(children + key_index + 1, children + key_index + 2, (node->m_count - key_index - 1) * sizeof(Node*));
+	--node->m_count;
+}
+
+bool BasicBPlusTree::IsRightmost(const Path* path, unsigned int level) const
+{
+	for (unsigned int index = 0; index < level; ++index)
+	{
+		if (path->m_indexes[index] != path->m_nodes[index]->m_count)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void BasicBPlusTree::InsertAt(Path* path, const char* key, const char* value)
+{
+	if (m_root == NULL)
+	{
+		Node* leaf = AllocateNode(true);
+		m_root = leaf;
+		m_first_leaf = (Leaf*)leaf;
+		m_last_leaf = (Leaf*)leaf;
+		m_height = 1;
+		path->m_nodes[0] = leaf;
+		path->m_indexes[0] = 0;
+	}
+	unsigned int level = m_height - 1;
+	Node* leaf = path->m_nodes[level];
+	unsigned int index = path->m_indexes[level];
+	if (leaf->m_count < m_leaf_capacity)
+	{
+		InsertIntoLeaf(leaf, index, key, value);
+		++m_count;
+		return;
+	}
+	//appending to the last leaf keeps it full, so ascending inserts fill leaves up as bulk load does.
+	unsigned int split = ((((Leaf*)leaf)->m_next == NULL) && (index == leaf->m_count)) ?
+		leaf->m_count : (leaf->m_count + 1) / 2;
+	bool to_right = ((index > split) || ((index == split) && (split == m_leaf_capacity)));
+	//everything that can throw is done before the tree is changed: separator copy and nodes for all splits.
+	CopyKey(m_separators, (to_right && (index == split)) ? key : GetLeafKey(leaf, split));
+	Node* new_nodes[MAX_HEIGHT + 1];
+	unsigned int new_node_count = 0;
+	unsigned int needed = 1;
+	for (unsigned int parent_level = level; parent_level > 0; --parent_level)
+	{
+		if (path->m_nodes[parent_level - 1]->m_count < m_inner_capacity)
+		{
+			break;
+		}
+		++needed;
+	}
+	if (needed == m_height)
+	{
+		++needed;	//root is split, a new root is needed
+	}
+	try
+	{
+		for (; new_node_count < needed; ++new_node_count)
+		{
+			new_nodes[new_node_count] = AllocateNode(new_node_count == 0);
+		}
+	}
+	catch (...)
+	{
+		for (unsigned int node_index = 0; node_index < new_node_count; ++node_index)
+		{
+			FreeNode(new_nodes[node_index]);
+		}
+		DestroyKey(m_separators);
+		throw;
+	}
+	Leaf* right = (Leaf*)new_nodes[0];
+	right->m_prev = (Leaf*)leaf;
+	right->m_next = ((Leaf*)leaf)->m_next;
+	if (right->m_next != NULL)
+	{
+		right->m_next->m_prev = right;
+	} else {
+		m_last_leaf = right;
+	}
+	((Leaf*)leaf)->m_next = right;
+	right->m_count = leaf->m_count - split;
+	memcpy(GetLeafKey(right, 0), GetLeafKey(leaf, split), right->m_count * m_key_size);
+	memcpy(GetLeafValue(right, 0), GetLeafValue(leaf, split), right->m_count * m_value_size);
+	leaf->m_count = split;
+	if (to_right)
+	{
+		InsertIntoLeaf(right, index - split, key, value);
+	} else {
+		InsertIntoLeaf(leaf, index, key, value);
+	}
+	++m_count;
+	InsertIntoParent(path, level, m_separators, right, new_nodes + 1);
+}
+
+void BasicBPlusTree::InsertIntoParent(Path* path, unsigned int level, char* key, Node* right, Node** new_nodes)
+{
+	Node* left = path->m_nodes[level];
+	while (level > 0)
+	{
+		Node* parent = path->m_nodes[level - 1];
+		unsigned int index = path->m_indexes[level - 1];
+		if (parent->m_count < m_inner_capacity)
+		{
+			InsertIntoInner(parent, index, key, right);
+			return;
+		}
+		//parent is split. think of its keys with key inserted at index and its children with right inserted
+		//after index: keys before middle stay, middle goes up, the rest go to the new node.
+		unsigned int count = m_inner_capacity + 1;
+		unsigned int middle = IsRightmost(path, level) ? count - 2 : count / 2;
+		Node* new_node = *new_nodes++;
+		Node** parent_children = GetChildren(parent);
+		Node** new_children = GetChildren(new_node);
+		char* up_key = (key == m_separators) ? m_separators + m_key_size : m_separators;
+		for (unsigned int key_index = middle; key_index < count; ++key_index)
+		{
+			const char* src = (key_index < index) ? GetInnerKey(parent, key_index) :
+				((key_index == index) ? key : GetInnerKey(parent, key_index - 1));
+			memcpy((key_index == middle) ? up_key : GetInnerKey(new_node, key_index - middle - 1), src, m_key_size);
+		}
+		for (unsigned int child_index = middle + 1; child_index <= count; ++child_index)
+		{
+			new_children[child_index - middle - 1] = (child_index <= index) ? parent_children[child_index] :
+				((child_index == index + 1) ? right : parent_children[child_index - 1]);
+		}
+		new_node->m_count = count - middle - 1;
+		if (index < middle)
+		{
+			memmove(GetInnerKey(parent, index + 1), GetInnerKey(parent, index), (middle - 1 - index) * m_key_size);
+			memcpy(GetInnerKey(parent, index), key, m_key_size);
+			memmove(parent_children + index + 2, parent_children + index + 1, (middle - 1 - index) * sizeof(Node*));
+			parent_children[index + 1] = right;
+		}
+		parent->m_count = middle;
+		left = parent;
+		right = new_node;
+		key = up_key;
+		--level;
+	}
+	//root was split
+	Node* root = *new_nodes;
+	memcpy(GetInnerKey(root, 0), key, m_key_size);
+	GetChildren(root)[0] = left;
+	GetChildren(root)[1] = right;
+	root->m_count = 1;
+	m_root = root;
+	++m_height;
+}
+
+void BasicBPlusTree::RemoveAt(Path* path)
+{
+	unsigned int level = m_height - 1;
+	Node* leaf = path->m_nodes[level];
+	unsigned int index = path->m_indexes[level];
+	ASSERT(index < leaf->m_count);
+	DestroyKey(GetLeafKey(leaf, index));
+	DestroyValue(GetLeafValue(leaf, index));
+	unsigned int tail = leaf->m_count - index - 1;
+	memmove(GetLeafKey(leaf, index), GetLeafKey(leaf, index + 1), tail * m_key_size);
+	memmove(GetLeafValue(leaf, index), GetLeafValue(leaf, index + 1), tail * m_value_size);
+	--leaf->m_count;
+	--m_count;
+	if (level == 0)
+	{
+		if (leaf->m_count == 0)
+		{
+			FreeNode(leaf);
+			m_root = NULL;
+			m_first_leaf = NULL;
+			m_last_leaf = NULL;
+			m_height = 0;
+		}
+		return;
+	}
+	Rebalance(path, level);
+}
+
+void BasicBPlusTree::Rebalance(Path* path, unsigned int level)
+{
+	while (level > 0)
+	{
+		Node* node = path->m_nodes[level];
+		unsigned int min_count = (node->m_is_leaf ? m_leaf_capacity : m_inner_capacity) / 2;
+		if (node->m_count >= min_count)
+		{
+			return;
+		}
+		Node* parent = path->m_nodes[level - 1];
+		unsigned int index = path->m_indexes[level - 1];
+		Node** children = GetChildren(parent);
+		Node* left = (index > 0) ? children[index - 1] : NULL;
+		Node* right = (index < parent->m_count) ? children[index + 1] : NULL;
+		if ((left != NULL) && (left->m_count > min_count))
+		{
+			BorrowFromLeft(parent, index, left, node);
+			return;
+		}
+		if ((right != NULL) && (right->m_count > min_count))
+		{
+			BorrowFromRight(parent, index, node, right);
+			return;
+		}
+		//both neighbours have no more than min_count, so two nodes fit in one.
+		if (left != NULL)
+		{
+			Merge(parent, index - 1, left, node);
+		} else {
+			Merge(parent, index, node, right);
+		}
+		if ((level == 1) && (parent->m_count == 0))
+		{
+			m_root = children[0];
+			FreeNode(parent);
+			--m_height;
+			return;
+		}
+		--level;
+	}
+}
+
+void BasicBPlusTree::BorrowFromLeft(Node* parent, unsigned int index, Node* left, Node* node)
+{
+	char* separator = GetInnerKey(parent, index - 1);
+	if (node->m_is_leaf)
+	{
+		unsigned int last = left->m_count - 1;
+		CopyKey(m_separators, GetLeafKey(left, last));
+		DestroyKey(separator);
+		memcpy(separator, m_separators, m_key_size);
+		InsertIntoLeaf(node, 0, GetLeafKey(left, last), GetLeafValue(left, last));
+		--left->m_count;
+	} else {
+		//separator goes down to node, the last key of left goes up
+		Node** node_children = GetChildren(node);
+		memmove(GetInnerKey(node, 1), GetInnerKey(node, 0), node->m_count * m_key_size);
+		memmove(node_children + 1, node_children, (node->m_count + 1) * sizeof(Node*));
+		memcpy(GetInnerKey(node, 0), separator, m_key_size);
+		node_children[0] = GetChildren(left)[left->m_count];
+		memcpy(separator, GetInnerKey(left, left->m_count - 1), m_key_size);
+		--left->m_count;
+		++node->m_count;
+	}
+}
+
+void BasicBPlusTree::BorrowFromRight(Node* parent, unsigned int index, Node* node, Node* right)
+{
+	char* separator = GetInnerKey(parent, index);
+	if (node->m_is_leaf)
+	{
+		//the second entry of right becomes its first one
+		CopyKey(m_separators, GetLeafKey(right, 1));
+		DestroyKey(separator);
+		memcpy(separator, m_separators, m_key_size);
+		InsertIntoLeaf(node, node->m_count, GetLeafKey(right, 0), GetLeafValue(right, 0));
+		unsigned int tail = right->m_count - 1;
+		memmove(GetLeafKey(right, 0), GetLeafKey(right, 1), tail * m_key_size);
+		memmove(GetLeafValue(right, 0), GetLeafValue(right, 1), tail * m_value_size);
+		--right->m_count;
+	} else {
+		Node** right_children = GetChildren(right);
+		memcpy(GetInnerKey(node, node->m_count), separator, m_key_size);
+		GetChildren(node)[node->m_count + 1] = right_children[0];
+		++node->m_count;
+		memcpy(separator, GetInnerKey(right, 0), m_key_size);
+		memmove(GetInnerKey(right, 0), GetInnerKey(right, 1), (right->m_count - 1) * m_key_size);
+		memmove(right_children, right_children + 1, right->m_count * sizeof(Node*));
+		--right->m_count;
+	}
+}
+
+void BasicBPlusTree::Merge(Node* parent, unsigned int separator_index, Node* left, Node* right)
+{
+	char* separator = GetInnerKey(parent, separator_index);
+	if (left->m_is_leaf)
+	{
+		ASSERT(left->m_count + right->m_count <= m_leaf_capacity);
+		memcpy(GetLeafKey(left, left->m_count), GetLeafKey(right, 0), right->m_count * m_key_size);
+		memcpy(GetLeafValue(left, left->m_count), GetLeafValue(right, 0), right->m_count * m_value_size);
+		left->m_count += right->m_count;
+		Leaf* next = ((Leaf*)right)->m_next;
+		((Leaf*)left)->m_next = next;
+		if (next != NULL)
+		{
+			next->m_prev = (Leaf*)left;
+		} else {
+			m_last_leaf = (Leaf*)left;
+		}
+		DestroyKey(separator);
+	} else {
+		ASSERT(left->m_count + right->m_count + 1 <= m_inner_capacity);
+		memcpy(GetInnerKey(left, left->m_count), separator, m_key_size);
+		memcpy(GetInnerKey(left, left->m_count + 1), GetInnerKey(right, 0), right->m_count * m_key_size);
+		memcpy(GetChildren(left) + left->m_count + 1, GetChildren(right), (right->m_count + 1) * sizeof(Node*));
+		left->m_count += right->m_count + 1;
+	}
+	RemoveFromInner(parent, separator_index);
+	FreeNode(right);
+}
+
+void BasicBPlusTree::InternalBulkLoad(const char* keys, const char* values, unsigned int count)
+{
+	if (m_root != NULL)
+	{
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Cannot bulk load B+ tree which is not empty",
+			EXC_HERE);
+	}
+	if (count == 0)
+	{
+		return;
+	}
+	//entries are spread evenly, so every leaf is at least half full.
+	unsigned int leaf_count = (count + m_leaf_capacity - 1) / m_leaf_capacity;
+	Node** nodes = (Node**)m_allocator->AllocateDataArray(sizeof(Node*), leaf_count);
+	if (nodes == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate B+ tree",
+			EXC_HERE);
+	}
+	unsigned int node_count = 0;
+	Leaf* last_leaf = NULL;
+	try
+	{
+		unsigned int entry_index = 0;
+		while (node_count < leaf_count)
+		{
+			Node* leaf = AllocateNode(true);
+			nodes[node_count] = leaf;
+			if (node_count > 0)
+			{
+				((Leaf*)leaf)->m_prev = (Leaf*)nodes[node_count - 1];
+				((Leaf*)nodes[node_count - 1])->m_next = (Leaf*)leaf;
+			}
+			unsigned int fill = count / leaf_count + ((node_count < count % leaf_count) ? 1 : 0);
+			++node_count;
+			for (; leaf->m_count < fill; ++leaf->m_count, ++entry_index)
+			{
+				ConstructEntry(GetLeafKey(leaf, leaf->m_count),
+							   GetLeafValue(leaf, leaf->m_count),
+							   keys + entry_index * m_key_size,
+							   (values != NULL) ? values + entry_index * m_value_size : NULL);
+			}
+		}
+		last_leaf = (Leaf*)nodes[leaf_count - 1];
+		m_height = 1;
+		while (node_count > 1)
+		{
+			BuildLevel(nodes, node_count, &node_count);
+			++m_height;
+		}
+	}
+	catch (...)
+	{
+		for (unsigned int index = 0; index < node_count; ++index)
+		{
+			DestroySubtree(nodes[index]);
+		}
+		m_allocator->FreeDataArray((char*)nodes);
+		m_height = 0;
+		throw;
+	}
+	m_root = nodes[0];
+	m_first_leaf = (Leaf*)GetLeftmostLeaf(m_root);
+	m_last_leaf = last_leaf;
+	m_count = count;
+	m_allocator->FreeDataArray((char*)nodes);
+}
+
+void BasicBPlusTree::BuildLevel(Node** nodes, unsigned int count, unsigned int* out_count)
+{
+	//children are spread evenly, so every node has at least half of the maximum.
+	unsigned int parent_count = (count + m_inner_capacity) / (m_inner_capacity + 1);
+	unsigned int child_index = 0;
+	for (unsigned int parent_index = 0; parent_index < parent_count; ++parent_index)
+	{
+		unsigned int fill = count / parent_count + ((parent_index < count % parent_count) ? 1 : 0);
+		Node* parent = NULL;
+		try
+		{
+			parent = AllocateNode(false);
+			Node** children = GetChildren(parent);
+			children[0] = nodes[child_index];
+			for (unsigned int index = 1; index < fill; ++index)
+			{
+				Node* child = nodes[child_index + index];
+				CopyKey(GetInnerKey(parent, parent->m_count), GetLeafKey(GetLeftmostLeaf(child), 0));
+				children[index] = child;
+				++parent->m_count;
+			}
+		}
+		catch (...)
+		{
+			if (parent != NULL)
+			{
+				for (unsigned int index = 0; index < parent->m_count; ++index)
+				{
+					DestroyKey(GetInnerKey(parent, index));
+				}
+				FreeNode(parent);
+			}
+			//nodes before parent_index are parents already, the rest are still on the lower level.
+			for (unsigned int index = child_index; index < count; ++index)
+			{
+				nodes[parent_index + index - child_index] = nodes[index];
+			}
+			*out_count = parent_index + count - child_index;
+			throw;
+		}
+		nodes[parent_index] = parent;
+		child_index += fill;
+	}
+	*out_count = parent_count;
+}
+
+#ifdef SYNCTL_SSE2
+//lanes of a and b that are equal get all bits of the lane set
+template <unsigned int char_size>
+static __m128i CompareCharLanes(__m128i a, __m128i b);
+template <>
+inline __m128i CompareCharLanes<1>(__m128i a, __m128i b)
+	{ return _mm_cmpeq_epi8(a, b); }
+template <>
+inline __m128i CompareCharLanes<2>(__m128i a, __m128i b)
+	{ return _mm_cmpeq_epi16(a, b); }
+template <>
+inline __m128i CompareCharLanes<4>(__m128i a, __m128i b)
+	{ return _mm_cmpeq_epi32(a, b); }
+
+template <class CharType>
+static __m128i SetCharLanes(CharType ch);
+template <>
+inline __m128i SetCharLanes<char>(char ch)
+	{ return _mm_set1_epi8(ch); }
+template <>
+inline __m128i SetCharLanes<wchar_t>(wchar_t ch)
+{
+	if (sizeof(wchar_t) == 2)
+	{
+		return _mm_set1_epi16((short)ch);
+	}
+	return _mm_set1_epi32((int)ch);
+}
+#endif //SYNCTL_SSE2
+
+//reads go by aligned 16 byte blocks, the block with the terminating zero may be read past the string's end
+template <class CharType>
+SYNCTL_NO_SANITIZE_ADDRESS static unsigned int ScanLength(const CharType* str)
+{
+#ifdef SYNCTL_SSE2
+	if (((size_t)str % sizeof(CharType)) == 0)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const char* block = (const char*)((size_t)str & ~(size_t)15);
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(
+			CompareCharLanes<sizeof(CharType)>(_mm_load_si128((const __m128i*)block), zero));
+		mask &= (0xFFFFu << (unsigned int)((const char*)str - block));
+		while (mask == 0)
+		{
+			block += 16;
+			mask = (unsigned int)_mm_movemask_epi8(
+				CompareCharLanes<sizeof(CharType)>(_mm_load_si128((const __m128i*)block), zero));
+		}
+		return (unsigned int)((block + CountTrailingZeros(mask) - (const char*)str) / sizeof(CharType));
+	}
+#endif //SYNCTL_SSE2
+	return TStrLen(str);
+}
+
+template <class CharType>
+static unsigned int ScanChar(const CharType* str, unsigned int length, CharType ch)
+{
+	unsigned int index = 0;
+#ifdef SYNCTL_SSE2
+	const unsigned int block_chars = 16 / sizeof(CharType);
+	const __m128i pattern = SetCharLanes(ch);
+	while (index + block_chars <= length)
+	{
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(
+			CompareCharLanes<sizeof(CharType)>(_mm_loadu_si128((const __m128i*)(str + index)), pattern));
+		if (mask != 0)
+		{
+			return index + CountTrailingZeros(mask) / sizeof(CharType);
+		}
+		index += block_chars;
+	}
+#endif //SYNCTL_SSE2
+	while ((index < length) && (str[index] != ch))
+	{
+		++index;
+	}
+	return index;
+}
+
+unsigned int SyncTL::StringLength(const char* str)
+{
+	return ScanLength(str);
+}
+
+unsigned int SyncTL::StringLength(const wchar_t* str)
+{
+	return ScanLength(str);
+}
+
+unsigned int SyncTL::FindChar(const char* str, unsigned int length, char ch)
+{
+	return ScanChar(str, length, ch);
+}
+
+unsigned int SyncTL::FindChar(const wchar_t* str, unsigned int length, wchar_t ch)
+{
+	return ScanChar(str, length, ch);
+}
+
+size_t SyncTL::FindMismatch(const char* first, const char* second, size_t size)
+{
+	size_t index = 0;
+#ifdef SYNCTL_SSE2
+	while (index + 16 <= size)
+	{
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i*)(first + index)), _mm_loadu_si128((const __m128i*)(second + index))));
+		if (mask != 0xFFFF)
+		{
+			return index + CountTrailingZeros(~mask);
+		}
+		index += 16;
+	}
+#endif //SYNCTL_SSE2
+	while ((index < size) && (first[index] == second[index]))
+	{
+		++index;
+	}
+	return index;
+}
+
+unsigned int /*error code*/ SyncTL::Utf8ToWide(const char* str, unsigned int length, WString* out)
+{
+	//every byte gives at most one wchar_t, even 4 byte sequences become only a surrogate pair
+	out->Resize(length);
+	wchar_t* dst = out->GetData();
+	unsigned int count = 0;
+	unsigned int index = 0;
+	while (index < length)
+	{
+#ifdef SYNCTL_SSE2
+		//ASCII blocks are widened as a whole
+		const __m128i zero = _mm_setzero_si128();
+		while (index + 16 <= length)
+		{
+			__m128i bytes = _mm_loadu_si128((const __m128i*)(str + index));
+			if (_mm_movemask_epi8(bytes) != 0)
+			{
+				break;
+			}
+			__m128i low = _mm_unpacklo_epi8(bytes, zero);
+			__m128i high = _mm_unpackhi_epi8(bytes, zero);
+			if (sizeof(wchar_t) == 2)
+			{
+				_mm_storeu_si128((__m128i*)(dst + count), low);
+				_mm_storeu_si128((__m128i*)(dst + count + 8), high);
+			} else {
+				_mm_storeu_si128((__m128i*)(dst + count), _mm_unpacklo_epi16(low, zero));
+				_mm_storeu_si128((__m128i*)(dst + count + 4), _mm_unpackhi_epi16(low, zero));
+				_mm_storeu_si128((__m128i*)(dst + count + 8), _mm_unpacklo_epi16(high, zero));
+				_mm_storeu_si128((__m128i*)(dst + count + 12), _mm_unpackhi_epi16(high, zero));
+			}
+			index += 16;
+			count += 16;
+		}
+		if (index == length)
+		{
+			break;
+		}
+#endif //SYNCTL_SSE2
+		unsigned char lead = (unsigned char)str[index];
+		unsigned int code_point = lead;
+		unsigned int sequence_length = 1;
+		unsigned int min_code_point = 0;
+		if (lead >= 0x80)
+		{
+			if ((lead & 0xE0) == 0xC0)
+			{
+				sequence_length = 2;
+				code_point = lead & 0x1F;
+				min_code_point = 0x80;
+			} else if ((lead & 0xF0) == 0xE0)
+			{
+				sequence_length = 3;
+				code_point = lead & 0x0F;
+				min_code_point = 0x800;
+			} else if ((lead & 0xF8) == 0xF0)
+			{
+				sequence_length = 4;
+				code_point = lead & 0x07;
+				min_code_point = 0x10000;
+			} else {
+				out->Resize(count);
+				return UTILS_ERROR_INVALID_ENCODING;
+			}
+			if (length - index < sequence_length)
+			{
+				out->Resize(count);
+				return UTILS_ERROR_INVALID_ENCODING;
+			}
+			for (unsigned int byte_index = 1; byte_index < sequence_length; ++byte_index)
+			{
+				unsigned char byte = (unsigned char)str[index + byte_index];
+				if ((byte & 0xC0) != 0x80)
+				{
+					out->Resize(count);
+					return UTILS_ERROR_INVALID_ENCODING;
+				}
+				code_point = (code_point << 6) | (byte & 0x3F);
+			}
+			//overlong forms, surrogates and values past unicode are not characters
+			if ((code_point < min_code_point) || (code_point > 0x10FFFF) ||
+				((code_point >= 0xD800) && (code_point <= 0xDFFF)))
+			{
+				out->Resize(count);
+				return UTILS_ERROR_INVALID_ENCODING;
+			}
+		}
+		if ((sizeof(wchar_t) == 2) && (code_point >= 0x10000))
+		{
+			code_point -= 0x10000;
+			dst[count] = (wchar_t)(0xD800 | (code_point >> 10));
+			dst[count + 1] = (wchar_t)(0xDC00 | (code_point & 0x3FF));
+			count += 2;
+		} else {
+			dst[count] = (wchar_t)code_point;
+			++count;
+		}
+		index += sequence_length;
+	}
+	out->Resize(count);
+	return UTILS_ERROR_OK;
+}
+
+unsigned int /*error code*/ SyncTL::WideToUtf8(const wchar_t* str, unsigned int length, AString* out)
+{
+	//a UTF-16 unit gives at most 3 bytes (a surrogate pair gives 4 for 2 units), a UTF-32 one at most 4
+	out->Resize(length * ((sizeof(wchar_t) == 2) ? 3 : 4));
+	char* dst = out->GetData();
+	unsigned int count = 0;
+	unsigned int index = 0;
+	while (index < length)
+	{
+#ifdef SYNCTL_SSE2
+		//ASCII blocks are narrowed as a whole
+		const unsigned int block_chars = 16 / sizeof(wchar_t);
+		const __m128i zero = _mm_setzero_si128();
+		while (index + block_chars <= length)
+		{
+			__m128i units = _mm_loadu_si128((const __m128i*)(str + index));
+			if (sizeof(wchar_t) == 2)
+			{
+				__m128i high_bits = _mm_and_si128(units, _mm_set1_epi16((short)0xFF80));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi16(high_bits, zero)) != 0xFFFF)
+				{
+					break;
+				}
+				_mm_storel_epi64((__m128i*)(dst + count), _mm_packus_epi16(units, units));
+			} else {
+				__m128i high_bits = _mm_and_si128(units, _mm_set1_epi32((int)0xFFFFFF80));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi32(high_bits, zero)) != 0xFFFF)
+				{
+					break;
+				}
+				__m128i words = _mm_packs_epi32(units, units);
+				int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+				memcpy(dst + count, &bytes, 4);
+			}
+			index += block_chars;
+			count += block_chars;
+		}
+		if (index == length)
+		{
+			break;
+		}
+#endif //SYNCTL_SSE2
+		unsigned int code_point = (unsigned int)str[index];
+		++index;
+		if ((code_point >= 0xD800) && (code_point <= 0xDFFF))
+		{
+			//only a high surrogate followed by a low one is valid, and only in UTF-16
+			if ((sizeof(wchar_t) != 2) || (code_point > 0xDBFF) || (index == length) ||
+				((unsigned int)str[index] < 0xDC00) || ((unsigned int)str[index] > 0xDFFF))
+			{
+				out->Resize(count);
+				return UTILS_ERROR_INVALID_ENCODING;
+			}
+			code_point = 0x10000 + (((code_point - 0xD800) << 10) | ((unsigned int)str[index] - 0xDC00));
+			++index;
+		}
+		if (code_point < 0x80)
+		{
+			dst[count] = (char)code_point;
+			++count;
+		} else if (code_point < 0x800)
+		{
+			dst[count] = (char)(0xC0 | (code_point >> 6));
+			dst[count + 1] = (char)(0x80 | (code_point & 0x3F));
+			count += 2;
+		} else if (code_point < 0x10000)
+		{
+			dst[count] = (char)(0xE0 | (code_point >> 12));
+			dst[count + 1] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+			dst[count + 2] = (char)(0x80 | (code_point & 0x3F));
+			count += 3;
+		} else if (code_point <= 0x10FFFF)
+		{
+			dst[count] = (char)(0xF0 | (code_point >> 18));
+			dst[count + 1] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+			dst[count + 2] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+			dst[count + 3] = (char)(0x80 | (code_point & 0x3F));
+			count += 4;
+		} else {
+			out->Resize(count);
+			return UTILS_ERROR_INVALID_ENCODING;
+		}
+	}
+	out->Resize(count);
+	return UTILS_ERROR_OK;
+}
+
+//lane operations for the scan kernels. Reg holds LANES values, EqualMask has a bit for each equal lane,
+//Acc is a register of sums that are wider than values.
+template <class ValueType, class SumValueType>
+struct ScalarOps
+{
+	typedef ValueType Value;
+	typedef SumValueType SumType;
+	typedef ValueType Reg;
+	typedef SumValueType Acc;
+	enum { LANES = 1 };
+	static Reg Load(const Value* data)
+		{ return *data; }
+	static Reg Set(Value value)
+		{ return value; }
+	static unsigned int EqualMask(Reg a, Reg b)
+		{ return (a == b) ? 1 : 0; }
+	static Reg Min(Reg a, Reg b)
+		{ return (b < a) ? b : a; }
+	static Reg Max(Reg a, Reg b)
+		{ return (a < b) ? b : a; }
+	static void Store(Value* out, Reg value)
+		{ *out = value; }
+	static Acc ZeroAcc()
+		{ return Acc(); }
+	static Acc Add(Acc acc, Reg value)
+		{ return acc + value; }
+	static Acc Combine(Acc a, Acc b)
+		{ return a + b; }
+	static SumType Reduce(Acc acc)
+		{ return acc; }
+};
+
+#ifdef SYNCTL_SSE2
+inline __m128i Sse2Select(__m128i mask, __m128i a, __m128i b)
+	{ return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+
+//SSE2 has no 64 bit compare, dwords are compared as signed numbers. bias makes low dwords (and for unsigned
+//numbers high ones too) compare as unsigned.
+inline __m128i Sse2Greater64(__m128i a, __m128i b, __m128i bias)
+{
+	a = _mm_xor_si128(a, bias);
+	b = _mm_xor_si128(b, bias);
+	__m128i greater = _mm_cmpgt_epi32(a, b);
+	__m128i equal = _mm_cmpeq_epi32(a, b);
+	__m128i low_greater = _mm_shuffle_epi32(greater, _MM_SHUFFLE(2, 2, 0, 0));
+	__m128i ret_val = _mm_or_si128(greater, _mm_and_si128(equal, low_greater));
+	return _mm_shuffle_epi32(ret_val, _MM_SHUFFLE(3, 3, 1, 1));
+}
+
+template <class ValueType, bool is_signed>
+struct Sse2Int32Ops
+{
+	typedef ValueType Value;
+	typedef typename std::conditional<is_signed, long long, unsigned long long>::type SumType;
+	typedef __m128i Reg;
+	typedef __m128i Acc;
+	enum { LANES = 4 };
+	static Reg Load(const Value* data)
+		{ return _mm_loadu_si128((const __m128i*)data); }
+	static Reg Set(Value value)
+		{ return _mm_set1_epi32((int)value); }
+	static unsigned int EqualMask(Reg a, Reg b)
+		{ return (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))); }
+	static Reg Greater(Reg a, Reg b)
+	{
+		if (is_signed)
+		{
+			return _mm_cmpgt_epi32(a, b);
+		}
+		const __m128i bias = _mm_set1_epi32((int)0x80000000);
+		return _mm_cmpgt_epi32(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+	}
+	static Reg Min(Reg a, Reg b)
+		{ return Sse2Select(Greater(a, b), b, a); }
+	static Reg Max(Reg a, Reg b)
+		{ return Sse2Select(Greater(a, b), a, b); }
+	static void Store(Value* out, Reg value)
+		{ _mm_storeu_si128((__m128i*)out, value); }
+	static Acc ZeroAcc()
+		{ return _mm_setzero_si128(); }
+	static Acc Add(Acc acc, Reg value)
+	{
+		__m128i high = is_signed ? _mm_srai_epi32(value, 31) : _mm_setzero_si128();
+		return _mm_add_epi64(acc, _mm_add_epi64(_mm_unpacklo_epi32(value, high), _mm_unpackhi_epi32(value, high)));
+	}
+	static Acc Combine(Acc a, Acc b)
+		{ return _mm_add_epi64(a, b); }
+	static SumType Reduce(Acc acc)
+	{
+		SumType lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		return lanes[0] + lanes[1];
+	}
+};
+
+template <class ValueType, bool is_signed>
+struct Sse2Int64Ops
+{
+	typedef ValueType Value;
+	typedef ValueType SumType;
+	typedef __m128i Reg;
+	typedef __m128i Acc;
+	enum { LANES = 2 };
+	static Reg Load(const Value* data)
+		{ return _mm_loadu_si128((const __m128i*)data); }
+	static Reg Set(Value value)
+		{ return _mm_set1_epi64x((long long)value); }
+	static unsigned int EqualMask(Reg a, Reg b)
+	{
+		__m128i equal = _mm_cmpeq_epi32(a, b);
+		equal = _mm_and_si128(equal, _mm_shuffle_epi32(equal, _MM_SHUFFLE(2, 3, 0, 1)));
+		return (unsigned int)_mm_movemask_pd(_mm_castsi128_pd(equal));
+	}
+	static Reg Greater(Reg a, Reg b)
+	{
+		const __m128i bias = is_signed ? _mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000) :
+										 _mm_set1_epi32((int)0x80000000);
+		return Sse2Greater64(a, b, bias);
+	}
+	static Reg Min(Reg a, Reg b)
+		{ return Sse2Select(Greater(a, b), b, a); }
+	static Reg Max(Reg a, Reg b)
+		{ return Sse2Select(Greater(a, b), a, b); }
+	static void Store(Value* out, Reg value)
+		{ _mm_storeu_si128((__m128i*)out, value); }
+	static Acc ZeroAcc()
+		{ return _mm_setzero_si128(); }
+	static Acc Add(Acc acc, Reg value)
+		{ return _mm_add_epi64(acc, value); }
+	static Acc Combine(Acc a, Acc b)
+		{ return _mm_add_epi64(a, b); }
+	static SumType Reduce(Acc acc)
+	{
+		SumType lanes[2];
+		_mm_storeu_si128((__m128i*)lanes, acc);
+		return lanes[0] + lanes[1];
+	}
+};
+
+struct Sse2FloatOps
+{
+	typedef float Value;
+	typedef double SumType;
+	typedef __m128 Reg;
+	typedef __m128d Acc;
+	enum { LANES = 4 };
+	static Reg Load(const Value* data)
+		{ return _mm_loadu_ps(data); }
+	static Reg Set(Value value)
+		{ return _mm_set1_ps(value); }
+	static unsigned int EqualMask(Reg a, Reg b)
+		{ return (unsigned int)_mm_movemask_ps(_mm_cmpeq_ps(a, b)); }
+	static Reg Min(Reg a, Reg b)
+		{ return _mm_min_ps(a, b); }
+	static Reg Max(Reg a, Reg b)
+		{ return _mm_max_ps(a, b); }
+	static void Store(Value* out, Reg value)
+		{ _mm_storeu_ps(out, value); }
+	static Acc ZeroAcc()
+		{ return _mm_setzero_pd(); }
+	static Acc Add(Acc acc, Reg value)
+		{ return _mm_add_pd(acc, _mm_add_pd(_mm_cvtps_pd(value), _mm_cvtps_pd(_mm_movehl_ps(value, value)))); }
+	static Acc Combine(Acc a, Acc b)
+		{ return _mm_add_pd(a, b); }
+	static SumType Reduce(Acc acc)
+	{
+		double lanes[2];
+		_mm_storeu_pd(lanes, acc);
+		return lanes[0] + lanes[1];
+	}
+};
+
+struct Sse2DoubleOps
+{
+	typedef double Value;
+	typedef double SumType;
+	typedef __m128d Reg;
+	typedef __m128d Acc;
+	enum { LANES = 2 };
+	static Reg Load(const Value* data)
+		{ return _mm_loadu_pd(data); }
+	static Reg Set(Value value)
+		{ return _mm_set1_pd(value); }
+	static unsigned int EqualMask(Reg a, Reg b)
+		{ return (unsigned int)_mm_movemask_pd(_mm_cmpeq_pd(a, b)); }
+	static Reg Min(Reg a, Reg b)
+		{ return _mm_min_pd(a, b); }
+	static Reg Max(Reg a, Reg b)
+		{ return _mm_max_pd(a, b); }
+	static void Store(Value* out, Reg value)
+		{ _mm_storeu_pd(out, value); }
+	static Acc ZeroAcc()
+		{ return _mm_setzero_pd(); }
+	static Acc Add(Acc acc, Reg value)
+		{ return _mm_add_pd(acc, value); }
+	static Acc Combine(Acc a, Acc b)
+		{ return _mm_add_pd(a, b); }
+	static SumType Reduce(Acc acc)
+	{
+		double lanes[2];
+		_mm_storeu_pd(lanes, acc);
+		return lanes[0] + lanes[1];
+	}
+};
+#endif //SYNCTL_SSE2
+
+//scan kernels. Find and Sum go through several registers at a time, so loads are not waiting for each other.
+template <class Ops>
+static unsigned int FindKernel(const typename Ops::Value* data, unsigned int count, typename Ops::Value value)
+{
+	typename Ops::Reg pattern = Ops::Set(value);
+	unsigned int index = 0;
+	for (; index + 4 * Ops::LANES <= count; index += 4 * Ops::LANES)
+	{
+		unsigned int mask = Ops::EqualMask(Ops::Load(data + index), pattern) |
+							(Ops::EqualMask(Ops::Load(data + index + Ops::LANES), pattern) << Ops::LANES) |
+							(Ops::EqualMask(Ops::Load(data + index + 2 * Ops::LANES), pattern) << (2 * Ops::LANES)) |
+							(Ops::EqualMask(Ops::Load(data + index + 3 * Ops::LANES), pattern) << (3 * Ops::LANES));
+		if (mask != 0)
+		{
+			return index + CountTrailingZeros(mask);
+		}
+	}
+	for (; index + Ops::LANES <= count; index += Ops::LANES)
+	{
+		unsigned int mask = Ops::EqualMask(Ops::Load(data + index), pattern);
+		if (mask != 0)
+		{
+			return index + CountTrailingZeros(mask);
+		}
+	}
+	while ((index < count) && ((data[index] == value) == false))
+	{
+		++index;
+	}
+	return index;
+}
+
+template <class Ops>
+static unsigned int CountKernel(const typename Ops::Value* data, unsigned int count, typename Ops::Value value)
+{
+	typename Ops::Reg pattern = Ops::Set(value);
+	unsigned int ret_val = 0;
+	unsigned int index = 0;
+	for (; index + Ops::LANES <= count; index += Ops::LANES)
+	{
+		ret_val += CountSetBits(Ops::EqualMask(Ops::Load(data + index), pattern));
+	}
+	for (; index < count; ++index)
+	{
+		if (data[index] == value)
+		{
+			++ret_val;
+		}
+	}
+	return ret_val;
+}
+
+template <class Ops>
+static bool MinMaxKernel(const typename Ops::Value* data, unsigned int count,
+						 typename Ops::Value* out_min, typename Ops::Value* out_max)
+{
+	typedef typename Ops::Value Value;
+	if (count == 0)
+	{
+		return false;
+	}
+	Value min_value = data[0];
+	Value max_value = data[0];
+	unsigned int index = 0;
+	if (count >= Ops::LANES)
+	{
+		typename Ops::Reg min_reg = Ops::Load(data);
+		typename Ops::Reg max_reg = min_reg;
+		for (index = Ops::LANES; index + Ops::LANES <= count; index += Ops::LANES)
+		{
+			typename Ops::Reg values = Ops::Load(data + index);
+			min_reg = Ops::Min(min_reg, values);
+			max_reg = Ops::Max(max_reg, values);
+		}
+		Value lanes[Ops::LANES];
+		Ops::Store(lanes, min_reg);
+		for (unsigned int lane = 0; lane < Ops::LANES; ++lane)
+		{
+			min_value = (lanes[lane] < min_value) ? lanes[lane] : min_value;
+		}
+		Ops::Store(lanes, max_reg);
+		for (unsigned int lane = 0; lane < Ops::LANES; ++lane)
+		{
+			max_value = (max_value < lanes[lane]) ? lanes[lane] : max_value;
+		}
+	}
+	for (; index < count; ++index)
+	{
+		min_value = (data[index] < min_value) ? data[index] : min_value;
+		max_value = (max_value < data[index]) ? data[index] : max_value;
+	}
+	*out_min = min_value;
+	*out_max = max_value;
+	return true;
+}
+
+template <class Ops>
+static typename Ops::SumType SumKernel(const typename Ops::Value* data, unsigned int count)
+{
+	typename Ops::Acc first = Ops::ZeroAcc();
+	typename Ops::Acc second = Ops::ZeroAcc();
+	unsigned int index = 0;
+	for (; index + 2 * Ops::LANES <= count; index += 2 * Ops::LANES)
+	{
+		first = Ops::Add(first, Ops::Load(data + index));
+		second = Ops::Add(second, Ops::Load(data + index + Ops::LANES));
+	}
+	typename Ops::SumType ret_val = Ops::Reduce(Ops::Combine(first, second));
+	for (; index < count; ++index)
+	{
+		ret_val += data[index];
+	}
+	return ret_val;
+}
+
+#ifdef SYNCTL_AVX2_KERNELS
+template <class ValueType, bool is_signed>
+struct Avx2Int32Ops
+{
+	typedef ValueType Value;
+	typedef typename std::conditional<is_signed, long long, unsigned long long>::type SumType;
+	typedef __m256i Reg;
+	typedef __m256i Acc;
+	enum { LANES = 8 };
+	SYNCTL_TARGET_AVX2 static Reg Load(const Value* data)
+		{ return _mm256_loadu_si256((const __m256i*)data); }
+	SYNCTL_TARGET_AVX2 static Reg Set(Value value)
+		{ return _mm256_set1_epi32((int)value); }
+	SYNCTL_TARGET_AVX2 static unsigned int EqualMask(Reg a, Reg b)
+		{ return (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))); }
+	SYNCTL_TARGET_AVX2 static Reg Min(Reg a, Reg b)
+		{ return is_signed ? _mm256_min_epi32(a, b) : _mm256_min_epu32(a, b); }
+	SYNCTL_TARGET_AVX2 static Reg Max(Reg a, Reg b)
+		{ return is_signed ? _mm256_max_epi32(a, b) : _mm256_max_epu32(a, b); }
+	SYNCTL_TARGET_AVX2 static void Store(Value* out, Reg value)
+		{ _mm256_storeu_si256((__m256i*)out, value); }
+	SYNCTL_TARGET_AVX2 static Acc ZeroAcc()
+		{ return _mm256_setzero_si256(); }
+	SYNCTL_TARGET_AVX2 static Acc Add(Acc acc, Reg value)
+	{
+		__m128i low = _mm256_castsi256_si128(value);
+		__m128i high = _mm256_extracti128_si256(value, 1);
+		if (is_signed)
+		{
+			return _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_cvtepi32_epi64(low), _mm256_cvtepi32_epi64(high)));
+		}
+		return _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_cvtepu32_epi64(low), _mm256_cvtepu32_epi64(high)));
+	}
+	SYNCTL_TARGET_AVX2 static Acc Combine(Acc a, Acc b)
+		{ return _mm256_add_epi64(a, b); }
+	SYNCTL_TARGET_AVX2 static SumType Reduce(Acc acc)
+	{
+		SumType lanes[4];
+		_mm256_storeu_si256((__m256i*)lanes, acc);
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+};
+
+template <class ValueType, bool is_signed>
+struct Avx2Int64Ops
+{
+	typedef ValueType Value;
+	typedef ValueType SumType;
+	typedef __m256i Reg;
+	typedef __m256i Acc;
+	enum { LANES = 4 };
+	SYNCTL_TARGET_AVX2 static Reg Load(const Value* data)
+		{ return _mm256_loadu_si256((const __m256i*)data); }
+	SYNCTL_TARGET_AVX2 static Reg Set(Value value)
+		{ return _mm256_set1_epi64x((long long)value); }
+	SYNCTL_TARGET_AVX2 static unsigned int EqualMask(Reg a, Reg b)
+		{ return (unsigned int)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b))); }
+	SYNCTL_TARGET_AVX2 static Reg Greater(Reg a, Reg b)
+	{
+		if (is_signed)
+		{
+			return _mm256_cmpgt_epi64(a, b);
+		}
+		const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+		return _mm256_cmpgt_epi64(_mm256_xor_si256(a, bias), _mm256_xor_si256(b, bias));
+	}
+	SYNCTL_TARGET_AVX2 static Reg Min(Reg a, Reg b)
+		{ return _mm256_blendv_epi8(a, b, Greater(a, b)); }
+	SYNCTL_TARGET_AVX2 static Reg Max(Reg a, Reg b)
+		{ return _mm256_blendv_epi8(b, a, Greater(a, b)); }
+	SYNCTL_TARGET_AVX2 static void Store(Value* out, Reg value)
+		{ _mm256_storeu_si256((__m256i*)out, value); }
+	SYNCTL_TARGET_AVX2 static Acc ZeroAcc()
+		{ return _mm256_setzero_si256(); }
+	SYNCTL_TARGET_AVX2 static Acc Add(Acc acc, Reg value)
+		{ return _mm256_add_epi64(acc, value); }
+	SYNCTL_TARGET_AVX2 static Acc Combine(Acc a, Acc b)
+		{ return _mm256_add_epi64(a, b); }
+	SYNCTL_TARGET_AVX2 static SumType Reduce(Acc acc)
+	{
+		SumType lanes[4];
+		_mm256_storeu_si256((__m256i*)lanes, acc);
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+};
+
+struct Avx2FloatOps
+{
+	typedef float Value;
+	typedef double SumType;
+	typedef __m256 Reg;
+	typedef __m256d Acc;
+	enum { LANES = 8 };
+	SYNCTL_TARGET_AVX2 static Reg Load(const Value* data)
+		{ return _mm256_loadu_ps(data); }
+	SYNCTL_TARGET_AVX2 static Reg Set(Value value)
+		{ return _mm256_set1_ps(value); }
+	SYNCTL_TARGET_AVX2 static unsigned int EqualMask(Reg a, Reg b)
+		{ return (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)); }
+	SYNCTL_TARGET_AVX2 static Reg Min(Reg a, Reg b)
+		{ return _mm256_min_ps(a, b); }
+	SYNCTL_TARGET_AVX2 static Reg Max(Reg a, Reg b)
+		{ return _mm256_max_ps(a, b); }
+	SYNCTL_TARGET_AVX2 static void Store(Value* out, Reg value)
+		{ _mm256_storeu_ps(out, value); }
+	SYNCTL_TARGET_AVX2 static Acc ZeroAcc()
+		{ return _mm256_setzero_pd(); }
+	SYNCTL_TARGET_AVX2 static Acc Add(Acc acc, Reg value)
+	{
+		return _mm256_add_pd(acc, _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(value)),
+												_mm256_cvtps_pd(_mm256_extractf128_ps(value, 1))));
+	}
+	SYNCTL_TARGET_AVX2 static Acc Combine(Acc a, Acc b)
+		{ return _mm256_add_pd(a, b); }
+	SYNCTL_TARGET_AVX2 static SumType Reduce(Acc acc)
+	{
+		double lanes[4];
+		_mm256_storeu_pd(lanes, acc);
+		return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	}
+};
+
+struct Avx2DoubleOps
+{
+	typedef double Value;
+	typedef double SumType;
+	typedef __m256d Reg;
+	typedef __m256d Acc;
+	enum { LANES = 4 };
+	SYNCTL_TARGET_AVX2 static Reg Load(const Value* data)
+		{ return _mm256_loadu_pd(data); }
+	SYNCTL_TARGET_AVX2 static Reg Set(Value value)
+		{ return _mm256_set1_pd(value); }
+	SYNCTL_TARGET_AVX2 static unsigned int EqualMask(Reg a, Reg b)
+		{ return (unsigned int)_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)); }
+	SYNCTL_TARGET_AVX2 static Reg Min(Reg a, Reg b)
+		{ return _mm256_min_pd(a, b); }
+	SYNCTL_TARGET_AVX2 static Reg Max(Reg a, Reg b)
+		{ return _mm256_max_pd(a, b); }
+	SYNCTL_TARGET_AVX2 static void Store(Value* out, Reg value)
+		{ _mm256_storeu_pd(out, value); }
+	SYNCTL_TARGET_AVX2 static Acc ZeroAcc()
+		{ return _mm256_setzero_pd(); }
+	SYNCTL_TARGET_AVX2 static Acc Add(Acc acc, Reg value)
+		{ return _mm256_add_pd(acc, value); }
+	SYNCTL_TARGET_AVX2 static Acc Combine(Acc a, Acc b)
+		{ return _mm256_add_pd(a, b); }
+	SYNCTL_TARGET_AVX2 static SumType Reduce(Acc acc)
+	{
+		double lanes[4];
+		_mm256_storeu_pd(lanes, acc);
+		return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	}
+};
+
+//the same kernels as above, compiled for AVX2. a function without AVX2 cannot call AVX2 lane operations,
+//so they are separate functions and not instances of the same templates.
+template <class Ops>
+SYNCTL_TARGET_AVX2 static unsigned int Avx2FindKernel(const typename Ops::Value* data, unsigned int count,
+													   typename Ops::Value value)
+{
+	typename Ops::Reg pattern = Ops::Set(value);
+	unsigned int index = 0;
+	for (; index + 4 * Ops::LANES <= count; index += 4 * Ops::LANES)
+	{
+		unsigned int mask = Ops::EqualMask(Ops::Load(data + index), pattern) |
+							(Ops::EqualMask(Ops::Load(data + index + Ops::LANES), pattern) << Ops::LANES) |
+							(Ops::EqualMask(Ops::Load(data + index + 2 * Ops::LANES), pattern) << (2 * Ops::LANES)) |
+							(Ops::EqualMask(Ops::Load(data + index + 3 * Ops::LANES), pattern) << (3 * Ops::LANES));
+		if (mask != 0)
+		{
+			return index + CountTrailingZeros(mask);
+		}
+	}
+	for (; index + Ops::LANES <= count; index += Ops::LANES)
+	{
+		unsigned int mask = Ops::EqualMask(Ops::Load(data + index), pattern);
+		if (mask != 0)
+		{
+			return index + CountTrailingZeros(mask);
+		}
+	}
+	while ((index < count) && ((data[index] == value) == false))
+	{
+		++index;
+	}
+	return index;
+}
+
+template <class Ops>
+SYNCTL_TARGET_AVX2 static unsigned int Avx2CountKernel(const typename Ops::Value* data, unsigned int count,
+														typename Ops::Value value)
+{
+	typename Ops::Reg pattern = Ops::Set(value);
+	unsigned int ret_val = 0;
+	unsigned int index = 0;
+	for (; index + Ops::LANES <= count; index += Ops::LANES)
+	{
+		ret_val += CountSetBits(Ops::EqualMask(Ops::Load(data + index), pattern));
+	}
+	for (; index < count; ++index)
+	{
+		if (data[index] == value)
+		{
+			++ret_val;
+		}
+	}
+	return ret_val;
+}
+
+template <class Ops>
+SYNCTL_TARGET_AVX2 static bool Avx2MinMaxKernel(const typename Ops::Value* data, unsigned int count,
+												 typename Ops::Value* out_min, typename Ops::Value* out_max)
+{
+	typedef typename Ops::Value Value;
+	if (count == 0)
+	{
+		return false;
+	}
+	Value min_value = data[0];
+	Value max_value = data[0];
+	unsigned int index = 0;
+	if (count >= Ops::LANES)
+	{
+		typename Ops::Reg min_reg = Ops::Load(data);
+		typename Ops::Reg max_reg = min_reg;
+		for (index = Ops::LANES; index + Ops::LANES <= count; index += Ops::LANES)
+		{
+			typename Ops::Reg values = Ops::Load(data + index);
+			min_reg = Ops::Min(min_reg, values);
+			max_reg = Ops::Max(max_reg, values);
+		}
+		Value lanes[Ops::LANES];
+		Ops::Store(lanes, min_reg);
+		for (unsigned int lane = 0; lane < Ops::LANES; ++lane)
+		{
+			min_value = (lanes[lane] < min_value) ? lanes[lane] : min_value;
+		}
+		Ops::Store(lanes, max_reg);
+		for (unsigned int lane = 0; lane < Ops::LANES; ++lane)
+		{
+			max_value = (max_value < lanes[lane]) ? lanes[lane] : max_value;
+		}
+	}
+	for (; index < count; ++index)
+	{
+		min_value = (data[index] < min_value) ? data[index] : min_value;
+		max_value = (max_value < data[index]) ? data[index] : max_value;
+	}
+	*out_min = min_value;
+	*out_max = max_value;
+	return true;
+}
+
+template <class Ops>
+SYNCTL_TARGET_AVX2 static typename Ops::SumType Avx2SumKernel(const typename Ops::Value* data, unsigned int count)
+{
+	typename Ops::Acc first = Ops::ZeroAcc();
+	typename Ops::Acc second = Ops::ZeroAcc();
+	unsigned int index = 0;
+	for (; index + 2 * Ops::LANES <= count; index += 2 * Ops::LANES)
+	{
+		first = Ops::Add(first, Ops::Load(data + index));
+		second = Ops::Add(second, Ops::Load(data + index + Ops::LANES));
+	}
+	typename Ops::SumType ret_val = Ops::Reduce(Ops::Combine(first, second));
+	for (; index < count; ++index)
+	{
+		ret_val += data[index];
+	}
+	return ret_val;
+}
+#endif //SYNCTL_AVX2_KERNELS
+
+//picks AVX2 kernels if the cpu has AVX2, BaseOps ones otherwise
+template <class BaseOps, class Avx2Ops>
+struct KernelDispatch
+{
+	typedef typename BaseOps::Value Value;
+	typedef typename BaseOps::SumType SumType;
+	static bool HasAvx2()
+		{ return ((GetCpuFeatures() & CPU_FEATURE_AVX2) != 0); }
+	static unsigned int Find(const Value* data, unsigned int count, Value value)
+	{
+#ifdef SYNCTL_AVX2_KERNELS
+		if (HasAvx2())
+		{
+			return Avx2FindKernel<Avx2Ops>(data, count, value);
+		}
+#endif //SYNCTL_AVX2_KERNELS
+		return FindKernel<BaseOps>(data, count, value);
+	}
+	static unsigned int Count(const Value* data, unsigned int count, Value value)
+	{
+#ifdef SYNCTL_AVX2_KERNELS
+		if (HasAvx2())
+		{
+			return Avx2CountKernel<Avx2Ops>(data, count, value);
+		}
+#endif //SYNCTL_AVX2_KERNELS
+		return CountKernel<BaseOps>(data, count, value);
+	}
+	static bool MinMax(const Value* data, unsigned int count, Value* out_min, Value* out_max)
+	{
+#ifdef SYNCTL_AVX2_KERNELS
+		if (HasAvx2())
+		{
+			return Avx2MinMaxKernel<Avx2Ops>(data, count, out_min, out_max);
+		}
+#endif //SYNCTL_AVX2_KERNELS
+		return MinMaxKernel<BaseOps>(data, count, out_min, out_max);
+	}
+	static SumType Sum(const Value* data, unsigned int count)
+	{
+#ifdef SYNCTL_AVX2_KERNELS
+		if (HasAvx2())
+		{
+			return Avx2SumKernel<Avx2Ops>(data, count);
+		}
+#endif //SYNCTL_AVX2_KERNELS
+		return SumKernel<BaseOps>(data, count);
+	}
+};
+
+#ifdef SYNCTL_AVX2_KERNELS
+typedef KernelDispatch<Sse2Int32Ops<int, true>, Avx2Int32Ops<int, true> > IntKernels;
+typedef KernelDispatch<Sse2Int32Ops<unsigned int, false>, Avx2Int32Ops<unsigned int, false> > UIntKernels;
+typedef KernelDispatch<Sse2Int64Ops<long long, true>, Avx2Int64Ops<long long, true> > Int64Kernels;
+typedef KernelDispatch<Sse2Int64Ops<unsigned long long, false>,
+					   Avx2Int64Ops<unsigned long long, false> > UInt64Kernels;
+typedef KernelDispatch<Sse2FloatOps, Avx2FloatOps> FloatKernels;
+typedef KernelDispatch<Sse2DoubleOps, Avx2DoubleOps> DoubleKernels;
+#else
+typedef KernelDispatch<ScalarOps<int, long long>, void> IntKernels;
+typedef KernelDispatch<ScalarOps<unsigned int, unsigned long long>, void> UIntKernels;
+typedef KernelDispatch<ScalarOps<long long, long long>, void> Int64Kernels;
+typedef KernelDispatch<ScalarOps<unsigned long long, unsigned long long>, void> UInt64Kernels;
+typedef KernelDispatch<ScalarOps<float, double>, void> FloatKernels;
+typedef KernelDispatch<ScalarOps<double, double>, void> DoubleKernels;
+#endif //SYNCTL_AVX2_KERNELS
+
+unsigned int SyncTL::FindValue(const int* data, unsigned int count, int value)
+{
+	return IntKernels::Find(data, count, value);
+}
+
+unsigned int SyncTL::FindValue(const unsigned int* data, unsigned int count, unsigned int value)
+{
+	return UIntKernels::Find(data, count, value);
+}
+
+unsigned int SyncTL::FindValue(const long long* data, unsigned int count, long long value)
+{
+	return Int64Kernels::Find(data, count, value);
+}
+
+unsigned int SyncTL::FindValue(const unsigned long long* data, unsigned int count, unsigned long long value)
+{
+	return UInt64Kernels::Find(data, count, value);
+}
+
+unsigned int SyncTL::FindValue(const float* data, unsigned int count, float value)
+{
+	return FloatKernels::Find(data, count, value);
+}
+
+unsigned int SyncTL::FindValue(const double* data, unsigned int count, double value)
+{
+	return DoubleKernels::Find(data, count, value);
+}
+
+unsigned int SyncTL::CountValue(const int* data, unsigned int count, int value)
+{
+	return IntKernels::Count(data, count, value);
+}
+
+unsigned int SyncTL::CountValue(const unsigned int* data, unsigned int count, unsigned int value)
+{
+	return UIntKernels::Count(data, count, value);
+}
+
+unsigned int SyncTL::CountValue(const long long* data, unsigned int count, long long value)
+{
+	return Int64Kernels::Count(data, count, value);
+}
+
+unsigned int SyncTL::CountValue(const unsigned long long* data, unsigned int count, unsigned long long value)
+{
+	return UInt64Kernels::Count(data, count, value);
+}
+
+unsigned int SyncTL::CountValue(const float* data, unsigned int count, float value)
+{
+	return FloatKernels::Count(data, count, value);
+}
+
+unsigned int SyncTL::CountValue(const double* data, unsigned int count, double value)
+{
+	return DoubleKernels::Count(data, count, value);
+}
+
+bool SyncTL::FindMinMax(const int* data, unsigned int count, int* out_min, int* out_max)
+{
+	return IntKernels::MinMax(data, count, out_min, out_max);
+}
+
+bool SyncTL::FindMinMax(const unsigned int* data, unsigned int count, unsigned int* out_min, unsigned int* out_max)
+{
+	return UIntKernels::MinMax(data, count, out_min, out_max);
+}
+
+bool SyncTL::FindMinMax(const long long* data, unsigned int count, long long* out_min, long long* out_max)
+{
+	return Int64Kernels::MinMax(data, count, out_min, out_max);
+}
+
+bool SyncTL::FindMinMax(const unsigned long long* data, unsigned int count, unsigned long long* out_min,
+						unsigned long long* out_max)
+{
+	return UInt64Kernels::MinMax(data, count, out_min, out_max);
+}
+
+bool SyncTL::FindMinMax(const float* data, unsigned int count, float* out_min, float* out_max)
+{
+	return FloatKernels::MinMax(data, count, out_min, out_max);
+}
+
+bool SyncTL::FindMinMax(const double* data, unsigned int count, double* out_min, double* out_max)
+{
+	return DoubleKernels::MinMax(data, count, out_min, out_max);
+}
+
+long long SyncTL::SumValues(const int* data, unsigned int count)
+{
+	return IntKernels::Sum(data, count);
+}
+
+unsigned long long SyncTL::SumValues(const unsigned int* data, unsigned int count)
+{
+	return UIntKernels::Sum(data, count);
+}
+
+long long SyncTL::SumValues(const long long* data, unsigned int count)
+{
+	return Int64Kernels::Sum(data, count);
+}
+
+unsigned long long SyncTL::SumValues(const unsigned long long* data, unsigned int count)
+{
+	return UInt64Kernels::Sum(data, count);
+}
+
+double SyncTL::SumValues(const float* data, unsigned int count)
+{
+	return FloatKernels::Sum(data, count);
+}
+
+double SyncTL::SumValues(const double* data, unsigned int count)
+{
+	return DoubleKernels::Sum(data, count);
+}
+
+enum RadixKeyKind
+{
+	RADIX_KEY_UNSIGNED,
+	RADIX_KEY_SIGNED,
+	RADIX_KEY_FLOAT
+};
+
+//keys are turned into unsigned numbers of the same order, sorted by bytes from the lowest one and turned back
+template <class BitsType>
+static void RadixSortKeys(BitsType* data, unsigned int count, RadixKeyKind kind)
+{
+	const BitsType sign = (BitsType)1 << (sizeof(BitsType) * 8 - 1);
+	BitsType* buffer = (BitsType*)BasicVector::GetDefaultAllocator()->AllocateDataArray(sizeof(BitsType), count);
+	if (buffer == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate buffer for radix sort",
+			EXC_HERE);
+	}
+	//counts of each byte value for all bytes are taken in one pass
+	unsigned int counts[sizeof(BitsType)][0x100];
+	memset(counts, 0, sizeof(counts));
+	for (unsigned int index = 0; index < count; ++index)
+	{
+		BitsType key = data[index];
+		if (kind == RADIX_KEY_SIGNED)
+		{
+			key ^= sign;
+		} else if (kind == RADIX_KEY_FLOAT)
+		{
+			//negative numbers are in the reverse order of their bits
+			key = ((key & sign) != 0) ? (BitsType)~key : (BitsType)(key | sign);
+		}
+		data[index] = key;
+		for (unsigned int digit = 0; digit < sizeof(BitsType); ++digit)
+		{
+			++counts[digit][(key >> (digit * 8)) & 0xFF];
+		}
+	}
+	BitsType* src = data;
+	BitsType* dst = buffer;
+	for (unsigned int digit = 0; digit < sizeof(BitsType); ++digit)
+	{
+		unsigned int* digit_counts = counts[digit];
+		unsigned int shift = digit * 8;
+		if (digit_counts[(src[0] >> shift) & 0xFF] == count)
+		{
+			continue;	//all keys have the same byte here
+		}
+		unsigned int offset = 0;
+		for (unsigned int value = 0; value < 0x100; ++value)
+		{
+			unsigned int value_count = digit_counts[value];
+			digit_counts[value] = offset;
+			offset += value_count;
+		}
+		for (unsigned int index = 0; index < count; ++index)
+		{
+			BitsType key = src[index];
+			dst[digit_counts[(key >> shift) & 0xFF]++] = key;
+		}
+		std::swap(src, dst);
+	}
+	for (unsigned int index = 0; index < count; ++index)
+	{
+		BitsType key = src[index];
+		if (kind == RADIX_KEY_SIGNED)
+		{
+			key ^= sign;
+		} else if (kind == RADIX_KEY_FLOAT)
+		{
+			key = ((key & sign) != 0) ? (BitsType)(key & ~sign) : (BitsType)~key;
+		}
+		data[index] = key;
+	}
+	BasicVector::GetDefaultAllocator()->FreeDataArray((char*)buffer);
+}
+
+void SyncTL::RadixSort(int* data, unsigned int count)
+{
+	RadixSortKeys((unsigned int*)data, count, RADIX_KEY_SIGNED);
+}
+
+void SyncTL::RadixSort(unsigned int* data, unsigned int count)
+{
+	RadixSortKeys(data, count, RADIX_KEY_UNSIGNED);
+}
+
+void SyncTL::RadixSort(long long* data, unsigned int count)
+{
+	RadixSortKeys((unsigned long long*)data, count, RADIX_KEY_SIGNED);
+}
+
+void SyncTL::RadixSort(unsigned long long* data, unsigned int count)
+{
+	RadixSortKeys(data, count, RADIX_KEY_UNSIGNED);
+}
+
+void SyncTL::RadixSort(float* data, unsigned int count)
+{
+	static_assert(sizeof(float) == sizeof(unsigned int), "float is sorted by it's bits");
+	RadixSortKeys((unsigned int*)data, count, RADIX_KEY_FLOAT);
+}
+
+void SyncTL::RadixSort(double* data, unsigned int count)
+{
+	static_assert(sizeof(double) == sizeof(unsigned long long), "double is sorted by it's bits");
+	RadixSortKeys((unsigned long long*)data, count, RADIX_KEY_FLOAT);
+}
+
+EpochManager::EpochManager():
+	m_epoch(0),
+	m_records(NULL)
+{
+}
+
+EpochManager::~EpochManager()
+{
+	FreeRetired();
+	Record* record = m_records.load(std::memory_order_acquire);
+	while (record != NULL)
+	{
+		Record* next = record->m_next;
+		delete record;
+		record = next;
+	}
+}
+
+void EpochManager::FreeRetired()
+{
+	for (Record* record = m_records.load(std::memory_order_acquire); record != NULL; record = record->m_next)
+	{
+		ASSERT(record->m_is_taken.load(std::memory_order_relaxed) == false);
+		for (unsigned int bag = 0; bag < BAG_COUNT; ++bag)
+		{
+			FreeBag(record, bag);
+		}
+	}
+}
+
+EpochManager::Record* EpochManager::TakeRecord()
+{
+	for (Record* record = m_records.load(std::memory_order_acquire); record != NULL; record = record->m_next)
+	{
+		bool expected = false;
+		if ((record->m_is_taken.load(std::memory_order_relaxed) == false) &&
+			record->m_is_taken.compare_exchange_strong(expected, true, std::memory_order_acquire,
+													   std::memory_order_relaxed))
+		{
+			return record;
+		}
+	}
+	//all records are taken, there is one more thread in guards than ever before
+	Record* record = new Record();
+	record->m_state.store(0, std::memory_order_relaxed);
+	record->m_is_taken.store(true, std::memory_order_relaxed);
+	for (unsigned int bag = 0; bag < BAG_COUNT; ++bag)
+	{
+		record->m_bags[bag] = NULL;
+		record->m_bag_epochs[bag] = 0;
+	}
+	record->m_retired_count = 0;
+	Record* head = m_records.load(std::memory_order_relaxed);
+	do
+	{
+		record->m_next = head;
+	} while (m_records.compare_exchange_weak(head, record, std::memory_order_release,
+											 std::memory_order_relaxed) == false);
+	return record;
+}
+
+void EpochManager::Enter(Record* record)
+{
+	//the state is published before the epoch is checked again, so TryAdvance either sees this thread
+	//or this thread sees the new epoch
+	unsigned long long epoch = m_epoch.load(std::memory_order_relaxed);
+	while (true)
+	{
+		record->m_state.store((epoch << 1) | 1, std::memory_order_seq_cst);
+		unsigned long long current = m_epoch.load(std::memory_order_seq_cst);
+		if (current == epoch)
+		{
+			break;
+		}
+		epoch = current;
+	}
+}
+
+void EpochManager::TryAdvance()
+{
+	unsigned long long epoch = m_epoch.load(std::memory_order_seq_cst);
+	for (Record* record = m_records.load(std::memory_order_acquire); record != NULL; record = record->m_next)
+	{
+		unsigned long long state = record->m_state.load(std::memory_order_seq_cst);
+		if (((state & 1) != 0) && ((state >> 1) != epoch))
+		{
+			return;	//a thread is still in the previous epoch
+		}
+	}
+	m_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+}
+
+void EpochManager::Collect(Record* record)
+{
+	unsigned long long epoch = m_epoch.load(std::memory_order_acquire);
+	for (unsigned int bag = 0; bag < BAG_COUNT; ++bag)
+	{
+		if ((record->m_bags[bag] != NULL) && (record->m_bag_epochs[bag] + 2 <= epoch))
+		{
+			FreeBag(record, bag);
+		}
+	}
+}
+
+void EpochManager::FreeBag(Record* record, unsigned int bag)
+{
+	RetiredNode* node = record->m_bags[bag];
+	record->m_bags[bag] = NULL;
+	while (node != NULL)
+	{
+		RetiredNode* next = node->m_next_retired;
+		node->m_free(node, node->m_context);
+		node = next;
+	}
+}
+
+EpochManager::Guard::Guard(EpochManager* manager):
+	m_manager(manager),
+	m_record(manager->TakeRecord())
+{
+	m_manager->Enter(m_record);
+	m_manager->Collect(m_record);
+}
+
+EpochManager::Guard::~Guard()
+{
+	m_record->m_state.store(0, std::memory_order_release);
+	m_record->m_is_taken.store(false, std::memory_order_release);
+}
+
+void EpochManager::Guard::Retire(RetiredNode* node, void (*free_function)(RetiredNode* node, void* context),
+								 void* context)
+{
+	node->m_free = free_function;
+	node->m_context = context;
+	//the node is labeled with the global epoch and not with the one of this guard: a guard that came after
+	//the guard of this thread may have seen the node before it was unlinked.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	unsigned long long epoch = m_manager->m_epoch.load(std::memory_order_seq_cst);
+	unsigned int bag = (unsigned int)(epoch % BAG_COUNT);
+	if (m_record->m_bag_epochs[bag] != epoch)
+	{	//what is there is at least three epochs old
+		FreeBag(m_record, bag);
+		m_record->m_bag_epochs[bag] = epoch;
+	}
+	node->m_next_retired = m_record->m_bags[bag];
+	m_record->m_bags[bag] = node;
+	if (++m_record->m_retired_count >= ADVANCE_PERIOD)
+	{
+		m_record->m_retired_count = 0;
+		m_manager->TryAdvance();
+		m_manager->Collect(m_record);
+	}
+}
+
+BasicSkipList::BasicSkipList(unsigned int key_size,
+							 unsigned int key_alignment,
+							 unsigned int value_size,
+							 unsigned int value_alignment,
+							 BasicVector::Allocator* allocator):
+	m_allocator(allocator),
+	m_head(NULL),
+	m_count(0),
+	m_height_seed(0)
+{
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot create skip list without allocator",
+			EXC_HERE);
+	}
+	m_key_offset = AlignOffset(sizeof(Node), key_alignment);
+	m_value_offset = AlignOffset(m_key_offset + key_size, value_alignment);
+	m_links_offset = AlignOffset(m_value_offset + value_size, sizeof(Link));
+	m_head = AllocateNode(MAX_HEIGHT);
+	m_height_seed.store((unsigned int)(size_t)this, std::memory_order_relaxed);
+}
+
+BasicSkipList::~BasicSkipList()
+{
+	ASSERT(GetNode(GetLinks(m_head)[0].load(std::memory_order_relaxed)) == NULL);
+	m_allocator->FreeDataArray((char*)m_head);
+}
+
+void BasicSkipList::Clear()
+{
+	//no one uses the map, so all removed nodes are unlinked already and are in m_epochs
+	Node* node = GetNode(GetLinks(m_head)[0].load(std::memory_order_acquire));
+	while (node != NULL)
+	{
+		Node* next = GetNode(GetLinks(node)[0].load(std::memory_order_relaxed));
+		DestroyNode(node);
+		node = next;
+	}
+	for (unsigned int level = 0; level < MAX_HEIGHT; ++level)
+	{
+		GetLinks(m_head)[level].store(0, std::memory_order_relaxed);
+	}
+	m_count.store(0, std::memory_order_relaxed);
+	m_epochs.FreeRetired();
+}
+
+bool BasicSkipList::MarkLinks(Node* node)
+{
+	Link* links = GetLinks(node);
+	for (unsigned int level = node->m_height - 1; level > 0; --level)
+	{
+		links[level].fetch_or(1, std::memory_order_acq_rel);
+	}
+	return (IsMarked(links[0].fetch_or(1, std::memory_order_acq_rel)) == false);
+}
+
+BasicSkipList::Node* BasicSkipList::GetNextAlive(const Node* node) const
+{
+	Node* next = GetNode(GetLinks(node)[0].load(std::memory_order_acquire));
+	while (next != NULL)
+	{
+		uintptr_t link = GetLinks(next)[0].load(std::memory_order_acquire);
+		if (IsMarked(link) == false)
+		{
+			break;
+		}
+		next = GetNode(link);
+	}
+	return next;
+}
+
+BasicSkipList::Node* BasicSkipList::AllocateNode(unsigned int height)
+{
+	ASSERT(((height > 0) && (height <= MAX_HEIGHT)));
+	char* memory = m_allocator->AllocateDataArray(m_links_offset + height * sizeof(Link), 1);
+	if (memory == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate skip list node",
+			EXC_HERE);
+	}
+	Node* node = new (memory) Node();
+	node->m_next_retired = NULL;
+	node->m_free = NULL;
+	node->m_context = NULL;
+	node->m_owners.store(2, std::memory_order_relaxed);
+	node->m_height = height;
+	Link* links = GetLinks(node);
+	for (unsigned int level = 0; level < height; ++level)
+	{
+		new (&links[level]) Link(0);
+	}
+	return node;
+}
+
+BasicSkipList::Node* BasicSkipList::CreateNode(unsigned int height, const char* key, const char* value)
+{
+	Node* node = AllocateNode(height);
+	try
+	{
+		ConstructEntry(GetKey(node), GetValue(node), key, value);
+	}
+	catch (...)
+	{
+		m_allocator->FreeDataArray((char*)node);
+		throw;
+	}
+	return node;
+}
+
+void BasicSkipList::DestroyNode(Node* node)
+{
+	DestroyEntry(GetKey(node), GetValue(node));
+	m_allocator->FreeDataArray((char*)node);
+}
+
+void BasicSkipList::FreeRetiredNode(EpochManager::RetiredNode* node, void* context)
+{
+	((BasicSkipList*)context)->DestroyNode(static_cast<Node*>(node));
+}
+
+void BasicSkipList::ReleaseOwner(Node* node, EpochManager::Guard* guard)
+{
+	if (node->m_owners.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		guard->Retire(node, FreeRetiredNode, this);
+	}
+}
+
+unsigned int BasicSkipList::GetRandomHeight()
+{
+	//every bit is a coin, so a node gets one level more with probability 1/2
+	unsigned int bits = (unsigned int)MixHash(m_height_seed.fetch_add(1, std::memory_order_relaxed));
+	return CountTrailingZeros(bits | (1u << (MAX_HEIGHT - 1))) + 1;
+}
+
+unsigned int SyncTL::GetThreadRandom()
+{
+	static thread_local unsigned long long state = 0;
+	if (state == 0)
+	{	//threads start from different places
+		state = MixHash((unsigned long long)(size_t)&state) | 1;
+	}
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return (unsigned int)(state >> 32);
+}
+
+#ifdef SYNCTL_AVX2_KERNELS
+//Mula's popcount: nibbles are counted by a table lookup in a register, bytes are summed by psadbw.
+SYNCTL_TARGET_AVX2 static unsigned int Avx2CountBits(const unsigned long long* words, unsigned int count)
+{
+	const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+											0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0F);
+	__m256i acc = _mm256_setzero_si256();
+	unsigned int index = 0;
+	for (; index + 4 <= count; index += 4)
+	{
+		__m256i value = _mm256_loadu_si256((const __m256i*)(words + index));
+		__m256i low = _mm256_and_si256(value, low_mask);
+		__m256i high = _mm256_and_si256(_mm256_srli_epi16(value, 4), low_mask);
+		__m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+	}
+	unsigned long long sums[4];
+	_mm256_storeu_si256((__m256i*)sums, acc);
+	unsigned long long ret_val = sums[0] + sums[1] + sums[2] + sums[3];
+	for (; index < count; ++index)
+	{
+		ret_val += CountSetBits64(words[index]);
+	}
+	return (unsigned int)ret_val;
+}
+
+//index of the first word that is not 0 after xor with flip, or count
+SYNCTL_TARGET_AVX2 static unsigned int Avx2FindWord(const unsigned long long* words, unsigned int count,
+													  unsigned long long flip)
+{
+	const __m256i flip_mask = _mm256_set1_epi64x((long long)flip);
+	unsigned int index = 0;
+	for (; index + 4 <= count; index += 4)
+	{
+		__m256i value = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(words + index)), flip_mask);
+		if (_mm256_testz_si256(value, value) == 0)
+		{
+			break;
+		}
+	}
+	for (; index < count; ++index)
+	{
+		if ((words[index] ^ flip) != 0)
+		{
+			break;
+		}
+	}
+	return index;
+}
+#endif //SYNCTL_AVX2_KERNELS
+
+#ifdef SYNCTL_POPCNT_KERNELS
+#if (defined __GNUC__) || (defined __clang__)
+__attribute__((target("popcnt")))
+#endif //__GNUC__
+static unsigned int PopcntCountBits(const unsigned long long* words, unsigned int count)
+{
+	unsigned long long ret_val = 0;
+	for (unsigned int index = 0; index < count; ++index)
+	{
+#ifdef _MSC_VER
+		ret_val += __popcnt((unsigned int)words[index]) + __popcnt((unsigned int)(words[index] >> 32));
+#else
+		ret_val += (unsigned long long)__builtin_popcountll(words[index]);
+#endif //_MSC_VER
+	}
+	return (unsigned int)ret_val;
+}
+#endif //SYNCTL_POPCNT_KERNELS
+
+static unsigned int CountBits(const unsigned long long* words, unsigned int count)
+{
+#ifdef SYNCTL_AVX2_KERNELS
+	if ((GetCpuFeatures() & CPU_FEATURE_AVX2) != 0)
+	{
+		return Avx2CountBits(words, count);
+	}
+#endif //SYNCTL_AVX2_KERNELS
+#ifdef SYNCTL_POPCNT_KERNELS
+	if ((GetCpuFeatures() & CPU_FEATURE_POPCNT) != 0)
+	{
+		return PopcntCountBits(words, count);
+	}
+#endif //SYNCTL_POPCNT_KERNELS
+	unsigned int ret_val = 0;
+	for (unsigned int index = 0; index < count; ++index)
+	{
+		ret_val += CountSetBits64(words[index]);
+	}
+	return ret_val;
+}
+
+static unsigned int FindWord(const unsigned long long* words, unsigned int from, unsigned int count,
+							 unsigned long long flip)
+{
+#ifdef SYNCTL_AVX2_KERNELS
+	if ((GetCpuFeatures() & CPU_FEATURE_AVX2) != 0)
+	{
+		return from + Avx2FindWord(words + from, count - from, flip);
+	}
+#endif //SYNCTL_AVX2_KERNELS
+	while ((from < count) && ((words[from] ^ flip) == 0))
+	{
+		++from;
+	}
+	return from;
+}
+
+Bitset::Bitset(unsigned int size, BasicVector::Allocator* allocator):
+	m_words(NULL),
+	m_size(0),
+	m_capacity(0),
+	m_allocator(allocator)
+{
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot create bitset without allocator",
+			EXC_HERE);
+	}
+	Resize(size);
+}
+
+Bitset::Bitset(Word* words, unsigned int size):
+	m_words(words),
+	m_size(size),
+	m_capacity(GetWordCount(size)),
+	m_allocator(NULL)
+{
+	ASSERT(((words != NULL) || (size == 0)));
+	ResetAll();
+}
+
+Bitset::Bitset(const Bitset& another):
+	m_words(NULL),
+	m_size(0),
+	m_capacity(0),
+	m_allocator((another.m_allocator != NULL) ? another.m_allocator : BasicVector::GetDefaultAllocator())
+{
+	*this = another;
+}
+
+Bitset::~Bitset()
+{
+	if ((m_words != NULL) && (m_allocator != NULL))
+	{
+		m_allocator->FreeDataArray((char*)m_words);
+	}
+}
+
+Bitset& Bitset::operator = (const Bitset& another)
+{
+	if (this != &another)
+	{
+		unsigned int word_count = GetWordCount(another.m_size);
+		if (word_count > m_capacity)
+		{
+			Reallocate(word_count);
+		}
+		if (word_count > 0)
+		{
+			memcpy(m_words, another.m_words, word_count * sizeof(Word));
+		}
+		m_size = another.m_size;
+	}
+	return *this;
+}
+
+void Bitset::Reallocate(unsigned int word_count)
+{
+	if (m_allocator == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+			L"Cannot grow bitset because it's words are not owned by it",
+			EXC_HERE);
+	}
+	Word* words = (Word*)m_allocator->AllocateDataArray(sizeof(Word), word_count);
+	if (words == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate bitset",
+			EXC_HERE);
+	}
+	unsigned int old_count = GetWordCount(m_size);
+	if (old_count > word_count)
+	{
+		old_count = word_count;
+	}
+	if (m_words != NULL)
+	{
+		memcpy(words, m_words, old_count * sizeof(Word));
+		m_allocator->FreeDataArray((char*)m_words);
+	}
+	m_words = words;
+	m_capacity = word_count;
+}
+
+void Bitset::Resize(unsigned int size)
+{
+	unsigned int old_count = GetWordCount(m_size);
+	unsigned int word_count = GetWordCount(size);
+	if (word_count > m_capacity)
+	{
+		unsigned int capacity = m_capacity * 2;
+		Reallocate((capacity > word_count) ? capacity : word_count);
+	}
+	if (word_count > old_count)
+	{
+		memset(m_words + old_count, 0, (word_count - old_count) * sizeof(Word));
+	}
+	m_size = size;
+	ClearTail();
+}
+
+void Bitset::ClearTail()
+{
+	if ((m_size % WORD_BITS) != 0)
+	{
+		m_words[m_size / WORD_BITS] &= ((Word)1 << (m_size % WORD_BITS)) - 1;
+	}
+}
+
+void Bitset::SetAll()
+{
+	unsigned int word_count = GetWordCount(m_size);
+	if (word_count > 0)
+	{
+		memset(m_words, 0xFF, word_count * sizeof(Word));
+	}
+	ClearTail();
+}
+
+void Bitset::ResetAll()
+{
+	unsigned int word_count = GetWordCount(m_size);
+	if (word_count > 0)
+	{
+		memset(m_words, 0, word_count * sizeof(Word));
+	}
+}
+
+void Bitset::FlipAll()
+{
+	unsigned int word_count = GetWordCount(m_size);
+	for (unsigned int index = 0; index < word_count; ++index)
+	{
+		m_words[index] = ~m_words[index];
+	}
+	ClearTail();
+}
+
+unsigned int Bitset::Count() const
+{
+	return CountBits(m_words, GetWordCount(m_size));
+}
+
+unsigned int Bitset::FindBit(unsigned int from, Word flip) const
+{
+	if (from >= m_size)
+	{
+		return NOT_FOUND;
+	}
+	unsigned int word_index = from / WORD_BITS;
+	Word word = (m_words[word_index] ^ flip) & (~(Word)0 << (from % WORD_BITS));
+	if (word == 0)
+	{
+		unsigned int word_count = GetWordCount(m_size);
+		word_index = FindWord(m_words, word_index + 1, word_count, flip);
+		if (word_index == word_count)
+		{
+			return NOT_FOUND;
+		}
+		word = m_words[word_index] ^ flip;
+	}
+	//clear bits past the size look set with flip
+	unsigned int ret_val = word_index * WORD_BITS + CountTrailingZeros64(word);
+	return ((ret_val < m_size) ? ret_val : (unsigned int)NOT_FOUND);
+}
+
+void Bitset::CheckSize(const Bitset& another) const
+{
+	if (m_size != another.m_size)
+	{
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Cannot combine bitsets of different sizes",
+			EXC_HERE);
+	}
+}
+
+Bitset& Bitset::operator &= (const Bitset& another)
+{
+	CheckSize(another);
+	unsigned int word_count = GetWordCount(m_size);
+	for (unsigned int index = 0; index < word_count; ++index)
+	{
+		m_words[index] &= another.m_words[index];
+	}
+	return *this;
+}
+
+Bitset& Bitset::operator |= (const Bitset& another)
+{
+	CheckSize(another);
+	unsigned int word_count = GetWordCount(m_size);
+	for (unsigned int index = 0; index < word_count; ++index)
+	{
+		m_words[index] |= another.m_words[index];
+	}
+	return *this;
+}
+
+Bitset& Bitset::operator ^= (const Bitset& another)
+{
+	CheckSize(another);
+	unsigned int word_count = GetWordCount(m_size);
+	for (unsigned int index = 0; index < word_count; ++index)
+	{
+		m_words[index] ^= another.m_words[index];
+	}
+	return *this;
+}
+
+Bitset& Bitset::AndNot(const Bitset& another)
+{
+	CheckSize(another);
+	unsigned int word_count = GetWordCount(m_size);
+	for (unsigned int index = 0; index < word_count; ++index)
+	{
+		m_words[index] &= ~another.m_words[index];
+	}
+	return *this;
+}
+
+bool Bitset::operator == (const Bitset& another) const
+{
+	if (m_size != another.m_size)
+	{
+		return false;
+	}
+	unsigned int word_count = GetWordCount(m_size);
+	return ((word_count == 0) || (memcmp(m_words, another.m_words, word_count * sizeof(Word)) == 0));
+}
+
+AtomicBitset::AtomicBitset(unsigned int size, BasicVector::Allocator* allocator):
+	m_words(NULL),
+	m_size(size),
+	m_allocator(allocator)
+{
+	if ((m_allocator == NULL) || (size == 0))
+	{
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Cannot create atomic bitset of zero size or without allocator",
+			EXC_HERE);
+	}
+	m_words = (std::atomic<Word>*)m_allocator->AllocateDataArray(sizeof(std::atomic<Word>), GetWordCount());
+	if (m_words == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate atomic bitset",
+			EXC_HERE);
+	}
+	for (unsigned int index = 0; index < GetWordCount(); ++index)
+	{
+		new (&m_words[index]) std::atomic<Word>(0);
+	}
+}
+
+AtomicBitset::~AtomicBitset()
+{
+	m_allocator->FreeDataArray((char*)m_words);
+}
+
+AtomicBitset::Word AtomicBitset::GetValidMask(unsigned int word_index) const
+{
+	if ((word_index + 1 < GetWordCount()) || ((m_size % WORD_BITS) == 0))
+	{
+		return ~(Word)0;
+	}
+	return ((Word)1 << (m_size % WORD_BITS)) - 1;
+}
+
+void AtomicBitset::ResetAll()
+{
+	for (unsigned int index = 0; index < GetWordCount(); ++index)
+	{
+		m_words[index].store(0, std::memory_order_release);
+	}
+}
+
+unsigned int AtomicBitset::Count() const
+{
+	unsigned int ret_val = 0;
+	for (unsigned int index = 0; index < GetWordCount(); ++index)
+	{
+		ret_val += CountSetBits64(m_words[index].load(std::memory_order_acquire));
+	}
+	return ret_val;
+}
+
+unsigned int AtomicBitset::FindBit(unsigned int from, Word flip) const
+{
+	unsigned int word_count = GetWordCount();
+	unsigned int word_index = from / WORD_BITS;
+	Word start_mask = ~(Word)0 << (from % WORD_BITS);
+	for (; (from < m_size) && (word_index < word_count); ++word_index)
+	{
+		Word word = (m_words[word_index].load(std::memory_order_acquire) ^ flip) & start_mask & GetValidMask(word_index);
+		if (word != 0)
+		{
+			return word_index * WORD_BITS + CountTrailingZeros64(word);
+		}
+		start_mask = ~(Word)0;
+	}
+	return NOT_FOUND;
+}
+
+unsigned int AtomicBitset::SetFirstClear(unsigned int hint)
+{
+	unsigned int word_count = GetWordCount();
+	unsigned int word_index = (hint < m_size) ? hint / WORD_BITS : 0;
+	for (unsigned int step = 0; step < word_count; ++step)
+	{
+		Word valid = GetValidMask(word_index);
+		Word word = m_words[word_index].load(std::memory_order_relaxed);
+		while ((~word & valid) != 0)
+		{
+			Word clear = ~word & valid;
+			Word bit = clear & (0 - clear);	//the lowest one
+			if (m_words[word_index].compare_exchange_weak(word, word | bit, std::memory_order_acq_rel,
+														  std::memory_order_relaxed))
+			{
+				return word_index * WORD_BITS + CountTrailingZeros64(bit);
+			}
+		}
+		if (++word_index == word_count)
+		{
+			word_index = 0;
+		}
+	}
+	return NOT_FOUND;
 }
\ No newline at end of file
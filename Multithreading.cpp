@@ -157,68 +157,35 @@ MainThread* SyncTL::MainThread::GetMainThread()
 unsigned int /*error code*/ SyncTL::MainThread::PostMessage(ThreadMessage* message)
 {
 	ASSERT(message != NULL);
-	/*if(m_messages.LockForWrite() == false)
-	{
-		throw Exception(THREADING_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
-			L"Cannot get lock for write to message queue of main thread",
-			EXC_HERE);
-	}*/
-	TemplateWriteSynchronizer<BasicList> sync(&m_messages);
-	m_messages.PushBack(message);
-	//m_messages.Unlock();
+	m_messages.Push(message);
 	return ERR_OK;
 }
 
 unsigned int /*error code*/ SyncTL::MainThread::ProcessMessages(unsigned int count)
 {
-	unsigned int ret_val = UNDEFINED_ERROR;
-	bool exit_flag = false;
-	while(exit_flag == false)
+	unsigned int ret_val = ERR_OK;
+	while(count != 0)
 	{
-		ThreadMessage* msg = NULL;
-		if(m_messages.LockForWrite() == false)
+		ListHook* e = m_messages.Pop();
+		if(e == NULL)
 		{
-			throw Exception(THREADING_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
-				L"Cannot get lock for write to messages list on main thread",
-				EXC_HERE);
+			break;
 		}
-		//TemplateWriteSynchronizer<BasicList> sync(&m_messages);
-		BasicList::Entry* e = m_messages.PopFront();
-		if(e != NULL)
+		//only ThreadMessage-s are posted to m_messages, see PostMessage
+		ThreadMessage* tm = static_cast<ThreadMessage*>(static_cast<ThreadEntry*>(e));
+		if(tm != NULL)
 		{
-			msg = dynamic_cast<ThreadMessage*>(e);
-			ASSERT(msg != NULL);	//posting to m_messages anything but ThreadMessage-s is an error.
-			unsigned int msg_count = m_messages.GetCount();
-			m_messages.Unlock();
-			ThreadMessage* tm = dynamic_cast<ThreadMessage*>(msg);
-			if(tm != NULL)
-			{
-				unsigned int msg_ret_val = OnMessage(tm);
-				if(msg_ret_val != ERR_OK)
-				{
-					exit_flag = true;
-					ret_val = msg_ret_val;
-				}
-			} else {
-				OutputDebugMsg(L"unrecognized type of message detected on main thread message queue\n");
-			}
-			--count;
-			if(count == 0)
+			unsigned int msg_ret_val = OnMessage(tm);
+			delete tm;
+			if(msg_ret_val != ERR_OK)
 			{
-				exit_flag = true;
-				ret_val = ERR_OK;
+				ret_val = msg_ret_val;
+				break;
 			}
-			if(msg_count == 0)
-			{
-				exit_flag = true;
-				ret_val = ERR_OK;
-			}
-			delete msg;
 		} else {
-			exit_flag = true;
-			ret_val = ERR_OK;
+			OutputDebugMsg(L"unrecognized type of message detected on main thread message queue\n");
 		}
-		m_messages.Unlock();
+		--count;
 	}
 	return ret_val;
 }
@@ -254,24 +221,16 @@ SyncTL::WorkerThread::WorkerThread(SyncTL::ThreadPriority priority):
 	m_exit_flag(false)
 {
 	m_worker_list.SetLock(&m_worker_list_lock);
-	m_message_list.SetLock(&m_message_list_lock);
 }
 
 SyncTL::WorkerThread::~WorkerThread()
 {
-	m_message_list.LockForWrite();
-	while(m_message_list.IsEmpty() == false)
+	ListHook* entry = m_message_queue.Pop();
+	while(entry != NULL)
 	{
-		MessageList::Entry* entry = m_message_list.PopFront();
-		ASSERT(entry != NULL);
-		delete entry;
+		delete static_cast<WorkerMessage*>(static_cast<IntrusiveListHook<>*>(entry));
+		entry = m_message_queue.Pop();
 	}
-	m_message_list.Unlock();
-	if(m_message_list_lock.TryLockForWrite() == false)
-	{
-		m_message_list.Unlock();
-	}
-	m_message_list.SetLock(NULL);	//because lock will be destroyed before m_message_list and m_message_list destuctor will fail
 	if(m_worker_list_lock.TryLockForWrite() == false)
 	{
 		m_worker_list.Unlock();
@@ -279,12 +238,25 @@ SyncTL::WorkerThread::~WorkerThread()
 	m_worker_list.SetLock(NULL);
 	Stop();
 	WaitForExit(INFINITE);
-	//worker deletion is up to those who added them here
+	//worker deletion is up to those who added them here, they are only unlinked
+	for(Worker* worker = m_worker_list.PopFront(); worker != NULL; worker = m_worker_list.PopFront())
+	{
+		worker->m_thread = NULL;
+	}
+}
+
+SyncTL::Worker::~Worker()
+{
+	ASSERT(m_at_work == false);
+	if(m_thread != NULL)
+	{
+		m_thread->RemoveWorker(this);
+	}
 }
 
 unsigned int /*error code*/ SyncTL::WorkerThread::Stop(unsigned int* platform_error)
 {
-	m_message_list_not_empty.SetEvent();
+	m_message_queue_not_empty.SetEvent();
 	return Thread::Stop(platform_error);
 }
 
@@ -298,7 +270,7 @@ unsigned int /*error code*/ SyncTL::WorkerThread::AddWorker(SyncTL::Worker* work
 	{
 		return THREADING_ERROR_CANNOT_GET_LOCK_FOR_WRITE;
 	}*/
-	TemplateWriteSynchronizer<BasicList> sync(&m_worker_list);
+	//the list locks itself
 	m_worker_list.PushFront(worker);
 	worker->m_thread = this;
 	//m_worker_list.Unlock();
@@ -309,7 +281,7 @@ unsigned int /*error code*/ SyncTL::WorkerThread::AddWorker(SyncTL::Worker* work
 unsigned int /*error code*/ SyncTL::WorkerThread::RemoveWorker(WorkerIterator it)
 {
 	ASSERT(it.IsValid());
-	Worker* worker = dynamic_cast<Worker*>(it.operator BasicList::Entry *());
+	Worker* worker = GetWorker(it);
 	ASSERT(worker->m_thread != NULL);
 	ASSERT(worker->m_at_work == false);
 	unsigned int ret_val = UNDEFINED_ERROR;
@@ -317,8 +289,7 @@ unsigned int /*error code*/ SyncTL::WorkerThread::RemoveWorker(WorkerIterator it
 	{
 		return THREADING_ERROR_CANNOT_GET_LOCK_FOR_WRITE;
 	}*/
-	TemplateWriteSynchronizer<BasicList> sync(&m_worker_list);
-	m_worker_list.Remove(it);
+	m_worker_list.Remove(worker);
 	worker->m_thread = NULL;
 	//m_worker_list.Unlock();
 	ret_val = ERR_OK;
@@ -335,7 +306,6 @@ unsigned int /*error code*/ SyncTL::WorkerThread::RemoveWorker(SyncTL::Worker* w
 	{
 		return THREADING_ERROR_CANNOT_GET_LOCK_FOR_WRITE;
 	}*/
-	TemplateWriteSynchronizer<BasicList> sync(&m_worker_list);
 	m_worker_list.Remove(worker);
 	worker->m_thread = NULL;
 	//m_worker_list.Unlock();
@@ -346,17 +316,12 @@ unsigned int /*error code*/ SyncTL::WorkerThread::RemoveWorker(SyncTL::Worker* w
 unsigned int /*error code*/ SyncTL::WorkerThread::PostMessageToWorker(SyncTL::WorkerMessage* wm)
 {
 	ASSERT(wm != NULL);
-	/*bool ok = m_message_list.LockForWrite();
-	if(false)
+	//worker thread clears the event before the last look at the queue, so it is enough
+	//to set the event only when the queue was empty.
+	if(m_message_queue.Push(wm))
 	{
-		throw Exception(THREADING_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
-			L"Cannot get lock for write to post to the main thread message list",
-			EXC_HERE);
-	}*/
-	TemplateWriteSynchronizer<BasicList> sync(&m_message_list);
-	m_message_list.PushBack(wm);
-	m_message_list_not_empty.SetEvent();
-	//m_message_list.Unlock();
+		m_message_queue_not_empty.SetEvent();
+	}
 	return ERR_OK;
 }
 
@@ -371,7 +336,7 @@ bool SyncTL::WorkerThread::IsWorkerAdded(SyncTL::Worker* worker, WorkerIterator*
 			L"Cannot get lock for read to find worker on worker thread",
 			EXC_HERE);
 	}*/
-	TemplateReadSynchronizer<MessageList> sync(&(nonconst_this->m_worker_list));
+	TemplateReadSynchronizer<WorkerList> sync(&(nonconst_this->m_worker_list));
 	for(WorkerIterator it = nonconst_this->m_worker_list.Begin(); it.IsValid(); ++ it)
 	{
 		Worker* w = GetWorker(it);
@@ -398,21 +363,17 @@ unsigned int /*error code*/ SyncTL::WorkerThread::ThreadProc()
 	{
 		//get message
 		WorkerMessage* wm = NULL;
-		bool ok = m_message_list_lock.LockForWrite();
-		bool locked = false;
-		if(ok == false)
+		ListHook* ble = m_message_queue.Pop();
+		if(ble == NULL)
 		{
-			Exception* exc = new Exception(THREADING_ERROR_CANNOT_GET_LOCK_FOR_WRITE,
-				L"Cannot get lock for write to worker thread message list",
-				EXC_HERE);
-			PostExceptionToMainThread(exc);
+			//clear the event before the last check, so a message posted right now sets it again.
+			m_message_queue_not_empty.ClearEvent();
+			ble = m_message_queue.Pop();
 		}
-		locked = true;
-		//wm = dynamic_cast<WorkerMessage*>(m_message_list.PopFront());
-		BasicList::Entry* ble = m_message_list.PopFront();
 		if(ble != NULL)
 		{
-			wm = dynamic_cast<WorkerMessage*>(ble);
+			//only WorkerMessage-s are posted here, see PostMessageToWorker
+			wm = static_cast<WorkerMessage*>(static_cast<IntrusiveListHook<>*>(ble));
 		}
 		if(wm != NULL)
 		{
@@ -424,8 +385,7 @@ unsigned int /*error code*/ SyncTL::WorkerThread::ThreadProc()
 			try
 			{
 				worker_ret_val = worker->InternalExecute(wm);
-				ExitMessage* em = dynamic_cast<ExitMessage*>(wm);
-				if(em != NULL)
+				if(wm->IsExit())
 				{
 					m_exit_flag = true;
 				}
@@ -472,20 +432,334 @@ unsigned int /*error code*/ SyncTL::WorkerThread::ThreadProc()
 		} else {
 			//sleep until messages will come.
 			wait_for_messages = true;
-			m_message_list_not_empty.ClearEvent();
-		}
-		if(locked)
-		{
-			m_message_list_lock.Unlock();
 		}
 		if(wait_for_messages)
 		{
-			m_message_list_not_empty.Wait(INFINITE);
+			m_message_queue_not_empty.Wait(INFINITE);
+			wait_for_messages = false;
 		}
 	}
 	return ret_val;
 }
 
+SyncTL::ParallelJob::ParallelJob(unsigned int task_count):
+	m_task_count(task_count),
+	m_next_task(0),
+	m_running_workers(0),
+	m_failed(false),
+	m_error(NULL)
+{}
+
+SyncTL::ParallelJob::~ParallelJob()
+{
+	if (m_error != NULL)
+	{
+		delete m_error;
+	}
+}
+
+void SyncTL::ParallelJob::Reset(unsigned int worker_count)
+{
+	if (m_error != NULL)
+	{
+		delete m_error;
+		m_error = NULL;
+	}
+	m_failed.store(false);
+	m_next_task.store(0);
+	m_running_workers.store(worker_count);
+	if (worker_count == 0)
+	{
+		m_done.SetEvent();
+	} else {
+		m_done.ClearEvent();
+	}
+}
+
+void SyncTL::ParallelJob::SetError(const Exception& exc)
+{
+	bool failed = false;
+	if (m_failed.compare_exchange_strong(failed, true))
+	{
+		//ThreadException keeps a copy of the message, the original one may be gone when Run throws it.
+		m_error = new ThreadException(exc);
+	}
+}
+
+void SyncTL::ParallelJob::RunTasks()
+{
+	while (m_failed.load(std::memory_order_relaxed) == false)
+	{
+		unsigned int index = m_next_task.fetch_add(1);
+		if (index >= m_task_count)
+		{
+			break;
+		}
+		try
+		{
+			RunTask(index);
+		} catch (Exception& exc)
+		{
+			SetError(exc);
+		}
+		catch (std::exception& exc)
+		{
+			wchar_t msg[0x7f];
+			memset(msg, 0, sizeof(msg));
+			mbstowcs(msg, exc.what(), (sizeof(msg) / sizeof(msg[0])) - 1);
+			SetError(Exception(UTILS_ERROR_STD_EXCEPTION,
+				msg,
+				EXC_HERE));
+		}
+		catch ( ... )
+		{
+			SetError(Exception(UNDEFINED_ERROR,
+				L"Unknown error in parallel task",
+				EXC_HERE));
+		}
+	}
+}
+
+void SyncTL::ParallelJob::OnWorkerDone()
+{
+	if (m_running_workers.fetch_sub(1) == 1)
+	{
+		m_done.SetEvent();
+	}
+}
+
+unsigned int /*error code*/ SyncTL::WorkerPool::JobWorker::Execute(SyncTL::WorkerMessage* wm)
+{
+	ASSERT(wm != NULL);
+	//a pool posts only JobMessage-s and ExitMessage-s to it's workers
+	if (wm->IsExit() == false)
+	{
+		JobMessage* jm = static_cast<JobMessage*>(wm);
+		jm->m_job->RunTasks();
+		//the job may be gone right after this call
+		jm->m_job->OnWorkerDone();
+	}
+	//ExitMessage is handled by the thread itself
+	return ERR_OK;
+}
+
+SyncTL::WorkerPool::WorkerPool(unsigned int thread_count, SyncTL::ThreadPriority priority):
+	m_thread_count(0),
+	m_threads(NULL),
+	m_workers(NULL)
+{
+	if (thread_count == 0)
+	{
+		thread_count = std::thread::hardware_concurrency();
+		if (thread_count > 0)
+		{
+			-- thread_count;	//the calling thread works too
+		}
+	}
+	m_threads = new WorkerThread*[thread_count];
+	m_workers = new JobWorker[thread_count];
+	try
+	{
+		for (; m_thread_count < thread_count; ++ m_thread_count)
+		{
+			WorkerThread* thread = new WorkerThread(priority);
+			thread->AddWorker(&m_workers[m_thread_count]);
+			unsigned int platform_error = 0;
+			if (thread->Run(&platform_error) != ERR_OK)
+			{
+				thread->RemoveWorker(&m_workers[m_thread_count]);
+				delete thread;
+				throw Exception(THREADING_ERROR_CANNOT_START_THREAD,
+					L"Cannot start worker pool thread",
+					EXC_HERE,
+					platform_error);
+			}
+			m_threads[m_thread_count] = thread;
+		}
+	} catch (...)
+	{
+		Destroy();
+		throw;
+	}
+}
+
+SyncTL::WorkerPool::~WorkerPool()
+{
+	Destroy();
+}
+
+void SyncTL::WorkerPool::Destroy()
+{
+	//threads leave their loop only after ExitMessage
+	for (unsigned int i = 0; i < m_thread_count; ++ i)
+	{
+		m_threads[i]->PostMessageToWorker(new ExitMessage(&m_workers[i], true));
+	}
+	for (unsigned int i = 0; i < m_thread_count; ++ i)
+	{
+		m_threads[i]->WaitForExit(INFINITE);
+		m_threads[i]->RemoveWorker(&m_workers[i]);
+		delete m_threads[i];
+	}
+	m_thread_count = 0;
+	delete [] m_threads;
+	m_threads = NULL;
+	delete [] m_workers;
+	m_workers = NULL;
+}
+
+void SyncTL::WorkerPool::Run(SyncTL::ParallelJob* job)
+{
+	ASSERT(job != NULL);
+	unsigned int task_count = job->GetTaskCount();
+	if (task_count == 0)
+	{
+		return;
+	}
+	WriteSynchronizer sync(&m_run_lock);
+	//the calling thread takes one task anyway, so there is no need to wake more threads than there are other tasks
+	unsigned int worker_count = m_thread_count;
+	if (worker_count > task_count - 1)
+	{
+		worker_count = task_count - 1;
+	}
+	job->Reset(worker_count);
+	for (unsigned int i = 0; i < worker_count; ++ i)
+	{
+		m_threads[i]->PostMessageToWorker(new JobMessage(&m_workers[i], job));
+	}
+	job->RunTasks();
+	job->m_done.Wait();
+	if (job->m_failed.load())
+	{
+		ASSERT(job->m_error != NULL);
+		throw ThreadException(*(job->m_error));
+	}
+}
+
+unsigned int SyncTL::SplitSubtree(BasicTree::Entry* root, unsigned int min_tasks, unsigned int max_depth,
+								  Vector<BasicTree::Entry*>* out_tasks)
+{
+	ASSERT(root != NULL);
+	ASSERT(out_tasks != NULL);
+	Vector<BasicTree::Entry*> next_level(0x20, BasicVector::GetDefaultAllocator(), NULL);
+	out_tasks->Clear();
+	out_tasks->PushBack(root);
+	unsigned int depth = 0;
+	while ((out_tasks->GetCount() < min_tasks) && (depth < max_depth))
+	{
+		//children of a level in the children order are the next level in the tree order
+		next_level.Clear();
+		for (unsigned int i = 0; i < out_tasks->GetCount(); ++ i)
+		{
+			for (BasicTree::Entry* child = (*out_tasks)[i]->GetFirstChild(); child != NULL; child = child->GetNextSibling())
+			{
+				next_level.PushBack(child);
+			}
+		}
+		if (next_level.GetCount() == 0)
+		{
+			break;
+		}
+		out_tasks->Clear();
+		for (unsigned int i = 0; i < next_level.GetCount(); ++ i)
+		{
+			out_tasks->PushBack(next_level[i]);
+		}
+		++ depth;
+	}
+	return depth;
+}
+
+void SyncTL::VisitSubtree(BasicTree::Entry* root, TreeVisitor* visitor, unsigned int depth_limit)
+{
+	ASSERT(root != NULL);
+	ASSERT(visitor != NULL);
+	//links are followed directly, the caller holds the tree lock
+	unsigned int depth = 0;
+	BasicTree::Entry* entry = root;
+	while (entry != NULL)
+	{
+		visitor->Visit(entry);
+		BasicTree::Entry* child = entry->GetFirstChild();
+		if ((child != NULL) && (depth < depth_limit))
+		{
+			entry = child;
+			++ depth;
+			continue;
+		}
+		//go up until there is a next sibling, but not above the root
+		while (entry != root)
+		{
+			BasicTree::Entry* sibling = entry->GetNextSibling();
+			if (sibling != NULL)
+			{
+				entry = sibling;
+				break;
+			}
+			entry = entry->GetParent();
+			-- depth;
+		}
+		if (entry == root)
+		{
+			entry = NULL;
+		}
+	}
+}
+
+namespace SyncTL
+{
+
+class TreeVisitJob: public ParallelJob
+{
+public:
+	TreeVisitJob(TreeVisitor* visitor, Vector<BasicTree::Entry*>* tasks):
+		ParallelJob(tasks->GetCount()),
+		m_visitor(visitor),
+		m_tasks(tasks)
+		{}
+protected:
+	void RunTask(unsigned int index)
+		{ VisitSubtree((*m_tasks)[index], m_visitor); }
+	TreeVisitor* m_visitor;
+	Vector<BasicTree::Entry*>* m_tasks;
+};
+
+} //end namespace SyncTL
+
+void SyncTL::ParallelForEach(WorkerPool* pool, BasicTree* tree, BasicTree::Entry* subtree_root, TreeVisitor* visitor,
+							 unsigned int cutoff_depth)
+{
+	ASSERT(pool != NULL);
+	ASSERT(tree != NULL);
+	ASSERT(visitor != NULL);
+	TemplateReadSynchronizer<BasicTree> sync(tree);
+	if (subtree_root == NULL)
+	{
+		subtree_root = tree->GetRoot();
+		if (subtree_root == NULL)
+		{
+			return;
+		}
+	}
+	Vector<BasicTree::Entry*> tasks(0x20, BasicVector::GetDefaultAllocator(), NULL);
+	unsigned int min_tasks = pool->GetConcurrency() * TREE_TASKS_PER_THREAD;
+	if (cutoff_depth != AUTO_CUTOFF_DEPTH)
+	{
+		min_tasks = UINT_MAX;
+	}
+	unsigned int depth = SplitSubtree(subtree_root, min_tasks, cutoff_depth, &tasks);
+	if (depth == 0)
+	{
+		VisitSubtree(subtree_root, visitor);
+		return;
+	}
+	//entries above the cutoff are few, they are visited here
+	VisitSubtree(subtree_root, visitor, depth - 1);
+	TreeVisitJob job(visitor, &tasks);
+	pool->Run(&job);
+}
+
 MainThread* SyncTL::GetMainThread()
 {
 	static MainThread* main_thread(MainThread::GetMainThread());
@@ -57,10 +57,15 @@ enum ThreadPriority
 	PRIORITY_UNDEFINED
 };
 
-typedef BasicList::Entry  ThreadEntry;
+typedef IntrusiveListHook<>  ThreadEntry;
 
+//messages are deleted through this class, the queue hook has no virtual destructor
 class ThreadMessage: public ThreadEntry
-{};
+{
+public:
+	virtual ~ThreadMessage()
+		{}
+};
 
 class ThreadException: public ThreadMessage, public Exception
 {
@@ -75,6 +80,16 @@ public:
 		//*fn_end = char(0);
 		m_filename = m_filename_buffer;
 	}
+	//the copy keeps it's own buffers
+	ThreadException(const ThreadException& exc):
+		ThreadMessage(),
+		Exception(exc)
+	{
+		wcscpy(m_message_buffer, exc.m_message_buffer);
+		m_message = m_message_buffer;
+		strcpy(m_filename_buffer, exc.m_filename_buffer);
+		m_filename = m_filename_buffer;
+	}
 protected:
 	wchar_t m_message_buffer[ERROR_MSG_BUFFER_LENGTH];
 	char m_filename_buffer[ERROR_MSG_BUFFER_LENGTH];
@@ -168,22 +183,23 @@ protected:
 	Timer m_timer;
 	TimerEvent m_timer_event;
 	//this is separate message queue besides of those provided by the target OS.
-	//another threads can post their messages here.
-	BasicList m_messages;
+	//another threads can post their messages here without any lock.
+	MPSCQueue m_messages;
 	static MainThread* m_this_singleton;
 };
 
 class WorkerThread;
 class Worker;
 
-class WorkerMessage: public BasicList::Entry
+class WorkerMessage: public IntrusiveListHook<>
 {
 	friend class WorkerThread;
 public:
 	WorkerMessage(Worker* dest, bool delete_after_completion = true):
 		m_dest_worker(dest),
 		m_ret_val(UNDEFINED_ERROR),
-		m_delete_after_completion(delete_after_completion)
+		m_delete_after_completion(delete_after_completion),
+		m_is_exit(false)
 	{
 		ASSERT(m_dest_worker != NULL);
 	}
@@ -193,10 +209,13 @@ public:
 		{ return m_ret_val;	}
 	void SetRetVal(unsigned int ret_val)
 		{ m_ret_val = ret_val; }
+	bool IsExit() const
+		{ return m_is_exit; }
 protected:
 	Worker* m_dest_worker;
 	unsigned int m_ret_val;
 	bool m_delete_after_completion;
+	bool m_is_exit;	//set by ExitMessage, so the worker thread does not need RTTI to recognize it
 };
 
 class ExitMessage: public WorkerMessage
@@ -204,10 +223,12 @@ class ExitMessage: public WorkerMessage
 public:
 	ExitMessage(Worker* worker, bool delete_after_completion):
 		WorkerMessage(worker, delete_after_completion)
-	{}
+	{
+		m_is_exit = true;
+	}
 };
 
-class Worker: public BasicList::Entry
+class Worker: public IntrusiveListHook<Worker>
 {
 	friend class WorkerThread;
 public:
@@ -215,8 +236,8 @@ public:
 		m_thread(NULL),
 		m_at_work(false)
 		{}
-	virtual ~Worker()
-		{ ASSERT(m_at_work == false); }
+	//removes itself from it's thread
+	virtual ~Worker();
 	virtual unsigned int /*error code*/ Execute(WorkerMessage* wm) = 0;
 protected:
 	//this method is to be called from worker. it calls Execute. reimplement Execute.
@@ -232,9 +253,9 @@ protected:
 	bool m_at_work;
 };
 
-//typedef List<WorkerMessage> MessageList;
-//because messages will be of different types
-typedef BasicList MessageList;
+//messages of different types are queued by their hooks
+typedef MPSCQueue MessageList;
+typedef IntrusiveList<Worker, Worker> WorkerList;
 
 /*this class throws exceptions instead of returning error codes because it is crossplatform and there
 are many error codes. I better put system error code and message in exception instead of mapping system error codes
@@ -243,7 +264,7 @@ when message is posted, worker thread is responsible for it's deletion.*/
 class WorkerThread: public Thread
 {
 public:
-	typedef BasicList::Iterator WorkerIterator;
+	typedef WorkerList::Iterator WorkerIterator;
 	WorkerThread(ThreadPriority priority);
 	virtual ~WorkerThread();
 	unsigned int /*error code*/ Stop(unsigned int* platform_error = NULL);
@@ -255,15 +276,436 @@ public:
 protected:
 	unsigned int /*error code*/ ThreadProc();
 	inline Worker* GetWorker(WorkerIterator& it) const
-		{ return dynamic_cast<Worker*>(it.operator BasicList::Entry *()); }
-	BasicList m_worker_list;
+		{ return it; }
+	WorkerList m_worker_list;
 	ReadWriteLock m_worker_list_lock;
-	MessageList m_message_list;
-	ReadWriteLock m_message_list_lock;
+	MPSCQueue m_message_queue;
 	bool m_exit_flag;
-	Event m_message_list_not_empty;
+	Event m_message_queue_not_empty;
+};
+
+//a job for WorkerPool. tasks 0..task_count-1 are taken one at a time by pool threads and by the thread that called
+//WorkerPool::Run, so RunTask is called from several threads at once.
+class ParallelJob
+{
+	friend class WorkerPool;
+public:
+	ParallelJob(unsigned int task_count = 0);
+	virtual ~ParallelJob();
+	unsigned int GetTaskCount() const
+		{ return m_task_count; }
+	void SetTaskCount(unsigned int task_count)
+		{ m_task_count = task_count; }
+protected:
+	virtual void RunTask(unsigned int index) = 0;
+	//takes tasks until there are none left. the first exception is kept and is thrown from WorkerPool::Run,
+	//the remaining tasks are skipped after it.
+	void RunTasks();
+	void SetError(const Exception& exc);
+	void Reset(unsigned int worker_count);
+	//called by each pool thread when it has nothing more to take
+	void OnWorkerDone();
+
+	unsigned int m_task_count;
+	std::atomic<unsigned int> m_next_task;
+	std::atomic<unsigned int> m_running_workers;
+	std::atomic<bool> m_failed;
+	ThreadException* m_error;
+	Event m_done;
+};
+
+/*a fixed set of worker threads running one ParallelJob at a time. the calling thread takes tasks too,
+so thread_count == 0 means one thread less than the number of cores.
+Run must not be called from inside of a task of the same pool.*/
+class WorkerPool
+{
+public:
+	WorkerPool(unsigned int thread_count = 0, ThreadPriority priority = PRIORITY_NORMAL);
+	virtual ~WorkerPool();
+	//number of threads running tasks, including the calling one
+	unsigned int GetConcurrency() const
+		{ return m_thread_count + 1; }
+	//returns when all tasks are done. throws the first exception thrown by a task.
+	void Run(ParallelJob* job);
+protected:
+	class JobMessage: public WorkerMessage
+	{
+	public:
+		JobMessage(Worker* worker, ParallelJob* job):
+			WorkerMessage(worker, true),
+			m_job(job)
+			{ ASSERT(m_job != NULL); }
+		ParallelJob* m_job;
+	};
+	class JobWorker: public Worker
+	{
+	public:
+		unsigned int /*error code*/ Execute(WorkerMessage* wm);
+	};
+	void Destroy();
+
+	unsigned int m_thread_count;
+	WorkerThread** m_threads;
+	JobWorker* m_workers;
+	//one job at a time
+	ReadWriteLock m_run_lock;
+};
+
+//visitor for ParallelForEach. Visit is called from several threads at once, in no particular order.
+class TreeVisitor
+{
+public:
+	virtual ~TreeVisitor()
+		{}
+	virtual void Visit(BasicTree::Entry* entry) = 0;
+};
+
+/*folder for ParallelFold. result of an entry is Visit(entry) with results of it's children combined into it one by one
+in the children order, so Combine sees the same order as RETURN_TO_PARENTS iteration.
+methods are called from several threads at once, but all calls for one entry are made on one thread.*/
+template <class ResultType>
+class TreeFolder
+{
+public:
+	virtual ~TreeFolder()
+		{}
+	virtual ResultType Visit(BasicTree::Entry* entry) = 0;
+	virtual void Combine(ResultType& result, const ResultType& child_result, BasicTree::Entry* entry) = 0;
+};
+
+enum
+{
+	//the subtree is split until there are that many tasks per thread, so uneven branches even out
+	TREE_TASKS_PER_THREAD = 8,
+	AUTO_CUTOFF_DEPTH = UINT_MAX
+};
+
+/*splits a subtree into tasks: entries of the first depth having at least min_tasks entries, or of max_depth if it
+comes earlier, or of the deepest level if the subtree is not that wide. entries are put to out_tasks in the tree order,
+the return value is their depth (root has depth 0).*/
+unsigned int SplitSubtree(BasicTree::Entry* root, unsigned int min_tasks, unsigned int max_depth,
+						  Vector<BasicTree::Entry*>* out_tasks);
+//visits the subtree in pre-order, not descending below depth_limit. no locks are taken.
+void VisitSubtree(BasicTree::Entry* root, TreeVisitor* visitor, unsigned int depth_limit = UINT_MAX);
+
+/*visits every entry of the subtree (whole tree when subtree_root is NULL) on the pool threads.
+the tree is locked for read once for the whole traversal instead of locking on every iterator step.
+cutoff_depth is the depth the subtree is split at, by default it is chosen by the number of threads.*/
+void ParallelForEach(WorkerPool* pool, BasicTree* tree, BasicTree::Entry* subtree_root, TreeVisitor* visitor,
+					 unsigned int cutoff_depth = AUTO_CUTOFF_DEPTH);
+
+/*folds the subtree bottom up without recursion. entries at frontier_depth are not descended into when frontier_results
+is not NULL, the next result from there is combined instead, they are taken in the tree order.
+ResultType must be default constructible and assignable.*/
+template <class ResultType>
+ResultType FoldSubtree(BasicTree::Entry* root, TreeFolder<ResultType>* folder,
+					   unsigned int frontier_depth = UINT_MAX, const ResultType* frontier_results = NULL)
+{
+	ASSERT(root != NULL);
+	ASSERT(folder != NULL);
+	//accumulators of the entries on the path from the root to the current entry
+	unsigned int acc_size = 0x10;
+	ResultType* acc = new ResultType[acc_size];
+	try
+	{
+		acc[0] = folder->Visit(root);
+		unsigned int depth = 0;
+		BasicTree::Entry* entry = root;
+		BasicTree::Entry* next = root->GetFirstChild();
+		while (true)
+		{
+			if (next != NULL)
+			{
+				if ((frontier_results != NULL) && (depth + 1 == frontier_depth))
+				{
+					folder->Combine(acc[depth], *frontier_results, entry);
+					++ frontier_results;
+					next = next->GetNextSibling();
+					continue;
+				}
+				++ depth;
+				if (depth == acc_size)
+				{
+					ResultType* new_acc = new ResultType[acc_size * 2];
+					for (unsigned int i = 0; i < acc_size; ++ i)
+					{
+						new_acc[i] = acc[i];
+					}
+					delete [] acc;
+					acc = new_acc;
+					acc_size *= 2;
+				}
+				entry = next;
+				acc[depth] = folder->Visit(entry);
+				next = entry->GetFirstChild();
+				continue;
+			}
+			//entry is done
+			if (depth == 0)
+			{
+				break;
+			}
+			BasicTree::Entry* parent = entry->GetParent();
+			folder->Combine(acc[depth - 1], acc[depth], parent);
+			next = entry->GetNextSibling();
+			entry = parent;
+			-- depth;
+		}
+		ResultType ret_val = acc[0];
+		delete [] acc;
+		return ret_val;
+	} catch (...)
+	{
+		delete [] acc;
+		throw;
+	}
+}
+
+template <class ResultType>
+class TreeFoldJob: public ParallelJob
+{
+public:
+	TreeFoldJob(TreeFolder<ResultType>* folder, Vector<BasicTree::Entry*>* tasks, ResultType* results):
+		ParallelJob(tasks->GetCount()),
+		m_folder(folder),
+		m_tasks(tasks),
+		m_results(results)
+		{}
+protected:
+	void RunTask(unsigned int index)
+		{ m_results[index] = FoldSubtree<ResultType>((*m_tasks)[index], m_folder); }
+	TreeFolder<ResultType>* m_folder;
+	Vector<BasicTree::Entry*>* m_tasks;
+	ResultType* m_results;
+};
+
+/*folds the subtree (whole tree when subtree_root is NULL) on the pool threads: subtrees below the cutoff depth
+are folded in parallel, then the part above it is folded on the calling thread.
+the tree is locked for read once. returns ResultType() for an empty tree.*/
+template <class ResultType>
+ResultType ParallelFold(WorkerPool* pool, BasicTree* tree, BasicTree::Entry* subtree_root,
+						TreeFolder<ResultType>* folder, unsigned int cutoff_depth = AUTO_CUTOFF_DEPTH)
+{
+	ASSERT(pool != NULL);
+	ASSERT(tree != NULL);
+	ASSERT(folder != NULL);
+	TemplateReadSynchronizer<BasicTree> sync(tree);
+	if (subtree_root == NULL)
+	{
+		subtree_root = tree->GetRoot();
+		if (subtree_root == NULL)
+		{
+			return ResultType();
+		}
+	}
+	Vector<BasicTree::Entry*> tasks(0x20, BasicVector::GetDefaultAllocator(), NULL);
+	unsigned int min_tasks = pool->GetConcurrency() * TREE_TASKS_PER_THREAD;
+	if (cutoff_depth != AUTO_CUTOFF_DEPTH)
+	{
+		min_tasks = UINT_MAX;
+	}
+	unsigned int depth = SplitSubtree(subtree_root, min_tasks, cutoff_depth, &tasks);
+	if (depth == 0)
+	{
+		return FoldSubtree<ResultType>(subtree_root, folder);
+	}
+	ResultType* results = new ResultType[tasks.GetCount()];
+	try
+	{
+		TreeFoldJob<ResultType> job(folder, &tasks, results);
+		pool->Run(&job);
+		ResultType ret_val = FoldSubtree<ResultType>(subtree_root, folder, depth, results);
+		delete [] results;
+		return ret_val;
+	} catch (...)
+	{
+		delete [] results;
+		throw;
+	}
+}
+
+enum
+{
+	PARALLEL_SORT_MIN_COUNT = 0x10000,	//smaller vectors are sorted on the calling thread
+	SORT_TASKS_PER_THREAD = 2
 };
 
+//sorts parts of part_size of an array, a part per task
+template <class DataType, class Compare>
+class SortPartsJob: public ParallelJob
+{
+public:
+	SortPartsJob(DataType* data, unsigned int count, unsigned int part_size):
+		ParallelJob((count + part_size - 1) / part_size),
+		m_data(data),
+		m_count(count),
+		m_part_size(part_size)
+		{}
+protected:
+	void RunTask(unsigned int index)
+	{
+		unsigned int begin = index * m_part_size;
+		unsigned int part_count = (m_count - begin < m_part_size) ? m_count - begin : m_part_size;
+		SortAlgorithms<DataType, Compare>::StableSort(m_data + begin, part_count);
+	}
+	DataType* m_data;
+	unsigned int m_count;
+	unsigned int m_part_size;
+};
+
+/*merges pairs of sorted runs of run_size from src to dst. the output of a pair is cut into parts_per_pair slices,
+where a slice starts in both runs is found by binary search (merge path), so each slice is a task of it's own
+and the last rounds with few long runs are as parallel as the first ones.*/
+template <class DataType, class Compare>
+class MergeRunsJob: public ParallelJob
+{
+public:
+	MergeRunsJob(DataType* src, DataType* dst, unsigned int count, unsigned int run_size, unsigned int pair_count,
+				 unsigned int parts_per_pair):
+		ParallelJob(pair_count * parts_per_pair),
+		m_src(src),
+		m_dst(dst),
+		m_count(count),
+		m_run_size(run_size),
+		m_parts_per_pair(parts_per_pair)
+		{}
+	//number of left entries among the first out_index entries of the merge. equal entries come from the left first.
+	static unsigned int SplitMerge(const DataType* left, unsigned int left_count, const DataType* right,
+								   unsigned int right_count, unsigned int out_index)
+	{
+		unsigned int low = (out_index > right_count) ? out_index - right_count : 0;
+		unsigned int high = (out_index < left_count) ? out_index : left_count;
+		while (low < high)
+		{
+			unsigned int middle = low + (high - low) / 2;
+			if (Compare::Less(right[out_index - middle - 1], left[middle]))
+			{
+				high = middle;
+			} else {
+				low = middle + 1;
+			}
+		}
+		return low;
+	}
+protected:
+	void RunTask(unsigned int index)
+	{
+		unsigned int pair = index / m_parts_per_pair;
+		unsigned int part = index % m_parts_per_pair;
+		unsigned int left_begin = pair * 2 * m_run_size;
+		unsigned int left_count = (m_count - left_begin < m_run_size) ? m_count - left_begin : m_run_size;
+		unsigned int right_begin = left_begin + left_count;
+		unsigned int right_count = (m_count - right_begin < m_run_size) ? m_count - right_begin : m_run_size;
+		DataType* left = m_src + left_begin;
+		DataType* right = m_src + right_begin;
+		unsigned long long total = left_count + right_count;
+		unsigned int out_begin = (unsigned int)((total * part) / m_parts_per_pair);
+		unsigned int out_end = (unsigned int)((total * (part + 1)) / m_parts_per_pair);
+		unsigned int left_index = SplitMerge(left, left_count, right, right_count, out_begin);
+		unsigned int left_end = SplitMerge(left, left_count, right, right_count, out_end);
+		unsigned int right_index = out_begin - left_index;
+		unsigned int right_end = out_end - left_end;
+		DataType* out = m_dst + left_begin + out_begin;
+		while ((left_index < left_end) && (right_index < right_end))
+		{
+			if (Compare::Less(right[right_index], left[left_index]))
+			{
+				*out = std::move(right[right_index]);
+				++right_index;
+			} else {
+				*out = std::move(left[left_index]);
+				++left_index;
+			}
+			++out;
+		}
+		for (; left_index < left_end; ++left_index, ++out)
+		{
+			*out = std::move(left[left_index]);
+		}
+		for (; right_index < right_end; ++right_index, ++out)
+		{
+			*out = std::move(right[right_index]);
+		}
+	}
+	DataType* m_src;
+	DataType* m_dst;
+	unsigned int m_count;
+	unsigned int m_run_size;
+	unsigned int m_parts_per_pair;
+};
+
+/*sorts the vector on the pool threads, equal entries keep their order. parts of the vector are sorted in parallel
+(numbers in the default order by radix sort, see SortAlgorithms), then sorted runs are merged in rounds,
+each round in parallel. vectors smaller than PARALLEL_SORT_MIN_COUNT are sorted on the calling thread.
+the vector is locked for write once. Compare must not throw.*/
+template <class DataType, class Compare = LessFunction<DataType> >
+void ParallelSort(WorkerPool* pool, Vector<DataType>* vector)
+{
+	ASSERT(pool != NULL);
+	ASSERT(vector != NULL);
+	DataType* data = (DataType*)vector->LockEntries();
+	unsigned int count = vector->GetCount();
+	DataType* buffer = NULL;
+	unsigned int constructed = 0;
+	try
+	{
+		unsigned int task_count = pool->GetConcurrency() * SORT_TASKS_PER_THREAD;
+		if ((count < PARALLEL_SORT_MIN_COUNT) || (pool->GetConcurrency() == 1))
+		{
+			SortAlgorithms<DataType, Compare>::StableSort(data, count);
+		} else {
+			unsigned int part_size = (count + task_count - 1) / task_count;
+			SortPartsJob<DataType, Compare> sort_job(data, count, part_size);
+			pool->Run(&sort_job);
+			buffer = (DataType*)BasicVector::GetDefaultAllocator()->AllocateDataArray(sizeof(DataType), count);
+			if (buffer == NULL)
+			{
+				throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+					L"Cannot allocate buffer for parallel sort",
+					EXC_HERE);
+			}
+			for (; constructed < count; ++constructed)
+			{
+				new (buffer + constructed) DataType(std::move(data[constructed]));
+			}
+			DataType* src = buffer;
+			DataType* dst = data;
+			for (unsigned int run_size = part_size; run_size < count; )
+			{
+				unsigned int run_count = (count - 1) / run_size + 1;
+				unsigned int pair_count = (run_count + 1) / 2;
+				MergeRunsJob<DataType, Compare> merge_job(src, dst, count, run_size, pair_count,
+														  (task_count + pair_count - 1) / pair_count);
+				pool->Run(&merge_job);
+				std::swap(src, dst);
+				run_size = (run_size > count / 2) ? count : run_size * 2;
+			}
+			if (src != data)
+			{
+				for (unsigned int index = 0; index < count; ++index)
+				{
+					data[index] = std::move(src[index]);
+				}
+			}
+		}
+	} catch (...)
+	{
+		for (unsigned int index = 0; index < constructed; ++index)
+		{
+			buffer[index].~DataType();
+		}
+		BasicVector::GetDefaultAllocator()->FreeDataArray((char*)buffer);
+		vector->Unlock();
+		throw;
+	}
+	for (unsigned int index = 0; index < constructed; ++index)
+	{
+		buffer[index].~DataType();
+	}
+	BasicVector::GetDefaultAllocator()->FreeDataArray((char*)buffer);
+	vector->Unlock();
+}
+
 /*messages (and exceptions) will be deleted on main thread*/
 MainThread* GetMainThread();
 void PostExceptionToMainThread(Exception* exc);
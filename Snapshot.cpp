@@ -0,0 +1,364 @@
+#include "Snapshot.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace SyncTL;
+
+static inline unsigned long long AlignSnapshotOffset(unsigned long long offset)
+{
+	return ((offset + SnapshotHeader::ALIGNMENT - 1) & ~((unsigned long long)SnapshotHeader::ALIGNMENT - 1));
+}
+
+const SnapshotHeader* SyncTL::GetSnapshotHeader(const char* image, size_t image_size, unsigned int entry_size,
+												unsigned int alignment)
+{
+	const SnapshotHeader* header = (const SnapshotHeader*)image;
+	if ((image == NULL) || (image_size < sizeof(SnapshotHeader)))
+	{
+		throw Exception(UTILS_ERROR_INVALID_SNAPSHOT,
+			L"Snapshot image is too small",
+			EXC_HERE);
+	}
+	if (((size_t)image % alignment != 0) || ((size_t)image % sizeof(unsigned long long) != 0))
+	{
+		throw Exception(UTILS_ERROR_INVALID_SNAPSHOT,
+			L"Snapshot image is not aligned",
+			EXC_HERE);
+	}
+	if ((header->m_magic != SnapshotHeader::MAGIC) || (header->m_version != SnapshotHeader::VERSION))
+	{
+		throw Exception(UTILS_ERROR_INVALID_SNAPSHOT,
+			L"Not a snapshot image or unsupported version",
+			EXC_HERE);
+	}
+	if (header->m_entry_size != entry_size)
+	{
+		throw Exception(UTILS_ERROR_INVALID_SNAPSHOT,
+			L"Snapshot entry size does not match",
+			EXC_HERE);
+	}
+	//only the layout is checked here, nodes are trusted, otherwise loading would be a pass over the whole image.
+	unsigned long long count = header->m_count;
+	bool ok = (header->m_image_size <= image_size);
+	ok = ok && (header->m_data_offset % SnapshotHeader::ALIGNMENT == 0);
+	ok = ok && (header->m_data_offset >= sizeof(SnapshotHeader));
+	ok = ok && (header->m_data_offset + count * entry_size <= header->m_image_size);
+	if (header->m_kind == SNAPSHOT_TREE)
+	{
+		ok = ok && (header->m_nodes_offset % SnapshotHeader::ALIGNMENT == 0);
+		ok = ok && (header->m_nodes_offset >= sizeof(SnapshotHeader));
+		ok = ok && (header->m_nodes_offset + count * sizeof(BasicCompactTree::Node) <= header->m_image_size);
+		ok = ok && (count < BasicCompactTree::INVALID_INDEX);
+	} else {
+		ok = ok && ((header->m_kind == SNAPSHOT_VECTOR) || (header->m_kind == SNAPSHOT_LIST));
+	}
+	if (ok == false)
+	{
+		throw Exception(UTILS_ERROR_INVALID_SNAPSHOT,
+			L"Snapshot image is damaged",
+			EXC_HERE);
+	}
+	return header;
+}
+
+MappedFile::MappedFile():
+#ifdef WINDOWS
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(NULL),
+#endif //WINDOWS
+	m_data(NULL),
+	m_size(0)
+{}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+unsigned int /*error code*/ MappedFile::Open(const char* filename, unsigned int* platform_error)
+{
+	ASSERT(filename != NULL);
+	Close();
+#ifdef WINDOWS
+	m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	LARGE_INTEGER size;
+	bool ok = (m_file != INVALID_HANDLE_VALUE) && (GetFileSizeEx(m_file, &size) != FALSE) && (size.QuadPart > 0);
+	if (ok)
+	{
+		m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+		ok = (m_mapping != NULL);
+	}
+	if (ok)
+	{
+		m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		ok = (m_data != NULL);
+	}
+	if (ok == false)
+	{
+		if (platform_error != NULL)
+		{
+			*platform_error = GetLastError();
+		}
+		Close();
+		return UTILS_ERROR_CANNOT_OPEN_FILE;
+	}
+	m_size = (size_t)size.QuadPart;
+#else
+	FILE* file = fopen(filename, "rb");
+	if (file == NULL)
+	{
+		return UTILS_ERROR_CANNOT_OPEN_FILE;
+	}
+	long size = -1;
+	if (fseek(file, 0, SEEK_END) == 0)
+	{
+		size = ftell(file);
+	}
+	char* data = NULL;
+	if ((size > 0) && (fseek(file, 0, SEEK_SET) == 0))
+	{
+		data = (char*)malloc(size);
+	}
+	if ((data == NULL) || (fread(data, 1, size, file) != (size_t)size))
+	{
+		free(data);
+		fclose(file);
+		return UTILS_ERROR_CANNOT_OPEN_FILE;
+	}
+	fclose(file);
+	m_data = data;
+	m_size = size;
+#endif //WINDOWS
+	return ERR_OK;
+}
+
+void MappedFile::Close()
+{
+#ifdef WINDOWS
+	if (m_data != NULL)
+	{
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping != NULL)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = NULL;
+	}
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+#else
+	free((void*)m_data);
+#endif //WINDOWS
+	m_data = NULL;
+	m_size = 0;
+}
+
+BasicSnapshotWriter::BasicSnapshotWriter(unsigned int entry_size):
+	m_entry_size(entry_size),
+	m_buffer(NULL),
+	m_image(NULL),
+	m_image_size(0)
+{}
+
+BasicSnapshotWriter::~BasicSnapshotWriter()
+{
+	FreeImage();
+}
+
+void BasicSnapshotWriter::FreeImage()
+{
+	free(m_buffer);
+	m_buffer = NULL;
+	m_image = NULL;
+	m_image_size = 0;
+}
+
+void BasicSnapshotWriter::AllocateImage(SnapshotKind kind, unsigned int count)
+{
+	FreeImage();
+	unsigned long long nodes_offset = 0;
+	unsigned long long data_offset = AlignSnapshotOffset(sizeof(SnapshotHeader));
+	if (kind == SNAPSHOT_TREE)
+	{
+		nodes_offset = data_offset;
+		data_offset = AlignSnapshotOffset(nodes_offset + (unsigned long long)count * sizeof(BasicCompactTree::Node));
+	}
+	unsigned long long image_size = data_offset + (unsigned long long)count * m_entry_size;
+	if (image_size != (size_t)image_size)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Snapshot image is too big",
+			EXC_HERE);
+	}
+	m_buffer = (char*)malloc((size_t)image_size + SnapshotHeader::ALIGNMENT);
+	if (m_buffer == NULL)
+	{
+		throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+			L"Cannot allocate snapshot image",
+			EXC_HERE);
+	}
+	m_image = m_buffer + (SnapshotHeader::ALIGNMENT - ((size_t)m_buffer % SnapshotHeader::ALIGNMENT));
+	m_image_size = (size_t)image_size;
+	//padding is zeroed, so the same collection always gives the same file
+	memset(m_image, 0, (size_t)data_offset);
+	SnapshotHeader* header = (SnapshotHeader*)m_image;
+	header->m_magic = SnapshotHeader::MAGIC;
+	header->m_version = SnapshotHeader::VERSION;
+	header->m_kind = kind;
+	header->m_entry_size = m_entry_size;
+	header->m_count = count;
+	header->m_nodes_offset = nodes_offset;
+	header->m_data_offset = data_offset;
+	header->m_image_size = image_size;
+}
+
+void BasicSnapshotWriter::BuildTree(BasicTree* tree)
+{
+	ASSERT(tree != NULL);
+	typedef BasicCompactTree::Node Node;
+	typedef BasicCompactTree::NodeIndex NodeIndex;
+	const NodeIndex INVALID_INDEX = BasicCompactTree::INVALID_INDEX;
+	TemplateReadSynchronizer<BasicTree> sync(tree);
+	BasicTree::Entry* root = tree->GetRoot();
+	//count entries first, so the image is allocated at once
+	unsigned long long count = 0;
+	BasicTree::Entry* entry = root;
+	while (entry != NULL)
+	{
+		++ count;
+		if (entry->GetFirstChild() != NULL)
+		{
+			entry = entry->GetFirstChild();
+			continue;
+		}
+		while ((entry != root) && (entry->GetNextSibling() == NULL))
+		{
+			entry = entry->GetParent();
+		}
+		entry = (entry != root) ? entry->GetNextSibling() : NULL;
+	}
+	if (count >= INVALID_INDEX)
+	{
+		throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+			L"Tree is too big for a snapshot",
+			EXC_HERE);
+	}
+	AllocateImage(SNAPSHOT_TREE, (unsigned int)count);
+	if (root == NULL)
+	{
+		return;
+	}
+	//pre-order: a child goes right after it's parent, a sibling goes right after the previous sibling's branch.
+	//going up needs no stack, parent indexes are already in the nodes.
+	Node* nodes = (Node*)GetNodes();
+	char* payloads = GetPayloads();
+	NodeIndex current = 0;
+	NodeIndex last = 0;
+	nodes[0].m_parent = INVALID_INDEX;
+	nodes[0].m_first_child = INVALID_INDEX;
+	nodes[0].m_next_sibling = INVALID_INDEX;
+	CopyTreePayload(root, payloads);
+	entry = root;
+	while (true)
+	{
+		BasicTree::Entry* next = entry->GetFirstChild();
+		NodeIndex parent = current;
+		if (next == NULL)
+		{
+			while ((entry != root) && (entry->GetNextSibling() == NULL))
+			{
+				entry = entry->GetParent();
+				current = nodes[current].m_parent;
+			}
+			if (entry == root)
+			{
+				break;
+			}
+			next = entry->GetNextSibling();
+			parent = nodes[current].m_parent;
+		}
+		++ last;
+		ASSERT(last < count);
+		if (parent == current)
+		{
+			nodes[current].m_first_child = last;
+		} else {
+			nodes[current].m_next_sibling = last;
+		}
+		nodes[last].m_parent = parent;
+		nodes[last].m_first_child = INVALID_INDEX;
+		nodes[last].m_next_sibling = INVALID_INDEX;
+		CopyTreePayload(next, payloads + (size_t)last * m_entry_size);
+		entry = next;
+		current = last;
+	}
+	ASSERT(last + 1 == count);
+}
+
+void BasicSnapshotWriter::BuildVector(BasicVector* vector)
+{
+	ASSERT(vector != NULL);
+	ASSERT(vector->GetEntrySize() == m_entry_size);
+	TemplateReadSynchronizer<BasicVector> sync(vector);
+	unsigned int count = vector->GetCount();
+	AllocateImage(SNAPSHOT_VECTOR, count);
+	if (count != 0)
+	{
+		//entries of a vector are one array already. GetData does not detach a shared buffer,
+		//which would take the write lock while the read lock is held here.
+		memcpy(GetPayloads(), vector->GetData(), (size_t)count * m_entry_size);
+	}
+}
+
+void BasicSnapshotWriter::BuildList(BasicList* list)
+{
+	ASSERT(list != NULL);
+	TemplateReadSynchronizer<BasicList> sync(list);
+	AllocateImage(SNAPSHOT_LIST, list->GetCount());
+	char* dst = GetPayloads();
+	//iterator without lock, the list is locked already
+	BasicList::Iterator it((BasicList::Entry*)list->Begin());
+	for (; it.IsValid(); ++ it)
+	{
+		CopyListPayload(it, dst);
+		dst += m_entry_size;
+	}
+	ASSERT(dst == GetPayloads() + (size_t)list->GetCount() * m_entry_size);
+}
+
+unsigned int /*error code*/ BasicSnapshotWriter::WriteToFile(const char* filename) const
+{
+	ASSERT(filename != NULL);
+	if (m_image == NULL)
+	{
+		return UTILS_ERROR_INVALID_PARAMETERS;
+	}
+	FILE* file = fopen(filename, "wb");
+	if (file == NULL)
+	{
+		return UTILS_ERROR_CANNOT_OPEN_FILE;
+	}
+	bool ok = (fwrite(m_image, 1, m_image_size, file) == m_image_size);
+	ok = (fclose(file) == 0) && ok;
+	return ok ? (unsigned int)ERR_OK : (unsigned int)UTILS_ERROR_CANNOT_WRITE_FILE;
+}
+
+BasicTreeSnapshot::BasicTreeSnapshot(unsigned int data_size, const SnapshotHeader* header):
+	BasicCompactTree(data_size, GetNodes(header), (const char*)header + header->m_data_offset, header->m_count)
+{}
+
+const BasicCompactTree::Node* BasicTreeSnapshot::GetNodes(const SnapshotHeader* header)
+{
+	if (header->m_kind != SNAPSHOT_TREE)
+	{
+		throw Exception(UTILS_ERROR_INVALID_SNAPSHOT,
+			L"Cannot use an array snapshot as a tree",
+			EXC_HERE);
+	}
+	return (const Node*)((const char*)header + header->m_nodes_offset);
+}
\ No newline at end of file
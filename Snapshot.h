@@ -0,0 +1,229 @@
+#ifndef SNAPSHOT_H_INCLUDED
+#define SNAPSHOT_H_INCLUDED
+
+#if ((defined _WIN64) || (defined _WIN32))
+#define WINDOWS
+#endif	//WIN32 || WIN64
+
+#ifdef WINDOWS
+#include <Windows.h>
+#endif //WINDOWS
+
+#include "Collections.h"
+#include "Utils.h"
+#include <type_traits>
+
+/*snapshot is a flat image of a collection. it is built in one pass, written to a file by one write and then
+used right from the memory the file is mapped to, nothing is allocated or rebuilt on load.
+image layout: SnapshotHeader, then (for a tree) BasicCompactTree::Node array in pre-order, so the first child of
+an entry is the very next node, then the payload array in the same order. vector and list images have payloads only.
+payloads are copied as bytes, so DataType must be trivially copyable and must not keep pointers.
+numbers are in the native byte order, an image is to be read on the same kind of machine it was written on.*/
+
+namespace SyncTL
+{
+
+enum SnapshotKind
+{
+	SNAPSHOT_TREE = 1,
+	SNAPSHOT_VECTOR,
+	SNAPSHOT_LIST
+};
+
+struct SnapshotHeader
+{
+	enum
+	{
+		MAGIC = 0x534C5453,	//"STLS"
+		VERSION = 1,
+		ALIGNMENT = CACHE_LINE_SIZE	//node and payload arrays start at this alignment
+	};
+	unsigned int m_magic;
+	unsigned int m_version;
+	unsigned int m_kind;
+	unsigned int m_entry_size;
+	unsigned int m_count;
+	unsigned int m_reserved;
+	unsigned long long m_nodes_offset;	//0 if there are no nodes
+	unsigned long long m_data_offset;
+	unsigned long long m_image_size;
+};
+
+//checks that image is a whole snapshot with entries of entry_size and returns it's header.
+//the image must be aligned for the payloads. throws UTILS_ERROR_INVALID_SNAPSHOT.
+const SnapshotHeader* GetSnapshotHeader(const char* image, size_t image_size, unsigned int entry_size,
+										unsigned int alignment);
+
+//read-only view of a whole file. with WINDOWS the file is mapped, otherwise it is read into memory.
+class MappedFile
+{
+public:
+	MappedFile();
+	virtual ~MappedFile();
+	MappedFile(const MappedFile& another) = delete;
+	MappedFile& operator = (const MappedFile& another) = delete;
+	unsigned int /*error code*/ Open(const char* filename, unsigned int* platform_error = NULL);
+	void Close();
+	bool IsOpen() const
+		{ return (m_data != NULL); }
+	const char* GetData() const
+		{ return m_data; }
+	size_t GetSize() const
+		{ return m_size; }
+protected:
+#ifdef WINDOWS
+	HANDLE m_file;
+	HANDLE m_mapping;
+#endif //WINDOWS
+	const char* m_data;
+	size_t m_size;
+};
+
+//builds a snapshot image in memory, the collection is locked for read while it is copied.
+//SnapshotWriter<DataType> is the typed interface.
+class BasicSnapshotWriter
+{
+public:
+	BasicSnapshotWriter(unsigned int entry_size);
+	virtual ~BasicSnapshotWriter();
+	BasicSnapshotWriter(const BasicSnapshotWriter& another) = delete;
+	BasicSnapshotWriter& operator = (const BasicSnapshotWriter& another) = delete;
+	const char* GetImage() const
+		{ return m_image; }
+	size_t GetImageSize() const
+		{ return m_image_size; }
+	unsigned int /*error code*/ WriteToFile(const char* filename) const;
+protected:
+	void BuildTree(BasicTree* tree);
+	void BuildVector(BasicVector* vector);
+	void BuildList(BasicList* list);
+	//allocates an aligned image and fills the header
+	void AllocateImage(SnapshotKind kind, unsigned int count);
+	void FreeImage();
+	char* GetNodes() const
+		{ return m_image + ((SnapshotHeader*)m_image)->m_nodes_offset; }
+	char* GetPayloads() const
+		{ return m_image + ((SnapshotHeader*)m_image)->m_data_offset; }
+	virtual void CopyTreePayload(BasicTree::Entry* entry, char* dst) = 0;
+	virtual void CopyListPayload(BasicList::Entry* entry, char* dst) = 0;
+
+	unsigned int m_entry_size;
+	char* m_buffer;
+	char* m_image;	//m_buffer aligned
+	size_t m_image_size;
+};
+
+template <class DataType>
+class SnapshotWriter: public BasicSnapshotWriter
+{
+	static_assert(std::is_trivially_copyable<DataType>::value, "snapshot payloads are copied as bytes");
+public:
+	SnapshotWriter():
+		BasicSnapshotWriter(sizeof(DataType))
+	{}
+	void Build(Tree<DataType>* tree)
+		{ BuildTree(tree); }
+	void Build(Vector<DataType>* vector)
+		{ BuildVector(vector); }
+	void Build(List<DataType>* list)
+		{ BuildList(list); }
+protected:
+	void CopyTreePayload(BasicTree::Entry* entry, char* dst)
+	{
+		DataType& data = *static_cast<typename Tree<DataType>::Entry*>(entry);
+		memcpy(dst, &data, sizeof(DataType));
+	}
+	void CopyListPayload(BasicList::Entry* entry, char* dst)
+		{ memcpy(dst, &(static_cast<typename List<DataType>::Entry*>(entry)->GetData()), sizeof(DataType)); }
+};
+
+//read-only tree over a snapshot image. the image is not copied, it must outlive the snapshot.
+//iterators work the same way as BasicCompactTree ones, the tree is never locked because it never changes.
+class BasicTreeSnapshot: protected BasicCompactTree
+{
+public:
+	using BasicCompactTree::NodeIndex;
+	using BasicCompactTree::INVALID_INDEX;
+	using BasicCompactTree::ChildrenIterator;
+	using BasicCompactTree::TopLevelIterator;
+	using BasicCompactTree::GetChildrenIterator;
+	using BasicCompactTree::GetTopLevelIterator;
+	using BasicCompactTree::GetRoot;
+	using BasicCompactTree::IsEmpty;
+	using BasicCompactTree::GetCount;
+	using BasicCompactTree::GetParent;
+	using BasicCompactTree::GetFirstChild;
+	using BasicCompactTree::GetNextSibling;
+	using BasicCompactTree::IsLeaf;
+	using BasicCompactTree::GetPrevSibling;
+	using BasicCompactTree::GetLastChild;
+	using BasicCompactTree::GetChildrenCount;
+	using BasicCompactTree::IsValidEntry;
+protected:
+	BasicTreeSnapshot(unsigned int data_size, const SnapshotHeader* header);
+	static const Node* GetNodes(const SnapshotHeader* header);
+	void DestroyData(char* data)
+		{}
+};
+
+template <class DataType>
+class TreeSnapshot: public BasicTreeSnapshot
+{
+public:
+	TreeSnapshot(const char* image, size_t image_size):
+		BasicTreeSnapshot(sizeof(DataType), GetSnapshotHeader(image, image_size, sizeof(DataType), alignof(DataType)))
+	{}
+	TreeSnapshot(const MappedFile& file):
+		BasicTreeSnapshot(sizeof(DataType),
+						  GetSnapshotHeader(file.GetData(), file.GetSize(), sizeof(DataType), alignof(DataType)))
+	{}
+	const DataType& operator [] (NodeIndex entry) const
+	{
+		ASSERT(IsValidEntry(entry));
+		return *(const DataType*)GetDataPointer(entry);
+	}
+};
+
+//read-only array over a vector or a list snapshot image. the image must outlive the snapshot.
+template <class DataType>
+class VectorSnapshot
+{
+public:
+	VectorSnapshot(const char* image, size_t image_size)
+		{ Init(GetSnapshotHeader(image, image_size, sizeof(DataType), alignof(DataType))); }
+	VectorSnapshot(const MappedFile& file)
+		{ Init(GetSnapshotHeader(file.GetData(), file.GetSize(), sizeof(DataType), alignof(DataType))); }
+	unsigned int GetCount() const
+		{ return m_count; }
+	const DataType* GetData() const
+		{ return m_data; }
+	//this method throws exceptions
+	const DataType& operator [] (unsigned int index) const
+	{
+		if (index >= m_count)
+		{
+			throw Exception(UTILS_ERROR_INDEX_BIGGER_THAN_ARRAY_SIZE,
+				L"Cannot get snapshot entry because index is bigger than snapshot size",
+				EXC_HERE);
+		}
+		return m_data[index];
+	}
+protected:
+	void Init(const SnapshotHeader* header)
+	{
+		if (header->m_kind == SNAPSHOT_TREE)
+		{
+			throw Exception(UTILS_ERROR_INVALID_SNAPSHOT,
+				L"Cannot use a tree snapshot as an array",
+				EXC_HERE);
+		}
+		m_data = (const DataType*)((const char*)header + header->m_data_offset);
+		m_count = header->m_count;
+	}
+	const DataType* m_data;
+	unsigned int m_count;
+};
+
+} //end namespace SyncTL
+
+#endif //SNAPSHOT_H_INCLUDED
\ No newline at end of file
@@ -16,6 +16,8 @@
 #endif //WT_VERSION
 
 #include <atomic>
+#include <chrono>
+#include <thread>
 
 namespace SyncTL
 {
@@ -103,6 +105,93 @@ typedef SRWReadWriteLock ReadWriteLock;
 
 
 
+//read write lock that never goes to the kernel, it just spins. it is good for very short critical sections only,
+//e.g. for locks striped over buckets of a collection. read locks may be nested, write lock is not recursive.
+class SpinReadWriteLock : public BasicReadWriteLock
+{
+public:
+	enum
+	{
+		WRITER = -1,
+		SPIN_COUNT_BEFORE_YIELD = 0x40
+	};
+	SpinReadWriteLock():
+		m_state(0)
+	{}
+	virtual ~SpinReadWriteLock()
+	{}
+	bool LockForRead()
+	{
+		unsigned int spin_count = 0;
+		while (TryLockForReadOnce() == false)
+		{
+			Backoff(spin_count);
+		}
+		return true;
+	}
+	bool LockForWrite()
+	{
+		unsigned int spin_count = 0;
+		while (TryLockForWriteOnce() == false)
+		{
+			Backoff(spin_count);
+		}
+		return true;
+	}
+	bool TryLockForRead(unsigned int timeout_milliseconds = 0)
+		{ return SpinUntil(&SpinReadWriteLock::TryLockForReadOnce, timeout_milliseconds); }
+	bool TryLockForWrite(unsigned int timeout_milliseconds = 0)
+		{ return SpinUntil(&SpinReadWriteLock::TryLockForWriteOnce, timeout_milliseconds); }
+	void Unlock()
+	{
+		//only the owner calls Unlock, so the state is either WRITER or number of readers.
+		if (m_state.load(std::memory_order_relaxed) == WRITER)
+		{
+			m_state.store(0, std::memory_order_release);
+		} else {
+			ASSERT(m_state.load(std::memory_order_relaxed) > 0);
+			m_state.fetch_sub(1, std::memory_order_release);
+		}
+	}
+protected:
+	inline bool TryLockForReadOnce()
+	{
+		int state = m_state.load(std::memory_order_relaxed);
+		return ((state != WRITER) &&
+			m_state.compare_exchange_weak(state, state + 1, std::memory_order_acquire, std::memory_order_relaxed));
+	}
+	inline bool TryLockForWriteOnce()
+	{
+		int state = 0;
+		return ((m_state.load(std::memory_order_relaxed) == 0) &&
+			m_state.compare_exchange_weak(state, WRITER, std::memory_order_acquire, std::memory_order_relaxed));
+	}
+	bool SpinUntil(bool (SpinReadWriteLock::*try_lock)(), unsigned int timeout_milliseconds)
+	{
+		std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_milliseconds);
+		unsigned int spin_count = 0;
+		while ((this->*try_lock)() == false)
+		{
+			if (std::chrono::steady_clock::now() >= deadline)
+			{
+				return false;
+			}
+			Backoff(spin_count);
+		}
+		return true;
+	}
+	static inline void Backoff(unsigned int& spin_count)
+	{
+		++spin_count;
+		if (spin_count > SPIN_COUNT_BEFORE_YIELD)
+		{
+			std::this_thread::yield();
+		}
+	}
+	std::atomic<int> m_state;	//WRITER or number of readers
+};
+
 enum
 {
 	SYNCH_WAIT_OK = 0,
@@ -4,10 +4,8 @@
 
 using namespace SyncTL;
 
-Timer::TimerVector* Timer::m_timer_vector = NULL;
-//QtReadWriteLock* Timer::m_timer_vector_lock = NULL;
+Timer::TimerMap* Timer::m_timer_map = NULL;
 //QtReadWriteLock init_deinit_lock;
-ReadWriteLock* Timer::m_timer_vector_lock = NULL;
 ReadWriteLock init_deinit_lock;
 
 class Initializer
@@ -36,12 +34,11 @@ unsigned int /*error code*/ Timer::StaticInit()
 	{
 		return SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE;
 	}
-	if((m_timer_vector_lock != NULL) || (m_timer_vector != NULL))
+	if(m_timer_map != NULL)
 	{
 		return TIMER_ERROR_STATIC_MEMBERS_NON_NULL;
 	}
-	m_timer_vector_lock = new ReadWriteLock();
-	m_timer_vector = new TimerVector(TIMER_VECTOR_PREALLOC, BasicVector::GetDefaultAllocator(), m_timer_vector_lock);
+	m_timer_map = new TimerMap(TIMER_MAP_PREALLOC);
 	init_deinit_lock.Unlock();
 	return ERR_OK;
 }
@@ -54,25 +51,15 @@ unsigned int /*error code*/ Timer::StaticDeinit()
 	{
 		return SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE;
 	}
-	if(m_timer_vector != NULL)
+	if(m_timer_map != NULL)
 	{
-		ok = m_timer_vector->LockForWrite();
-		if(ok)
+		if(m_timer_map->GetCount() == 0)
 		{
-			if(m_timer_vector->GetCount() == 0)
-			{
-				m_timer_vector->Unlock();
-				delete m_timer_vector_lock;
-				m_timer_vector_lock = NULL;
-				delete m_timer_vector;
-				m_timer_vector = NULL;
-				ret_val = ERR_OK;
-			} else {
-				ret_val = TIMER_ERROR_TIMER_VECTOR_NOT_EMPTY;
-				m_timer_vector->Unlock();
-			}
+			delete m_timer_map;
+			m_timer_map = NULL;
+			ret_val = ERR_OK;
 		} else {
-			ret_val = TIMER_ERROR_CANNOT_LOCK_TIMER_VECTOR;
+			ret_val = TIMER_ERROR_TIMER_VECTOR_NOT_EMPTY;
 		}
 	}
 	init_deinit_lock.Unlock();
@@ -95,9 +82,9 @@ Timer::~Timer()
 #ifdef WINDOWS
 		KillTimer(NULL, m_timer_id);
 #endif //WINDOWS
-		if(m_timer_vector != NULL)
+		if(m_timer_map != NULL)
 		{
-			RemoveFromTimerVector(m_timer_id);
+			RemoveFromTimerMap(m_timer_id);
 		}
 	}
 }
@@ -133,7 +120,7 @@ unsigned int /*error code*/ Timer::Start()
 		return TIMER_ERROR_CANNOT_CREATE_TIMER;
 	}
 #endif //WINDOWS
-	return AddToTimerVector(this, m_timer_id);
+	return AddToTimerMap(this, m_timer_id);
 }
 
 unsigned int /*error code*/ Timer::Stop()
@@ -149,7 +136,7 @@ unsigned int /*error code*/ Timer::Stop()
 		TIMER_ERROR_CANNOT_DESTROY_TIMER;
 	}
 #endif //WINDOWS
-	unsigned int ret_val = RemoveFromTimerVector(m_timer_id);
+	unsigned int ret_val = RemoveFromTimerMap(m_timer_id);
 	m_timer_id = NULL;
 	return ret_val;
 }
@@ -157,7 +144,7 @@ unsigned int /*error code*/ Timer::Stop()
 #ifdef WINDOWS
 VOID CALLBACK Timer::TimerProcedure(HWND hwnd, UINT msg, UINT_PTR timer_id, DWORD time)
 {
-	Timer* _this = FindInTimerVector(timer_id);
+	Timer* _this = FindInTimerMap(timer_id);
 	if(_this != NULL)
 	{
 		if(_this->m_event != NULL)
@@ -172,71 +159,28 @@ VOID CALLBACK Timer::TimerProcedure(HWND hwnd, UINT msg, UINT_PTR timer_id, DWOR
 }
 #endif //WINDOWS
 
-unsigned int /*error code*/ Timer::AddToTimerVector(Timer* timer, Timer::TimerID timer_id)
+unsigned int /*error code*/ Timer::AddToTimerMap(Timer* timer, Timer::TimerID timer_id)
 {
 	ASSERT(timer != NULL);
 	ASSERT(timer_id != NULL);
-	unsigned int ret_val = UNDEFINED_ERROR;
-	bool ok = m_timer_vector->LockForWrite();
-	if(ok)
-	{
-		TimerEntry te;
-		te.m_timer = timer;
-		te.m_timer_id = timer_id;
-		m_timer_vector->PushBack(te);
-		m_timer_vector->Unlock();
-		ret_val = ERR_OK;
-	}
-	return ret_val;
+	m_timer_map->Set(timer_id, timer);
+	return ERR_OK;
 }
 
-unsigned int /*error code*/ Timer::RemoveFromTimerVector(Timer::TimerID timer_id)
+unsigned int /*error code*/ Timer::RemoveFromTimerMap(Timer::TimerID timer_id)
 {
 	ASSERT(timer_id != NULL);
-	unsigned int ret_val = UNDEFINED_ERROR;
-	bool ok = m_timer_vector->LockForWrite();
-	if(ok)
+	if(m_timer_map->Remove(timer_id) == false)
 	{
-		bool found = false;
-		for(TimerVector::Iterator it = m_timer_vector->Begin(); it.IsValid(); ++ it)
-		{
-			TimerEntry* te = it.operator Timer::TimerEntry *();
-			ASSERT(te != NULL);
-			if(te->m_timer_id == timer_id)
-			{
-				m_timer_vector->RemoveEntry(it);
-				ret_val = ERR_OK;
-				found = true;
-				break;
-			}
-		}
-		m_timer_vector->Unlock();
-		if(found == false)
-		{
-			ret_val = TIMER_ERROR_NOT_FOUND_IN_VECTOR;
-		}
+		return TIMER_ERROR_NOT_FOUND_IN_VECTOR;
 	}
-	return ret_val;
+	return ERR_OK;
 }
 
-Timer* Timer::FindInTimerVector(Timer::TimerID timer_id)
+Timer* Timer::FindInTimerMap(Timer::TimerID timer_id)
 {
 	Timer* ret_val = NULL;
-	bool ok = m_timer_vector->LockForWrite();
-	if(ok)
-	{
-		for(TimerVector::Iterator it = m_timer_vector->Begin(); it.IsValid(); ++ it)
-		{
-			TimerEntry* te = it.operator Timer::TimerEntry *();
-			ASSERT(te != NULL);
-			if(te->m_timer_id = timer_id)
-			{
-				ret_val = te->m_timer;
-				break;
-			}
-		}
-		m_timer_vector->Unlock();
-	}
+	m_timer_map->Find(timer_id, &ret_val);
 	return ret_val;
 }
 
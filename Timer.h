@@ -50,24 +50,13 @@ namespace SyncTL
 #else
 		typedef unsigned int TimerID;
 #endif //WINDOWS
-		struct TimerEntry
-		{
-			TimerEntry() :
-				m_timer_id(NULL),
-				m_timer(NULL)
-			{}
-			TimerID m_timer_id;
-			Timer* m_timer;
-		};
-		static const unsigned int TIMER_VECTOR_PREALLOC = 0x7F;
-		static unsigned int /*error code*/ AddToTimerVector(Timer* timer, TimerID timer_id);
-		static unsigned int /*error code*/ RemoveFromTimerVector(TimerID timer_id);
-		static Timer* FindInTimerVector(TimerID timer_id);
-		typedef Vector<TimerEntry> TimerVector;
-		static TimerVector* m_timer_vector;
-		//static QtReadWriteLock* m_timer_vector_lock; //to elimitnate dependency on Qt in non-qt projects
-		static SyncTL::ReadWriteLock* m_timer_vector_lock;
-		//SyncTL::SRWReadWriteLock m_timer_vector_lock;
+		static const unsigned int TIMER_MAP_PREALLOC = 0x7F;
+		static unsigned int /*error code*/ AddToTimerMap(Timer* timer, TimerID timer_id);
+		static unsigned int /*error code*/ RemoveFromTimerMap(TimerID timer_id);
+		static Timer* FindInTimerMap(TimerID timer_id);
+		//timer map is synchronized inside, timer procedure looks timers up there on every tick.
+		typedef HashMap<TimerID, Timer*> TimerMap;
+		static TimerMap* m_timer_map;
 		
 		TimerID m_timer_id;
 		Event* m_event;
@@ -39,13 +39,8 @@ UniformAllocator::UniformAllocator(unsigned int unit_size, unsigned int array_si
 
 UniformAllocator::~UniformAllocator()
 {
-	BasicList::Iterator it = m_array_list.Begin();
-	while (it.IsValid())
+	for (Array* array = m_array_list.PopFront(); array != NULL; array = m_array_list.PopFront())
 	{
-		Array* array = dynamic_cast<Array*>(it.operator BasicList::Entry *());//it.operator UniformAllocator::Array *();
-		++it;
-		ASSERT(array != NULL);
-		m_array_list.Remove(array);
 		DeleteArray(array);
 	}
 }
@@ -56,13 +51,11 @@ void* UniformAllocator::Alloc()
 	//SyncTL::LockGuard<true> lock_guard()
 	SyncTL::FastLockGuard lock_guard();
 	void* ret_val = NULL;
-	BasicList::Iterator it = m_array_list.Begin();
+	IntrusiveList<Array>::Iterator it = m_array_list.Begin();
 	Array* array = NULL;
 	while (it.IsValid())
 	{
-		Array* current_array = dynamic_cast<Array*>(it.operator BasicList::Entry *());
-			//(Array*)(it);
-			//it.operator UniformAllocator::Array *();
+		Array* current_array = it;
 		ASSERT(current_array != NULL);
 		if (current_array->GetFreeCount() > 0)
 		{
@@ -91,13 +84,11 @@ void UniformAllocator::Free(void* addr)
 	SyncTL::FastLockGuard lock_guard();
 	ASSERT(addr != NULL);
 	Array* array = NULL;
-	BasicList::Iterator it = m_array_list.Begin();
+	IntrusiveList<Array>::Iterator it = m_array_list.Begin();
 	Array* current_array = NULL;
 	while (it.IsValid())
 	{
-		BasicList::Entry* ble = it;
-		current_array = dynamic_cast<Array*>(ble);
-		//current_array = dynamic_cast<Array*>(it.operator BasicList::Entry *());
+		current_array = it;
 		ASSERT(current_array != NULL);
 		if (current_array->IsMyAllocation(addr) == true)
 		{
@@ -111,8 +102,8 @@ void UniformAllocator::Free(void* addr)
 		array->Free(addr);
 		if (array->GetFreeCount() == m_array_size)
 		{
-			m_array_list.Remove(it);
-			::Free((char*)array);
+			m_array_list.Remove(array);
+			DeleteArray(array);
 		}
 	}
 }
@@ -121,10 +112,10 @@ bool UniformAllocator::IsMyAllocation(void* addr) const
 {
 	//Synchronizer s(const_cast<CriticalSection*>(&m_cs));
 	SyncTL::FastLockGuard lock_guard();
-	BasicList::Iterator it = const_cast<BasicList&>(m_array_list).Begin();
+	IntrusiveList<Array>::Iterator it = const_cast<IntrusiveList<Array>&>(m_array_list).Begin();
 	while (it.IsValid())
 	{
-		Array* current_array = dynamic_cast<Array*>(it.operator BasicList::Entry *());
+		Array* current_array = it;
 		ASSERT(current_array != NULL);
 		if (current_array->IsMyAllocation(addr))
 		{
@@ -141,7 +132,8 @@ UniformAllocator::Array* UniformAllocator::CreateArray()
 	char* data = NULL;
 	ASSERT(m_unit_size > 0);
 	ASSERT(m_array_size > 0);
-	data = (char*)::Alloc(sizeof(Array) + ((sizeof(Allocation) + m_unit_size) * m_array_size));
+	//one block: the array, bits of free allocations and the allocations
+	data = (char*)::Alloc(Array::GetHeaderSize(m_array_size) + ((sizeof(Allocation) + m_unit_size) * m_array_size));
 	if (data == NULL)
 	{
 		throw Exception(ERR_CANNOT_ALLOC, L"Cannot create allocation array", EXC_HERE);
@@ -161,11 +153,12 @@ UniformAllocator::Array::Array(unsigned int unit_size, unsigned int count):
 	m_unit_size(unit_size),
 	m_count(count),
 	m_free_count(m_count),
-	m_nearest_free_index(0)
+	m_free_slots((Bitset::Word*)((char*)this + sizeof(Array)), count)
 {
 	ASSERT(m_unit_size > 0);
 	ASSERT(m_count > 0);
-	char* a_ptr = ((char*)this + sizeof(Array));
+	m_free_slots.SetAll();
+	char* a_ptr = GetArrayStart();
 	unsigned int index = 0;
 	while(index < count)
 	{
@@ -178,7 +171,7 @@ UniformAllocator::Array::Array(unsigned int unit_size, unsigned int count):
 UniformAllocator::Array::~Array()
 {
 	unsigned int index = 0;
-	char* a_ptr = (((char*)this) + sizeof(Array));
+	char* a_ptr = GetArrayStart();
 	while (index < m_count)
 	{
 		Allocation* a = (Allocation*)(a_ptr);
@@ -194,32 +187,15 @@ void* UniformAllocator::Array::Alloc()
 	Allocation* a = NULL;
 	if (GetFreeCount() > 0)
 	{
-		//char* a_ptr = GetArrayStart();
-		//a_ptr += (m_nearest_free_index * GetAbsoluteUnitSize());
-		//a = (Allocation*)a_ptr;
-		a = GetAllocation(m_nearest_free_index);
+		//free allocations are found in the bitset, 64 or 256 at a time, and not by their headers
+		unsigned int index = m_free_slots.FindFirstSet();
+		ASSERT(index < m_count);
+		m_free_slots.Reset(index);
+		a = GetAllocation(index);
 		ASSERT(a->GetIsFree() == true);
 		a->SetIsFree(false);
 		ret_val = a->GetDataPtr(); 	//pointer to data right behind the Allocation structure
-		bool free_allocation_found = false;
-		for (unsigned int index = m_nearest_free_index + 1; 
-			((index < m_count) && (free_allocation_found == false)); 
-			++index)
-		{
-			a = GetAllocation(index);
-			if (a->GetIsFree() == true)
-			{
-				m_nearest_free_index = index;
-				free_allocation_found = true;
-				ASSERT(GetAllocation(m_nearest_free_index)->GetIsFree() == true);
-			}
-		}
 		--m_free_count;
-		//if (free_allocation_found = false)
-		if(m_free_count == 0)
-		{
-			m_nearest_free_index = INVALID_FREE_INDEX;
-		}
 	}
 	return ret_val;
 }
@@ -234,12 +210,8 @@ void UniformAllocator::Array::Free(void* addr)
 	Allocation* a = GetAllocation((char*)addr);
 	a->SetIsFree(true);
 	unsigned int free_index = (((char*)addr - (char*)GetArrayStart()) / GetAbsoluteUnitSize());
-	if ((free_index <= m_nearest_free_index) || (m_nearest_free_index == INVALID_FREE_INDEX))
-	{
-		ASSERT(GetAllocation(free_index)->GetIsFree() == true);
-		m_nearest_free_index = free_index;
-	}
-	ASSERT(a->GetIsFree() == true);
-	ASSERT(GetAllocation(m_nearest_free_index)->GetIsFree() == true);
+	ASSERT(GetAllocation(free_index)->GetIsFree() == true);
+	ASSERT(m_free_slots.Test(free_index) == false);
+	m_free_slots.Set(free_index);
 	++m_free_count;
 }
\ No newline at end of file
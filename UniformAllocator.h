@@ -19,8 +19,7 @@ namespace SyncTL
 	public:
 		enum
 		{
-			DEFAULT_ARRAY_SIZE = 0xFF,
-			INVALID_FREE_INDEX = -1
+			DEFAULT_ARRAY_SIZE = 0xFF
 		};
 
 		enum
@@ -72,7 +71,7 @@ namespace SyncTL
 			char m_flags;
 		};
 
-		class Array : public virtual BasicList::Entry
+		class Array : public IntrusiveListHook<>
 		{
 		public:
 			Array(unsigned int unit_size, unsigned int count);
@@ -102,10 +101,15 @@ namespace SyncTL
 				}
 				return false;
 			}
+			//the header is the instance and the words of m_free_slots
+			static inline size_t GetHeaderSize(unsigned int count)
+			{
+				return sizeof(Array) + (Bitset::GetWordCount(count) * sizeof(Bitset::Word));
+			}
 		protected:
 			inline char* GetArrayStart() const
 			{
-				return(char*)this + sizeof(Array);
+				return(char*)this + GetHeaderSize(m_count);
 			}
 			inline char* GetArrayEnd() const
 			{
@@ -130,13 +134,13 @@ namespace SyncTL
 			unsigned int m_unit_size;
 			unsigned int m_count;
 			unsigned int m_free_count;
-			unsigned int m_nearest_free_index;
-		}; // and memory for allocation right after the end of array instance.
+			Bitset m_free_slots;	//a bit for each allocation, set if it is free. words are right after the instance.
+		}; // and memory for allocation right after the words of m_free_slots.
 
 		Array* CreateArray();
 		void DeleteArray(Array* array);
 
-		BasicList m_array_list;
+		IntrusiveList<Array> m_array_list;
 		unsigned int m_unit_size;
 		unsigned int m_array_size;
 		//CriticalSection m_cs;
@@ -225,6 +229,43 @@ namespace SyncTL
 		//void Free(void* addr);
 	};
 
+	//this lets collections which allocate entries one by one (e.g. HashMap) sit on UniformAllocator.
+	//unit size of the uniform allocator must be not less than entry size of the collection.
+	//UniformAllocator is not thread safe, so here is a lock. arrays are allocated by array_allocator.
+	class UniformEntryAllocator : public BasicHashMap::Allocator
+	{
+	public:
+		UniformEntryAllocator(UniformAllocator* ua,
+							  BasicVector::Allocator* array_allocator = BasicVector::GetDefaultAllocator()) :
+			m_ua(ua),
+			m_array_allocator(array_allocator)
+		{
+			ASSERT(m_ua != NULL);
+			ASSERT(m_array_allocator != NULL);
+		}
+		virtual ~UniformEntryAllocator()
+		{}
+		virtual char* AllocateDataArray(unsigned int entry_size, unsigned int count)
+			{ return m_array_allocator->AllocateDataArray(entry_size, count); }
+		virtual void FreeDataArray(char* data_array)
+			{ m_array_allocator->FreeDataArray(data_array); }
+		virtual void* AllocateEntry(unsigned int entry_size)
+		{
+			ASSERT(entry_size <= m_ua->GetUnitSize());
+			WriteSynchronizer sync(&m_lock);
+			return m_ua->Alloc();
+		}
+		virtual void FreeEntry(void* entry)
+		{
+			WriteSynchronizer sync(&m_lock);
+			m_ua->Free(entry);
+		}
+	protected:
+		UniformAllocator* m_ua;
+		BasicVector::Allocator* m_array_allocator;
+		SpinReadWriteLock m_lock;
+	};
+
 } //end namespace SyncTL
 
 #endif //UNIFORM_ALLOCATOR_H
\ No newline at end of file
@@ -143,11 +143,160 @@ void InternalOutputDebugMsg(const wchar_t* msg);
 //built-in "int" size depends on architecture.
 #define BIT_SIZEOF_INT	sizeof(int) << 3
 
+//SSE2 is always there on x64, on x86 it depends on compiler options.
+#if (defined _M_X64) || (defined _M_AMD64) || ((defined _M_IX86_FP) && (_M_IX86_FP >= 2)) || (defined __SSE2__)
+#define SYNCTL_SSE2
+#include <emmintrin.h>
+#endif //SSE2
+
+//x86 or x64, cpuid is there to check for optional instructions.
+#if (defined _M_IX86) || (defined _M_X64) || (defined _M_AMD64) || (defined __i386__) || (defined __x86_64__)
+#define SYNCTL_X86
+#endif //SYNCTL_X86
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif //_MSC_VER
+
+//index of the lowest set bit. value must not be 0.
+inline unsigned int CountTrailingZeros(unsigned int value)
+{
+#ifdef _MSC_VER
+	unsigned long ret_val = 0;
+	_BitScanForward(&ret_val, value);
+	return (unsigned int)ret_val;
+#else
+	return (unsigned int)__builtin_ctz(value);
+#endif //_MSC_VER
+}
+
+//number of set bits. POPCNT is a cpuid feature of it's own (SSE2 does not imply it) and MSVC's __popcnt
+//does not check for it, so this counts with arithmetic there. bit sets check for POPCNT at run time.
+inline unsigned int CountSetBits(unsigned int value)
+{
+#ifdef _MSC_VER
+	value = value - ((value >> 1) & 0x55555555);
+	value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
+	return (((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#else
+	return (unsigned int)__builtin_popcount(value);
+#endif //_MSC_VER
+}
+
+//index of the highest set bit. value must not be 0.
+inline unsigned int FindHighestBit(unsigned int value)
+{
+#ifdef _MSC_VER
+	unsigned long ret_val = 0;
+	_BitScanReverse(&ret_val, value);
+	return (unsigned int)ret_val;
+#else
+	return (unsigned int)(31 - __builtin_clz(value));
+#endif //_MSC_VER
+}
+
+//64 bit versions of the above, for bit sets
+inline unsigned int CountTrailingZeros64(unsigned long long value)
+{
+#if (defined _MSC_VER) && ((defined _M_X64) || (defined _M_AMD64))
+	unsigned long ret_val = 0;
+	_BitScanForward64(&ret_val, value);
+	return (unsigned int)ret_val;
+#elif defined (_MSC_VER)
+	unsigned int low = (unsigned int)value;
+	return ((low != 0) ? CountTrailingZeros(low) : 32 + CountTrailingZeros((unsigned int)(value >> 32)));
+#else
+	return (unsigned int)__builtin_ctzll(value);
+#endif //_MSC_VER
+}
+
+inline unsigned int CountSetBits64(unsigned long long value)
+{
+#ifdef _MSC_VER
+	return CountSetBits((unsigned int)value) + CountSetBits((unsigned int)(value >> 32));
+#else
+	return (unsigned int)__builtin_popcountll(value);
+#endif //_MSC_VER
+}
+
+enum CpuFeature
+{
+	CPU_FEATURE_SSE2 = 1,
+	CPU_FEATURE_AVX2 = 2,
+	CPU_FEATURE_POPCNT = 4
+};
+
+//CpuFeature flags of the cpu the program runs on, which may have more than the one it was built for.
+inline unsigned int DetectCpuFeatures()
+{
+	unsigned int ret_val = 0;
+#ifdef SYNCTL_SSE2
+	ret_val |= CPU_FEATURE_SSE2;
+#endif //SYNCTL_SSE2
+#ifdef SYNCTL_X86
+#if defined (_MSC_VER)
+	int info[4] = {0};
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 23)) != 0)
+	{
+		ret_val |= CPU_FEATURE_POPCNT;
+	}
+	//AVX registers are usable only if the system saves them (OSXSAVE and XCR0 bits)
+	bool avx_enabled = ((info[2] & (1 << 27)) != 0) && ((info[2] & (1 << 28)) != 0) && ((_xgetbv(0) & 6) == 6);
+	if (avx_enabled && (max_leaf >= 7))
+	{
+		__cpuidex(info, 7, 0);
+		if ((info[1] & (1 << 5)) != 0)
+		{
+			ret_val |= CPU_FEATURE_AVX2;
+		}
+	}
+#elif (defined __GNUC__) || (defined __clang__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("popcnt"))
+	{
+		ret_val |= CPU_FEATURE_POPCNT;
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		ret_val |= CPU_FEATURE_AVX2;
+	}
+#endif //_MSC_VER
+#endif //SYNCTL_X86
+	return ret_val;
+}
+
+//detects once
+inline unsigned int GetCpuFeatures()
+{
+	static const unsigned int features = DetectCpuFeatures();
+	return features;
+}
+
+//functions that read whole aligned blocks past the end of a string (that never crosses a page) are marked with it
+#if (defined __GNUC__) || (defined __clang__)
+#define SYNCTL_NO_SANITIZE_ADDRESS	__attribute__((no_sanitize_address))
+#else
+#define SYNCTL_NO_SANITIZE_ADDRESS
+#endif //__GNUC__
+
+//asks the cpu to bring the cache line of address in advance. it is only a hint, any address is fine.
+inline void Prefetch(const void* address)
+{
+#if defined (SYNCTL_SSE2)
+	_mm_prefetch((const char*)address, _MM_HINT_T0);
+#elif defined (__GNUC__)
+	__builtin_prefetch(address);
+#endif //SYNCTL_SSE2
+}
+
 template <typename CharType>
-unsigned int TStrLen(CharType* str)
+unsigned int TStrLen(const CharType* str)
 {
 	unsigned int ret_val(0);
-	while (*str != NULL)
+	while (str[ret_val] != 0)
 	{
 		++ret_val;
 	}
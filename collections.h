@@ -5,6 +5,10 @@
 
 #include "Utils.h"
 #include "Synchronization.h"
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 //Here is collections similar to those in Qt or STL. I decieded not to use any side collections in chess core
 //so it is independent to anything.
@@ -27,7 +31,12 @@ enum
 	UTILS_ERROR_CANNOT_REMOVE_NOT_IN_COLLECTION,
 	UTILS_ERROR_CANNOT_INSERT_NULL_ENTRY,
 	UTILS_ERROR_CANNOT_INSERT_ROOT_ALREADY_IS_SET,
-	UTILS_ERROR_CANNOT_INSERT_INVALID_PARENT
+	UTILS_ERROR_CANNOT_INSERT_INVALID_PARENT,
+	UTILS_ERROR_CANNOT_OPEN_FILE,
+	UTILS_ERROR_CANNOT_WRITE_FILE,
+	UTILS_ERROR_INVALID_SNAPSHOT,
+	UTILS_ERROR_UNSUPPORTED_MODE,
+	UTILS_ERROR_INVALID_ENCODING
 };
 
 class BasicVector
@@ -106,12 +115,38 @@ public:
 			GetEntry(index, &ret_val);
 			return ret_val;
 		}
+	//non-const access detaches a shared buffer, see EnableSharing
+	char* operator [] (unsigned int index)
+		{
+			Detach();
+			char* ret_val = NULL;
+			GetEntry(index, &ret_val);
+			return ret_val;
+		}
 	BasicVector& operator = (const BasicVector& another);
 	unsigned int GetCount() const
 		{ return m_count; }
 	Iterator Begin();
 	//no End(), instead use Iterator::IsValid().
 	Iterator Last();	//returns iterator to the last element.
+	/*with sharing, copies of the vector share one buffer with a reference counter instead of copying entries,
+	so a copy costs one atomic increment. the first change of a copy (insert, remove, clear, non-const access,
+	iterators) copies the buffer if somebody else still shares it. copies of a sharing vector share as well.
+	entries of a shared buffer must be changed only through a detached vector.
+	non-const access and iterators take the write lock to copy a buffer that is really shared, so they must not be
+	used under the read lock of the vector. readers use GetData or the const operator [] instead.*/
+	void EnableSharing(bool enable);
+	bool IsSharingEnabled() const
+		{ return m_sharing_enabled; }
+	//makes the buffer of this vector it's own, if it is shared. the write lock is taken only then.
+	void Detach();
+	//entries as one array. a shared buffer is not copied, so it is for reading only,
+	//under the read lock of the vector. NULL if the vector has no buffer.
+	const char* GetData() const
+		{ return m_data; }
+	//locks the vector for write and detaches it, so entries may be changed in place through the returned array
+	//until Unlock. it is for algorithms that go through the whole array, like ParallelSort.
+	char* LockEntries();
 	bool LockForRead();
 	bool LockForWrite();
 	void Unlock();
@@ -126,6 +161,21 @@ protected:
 	//this method is a placeholder for destructor call. in thes implementation it does nothing
 	//as long as this class treats stored data as just an array of bytes.
 	virtual void DeinitEntry(char* entry);
+	enum
+	{
+		SHARED_HEADER_SIZE = 16	//reference counter before entries of a shared buffer, keeps entries aligned
+	};
+	//with sharing, buffers start with a reference counter
+	std::atomic<unsigned int>* GetRefCount(char* data) const
+		{ return (std::atomic<unsigned int>*)(data - SHARED_HEADER_SIZE); }
+	bool IsBufferShared() const
+		{ return (m_sharing_enabled && (m_data != NULL) && (GetRefCount(m_data)->load(std::memory_order_acquire) > 1)); }
+	char* AllocateBuffer(unsigned int n_entries);
+	//frees the buffer or, if it is shared, just releases it
+	void ReleaseBuffer(char* data);
+	//like ReleaseBuffer, but the last owner also deinits count entries before freeing
+	void ReleaseEntries(char* data, unsigned int count);
+	void InternalDetach();
 	const unsigned int m_allocator_increment = 4;//debug only, will be 64;	//in terms of entries, not bytes
 	unsigned int m_entry_size;
 	unsigned int m_data_array_size;	//in terms of entries, not bytes.
@@ -133,8 +183,603 @@ protected:
 	unsigned int m_count;
 	Allocator* m_allocator;
 	BasicReadWriteLock* m_rw_lock;
+	bool m_sharing_enabled;
+};
+
+//scan kernels for arrays of numbers. they use AVX2 if the cpu has it, SSE2 otherwise.
+//Find returns index of the first value, or count if there is no value.
+unsigned int FindValue(const int* data, unsigned int count, int value);
+unsigned int FindValue(const unsigned int* data, unsigned int count, unsigned int value);
+unsigned int FindValue(const long long* data, unsigned int count, long long value);
+unsigned int FindValue(const unsigned long long* data, unsigned int count, unsigned long long value);
+unsigned int FindValue(const float* data, unsigned int count, float value);
+unsigned int FindValue(const double* data, unsigned int count, double value);
+unsigned int CountValue(const int* data, unsigned int count, int value);
+unsigned int CountValue(const unsigned int* data, unsigned int count, unsigned int value);
+unsigned int CountValue(const long long* data, unsigned int count, long long value);
+unsigned int CountValue(const unsigned long long* data, unsigned int count, unsigned long long value);
+unsigned int CountValue(const float* data, unsigned int count, float value);
+unsigned int CountValue(const double* data, unsigned int count, double value);
+//false if count is 0
+bool FindMinMax(const int* data, unsigned int count, int* out_min, int* out_max);
+bool FindMinMax(const unsigned int* data, unsigned int count, unsigned int* out_min, unsigned int* out_max);
+bool FindMinMax(const long long* data, unsigned int count, long long* out_min, long long* out_max);
+bool FindMinMax(const unsigned long long* data, unsigned int count, unsigned long long* out_min,
+				unsigned long long* out_max);
+bool FindMinMax(const float* data, unsigned int count, float* out_min, float* out_max);
+bool FindMinMax(const double* data, unsigned int count, double* out_min, double* out_max);
+long long SumValues(const int* data, unsigned int count);
+unsigned long long SumValues(const unsigned int* data, unsigned int count);
+long long SumValues(const long long* data, unsigned int count);
+unsigned long long SumValues(const unsigned long long* data, unsigned int count);
+double SumValues(const float* data, unsigned int count);
+double SumValues(const double* data, unsigned int count);
+
+//algorithms of Vector. this ones are plain loops for any DataType with == and <,
+//specializations below send numbers and pointers to the kernels.
+template <class DataType>
+struct VectorAlgorithms
+{
+	typedef DataType SumType;
+	static unsigned int Find(const DataType* data, unsigned int count, const DataType& value)
+	{
+		unsigned int index = 0;
+		while ((index < count) && ((data[index] == value) == false))
+		{
+			++index;
+		}
+		return index;
+	}
+	static unsigned int Count(const DataType* data, unsigned int count, const DataType& value)
+	{
+		unsigned int ret_val = 0;
+		for (unsigned int index = 0; index < count; ++index)
+		{
+			if (data[index] == value)
+			{
+				++ret_val;
+			}
+		}
+		return ret_val;
+	}
+	static bool MinMax(const DataType* data, unsigned int count, DataType* out_min, DataType* out_max)
+	{
+		if (count == 0)
+		{
+			return false;
+		}
+		unsigned int min_index = 0;
+		unsigned int max_index = 0;
+		for (unsigned int index = 1; index < count; ++index)
+		{
+			if (data[index] < data[min_index])
+			{
+				min_index = index;
+			}
+			if (data[max_index] < data[index])
+			{
+				max_index = index;
+			}
+		}
+		*out_min = data[min_index];
+		*out_max = data[max_index];
+		return true;
+	}
+	static SumType Sum(const DataType* data, unsigned int count)
+	{
+		SumType ret_val = SumType();
+		for (unsigned int index = 0; index < count; ++index)
+		{
+			ret_val += data[index];
+		}
+		return ret_val;
+	}
+};
+
+template <class DataType, class SumValueType>
+struct KernelVectorAlgorithms
+{
+	typedef SumValueType SumType;
+	static unsigned int Find(const DataType* data, unsigned int count, const DataType& value)
+		{ return FindValue(data, count, value); }
+	static unsigned int Count(const DataType* data, unsigned int count, const DataType& value)
+		{ return CountValue(data, count, value); }
+	static bool MinMax(const DataType* data, unsigned int count, DataType* out_min, DataType* out_max)
+		{ return FindMinMax(data, count, out_min, out_max); }
+	static SumType Sum(const DataType* data, unsigned int count)
+		{ return SumValues(data, count); }
+};
+
+template <>
+struct VectorAlgorithms<int>: public KernelVectorAlgorithms<int, long long> {};
+template <>
+struct VectorAlgorithms<unsigned int>: public KernelVectorAlgorithms<unsigned int, unsigned long long> {};
+template <>
+struct VectorAlgorithms<long long>: public KernelVectorAlgorithms<long long, long long> {};
+template <>
+struct VectorAlgorithms<unsigned long long>: public KernelVectorAlgorithms<unsigned long long, unsigned long long> {};
+template <>
+struct VectorAlgorithms<float>: public KernelVectorAlgorithms<float, double> {};
+template <>
+struct VectorAlgorithms<double>: public KernelVectorAlgorithms<double, double> {};
+
+//pointers are compared as unsigned numbers of the same size. they have no Sum.
+template <class DataType>
+struct VectorAlgorithms<DataType*>
+{
+	typedef typename std::conditional<sizeof(DataType*) == sizeof(unsigned long long),
+									  unsigned long long, unsigned int>::type NumberType;
+	static unsigned int Find(DataType* const* data, unsigned int count, DataType* value)
+		{ return FindValue((const NumberType*)data, count, (NumberType)value); }
+	static unsigned int Count(DataType* const* data, unsigned int count, DataType* value)
+		{ return CountValue((const NumberType*)data, count, (NumberType)value); }
+	static bool MinMax(DataType* const* data, unsigned int count, DataType** out_min, DataType** out_max)
+		{ return FindMinMax((const NumberType*)data, count, (NumberType*)out_min, (NumberType*)out_max); }
+};
+
+//ordering for sorting and for BPlusTreeMap and BPlusTreeSet keys, specialize it for types without operator <.
+template <class KeyType>
+struct LessFunction
+{
+	static bool Less(const KeyType& left, const KeyType& right)
+		{ return (left < right); }
+};
+
+enum
+{
+	SORT_INSERTION_MAX = 24,	//ranges up to this size are sorted by insertion
+	SORT_NINTHER_MIN = 128,		//pivots of bigger ranges are medians of three medians of three
+	SORT_PARTIAL_INSERTION_LIMIT = 8,	//entries moved before insertion sort of a partitioned range gives up
+	SORT_RADIX_MIN = 256		//smaller arrays of numbers are sorted by comparisons
+};
+
+//LSD radix sort of numbers by bytes, stable. bytes that are the same in all numbers are skipped.
+//floating point numbers are ordered by their bits: -0 is before +0, NaNs are at the ends.
+void RadixSort(int* data, unsigned int count);
+void RadixSort(unsigned int* data, unsigned int count);
+void RadixSort(long long* data, unsigned int count);
+void RadixSort(unsigned long long* data, unsigned int count);
+void RadixSort(float* data, unsigned int count);
+void RadixSort(double* data, unsigned int count);
+
+/*sorting by comparisons in place. Compare is like LessFunction and must not throw, DataType must be movable.
+Sort is introsort in the style of pdqsort: medians of three (of nine for big ranges) are pivots, small ranges are
+sorted by insertion, a partition that moved nothing is finished by insertion sort if it is nearly sorted, runs of
+entries equal to the pivot are put aside at once, and heap sort takes over after too many unbalanced partitions,
+so it is O(n log n) at worst. StableSort is merge sort with a buffer for half of the entries.*/
+template <class DataType, class Compare>
+struct ComparisonSort
+{
+	static void Sort(DataType* data, unsigned int count)
+	{
+		if (count > 1)
+		{
+			SortLoop(data, data + count, FindHighestBit(count), true);
+		}
+	}
+	static void StableSort(DataType* data, unsigned int count)
+	{
+		if (count <= SORT_INSERTION_MAX)
+		{
+			InsertionSort(data, data + count);
+			return;
+		}
+		DataType* buffer = (DataType*)BasicVector::GetDefaultAllocator()->AllocateDataArray(sizeof(DataType),
+																							  count / 2);
+		if (buffer == NULL)
+		{
+			throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+				L"Cannot allocate buffer for merge sort",
+				EXC_HERE);
+		}
+		MergeSort(data, data + count, buffer);
+		BasicVector::GetDefaultAllocator()->FreeDataArray((char*)buffer);
+	}
+	//the smallest sorted_count entries are sorted at the beginning, the rest are in no particular order
+	static void PartialSort(DataType* data, unsigned int count, unsigned int sorted_count)
+	{
+		if (sorted_count >= count)
+		{
+			Sort(data, count);
+			return;
+		}
+		if (sorted_count == 0)
+		{
+			return;
+		}
+		//heap of the smallest entries so far, with the biggest of them on top
+		MakeHeap(data, sorted_count);
+		for (unsigned int index = sorted_count; index < count; ++index)
+		{
+			if (Compare::Less(data[index], data[0]))
+			{
+				std::swap(data[index], data[0]);
+				SiftDown(data, 0, sorted_count);
+			}
+		}
+		SortHeap(data, sorted_count);
+	}
+	//puts the entry that would be at index in the sorted array there, entries before it are not bigger
+	//and entries after it are not smaller
+	static void NthElement(DataType* data, unsigned int count, unsigned int index)
+	{
+		ASSERT(index < count);
+		DataType* begin = data;
+		DataType* end = data + count;
+		DataType* nth = data + index;
+		unsigned int bad_allowed = FindHighestBit(count);
+		while (end - begin > SORT_INSERTION_MAX)
+		{
+			unsigned int size = (unsigned int)(end - begin);
+			ChoosePivot(begin, end);
+			if ((begin != data) && (Compare::Less(*(begin - 1), *begin) == false))
+			{
+				//entries equal to the previous pivot, which is not bigger than anything here
+				DataType* pivot = PartitionLeft(begin, end);
+				if (nth <= pivot)
+				{
+					return;
+				}
+				begin = pivot + 1;
+				continue;
+			}
+			bool already_partitioned = false;
+			DataType* pivot = PartitionRight(begin, end, &already_partitioned);
+			unsigned int left_size = (unsigned int)(pivot - begin);
+			unsigned int right_size = (unsigned int)(end - (pivot + 1));
+			if (((left_size < size / 8) || (right_size < size / 8)) && (--bad_allowed == 0))
+			{
+				PartialSort(begin, size, (unsigned int)(nth - begin) + 1);
+				return;
+			}
+			if (pivot == nth)
+			{
+				return;
+			}
+			if (nth < pivot)
+			{
+				end = pivot;
+			} else {
+				begin = pivot + 1;
+			}
+		}
+		InsertionSort(begin, end);
+	}
+protected:
+	static void SortLoop(DataType* begin, DataType* end, unsigned int bad_allowed, bool leftmost)
+	{
+		while (true)
+		{
+			unsigned int size = (unsigned int)(end - begin);
+			if (size <= SORT_INSERTION_MAX)
+			{
+				InsertionSort(begin, end);
+				return;
+			}
+			ChoosePivot(begin, end);
+			//an entry before a range that is not leftmost is a pivot from before, it is not bigger than anything
+			//here. if it is equal to the new pivot, all the entries equal to it are put aside at once.
+			if ((leftmost == false) && (Compare::Less(*(begin - 1), *begin) == false))
+			{
+				begin = PartitionLeft(begin, end) + 1;
+				continue;
+			}
+			bool already_partitioned = false;
+			DataType* pivot = PartitionRight(begin, end, &already_partitioned);
+			unsigned int left_size = (unsigned int)(pivot - begin);
+			unsigned int right_size = (unsigned int)(end - (pivot + 1));
+			if ((left_size < size / 8) || (right_size < size / 8))
+			{
+				--bad_allowed;
+				if (bad_allowed == 0)
+				{
+					HeapSort(begin, end);
+					return;
+				}
+				//breaks patterns which made the partition unbalanced
+				if (left_size >= SORT_INSERTION_MAX)
+				{
+					std::swap(begin[0], begin[left_size / 4]);
+					std::swap(pivot[-1], pivot[-(int)(left_size / 4)]);
+				}
+				if (right_size >= SORT_INSERTION_MAX)
+				{
+					std::swap(pivot[1], pivot[1 + right_size / 4]);
+					std::swap(end[-1], end[-(int)(right_size / 4)]);
+				}
+			} else if (already_partitioned && PartialInsertionSort(begin, pivot) &&
+					   PartialInsertionSort(pivot + 1, end))
+			{
+				return;
+			}
+			//the smaller side is sorted recursively, so the recursion is not deeper than log(n)
+			if (left_size < right_size)
+			{
+				SortLoop(begin, pivot, bad_allowed, leftmost);
+				begin = pivot + 1;
+				leftmost = false;
+			} else {
+				SortLoop(pivot + 1, end, bad_allowed, false);
+				end = pivot;
+			}
+		}
+	}
+	static void Sort2(DataType* a, DataType* b)
+	{
+		if (Compare::Less(*b, *a))
+		{
+			std::swap(*a, *b);
+		}
+	}
+	static void Sort3(DataType* a, DataType* b, DataType* c)
+	{
+		Sort2(a, b);
+		Sort2(b, c);
+		Sort2(a, b);
+	}
+	//puts the pivot to *begin. an entry not smaller than it stays at the end and an entry not bigger than it
+	//stays inside, partitions rely on them instead of checking bounds.
+	static void ChoosePivot(DataType* begin, DataType* end)
+	{
+		unsigned int size = (unsigned int)(end - begin);
+		DataType* middle = begin + size / 2;
+		if (size > SORT_NINTHER_MIN)
+		{
+			Sort3(begin, middle, end - 1);
+			Sort3(begin + 1, middle - 1, end - 2);
+			Sort3(begin + 2, middle + 1, end - 3);
+			Sort3(middle - 1, middle, middle + 1);
+			std::swap(*begin, *middle);
+		} else {
+			Sort3(middle, begin, end - 1);
+		}
+	}
+	//entries less than the pivot go to the left of it, the rest to the right. returns the pivot position.
+	static DataType* PartitionRight(DataType* begin, DataType* end, bool* out_already_partitioned)
+	{
+		DataType pivot(std::move(*begin));
+		DataType* first = begin;
+		DataType* last = end;
+		while (Compare::Less(*++first, pivot))
+		{}
+		if (first - 1 == begin)
+		{
+			while ((first < last) && (Compare::Less(*--last, pivot) == false))
+			{}
+		} else {
+			while (Compare::Less(*--last, pivot) == false)
+			{}
+		}
+		*out_already_partitioned = (first >= last);
+		while (first < last)
+		{
+			std::swap(*first, *last);
+			while (Compare::Less(*++first, pivot))
+			{}
+			while (Compare::Less(*--last, pivot) == false)
+			{}
+		}
+		DataType* pivot_position = first - 1;
+		*begin = std::move(*pivot_position);
+		*pivot_position = std::move(pivot);
+		return pivot_position;
+	}
+	//entries not bigger than the pivot go to the left of it, bigger ones to the right
+	static DataType* PartitionLeft(DataType* begin, DataType* end)
+	{
+		DataType pivot(std::move(*begin));
+		DataType* first = begin;
+		DataType* last = end;
+		while (Compare::Less(pivot, *--last))
+		{}
+		if (last + 1 == end)
+		{
+			while ((first < last) && (Compare::Less(pivot, *++first) == false))
+			{}
+		} else {
+			while (Compare::Less(pivot, *++first) == false)
+			{}
+		}
+		while (first < last)
+		{
+			std::swap(*first, *last);
+			while (Compare::Less(pivot, *--last))
+			{}
+			while (Compare::Less(pivot, *++first) == false)
+			{}
+		}
+		*begin = std::move(*last);
+		*last = std::move(pivot);
+		return last;
+	}
+	static void InsertionSort(DataType* begin, DataType* end)
+	{
+		if (begin == end)
+		{
+			return;
+		}
+		for (DataType* current = begin + 1; current != end; ++current)
+		{
+			if (Compare::Less(*current, *(current - 1)))
+			{
+				DataType tmp(std::move(*current));
+				DataType* hole = current;
+				do
+				{
+					*hole = std::move(*(hole - 1));
+					--hole;
+				} while ((hole != begin) && Compare::Less(tmp, *(hole - 1)));
+				*hole = std::move(tmp);
+			}
+		}
+	}
+	//insertion sort which gives up after SORT_PARTIAL_INSERTION_LIMIT moves. returns true if the range is sorted.
+	static bool PartialInsertionSort(DataType* begin, DataType* end)
+	{
+		if (begin == end)
+		{
+			return true;
+		}
+		unsigned int moved = 0;
+		for (DataType* current = begin + 1; current != end; ++current)
+		{
+			if (Compare::Less(*current, *(current - 1)))
+			{
+				DataType tmp(std::move(*current));
+				DataType* hole = current;
+				do
+				{
+					*hole = std::move(*(hole - 1));
+					--hole;
+				} while ((hole != begin) && Compare::Less(tmp, *(hole - 1)));
+				*hole = std::move(tmp);
+				moved += (unsigned int)(current - hole);
+				if (moved > SORT_PARTIAL_INSERTION_LIMIT)
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+	static void SiftDown(DataType* heap, unsigned int index, unsigned int count)
+	{
+		DataType tmp(std::move(heap[index]));
+		while (true)
+		{
+			unsigned int child = 2 * index + 1;
+			if (child >= count)
+			{
+				break;
+			}
+			if ((child + 1 < count) && Compare::Less(heap[child], heap[child + 1]))
+			{
+				++child;
+			}
+			if (Compare::Less(tmp, heap[child]) == false)
+			{
+				break;
+			}
+			heap[index] = std::move(heap[child]);
+			index = child;
+		}
+		heap[index] = std::move(tmp);
+	}
+	static void MakeHeap(DataType* heap, unsigned int count)
+	{
+		for (unsigned int index = count / 2; index > 0; --index)
+		{
+			SiftDown(heap, index - 1, count);
+		}
+	}
+	static void SortHeap(DataType* heap, unsigned int count)
+	{
+		while (count > 1)
+		{
+			--count;
+			std::swap(heap[0], heap[count]);
+			SiftDown(heap, 0, count);
+		}
+	}
+	static void HeapSort(DataType* begin, DataType* end)
+	{
+		MakeHeap(begin, (unsigned int)(end - begin));
+		SortHeap(begin, (unsigned int)(end - begin));
+	}
+	//buffer is raw memory for half of the range
+	static void MergeSort(DataType* begin, DataType* end, DataType* buffer)
+	{
+		unsigned int count = (unsigned int)(end - begin);
+		if (count <= SORT_INSERTION_MAX)
+		{
+			InsertionSort(begin, end);
+			return;
+		}
+		DataType* middle = begin + count / 2;
+		MergeSort(begin, middle, buffer);
+		MergeSort(middle, end, buffer);
+		if (Compare::Less(*middle, *(middle - 1)) == false)
+		{
+			return;	//halves are in order already
+		}
+		//the left half goes to the buffer and is merged back with the right one
+		unsigned int left_count = (unsigned int)(middle - begin);
+		for (unsigned int index = 0; index < left_count; ++index)
+		{
+			new (buffer + index) DataType(std::move(begin[index]));
+		}
+		DataType* left = buffer;
+		DataType* left_end = buffer + left_count;
+		DataType* right = middle;
+		DataType* out = begin;
+		while ((left != left_end) && (right != end))
+		{
+			if (Compare::Less(*right, *left))
+			{
+				*out = std::move(*right);
+				++right;
+			} else {
+				*out = std::move(*left);
+				++left;
+			}
+			++out;
+		}
+		while (left != left_end)
+		{
+			*out = std::move(*left);
+			++left;
+			++out;
+		}
+		for (unsigned int index = 0; index < left_count; ++index)
+		{
+			buffer[index].~DataType();
+		}
+	}
+};
+
+//sorting of Vector, by comparisons unless it is specialized
+template <class DataType, class Compare>
+struct SortAlgorithms: public ComparisonSort<DataType, Compare> {};
+
+//numbers in the default order are sorted by RadixSort, which is stable and does not compare
+template <class DataType>
+struct RadixSortAlgorithms: public ComparisonSort<DataType, LessFunction<DataType> >
+{
+	typedef ComparisonSort<DataType, LessFunction<DataType> > BaseClass;
+	static void Sort(DataType* data, unsigned int count)
+	{
+		if (count < SORT_RADIX_MIN)
+		{
+			BaseClass::Sort(data, count);
+		} else {
+			RadixSort(data, count);
+		}
+	}
+	static void StableSort(DataType* data, unsigned int count)
+	{
+		if (count < SORT_RADIX_MIN)
+		{
+			BaseClass::StableSort(data, count);
+		} else {
+			RadixSort(data, count);
+		}
+	}
 };
 
+template <>
+struct SortAlgorithms<int, LessFunction<int> >: public RadixSortAlgorithms<int> {};
+template <>
+struct SortAlgorithms<unsigned int, LessFunction<unsigned int> >: public RadixSortAlgorithms<unsigned int> {};
+template <>
+struct SortAlgorithms<long long, LessFunction<long long> >: public RadixSortAlgorithms<long long> {};
+template <>
+struct SortAlgorithms<unsigned long long, LessFunction<unsigned long long> >:
+	public RadixSortAlgorithms<unsigned long long> {};
+template <>
+struct SortAlgorithms<float, LessFunction<float> >: public RadixSortAlgorithms<float> {};
+template <>
+struct SortAlgorithms<double, LessFunction<double> >: public RadixSortAlgorithms<double> {};
+
 template <class DataType>
 class Vector: public BasicVector
 {
@@ -154,7 +799,8 @@ public:
 	};
 	enum
 	{
-		DEFAULT_PREALLOCATED = 0xff
+		DEFAULT_PREALLOCATED = 0xff,
+		NOT_FOUND = 0xFFFFFFFF
 	};
 	Vector(BasicReadWriteLock* lock = NULL):
 		BasicVector(lock)
@@ -176,13 +822,22 @@ public:
 				EXC_HERE);
 		}
 	}
+	DataType& operator [] (unsigned int index)
+	{
+		Detach();
+		return (*(const Vector*)this)[index];
+	}
 	void Insert(unsigned int index, const DataType* data)
 		{ BasicVector::InsertEntry(index, (const char*)data); }
 	//
 	Iterator Begin()
-		{ return Iterator(0, this);	}
+	{
+		Detach();
+		return Iterator(0, this);
+	}
 	Iterator Last()
 	{
+		Detach();
 		if (m_count == 0)
 		{
 			return Iterator(0, this);
@@ -209,6 +864,80 @@ public:
 		{ RemoveEntry(0); }
 	void PopBack()
 		{ RemoveEntry(GetCount() - 1); }
+	/*this methods lock the vector once and go through entries in place, see VectorAlgorithms.
+	int, unsigned int, long long, unsigned long long, float, double and pointers are scanned with SSE2 or AVX2.*/
+	//index of the first value starting from from, or NOT_FOUND
+	unsigned int Find(const DataType& value, unsigned int from = 0) const
+	{
+		ReadSynchronizer sync(m_rw_lock);
+		if (from >= m_count)
+		{
+			return NOT_FOUND;
+		}
+		const DataType* data = (const DataType*)m_data;
+		unsigned int index = from + VectorAlgorithms<DataType>::Find(data + from, m_count - from, value);
+		return ((index < m_count) ? index : NOT_FOUND);
+	}
+	unsigned int Count(const DataType& value) const
+	{
+		ReadSynchronizer sync(m_rw_lock);
+		return VectorAlgorithms<DataType>::Count((const DataType*)m_data, m_count, value);
+	}
+	bool Contains(const DataType& value) const
+		{ return (Find(value) != NOT_FOUND); }
+	//false if the vector is empty. with NaNs among floating point entries results are undefined.
+	bool GetMinMax(DataType* out_min, DataType* out_max) const
+	{
+		ReadSynchronizer sync(m_rw_lock);
+		return VectorAlgorithms<DataType>::MinMax((const DataType*)m_data, m_count, out_min, out_max);
+	}
+	//integers are summed in 64 bits, floating point numbers in double and not in the order of entries
+	template <class Algorithms = VectorAlgorithms<DataType> >
+	typename Algorithms::SumType Sum() const
+	{
+		ReadSynchronizer sync(m_rw_lock);
+		return Algorithms::Sum((const DataType*)m_data, m_count);
+	}
+	//this methods sort entries in place under one write lock, see SortAlgorithms.
+	//Compare is like LessFunction, other orders are given as Sort<MyCompare>().
+	template <class Compare = LessFunction<DataType> >
+	void Sort()
+	{
+		WriteSynchronizer sync(m_rw_lock);
+		InternalDetach();
+		SortAlgorithms<DataType, Compare>::Sort((DataType*)m_data, m_count);
+	}
+	//equal entries keep their order
+	template <class Compare = LessFunction<DataType> >
+	void StableSort()
+	{
+		WriteSynchronizer sync(m_rw_lock);
+		InternalDetach();
+		SortAlgorithms<DataType, Compare>::StableSort((DataType*)m_data, m_count);
+	}
+	//only the smallest sorted_count entries are sorted, they are at the beginning
+	template <class Compare = LessFunction<DataType> >
+	void PartialSort(unsigned int sorted_count)
+	{
+		WriteSynchronizer sync(m_rw_lock);
+		InternalDetach();
+		SortAlgorithms<DataType, Compare>::PartialSort((DataType*)m_data, m_count, sorted_count);
+	}
+	//puts the entry that would be at index after sorting there, with smaller ones before it and bigger after it.
+	//this method throws exceptions
+	template <class Compare = LessFunction<DataType> >
+	void NthElement(unsigned int index)
+	{
+		WriteSynchronizer sync(m_rw_lock);
+		if (index >= m_count)
+		{
+			throw Exception(UTILS_ERROR_INDEX_BIGGER_THAN_ARRAY_SIZE,
+				L"Cannot select vector entry because index is bigger than vector size",
+				EXC_HERE);
+		}
+		InternalDetach();
+		SortAlgorithms<DataType, Compare>::NthElement((DataType*)m_data, m_count, index);
+	}
 	DataType* Front() const
 	{
 		if (m_count == NULL)
@@ -246,861 +975,5365 @@ protected:
 	}
 };
 
+//string helpers for String. char and wchar_t versions go through 16 bytes at a time with SSE2,
+//other character types are handled one by one.
+unsigned int StringLength(const char* str);
+unsigned int StringLength(const wchar_t* str);
 template <class CharType>
-class String : public Vector<CharType>
+unsigned int StringLength(const CharType* str)
+	{ return TStrLen(str); }
+//index of the first ch in str[0, length), or length if there is no ch.
+unsigned int FindChar(const char* str, unsigned int length, char ch);
+unsigned int FindChar(const wchar_t* str, unsigned int length, wchar_t ch);
+template <class CharType>
+unsigned int FindChar(const CharType* str, unsigned int length, CharType ch)
 {
-	typedef Vector<CharType> BaseClass;
-public:
-	#define STRING_DEFAULT_PARAMS BasicVector::GetDefaultAllocator(), NULL
-	String(const CharType* str, BaseClass::Allocator* allocator, BasicReadWriteLock* lock):
-		Vector<CharType>::Vector(lock)
+	unsigned int index = 0;
+	while ((index < length) && (str[index] != ch))
 	{
-		unsigned int length = TStrLen(str);
-		unsigned int index = 0;
-		while (index < length)
-		{
-			BaseClass::PushBack(str[index]);
-			++index;
-		}
+		++index;
 	}
-	const CharType* GetCString() const
+	return index;
+}
+//index of the first byte that differs, or size if there is no such byte.
+size_t FindMismatch(const char* first, const char* second, size_t size);
+template <class CharType>
+int CompareChars(const CharType* first, const CharType* second, unsigned int length)
+{
+	size_t mismatch = FindMismatch((const char*)first, (const char*)second, length * sizeof(CharType));
+	if (mismatch == length * sizeof(CharType))
 	{
-		return m_data; 
+		return 0;
 	}
-protected:
-	CharType* m_data;
-};
-
-typedef String<wchar_t>  WString;
-typedef String<char>	 AString;
-
-class BasicStack : public BasicVector
-{
-public:
-	BasicStack(BasicReadWriteLock* lock):
-		BasicVector(lock)
-	{}
-	BasicStack(unsigned int entry_size, unsigned int n_preallocated, Allocator* allocator, BasicReadWriteLock* lock = NULL) :
-		BasicVector(entry_size, n_preallocated, allocator, lock)
-		{}
-	void PushFront(const char* data);
-	void PushBack(const char* data);
-	void PopFront();
-	void PopBack();
-	char* Top();
-};
+	unsigned int index = (unsigned int)(mismatch / sizeof(CharType));
+	return ((first[index] < second[index]) ? -1 : 1);
+}
 
-template <class DataType>
-class Stack : public BasicStack
+/*string with the terminating zero. short strings are kept inside the object, so they cost no allocation,
+longer ones are in a buffer that grows at least twice when it is full. length is stored, so GetLength is O(1).
+CharType must be a plain character type, characters are moved as bytes. WString and AString are the usual ones.*/
+template <class CharType>
+class String
 {
 public:
-	class Iterator : public BasicStack::Iterator
+	enum
 	{
-	public:
-		Iterator(unsigned int index, Stack* stack):
-			BasicStack::Iterator(index, stack)
-		{}
-		Iterator(const BasicVector::Iterator& src):
-			BasicStack::Iterator(src)
-		{}
-		operator DataType*()
-		{
-			char* ret_val = Data();
-			return reinterpret_cast<DataType*>(ret_val);
-		}
+		INLINE_CAPACITY = (24 / sizeof(CharType)) - 1,	//characters kept inside, without the terminating zero
+		NOT_FOUND = 0xFFFFFFFF
 	};
-
-	Stack(BasicReadWriteLock* lock = NULL):
-		BasicStack(lock)
-	{}
-	Stack(unsigned int n_preallocated, Allocator* allocator, BasicReadWriteLock* lock = NULL) :
-		BasicStack(sizeof(DataType), n_preallocated, allocator, lock)
-	{}
-	void PushFront(const DataType& data)
-		{ BasicStack::PushFront((const char*)&data); }
-	void PushBack(const DataType& data)
-		{ BasicStack::PushBack((const char*)&data); }
-	//pop front and back are in BasicStack, no need to overload them here.
-	DataType& GetTop()
+	String():
+		m_data(m_inline),
+		m_length(0),
+		m_capacity(INLINE_CAPACITY)
 	{
-		DataType* top = (DataType*)(Top());
-		if (top != NULL)
+		m_inline[0] = 0;
+	}
+	String(const CharType* str):
+		String()
+	{
+		Append(str, StringLength(str));
+	}
+	String(const CharType* str, unsigned int length):
+		String()
+	{
+		Append(str, length);
+	}
+	String(const String& another):
+		String()
+	{
+		Append(another.m_data, another.m_length);
+	}
+	String(String&& another):
+		String()
+	{
+		Swap(another);
+	}
+	~String()
+	{
+		if (IsInline() == false)
 		{
-			DataType& ret_val = *top;
-			return ret_val;
-		}
-		else {
-			ASSERT(GetCount() == 0);
-			return *((DataType*)NULL);
+			BasicVector::GetDefaultAllocator()->FreeDataArray((char*)m_data);
 		}
 	}
-	DataType& operator [] (unsigned int index)
+	String& operator = (const String& another)
 	{
-		DataType* ptr = NULL;
-		if (index < m_count)
+		if (this != &another)
 		{
-			ptr = (DataType*)(m_data + (index * m_entry_size));
+			m_length = 0;
+			Append(another.m_data, another.m_length);
 		}
-		else {
+		return *this;
+	}
+	String& operator = (String&& another)
+	{
+		Swap(another);
+		return *this;
+	}
+	String& operator = (const CharType* str)
+	{
+		m_length = 0;
+		return Append(str, StringLength(str));
+	}
+	unsigned int GetLength() const
+		{ return m_length; }
+	unsigned int GetCapacity() const
+		{ return m_capacity; }
+	bool IsEmpty() const
+		{ return (m_length == 0); }
+	const CharType* GetCString() const
+		{ return m_data; }
+	//characters may be changed through it, but not the length, see Resize
+	CharType* GetData()
+		{ return m_data; }
+	//this methods throw exceptions
+	CharType operator [] (unsigned int index) const
+	{
+		if (index >= m_length)
+		{
 			throw Exception(UTILS_ERROR_INDEX_BIGGER_THAN_ARRAY_SIZE,
-				L"Cannot access an element in stack, index >= m_count",
+				L"Cannot get string character because index is bigger than string length",
 				EXC_HERE);
 		}
-		return *ptr;
+		return m_data[index];
 	}
-};
-
-/*BasicList is not responsible for memory management for it's entries. entries are created and destroyed by the caller.*/
-class BasicList
-{
-public:
-	class Entry
+	CharType& operator [] (unsigned int index)
 	{
-		friend class BasicList;
-	public:
-		Entry() :
-			m_prev(NULL),
-			m_next(NULL),
-			m_list(NULL)
-		{}
-		virtual ~Entry()
+		if (index >= m_length)
 		{
-			if(m_list != NULL)
-			{
-				Remove();
-			}
+			throw Exception(UTILS_ERROR_INDEX_BIGGER_THAN_ARRAY_SIZE,
+				L"Cannot get string character because index is bigger than string length",
+				EXC_HERE);
 		}
-		virtual void Remove();
-	protected:
-		Entry* m_prev;
-		Entry* m_next;
-		BasicList* m_list;
-	};
-
-	class Iterator
+		return m_data[index];
+	}
+	void Reserve(unsigned int capacity)
 	{
-		friend class BasicList;
-	public:
-		Iterator(Entry* entry = NULL,
-			BasicReadWriteLock* rw_lock = NULL):
-			m_entry(entry),
-			m_rw_lock(rw_lock)
-		{}
-		bool operator == (const Iterator& another) const
-			{ return (m_entry == another.m_entry); }
-		bool operator != (const Iterator& another) const
-			{ return (m_entry != another.m_entry); }
-		operator Entry* ()
-			{ return m_entry; }
-		Iterator& operator ++ ()
-		{
-			Advance(true);
-			return *this;
-		}
-		Iterator operator ++ (int i)
-		{
-			Iterator ret_val = *this;
-			Advance(true);
-			return ret_val;
-		}
-		Iterator& operator -- ()
-		{
-			Advance(false);
-			return *this;
-		}
-		Iterator operator -- (int i)
-		{
-			Iterator ret_val = *this;
-			Advance(false);
-			return ret_val;
-		}
-		bool IsValid() const
+		if (capacity > m_capacity)
 		{
-			return (m_entry != NULL);
+			Grow(capacity);
 		}
-	protected:
-		//this method throws exceptions
-		void Advance(bool forward);
-		Entry* m_entry;
-		BasicReadWriteLock* m_rw_lock;
-	};
-
-	BasicList(BasicReadWriteLock* lock = NULL);
-	virtual ~BasicList();
-	unsigned int GetCount() const
-		{ return m_count; }
-	//all addition methods return iterator to the just added element.
-	inline Iterator Insert(Entry* entry, Iterator& before_here)
-	{
-		Entry* next = before_here.m_entry;
-		return InternalInsert(entry, next);
 	}
-	inline Iterator PushFront(Entry* entry)
+	//new characters are not initialized, they are to be written through GetData.
+	void Resize(unsigned int length)
 	{
-		return InternalInsert(entry, m_head);
+		Reserve(length);
+		m_length = length;
+		m_data[m_length] = 0;
 	}
-	inline Iterator PushBack(Entry* entry)
+	void Clear()
 	{
-		return InternalInsert(entry, NULL/*m_last*/);
+		m_length = 0;
+		m_data[0] = 0;
 	}
-	//this methods return just removed entry (those passed in parameter).
-	inline Entry* Remove(Entry* entry)
+	String& Append(const CharType* str, unsigned int length)
 	{
-		return InternalRemove(entry);
+		if (m_length + length > m_capacity)
+		{
+			//str may be a part of this string, it stays valid until the old buffer is freed in Grow
+			Grow(m_length + length, str, length);
+			return *this;
+		}
+		memmove(m_data + m_length, str, length * sizeof(CharType));
+		m_length += length;
+		m_data[m_length] = 0;
+		return *this;
 	}
-	inline Entry* Remove(Iterator& it)
+	String& Append(const CharType* str)
+		{ return Append(str, StringLength(str)); }
+	String& Append(const String& another)
+		{ return Append(another.m_data, another.m_length); }
+	String& Append(CharType ch)
 	{
-		Entry* entry = it.m_entry;
-		return InternalRemove(entry);
+		if (m_length == m_capacity)
+		{
+			Grow(m_length + 1);
+		}
+		m_data[m_length] = ch;
+		++m_length;
+		m_data[m_length] = 0;
+		return *this;
 	}
-	inline Entry* PopFront()
+	String& operator += (const CharType* str)
+		{ return Append(str); }
+	String& operator += (const String& another)
+		{ return Append(another); }
+	String& operator += (CharType ch)
+		{ return Append(ch); }
+	//these return index of the first match starting from from, or NOT_FOUND
+	unsigned int Find(CharType ch, unsigned int from = 0) const
 	{
-		if(GetCount() == 0)
+		if (from >= m_length)
 		{
-			return NULL;
+			return NOT_FOUND;
 		}
-		Entry* ret_val = m_head;
-		InternalRemove(m_head);
-		return ret_val;
+		unsigned int index = from + FindChar(m_data + from, m_length - from, ch);
+		return ((index < m_length) ? index : NOT_FOUND);
 	}
-	inline Entry* PopBack()
+	unsigned int Find(const CharType* str, unsigned int length, unsigned int from = 0) const
 	{
-		if(GetCount() == 0)
+		if (length == 0)
 		{
-			return NULL;
+			return ((from <= m_length) ? from : NOT_FOUND);
 		}
-		Entry* ret_val = m_last;
-		return InternalRemove(m_last); 
-		return ret_val;
+		//candidates are found by the first character, the rest is compared only for them
+		while ((from < m_length) && (m_length - from >= length))
+		{
+			unsigned int index = Find(str[0], from);
+			if ((index == NOT_FOUND) || (m_length - index < length))
+			{
+				return NOT_FOUND;
+			}
+			if (CompareChars(m_data + index + 1, str + 1, length - 1) == 0)
+			{
+				return index;
+			}
+			from = index + 1;
+		}
+		return NOT_FOUND;
 	}
-	inline bool IsEmpty() const
-		{ return GetCount() == 0; }
-	inline Iterator Begin()
+	unsigned int Find(const String& another, unsigned int from = 0) const
+		{ return Find(another.m_data, another.m_length, from); }
+	//less than zero, zero or bigger than zero, like strcmp
+	int Compare(const CharType* str, unsigned int length) const
 	{
-		if (m_head != NULL)
+		unsigned int common = (m_length < length) ? m_length : length;
+		int ret_val = CompareChars(m_data, str, common);
+		if (ret_val != 0)
 		{
-			return Iterator(m_head);
-		}
-		else {
-			return Iterator();	//invalid, it's ok.
+			return ret_val;
 		}
+		return ((m_length < length) ? -1 : ((m_length > length) ? 1 : 0));
 	}
-	inline void Clear()
+	int Compare(const String& another) const
+		{ return Compare(another.m_data, another.m_length); }
+	bool operator == (const String& another) const
+		{ return ((m_length == another.m_length) && (CompareChars(m_data, another.m_data, m_length) == 0)); }
+	bool operator != (const String& another) const
+		{ return ((*this == another) == false); }
+	bool operator < (const String& another) const
+		{ return (Compare(another) < 0); }
+	void Swap(String& another)
 	{
-		while (m_count != 0)
+		if (IsInline() || another.IsInline())
 		{
-			PopBack();
+			//inline characters stay in their objects, so they are moved through a temporary copy
+			String* inline_one = IsInline() ? this : &another;
+			String* other_one = IsInline() ? &another : this;
+			CharType tmp[INLINE_CAPACITY + 1];
+			unsigned int tmp_length = inline_one->m_length;
+			memcpy(tmp, inline_one->m_inline, (tmp_length + 1) * sizeof(CharType));
+			if (other_one->IsInline())
+			{
+				inline_one->m_length = other_one->m_length;
+				memcpy(inline_one->m_inline, other_one->m_inline, (other_one->m_length + 1) * sizeof(CharType));
+			} else {
+				inline_one->m_data = other_one->m_data;
+				inline_one->m_length = other_one->m_length;
+				inline_one->m_capacity = other_one->m_capacity;
+				other_one->m_data = other_one->m_inline;
+				other_one->m_capacity = INLINE_CAPACITY;
+			}
+			other_one->m_length = tmp_length;
+			memcpy(other_one->m_inline, tmp, (tmp_length + 1) * sizeof(CharType));
+			return;
 		}
+		std::swap(m_data, another.m_data);
+		std::swap(m_length, another.m_length);
+		std::swap(m_capacity, another.m_capacity);
 	}
-	bool LockForRead();
-	bool LockForWrite();
-	void Unlock();
-	void SetLock(BasicReadWriteLock* lock)
-		{ m_rw_lock = lock;	}
 protected:
-	//returns pointer to the entry in the list
-	Entry* InternalInsert(Entry* entry, Entry* before_this_entry /*may be NULL, this means PushBack*/);
-	//returns pointer to the entry next to the just removed entry or NULL if removed entry was the last.
-	Entry* InternalRemove(Entry* entry);
-
-	Entry* m_head;
-	Entry* m_last;	//this member is added here due to optimization reasons so PushBack to work faster.
-	unsigned int m_count;
-	BasicReadWriteLock* m_rw_lock;
+	bool IsInline() const
+		{ return (m_data == m_inline); }
+	//moves characters to a bigger buffer and appends str there
+	void Grow(unsigned int capacity, const CharType* str = NULL, unsigned int length = 0)
+	{
+		if (capacity < m_capacity * 2)
+		{
+			capacity = m_capacity * 2;
+		}
+		CharType* new_data = (CharType*)BasicVector::GetDefaultAllocator()->AllocateDataArray(sizeof(CharType),
+																							   capacity + 1);
+		if (new_data == NULL)
+		{
+			throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+				L"Cannot allocate string buffer",
+				EXC_HERE);
+		}
+		memcpy(new_data, m_data, m_length * sizeof(CharType));
+		if (length != 0)
+		{
+			memcpy(new_data + m_length, str, length * sizeof(CharType));
+		}
+		if (IsInline() == false)
+		{
+			BasicVector::GetDefaultAllocator()->FreeDataArray((char*)m_data);
+		}
+		m_data = new_data;
+		m_capacity = capacity;
+		m_length += length;
+		m_data[m_length] = 0;
+	}
+	CharType* m_data;	//m_inline or a buffer
+	unsigned int m_length;
+	unsigned int m_capacity;	//without the terminating zero
+	CharType m_inline[INLINE_CAPACITY + 1];
 };
 
-template <class DataType>
-class ListEntry : public BasicList::Entry
-{
-public:
-	ListEntry(const DataType& data):
-		m_data(data)
-	{}
-	Entry& operator = (const DataType& data)
-		{ m_data = data; }
-	Entry& operator = (const ListEntry& another)
-		{ m_data = another.m_data; }
-	operator DataType& ()
-		{ return GetData(); }
-	DataType& GetData()
-		{ return m_data; }
-protected:
-	DataType m_data;
-};
+typedef String<wchar_t>  WString;
+typedef String<char>	 AString;
 
-template <class DataType>
-class List : public BasicList
+//wchar_t is UTF-16 where it is 2 bytes and UTF-32 where it is 4. ASCII parts are converted 16 bytes at a time.
+//out is replaced. on UTILS_ERROR_INVALID_ENCODING out has the characters converted before the bad one.
+unsigned int /*error code*/ Utf8ToWide(const char* str, unsigned int length, WString* out);
+unsigned int /*error code*/ WideToUtf8(const wchar_t* str, unsigned int length, AString* out);
+
+/*double ended queue in a ring buffer. capacity is a power of two, so positions are wrapped by a mask.
+pushes and pops at both ends are O(1) (the buffer doubles when it is full), entries are reachable by index.
+like BasicVector it keeps entries as bytes, Deque<DataType> is the typed interface.*/
+class BasicDeque
 {
 public:
-	class Iterator;
-	typedef ListEntry<DataType> Entry;
-
-	class Iterator : public BasicList::Iterator
+	typedef BasicVector::Allocator Allocator;
+	class Iterator
 	{
 	public:
-		Iterator(Entry* entry = NULL):
-			BasicList::Iterator(entry)
+		Iterator(unsigned int index = 0, BasicDeque* deque = NULL):
+			m_deque(deque),
+			m_index(index)
 			{}
-		Iterator(const BasicList::Iterator& src):
-			BasicList::Iterator(src)
+		Iterator& operator ++ ()
+		{
+			++m_index;
+			return *this;
+		}
+		Iterator& operator -- ()
+		{
+			--m_index;	//goes to UINT_MAX before the first entry, which is not valid
+			return *this;
+		}
+		Iterator operator ++ (int)
+		{
+			Iterator ret_val = *this;
+			++m_index;
+			return ret_val;
+		}
+		Iterator operator -- (int)
+		{
+			Iterator ret_val = *this;
+			--m_index;
+			return ret_val;
+		}
+		bool operator == (const Iterator& another) const
+			{ return ((m_deque == another.m_deque) && (m_index == another.m_index)); }
+		bool operator != (const Iterator& another) const
+			{ return ((*this == another) == false); }
+		char* Data() const
+			{ return m_deque->GetSlot(m_index); }
+		bool IsValid() const
+			{ return ((m_deque != NULL) && (m_index < m_deque->m_count)); }
+		unsigned int GetIndex() const
+			{ return m_index; }
+	protected:
+		BasicDeque* m_deque;
+		unsigned int m_index;
+	};
+	BasicDeque(unsigned int entry_size,
+			   unsigned int n_preallocated = 0,
+			   Allocator* allocator = BasicVector::GetDefaultAllocator(),
+			   BasicReadWriteLock* lock = NULL);
+	//like BasicVector(lock), the deque is unusable until another one is assigned to it
+	BasicDeque(BasicReadWriteLock* lock);
+	//only frees the buffer, entries are destroyed by Clear, which typed deques call from their destructors
+	virtual ~BasicDeque();
+	//destroys entries and copies entries of another. an unusable deque takes entry size and allocator of another.
+	BasicDeque& operator = (const BasicDeque& another);
+	unsigned int GetCount() const
+		{ return m_count; }
+	bool IsEmpty() const
+		{ return (m_count == 0); }
+	unsigned int GetCapacity() const
+		{ return m_capacity; }
+	unsigned int GetEntrySize() const
+		{ return m_entry_size; }
+	//this methods throw exceptions
+	char* /*the new entry*/ PushBack(const char* data);
+	char* /*the new entry*/ PushFront(const char* data);
+	void PopBack();
+	void PopFront();
+	//count entries one after another in data
+	void PushBackArray(const char* data, unsigned int count);
+	//copies up to count entries from the front to out as new ones (out is raw memory, may be NULL)
+	//and removes them. returns how many were removed.
+	unsigned int PopFrontArray(char* out, unsigned int count);
+	void Reserve(unsigned int capacity);
+	//destroys entries, the buffer is kept
+	void Clear();
+	//this methods return NULL when there is no such entry
+	char* Front() const;
+	char* Back() const;
+	char* operator [] (unsigned int index) const;
+	Iterator Begin()
+		{ return Iterator(0, this); }
+	Iterator Last()	//returns iterator to the last element, index 0 if the deque is empty
+		{ return Iterator((m_count != 0) ? (m_count - 1) : 0, this); }
+	bool LockForRead();
+	bool LockForWrite();
+	void Unlock();
+	inline void SetLock(BasicReadWriteLock* lock)
+		{ m_rw_lock = lock; }
+	inline BasicReadWriteLock* GetLock() const
+		{ return m_rw_lock; }
+protected:
+	//takes entry size and allocator of another, but not entries (CopyEntries is not virtual yet here)
+	//and not the lock. copy constructors of descendants append entries with AppendFrom.
+	BasicDeque(const BasicDeque& another);
+	void AppendFrom(const BasicDeque& another);
+	//this CopyEntries implementation copies bytes, descendants call copy constructors
+	virtual void CopyEntries(const char* src, char* dst, unsigned int count);
+	//placeholder for destructors, does nothing here
+	virtual void DeinitEntries(char* entries, unsigned int count);
+	//moves entries to a new buffer when it grows, src entries are not used after that
+	virtual void RelocateEntries(char* src, char* dst, unsigned int count);
+	char* GetSlot(unsigned int index) const
+		{ return m_data + (size_t)((m_head + index) & (m_capacity - 1)) * m_entry_size; }
+	//capacity becomes the next power of two from min_capacity
+	void Grow(unsigned int min_capacity);
+	//destroys count entries at the front
+	void RemoveFront(unsigned int count);
+
+	unsigned int m_entry_size;
+	char* m_data;
+	unsigned int m_capacity;	//0 or a power of two
+	unsigned int m_head;	//position of the first entry
+	unsigned int m_count;
+	Allocator* m_allocator;
+	BasicReadWriteLock* m_rw_lock;
+};
+
+//BaseDeque is BasicDeque or a class derived from it, like BasicStack for Stack
+template <class DataType, class BaseDeque = BasicDeque>
+class Deque: public BaseDeque
+{
+public:
+	class Iterator: public BasicDeque::Iterator
+	{
+	public:
+		Iterator(unsigned int index = 0, Deque* deque = NULL):
+			BasicDeque::Iterator(index, deque)
 			{}
-		operator DataType* () const
+		Iterator(const BasicDeque::Iterator& src):
+			BasicDeque::Iterator(src)
+			{}
+		operator DataType*()
+			{ return reinterpret_cast<DataType*>(Data()); }
+	};
+	Deque(unsigned int n_preallocated = 0,
+		  BasicDeque::Allocator* allocator = BasicVector::GetDefaultAllocator(),
+		  BasicReadWriteLock* lock = NULL):
+		BaseDeque(sizeof(DataType), n_preallocated, allocator, lock)
+		{}
+	//entries are copied here and not by the base, where CopyEntries is not the typed one yet
+	Deque(const Deque& another):
+		BaseDeque(sizeof(DataType), 0, another.m_allocator, NULL)
+		{ this->AppendFrom(another); }
+	~Deque()
+		{ this->Clear(); }
+	Deque& operator = (const Deque& another)
+	{
+		BaseDeque::operator = (another);
+		return *this;
+	}
+	void PushBack(const DataType& data)
+		{ BaseDeque::PushBack((const char*)&data); }
+	void PushFront(const DataType& data)
+		{ BaseDeque::PushFront((const char*)&data); }
+	void PushBack(const DataType* data, unsigned int count)
+		{ this->PushBackArray((const char*)data, count); }
+	//moves up to count entries from the front to out and removes them, returns how many were moved
+	unsigned int PopFront(DataType* out, unsigned int count)
+	{
+		WriteSynchronizer sync(this->m_rw_lock);
+		if (count > this->m_count)
+		{
+			count = this->m_count;
+		}
+		for (unsigned int index = 0; index < count; ++index)
+		{
+			out[index] = std::move(*(DataType*)this->GetSlot(index));
+		}
+		this->RemoveFront(count);
+		return count;
+	}
+	void PopFront()
+		{ BaseDeque::PopFront(); }
+	DataType* Front() const
+		{ return (DataType*)BaseDeque::Front(); }
+	DataType* Back() const
+		{ return (DataType*)BaseDeque::Back(); }
+	//this method throws exceptions
+	DataType& operator [] (unsigned int index) const
+	{
+		char* data = BaseDeque::operator[](index);
+		if (data == NULL)
+		{
+			throw Exception(UTILS_ERROR_INDEX_BIGGER_THAN_ARRAY_SIZE,
+				L"Cannot get deque entry because index is bigger than deque size",
+				EXC_HERE);
+		}
+		return *(DataType*)data;
+	}
+	Iterator Begin()
+		{ return Iterator(0, this); }
+	Iterator Last()
+		{ return Iterator((this->m_count != 0) ? (this->m_count - 1) : 0, this); }
+protected:
+	void CopyEntries(const char* src, char* dst, unsigned int count)
+	{
+		const DataType* typed_src = (const DataType*)src;
+		DataType* typed_dst = (DataType*)dst;
+		for (unsigned int index = 0; index < count; ++index)
+		{
+			new (typed_dst + index) DataType(typed_src[index]);
+		}
+	}
+	void DeinitEntries(char* entries, unsigned int count)
+	{
+		DataType* typed_entries = (DataType*)entries;
+		for (unsigned int index = 0; index < count; ++index)
+		{
+			typed_entries[index].~DataType();
+		}
+	}
+	void RelocateEntries(char* src, char* dst, unsigned int count)
+	{
+		if (std::is_trivially_copyable<DataType>::value)
+		{
+			BaseDeque::RelocateEntries(src, dst, count);
+			return;
+		}
+		DataType* typed_src = (DataType*)src;
+		DataType* typed_dst = (DataType*)dst;
+		for (unsigned int index = 0; index < count; ++index)
+		{
+			new (typed_dst + index) DataType(std::move(typed_src[index]));
+			typed_src[index].~DataType();
+		}
+	}
+};
+
+//stack on a deque, so pushes and pops at the front are as cheap as at the back. the top is the back.
+class BasicStack : public BasicDeque
+{
+public:
+	BasicStack(BasicReadWriteLock* lock):
+		BasicDeque(lock)
+		{}
+	BasicStack(const BasicStack& another):
+		BasicDeque(another)
+		{ AppendFrom(another); }
+	BasicStack(unsigned int entry_size, unsigned int n_preallocated, Allocator* allocator, BasicReadWriteLock* lock = NULL) :
+		BasicDeque(entry_size, n_preallocated, allocator, lock)
+		{}
+	char* Top()
+		{ return Back(); }
+};
+
+//typed stack. it is a BasicStack as well, with the typed deque on top of it.
+template <class DataType>
+class Stack : public Deque<DataType, BasicStack>
+{
+	typedef Deque<DataType, BasicStack> BaseClass;
+public:
+	typedef typename BaseClass::Iterator Iterator;
+	Stack(BasicReadWriteLock* lock = NULL):
+		BaseClass(0, BasicVector::GetDefaultAllocator(), lock)
+	{}
+	Stack(unsigned int n_preallocated, BasicDeque::Allocator* allocator, BasicReadWriteLock* lock = NULL) :
+		BaseClass(n_preallocated, allocator, lock)
+	{}
+	DataType& GetTop()
+	{
+		DataType* top = BaseClass::Back();
+		if (top != NULL)
+		{
+			DataType& ret_val = *top;
+			return ret_val;
+		}
+		else {
+			ASSERT(BaseClass::GetCount() == 0);
+			return *((DataType*)NULL);
+		}
+	}
+};
+
+enum
+{
+	CACHE_LINE_SIZE = 64	//in bytes. used to keep members touched by different threads on different cache lines.
+};
+
+/*bucket container with stable addresses: entries never move, so pointers to them stay valid until they are erased.
+entries live in buckets, each next bucket is twice as big up to MAX_BUCKET_SIZE slots. an erased slot goes to the
+free list of it's bucket and is reused by the next inserts, a bucket becomes free when it's last entry is erased.
+every bucket keeps a bit per slot, so iteration skips erased slots a whole word at a time.
+entries are in no particular order. Colony<DataType> is the typed interface.*/
+class BasicColony
+{
+protected:
+	struct Bucket
+	{
+		Bucket* m_next;
+		Bucket* m_prev;
+		Bucket* m_next_free;	//buckets with free slots
+		Bucket* m_prev_free;
+		unsigned int m_capacity;
+		unsigned int m_count;
+		unsigned int m_first_free;	//erased slot, NO_SLOT if there is none
+		unsigned int m_used;	//slots after it were never used
+		unsigned int* m_occupancy;	//a bit per slot
+		char* m_slots;
+	};
+public:
+	typedef BasicVector::Allocator Allocator;
+	enum
+	{
+		MIN_BUCKET_SIZE = 32,
+		MAX_BUCKET_SIZE = 8192,
+		NO_SLOT = 0xFFFFFFFF
+	};
+	class Iterator
+	{
+		friend class BasicColony;
+	public:
+		Iterator(Bucket* bucket = NULL, unsigned int slot = 0, unsigned int slot_size = 0):
+			m_bucket(bucket),
+			m_slot(slot),
+			m_slot_size(slot_size)
+			{}
+		Iterator& operator ++ ();
+		bool operator == (const Iterator& another) const
+			{ return ((m_bucket == another.m_bucket) && ((m_bucket == NULL) || (m_slot == another.m_slot))); }
+		bool operator != (const Iterator& another) const
+			{ return ((*this == another) == false); }
+		bool IsValid() const
+			{ return (m_bucket != NULL); }
+		char* Data() const
+			{ return m_bucket->m_slots + (size_t)m_slot * m_slot_size; }
+	protected:
+		//first occupied slot from slot on, in this or next buckets
+		void Seek(unsigned int slot);
+
+		Bucket* m_bucket;
+		unsigned int m_slot;
+		unsigned int m_slot_size;
+	};
+	BasicColony(unsigned int entry_size,
+				Allocator* allocator = BasicVector::GetDefaultAllocator(),
+				BasicReadWriteLock* lock = NULL);
+	//only frees buckets, entries are destroyed by Clear, which typed colonies call from their destructors
+	virtual ~BasicColony();
+	BasicColony(const BasicColony& another) = delete;
+	BasicColony& operator = (const BasicColony& another) = delete;
+	unsigned int GetCount() const
+		{ return m_count; }
+	bool IsEmpty() const
+		{ return (m_count == 0); }
+	unsigned int GetCapacity() const
+		{ return m_capacity; }
+	//this methods throw exceptions
+	char* /*the new entry, it stays at this address*/ Insert(const char* data);
+	//returns iterator to the entry after the erased one. O(1).
+	Iterator Erase(const Iterator& it);
+	//finds the bucket of the entry first, so it takes O(number of buckets)
+	void Erase(char* entry);
+	//destroys entries and frees buckets
+	void Clear();
+	//iterators are not synchronized, lock the colony for read while iterating
+	Iterator Begin();
+	Iterator End()
+		{ return Iterator(); }
+	//invalid iterator if entry is not in the colony
+	Iterator GetIterator(char* entry);
+	bool LockForRead();
+	bool LockForWrite();
+	void Unlock();
+	inline void SetLock(BasicReadWriteLock* lock)
+		{ m_rw_lock = lock; }
+	inline BasicReadWriteLock* GetLock() const
+		{ return m_rw_lock; }
+protected:
+	//this CopyEntry implementation copies bytes, descendants call copy constructors
+	virtual void CopyEntry(const char* src, char* dst);
+	//placeholder for destructors, does nothing here
+	virtual void DeinitEntry(char* entry);
+	Bucket* AllocateBucket(unsigned int capacity);
+	void FreeBucket(Bucket* bucket);
+	void LinkFree(Bucket* bucket);
+	void UnlinkFree(Bucket* bucket);
+	Iterator InternalErase(const Iterator& it);
+
+	unsigned int m_entry_size;
+	unsigned int m_slot_size;	//an erased slot keeps the index of the next erased one
+	Bucket* m_first;
+	Bucket* m_last;
+	Bucket* m_first_free;
+	unsigned int m_count;
+	unsigned int m_capacity;
+	Allocator* m_allocator;
+	BasicReadWriteLock* m_rw_lock;
+};
+
+template <class DataType>
+class Colony: public BasicColony
+{
+public:
+	class Iterator: public BasicColony::Iterator
+	{
+	public:
+		Iterator()
+			{}
+		Iterator(const BasicColony::Iterator& src):
+			BasicColony::Iterator(src)
+			{}
+		operator DataType*()
+			{ return reinterpret_cast<DataType*>(Data()); }
+		DataType* operator -> ()
+			{ return reinterpret_cast<DataType*>(Data()); }
+	};
+	Colony(Allocator* allocator = BasicVector::GetDefaultAllocator(), BasicReadWriteLock* lock = NULL):
+		BasicColony(sizeof(DataType), allocator, lock)
+	{
+		static_assert(alignof(DataType) <= CACHE_LINE_SIZE, "colony slots are aligned to a cache line at most");
+	}
+	~Colony()
+		{ Clear(); }
+	DataType* Insert(const DataType& data)
+		{ return (DataType*)BasicColony::Insert((const char*)&data); }
+	Iterator Erase(const Iterator& it)
+		{ return BasicColony::Erase(it); }
+	void Erase(DataType* entry)
+		{ BasicColony::Erase((char*)entry); }
+	Iterator Begin()
+		{ return BasicColony::Begin(); }
+	Iterator End()
+		{ return Iterator(); }
+	Iterator GetIterator(DataType* entry)
+		{ return BasicColony::GetIterator((char*)entry); }
+protected:
+	void CopyEntry(const char* src, char* dst)
+		{ new (dst) DataType(*(const DataType*)src); }
+	void DeinitEntry(char* entry)
+		{ ((DataType*)entry)->~DataType(); }
+};
+
+/*BasicList is not responsible for memory management for it's entries. entries are created and destroyed by the caller.*/
+class BasicList
+{
+public:
+	class Entry
+	{
+		friend class BasicList;
+	public:
+		Entry() :
+			m_prev(NULL),
+			m_next(NULL),
+			m_list(NULL)
+		{}
+		virtual ~Entry()
+		{
+			if(m_list != NULL)
+			{
+				Remove();
+			}
+		}
+		virtual void Remove();
+		//neighbours in a list or in a chain (see PopAll)
+		Entry* GetNext() const
+			{ return m_next; }
+		Entry* GetPrev() const
+			{ return m_prev; }
+	protected:
+		Entry* m_prev;
+		Entry* m_next;
+		BasicList* m_list;
+	};
+
+	class Iterator
+	{
+		friend class BasicList;
+	public:
+		Iterator(Entry* entry = NULL,
+			BasicReadWriteLock* rw_lock = NULL):
+			m_entry(entry),
+			m_rw_lock(rw_lock)
+		{}
+		bool operator == (const Iterator& another) const
+			{ return (m_entry == another.m_entry); }
+		bool operator != (const Iterator& another) const
+			{ return (m_entry != another.m_entry); }
+		operator Entry* ()
+			{ return m_entry; }
+		Iterator& operator ++ ()
+		{
+			Advance(true);
+			return *this;
+		}
+		Iterator operator ++ (int i)
+		{
+			Iterator ret_val = *this;
+			Advance(true);
+			return ret_val;
+		}
+		Iterator& operator -- ()
+		{
+			Advance(false);
+			return *this;
+		}
+		Iterator operator -- (int i)
+		{
+			Iterator ret_val = *this;
+			Advance(false);
+			return ret_val;
+		}
+		bool IsValid() const
+		{
+			return (m_entry != NULL);
+		}
+	protected:
+		//this method throws exceptions
+		void Advance(bool forward);
+		Entry* m_entry;
+		BasicReadWriteLock* m_rw_lock;
+	};
+
+	BasicList(BasicReadWriteLock* lock = NULL);
+	virtual ~BasicList();
+	unsigned int GetCount() const
+		{ return m_count; }
+	//all addition methods return iterator to the just added element.
+	inline Iterator Insert(Entry* entry, Iterator& before_here)
+	{
+		Entry* next = before_here.m_entry;
+		return InternalInsert(entry, next);
+	}
+	inline Iterator PushFront(Entry* entry)
+	{
+		return InternalInsert(entry, m_head);
+	}
+	inline Iterator PushBack(Entry* entry)
+	{
+		return InternalInsert(entry, NULL/*m_last*/);
+	}
+	//this methods return just removed entry (those passed in parameter).
+	inline Entry* Remove(Entry* entry)
+	{
+		return InternalRemove(entry);
+	}
+	inline Entry* Remove(Iterator& it)
+	{
+		Entry* entry = it.m_entry;
+		return InternalRemove(entry);
+	}
+	inline Entry* PopFront()
+	{
+		if(GetCount() == 0)
+		{
+			return NULL;
+		}
+		Entry* ret_val = m_head;
+		InternalRemove(m_head);
+		return ret_val;
+	}
+	inline Entry* PopBack()
+	{
+		if(GetCount() == 0)
+		{
+			return NULL;
+		}
+		Entry* ret_val = m_last;
+		return InternalRemove(m_last); 
+		return ret_val;
+	}
+	inline bool IsEmpty() const
+		{ return GetCount() == 0; }
+	inline Iterator Begin()
+	{
+		if (m_head != NULL)
+		{
+			return Iterator(m_head);
+		}
+		else {
+			return Iterator();	//invalid, it's ok.
+		}
+	}
+	inline void Clear()
+	{
+		while (m_count != 0)
+		{
+			PopBack();
+		}
+	}
+	/*batch methods. links are changed in O(1) under one lock (both lists are locked when there are two), but every
+	moved entry is told it's new list, so they take O(count) anyway. this methods throw exceptions.*/
+	//moves entries from first to last (in order, all in from) before before_here (invalid iterator means to the end).
+	//before_here must not be in the range.
+	void Splice(BasicList* from, Entry* first, Entry* last, const Iterator& before_here);
+	//moves all entries of from to the end of this list
+	void SpliceAll(BasicList* from);
+	//takes all entries as a chain linked by their own links, from the first to the last. returns NULL if empty.
+	//entries are detached from the list under the lock, one by one. walk the chain with Unlink.
+	Entry* PopAll(Entry** out_last = NULL, unsigned int* out_count = NULL);
+	//appends count entries chained from first to last (by PopAll or by LinkChain)
+	void PushBackChain(Entry* first, Entry* last, unsigned int count);
+	//chains entries that are in no list, next goes after prev
+	static void LinkChain(Entry* prev, Entry* next);
+	//cuts entry off a chain and returns the next entry in the chain
+	static Entry* Unlink(Entry* entry);
+	bool LockForRead();
+	bool LockForWrite();
+	void Unlock();
+	void SetLock(BasicReadWriteLock* lock)
+		{ m_rw_lock = lock;	}
+protected:
+	//locks this list and another one for write in the order of their locks' addresses, so two threads
+	//splicing in opposite directions do not deadlock. unlocks in destructor.
+	class PairSynchronizer
+	{
+	public:
+		PairSynchronizer(BasicReadWriteLock* lock0, BasicReadWriteLock* lock1);
+		~PairSynchronizer();
+	protected:
+		BasicReadWriteLock* m_first;
+		BasicReadWriteLock* m_second;
+	};
+	//unlinks first..last (count entries) from this list, they stay chained. no lock is taken.
+	void CutChain(Entry* first, Entry* last, unsigned int count);
+	//links a chain before before_this (NULL means to the end) and makes it's entries belong to this list
+	void InsertChain(Entry* first, Entry* last, unsigned int count, Entry* before_this);
+
+	//returns pointer to the entry in the list
+	Entry* InternalInsert(Entry* entry, Entry* before_this_entry /*may be NULL, this means PushBack*/);
+	//returns pointer to the entry next to the just removed entry or NULL if removed entry was the last.
+	Entry* InternalRemove(Entry* entry);
+
+	Entry* m_head;
+	Entry* m_last;	//this member is added here due to optimization reasons so PushBack to work faster.
+	unsigned int m_count;
+	BasicReadWriteLock* m_rw_lock;
+};
+
+template <class DataType>
+class ListEntry : public BasicList::Entry
+{
+public:
+	ListEntry(const DataType& data):
+		m_data(data)
+	{}
+	Entry& operator = (const DataType& data)
+		{ m_data = data; }
+	Entry& operator = (const ListEntry& another)
+		{ m_data = another.m_data; }
+	operator DataType& ()
+		{ return GetData(); }
+	DataType& GetData()
+		{ return m_data; }
+protected:
+	DataType m_data;
+};
+
+template <class DataType>
+class List : public BasicList
+{
+public:
+	class Iterator;
+	typedef ListEntry<DataType> Entry;
+
+	class Iterator : public BasicList::Iterator
+	{
+	public:
+		Iterator(Entry* entry = NULL):
+			BasicList::Iterator(entry)
+			{}
+		Iterator(const BasicList::Iterator& src):
+			BasicList::Iterator(src)
+			{}
+		operator DataType* () const
+		{
+			if (m_entry == NULL)
+			{
+				return NULL;
+			}
+			Entry* entry = reinterpret_cast<Entry*>(m_entry);
+			if (entry != NULL)
+			{
+				//return &(entry->operator DataType());
+				return &(entry->GetData());
+			}
+			return NULL;
+		}
+	};
+
+	List(BasicReadWriteLock* lock = NULL) :
+		BasicList(lock)
+	{}
+};
+
+/*unrolled linked list: a node keeps up to a cache line of entries in a row, so iteration walks arrays and chases a
+pointer only once per node. insertion into a full node splits it in two, erasure merges a node with a neighbour when
+both fit into one. entries in a node are shifted on insertion and erasure, so iterators after the changed place in
+that node (and iterators into merged nodes) become invalid, insertion and erasure return valid ones.
+UnrolledList<DataType> is the typed interface.*/
+class BasicUnrolledList
+{
+protected:
+	struct Node
+	{
+		Node* m_prev;
+		Node* m_next;
+		unsigned int m_count;
+	};
+public:
+	typedef BasicVector::Allocator Allocator;
+	enum
+	{
+		MIN_NODE_CAPACITY = 4,
+		ENTRY_ALIGNMENT = 16	//entries in a node start at this alignment
+	};
+	class Iterator
+	{
+		friend class BasicUnrolledList;
+	public:
+		Iterator(Node* node = NULL, unsigned int index = 0, unsigned int entry_size = 0):
+			m_node(node),
+			m_index(index),
+			m_entry_size(entry_size)
+			{}
+		Iterator& operator ++ ()
+		{
+			if (++m_index == m_node->m_count)
+			{
+				m_node = m_node->m_next;
+				m_index = 0;
+			}
+			return *this;
+		}
+		Iterator& operator -- ()
+		{
+			if (m_index == 0)
+			{
+				m_node = m_node->m_prev;
+				m_index = (m_node != NULL) ? m_node->m_count - 1 : 0;
+			} else {
+				--m_index;
+			}
+			return *this;
+		}
+		bool operator == (const Iterator& another) const
+			{ return ((m_node == another.m_node) && (m_index == another.m_index)); }
+		bool operator != (const Iterator& another) const
+			{ return ((*this == another) == false); }
+		bool IsValid() const
+			{ return (m_node != NULL); }
+		char* Data() const
+			{ return GetEntries(m_node) + (size_t)m_index * m_entry_size; }
+	protected:
+		Node* m_node;
+		unsigned int m_index;
+		unsigned int m_entry_size;
+	};
+	//node_capacity 0 means as many entries as a cache line holds (MIN_NODE_CAPACITY at least)
+	BasicUnrolledList(unsigned int entry_size,
+					  unsigned int node_capacity = 0,
+					  Allocator* allocator = BasicVector::GetDefaultAllocator(),
+					  BasicReadWriteLock* lock = NULL);
+	//only frees nodes, entries are destroyed by Clear, which typed lists call from their destructors
+	virtual ~BasicUnrolledList();
+	BasicUnrolledList(const BasicUnrolledList& another) = delete;
+	BasicUnrolledList& operator = (const BasicUnrolledList& another) = delete;
+	unsigned int GetCount() const
+		{ return m_count; }
+	bool IsEmpty() const
+		{ return (m_count == 0); }
+	unsigned int GetNodeCapacity() const
+		{ return m_node_capacity; }
+	//all addition methods return iterator to the just added entry. they throw exceptions.
+	Iterator Insert(const char* data, const Iterator& before_here /*invalid one means PushBack*/);
+	Iterator PushFront(const char* data);
+	Iterator PushBack(const char* data);
+	//returns iterator to the entry after the erased one. throws exceptions.
+	Iterator Erase(const Iterator& it);
+	//this methods do nothing if the list is empty
+	void PopFront();
+	void PopBack();
+	//this methods return NULL if the list is empty
+	char* Front() const;
+	char* Back() const;
+	void Clear();
+	//iterators are not synchronized, lock the list for read while iterating
+	Iterator Begin() const
+		{ return Iterator(m_first, 0, m_entry_size); }
+	Iterator Last() const	//returns iterator to the last element
+		{ return Iterator(m_last, (m_last != NULL) ? m_last->m_count - 1 : 0, m_entry_size); }
+	bool LockForRead();
+	bool LockForWrite();
+	void Unlock();
+	inline void SetLock(BasicReadWriteLock* lock)
+		{ m_rw_lock = lock; }
+	inline BasicReadWriteLock* GetLock() const
+		{ return m_rw_lock; }
+protected:
+	static size_t GetHeaderSize()
+		{ return (sizeof(Node) + ENTRY_ALIGNMENT - 1) & ~((size_t)ENTRY_ALIGNMENT - 1); }
+	static char* GetEntries(Node* node)
+		{ return (char*)node + GetHeaderSize(); }
+	char* GetEntry(Node* node, unsigned int index) const
+		{ return GetEntries(node) + (size_t)index * m_entry_size; }
+	//this CopyEntry implementation copies bytes, descendants call copy constructors
+	virtual void CopyEntry(const char* src, char* dst);
+	//placeholder for destructors, does nothing here
+	virtual void DeinitEntry(char* entry);
+	//moves count entries from src to dst, the ranges may overlap. src entries are not used after that.
+	virtual void MoveEntries(char* src, char* dst, unsigned int count);
+	//new empty node after this one (or the first one if after_this is NULL)
+	Node* AddNode(Node* after_this);
+	void FreeNode(Node* node);
+	Iterator InternalInsert(const char* data, Node* node, unsigned int index);
+	Iterator InternalErase(Node* node, unsigned int index);
+	//moves all entries of the next node to this one and frees the next one
+	void MergeNext(Node* node);
+
+	unsigned int m_entry_size;
+	unsigned int m_node_capacity;
+	Node* m_first;
+	Node* m_last;
+	unsigned int m_count;
+	Allocator* m_allocator;
+	BasicReadWriteLock* m_rw_lock;
+};
+
+template <class DataType>
+class UnrolledList: public BasicUnrolledList
+{
+	static_assert(alignof(DataType) <= ENTRY_ALIGNMENT, "unrolled list entries are aligned to ENTRY_ALIGNMENT");
+public:
+	class Iterator: public BasicUnrolledList::Iterator
+	{
+	public:
+		Iterator()
+			{}
+		Iterator(const BasicUnrolledList::Iterator& src):
+			BasicUnrolledList::Iterator(src)
+			{}
+		operator DataType*()
+			{ return reinterpret_cast<DataType*>(Data()); }
+		DataType* operator -> ()
+			{ return reinterpret_cast<DataType*>(Data()); }
+	};
+	UnrolledList(unsigned int node_capacity = 0,
+				 Allocator* allocator = BasicVector::GetDefaultAllocator(),
+				 BasicReadWriteLock* lock = NULL):
+		BasicUnrolledList(sizeof(DataType), node_capacity, allocator, lock)
+		{}
+	~UnrolledList()
+		{ Clear(); }
+	Iterator Insert(const DataType& data, const Iterator& before_here)
+		{ return BasicUnrolledList::Insert((const char*)&data, before_here); }
+	Iterator PushFront(const DataType& data)
+		{ return BasicUnrolledList::PushFront((const char*)&data); }
+	Iterator PushBack(const DataType& data)
+		{ return BasicUnrolledList::PushBack((const char*)&data); }
+	Iterator Erase(const Iterator& it)
+		{ return BasicUnrolledList::Erase(it); }
+	DataType* Front() const
+		{ return (DataType*)BasicUnrolledList::Front(); }
+	DataType* Back() const
+		{ return (DataType*)BasicUnrolledList::Back(); }
+	Iterator Begin() const
+		{ return BasicUnrolledList::Begin(); }
+	Iterator Last() const
+		{ return BasicUnrolledList::Last(); }
+protected:
+	void CopyEntry(const char* src, char* dst)
+		{ new (dst) DataType(*(const DataType*)src); }
+	void DeinitEntry(char* entry)
+		{ ((DataType*)entry)->~DataType(); }
+	void MoveEntries(char* src, char* dst, unsigned int count)
+	{
+		if (std::is_trivially_copyable<DataType>::value)
+		{
+			BasicUnrolledList::MoveEntries(src, dst, count);
+			return;
+		}
+		DataType* typed_src = (DataType*)src;
+		DataType* typed_dst = (DataType*)dst;
+		//an entry is moved to a slot that is free already: the overlapping part goes in the direction of the move
+		if (typed_dst < typed_src)
+		{
+			for (unsigned int index = 0; index < count; ++index)
+			{
+				new (typed_dst + index) DataType(std::move(typed_src[index]));
+				typed_src[index].~DataType();
+			}
+		} else {
+			for (unsigned int index = count; index > 0; --index)
+			{
+				new (typed_dst + index - 1) DataType(std::move(typed_src[index - 1]));
+				typed_src[index - 1].~DataType();
+			}
+		}
+	}
+};
+
+/*link of an intrusive list. unlike BasicList::Entry it has no virtual methods and knows nothing about the list
+or the object it is in: the object is found from it's hook by static_cast (see IntrusiveListHook), so no RTTI is needed.
+an object has a hook per list it can be in at the same time. copies of an object are not linked anywhere.*/
+class ListHook
+{
+	friend class BasicIntrusiveList;
+	friend class MPSCQueue;
+public:
+	ListHook():
+		m_prev(NULL),
+		m_next(NULL)
+		{}
+	ListHook(const ListHook& another):
+		m_prev(NULL),
+		m_next(NULL)
+		{}
+	ListHook& operator = (const ListHook& another)
+		{ return *this; }
+	~ListHook()
+		{ ASSERT(m_next == NULL); }	//objects must be removed from lists before they die
+	//true while the hook is in an intrusive list
+	bool IsLinked() const
+		{ return (m_next != NULL); }
+protected:
+	ListHook* m_prev;
+	ListHook* m_next;
+};
+
+//base class hook: DataType derives from IntrusiveListHook<Tag> once per list, Tag tells the hooks apart.
+template <class Tag = void>
+class IntrusiveListHook: public ListHook
+{};
+
+/*intrusive doubly linked list of hooks, circular around a hook in the list itself, so it is never empty of links and
+linking and unlinking have no special cases. like BasicList it does not own it's entries.
+IntrusiveList<DataType, Tag> is the typed interface.*/
+class BasicIntrusiveList
+{
+public:
+	class Iterator
+	{
+		friend class BasicIntrusiveList;
+	public:
+		Iterator(ListHook* hook = NULL, const ListHook* end = NULL):
+			m_hook(hook),
+			m_end(end)
+			{}
+		bool operator == (const Iterator& another) const
+			{ return (m_hook == another.m_hook); }
+		bool operator != (const Iterator& another) const
+			{ return (m_hook != another.m_hook); }
+		operator ListHook* () const
+			{ return IsValid() ? m_hook : NULL; }
+		Iterator& operator ++ ()
+		{
+			m_hook = m_hook->m_next;
+			return *this;
+		}
+		Iterator& operator -- ()
+		{
+			m_hook = m_hook->m_prev;
+			return *this;
+		}
+		bool IsValid() const
+			{ return ((m_hook != NULL) && (m_hook != m_end)); }
+	protected:
+		ListHook* m_hook;
+		const ListHook* m_end;	//the list's own hook
+	};
+
+	BasicIntrusiveList(BasicReadWriteLock* lock = NULL);
+	//unlinks entries that are still there
+	virtual ~BasicIntrusiveList();
+	BasicIntrusiveList(const BasicIntrusiveList& another) = delete;
+	BasicIntrusiveList& operator = (const BasicIntrusiveList& another) = delete;
+	unsigned int GetCount() const
+		{ return m_count; }
+	bool IsEmpty() const
+		{ return (m_count == 0); }
+	//this methods throw exceptions if hook is linked already
+	void PushFront(ListHook* hook);
+	void PushBack(ListHook* hook);
+	void Insert(ListHook* hook, const Iterator& before_here /*invalid one means PushBack*/);
+	//returns the hook next to the removed one or NULL if it was the last. hook must be in this list.
+	ListHook* Remove(ListHook* hook);
+	//this methods return NULL if the list is empty
+	ListHook* PopFront();
+	ListHook* PopBack();
+	ListHook* Front() const
+		{ return (m_count != 0) ? m_end.m_next : NULL; }
+	ListHook* Back() const
+		{ return (m_count != 0) ? m_end.m_prev : NULL; }
+	//unlinks all entries
+	void Clear();
+	//iterators are not synchronized, lock the list for read while iterating
+	Iterator Begin()
+		{ return Iterator(m_end.m_next, &m_end); }
+	Iterator Last()
+		{ return Iterator(m_end.m_prev, &m_end); }
+	bool LockForRead();
+	bool LockForWrite();
+	void Unlock();
+	void SetLock(BasicReadWriteLock* lock)
+		{ m_rw_lock = lock; }
+protected:
+	void InternalInsert(ListHook* hook, ListHook* before_this);
+	void InternalRemove(ListHook* hook);
+
+	ListHook m_end;	//m_end.m_next is the first entry and m_end.m_prev is the last
+	unsigned int m_count;
+	BasicReadWriteLock* m_rw_lock;
+};
+
+template <class DataType, class Tag = void>
+class IntrusiveList: public BasicIntrusiveList
+{
+public:
+	typedef IntrusiveListHook<Tag> Hook;
+	class Iterator: public BasicIntrusiveList::Iterator
+	{
+	public:
+		Iterator()
+			{}
+		Iterator(const BasicIntrusiveList::Iterator& src):
+			BasicIntrusiveList::Iterator(src)
+			{}
+		operator DataType* () const
+			{ return IsValid() ? ToData(m_hook) : NULL; }
+		DataType* operator -> () const
+			{ return ToData(m_hook); }
+	};
+	IntrusiveList(BasicReadWriteLock* lock = NULL):
+		BasicIntrusiveList(lock)
+		{}
+	static DataType* ToData(ListHook* hook)
+		{ return (hook != NULL) ? static_cast<DataType*>(static_cast<Hook*>(hook)) : NULL; }
+	static ListHook* ToHook(DataType* data)
+		{ return static_cast<Hook*>(data); }
+	void PushFront(DataType* data)
+		{ BasicIntrusiveList::PushFront(ToHook(data)); }
+	void PushBack(DataType* data)
+		{ BasicIntrusiveList::PushBack(ToHook(data)); }
+	void Insert(DataType* data, const Iterator& before_here)
+		{ BasicIntrusiveList::Insert(ToHook(data), before_here); }
+	DataType* Remove(DataType* data)
+		{ return ToData(BasicIntrusiveList::Remove(ToHook(data))); }
+	DataType* PopFront()
+		{ return ToData(BasicIntrusiveList::PopFront()); }
+	DataType* PopBack()
+		{ return ToData(BasicIntrusiveList::PopBack()); }
+	DataType* Front() const
+		{ return ToData(BasicIntrusiveList::Front()); }
+	DataType* Back() const
+		{ return ToData(BasicIntrusiveList::Back()); }
+	Iterator Begin()
+		{ return BasicIntrusiveList::Begin(); }
+	Iterator Last()
+		{ return BasicIntrusiveList::Last(); }
+};
+
+//intrusive queue for many producers and a single consumer. entries are linked by their own ListHook links,
+//so Push does not allocate anything and takes no lock: it is one atomic exchange and one store (wait-free).
+//consumer takes the whole backlog by one exchange (PopAll) or entry by entry (Pop), in the order of posting.
+//like BasicList, the queue is not responsible for memory management for it's entries.
+//an entry must not be in an intrusive list (by the same hook) while it is in the queue.
+class MPSCQueue
+{
+public:
+	MPSCQueue();
+	virtual ~MPSCQueue();
+	//any thread. returns true if the queue was empty before this entry, so producer knows when to wake consumer up.
+	bool Push(ListHook* entry);
+	//consumer thread only. returns all posted entries as a chain in order of posting or NULL if queue is empty.
+	//entries already taken by Pop but not yet returned come first.
+	//entries in the chain are linked by their own links, walk the chain with Unlink.
+	ListHook* PopAll();
+	//consumer thread only. returns NULL if queue is empty.
+	ListHook* Pop();
+	//consumer thread only.
+	bool IsEmpty() const
+		{ return ((m_pending == NULL) && (m_head.load(std::memory_order_acquire) == NULL)); }
+	//cuts entry off the chain returned by PopAll and returns the next entry in the chain.
+	static ListHook* Unlink(ListHook* entry);
+protected:
+	typedef std::atomic<ListHook*> AtomicLink;
+	//producer sets this value before it publishes the entry, the real link is stored right after exchange.
+	static ListHook* GetPendingLink()
+		{ return reinterpret_cast<ListHook*>(0x1); }
+	static AtomicLink* GetAtomicLink(ListHook* entry)
+		{ return reinterpret_cast<AtomicLink*>(&entry->m_next); }
+	//takes posted entries only, m_pending is not touched
+	ListHook* TakePosted(ListHook** out_last);
+
+	AtomicLink m_head;	//the last posted entry, entries are linked from the last to the first.
+	ListHook* m_pending;	//consumer side: entries taken by Pop from m_head but not yet returned.
+	ListHook* m_pending_last;
+};
+
+class BasicFrozenTree;
+
+class BasicTree
+{
+public:
+	//this allocator is needed here because tree itself is not responsible for memory and is not going on to
+	//manage memory for tree iterator (it needs to keep the stack of parent entries). Allocator is the way to
+	//delegate memory management to BasicTree user.
+	class Allocator: public BasicStack::Allocator
+	{
+	public:
+		Allocator(unsigned int stack_frame_size, unsigned int entry_size) :
+			m_stack_frame_size(stack_frame_size),
+			m_entry_size(entry_size)
+		{}
+		virtual char* AllocateDataArray(unsigned int entry_size, unsigned int count) = 0;
+		virtual void FreeDataArray(char* data_array) = 0;
+		virtual void* AllocateStackFrame() = 0;
+		virtual void* AllocateEntry() = 0;
+		virtual void FreeStackFrame(void* frame) = 0;
+		virtual void FreeEntry(void* entry) = 0;
+	protected:
+		unsigned int m_stack_frame_size;
+		unsigned int m_entry_size;
+	};
+
+	class ChildrenIterator;
+	class Entry;
+	//leaves of the tree in the tree order, linked through the entries. see EnableLeafList.
+	struct LeafList
+	{
+		LeafList():
+			m_first(NULL),
+			m_last(NULL),
+			m_count(0)
+			{}
+		Entry* m_first;
+		Entry* m_last;
+		unsigned int m_count;
+	};
+	class Entry
+	{
+	public:
+		friend class BasicTree::ChildrenIterator;
+		friend class BasicTree;
+		class ChildrenIterator
+		{
+		public:
+			ChildrenIterator(const Entry* parent = NULL, const Entry* child = NULL) :
+				m_parent((Entry*)parent),
+				m_child((Entry*)child)
+			{}
+			bool IsValid() const
+				{ return ((m_parent != NULL) && (m_child != NULL));	}
+			Entry* GetParent() const
+				{ return m_parent; }
+			Entry* GetChild() const
+				{ return m_child; }
+			bool Advance(bool forward);
+			ChildrenIterator& operator ++ ()
+			{
+				if (Advance(true) == false)
+				{
+					m_child = NULL;	//this makes iterator invalid;
+				}
+				return *this;
+			}
+			ChildrenIterator operator ++ (int)
+			{
+				ChildrenIterator ret_val = *this;
+				if (Advance(false) == false)
+				{
+					m_child = NULL;
+				}
+				return ret_val;
+			}
+			ChildrenIterator operator -- ()
+			{
+				if (Advance(false) == false)
+				{
+					m_child = NULL;
+				}
+				return *this;
+			}
+			ChildrenIterator operator -- (int)
+			{
+				ChildrenIterator ret_val = *this;
+				if (Advance(false) == false)
+				{
+					m_child = NULL;
+				}
+				return ret_val;
+			}
+		protected:
+			Entry* m_parent;
+			Entry* m_child;
+			BasicReadWriteLock* m_rw_lock;	//this is those lock that belongs to the tree
+		};
+
+		Entry() :
+			m_parent(NULL),
+			m_first_child(NULL),
+			m_last_child(NULL),
+			m_children_count(0),
+			m_flags(0),
+			m_prev_sibling(NULL),
+			m_next_sibling(NULL),
+			m_links(NULL)
+		{}
+		//destructor destroys all children as well.
+		virtual ~Entry();
+		Entry(const Entry& another) = delete;
+		Entry& operator = (const Entry& another) = delete;
+		unsigned int GetChildrenCount() const
+			{ return m_children_count; }
+		Entry* GetParent() const
+			{ return m_parent; }
+		/*child_before is a child entry before which a new_child will be inserted. may be NULL, 
+		then new entry is pushed back to the end of the children list.
+		if leaves is not NULL, leaves of new_child are linked into it, this entry must be in that list's tree.*/
+		bool AddChild(Entry* new_child, Entry* child_before = NULL, LeafList* leaves = NULL);
+		//if leaves is not NULL, leaves of child are unlinked from it.
+		Entry* /*next child*/ RemoveChild(Entry* child, LeafList* leaves = NULL);
+		ChildrenIterator Begin() const
+			{ return ChildrenIterator(this, m_first_child);	}
+		Entry* GetNextSibling() const
+			{ return m_next_sibling; }
+		Entry* GetPrevSibling() const
+			{ return m_prev_sibling; }
+		Entry* GetFirstChild() const
+			{ return m_first_child;	}
+		Entry* GetLastChild() const
+			{ return m_last_child; }
+		//these are valid only while the leaf list of the tree is enabled, see EnableLeafList
+		Entry* GetNextLeaf() const
+			{ return (m_links != NULL) ? m_links->m_next_leaf : NULL; }
+		Entry* GetPrevLeaf() const
+			{ return (m_links != NULL) ? m_links->m_prev_leaf : NULL; }
+		//sibling setters are for internal use
+		void SetPrevSibling(Entry* e)
+			{ m_prev_sibling = e; }
+		void SetNextSibling(Entry* e)
+			{ m_next_sibling = e; }
+	protected:
+		enum
+		{
+			AGGREGATE_DIRTY = 1	//aggregates of the entry and it's ancestors are to be updated at the end of a batch
+		};
+		Entry* m_parent;
+		Entry* m_first_child;
+		Entry* m_last_child;
+		unsigned int m_children_count;
+		unsigned int m_flags;
+		//double linked list of children
+		Entry* m_prev_sibling;
+		Entry* m_next_sibling;
+		/*what only the leaf list and entry locks need. it is allocated when the entry gets into a tree with one of them
+		and freed with the entry, so entries of other trees pay a pointer (8 bytes on x64) instead of 32 bytes.*/
+		struct Links
+		{
+			Links():
+				m_prev_leaf(NULL),
+				m_next_leaf(NULL)
+				{}
+			//double linked list of leaves
+			Entry* m_prev_leaf;
+			Entry* m_next_leaf;
+			//protects the list of children, used only with entry locks, see EnableEntryLocks
+			SpinReadWriteLock m_lock;
+		};
+		Links* m_links;
+
+		//gives links to the entries of subtree that have none
+		static void AttachLinks(Entry* subtree);
+		static Entry* GetFirstLeaf(Entry* subtree);
+		static Entry* GetLastLeaf(Entry* subtree);
+		//links leaves of subtree one to another in the tree order. returns the number of leaves.
+		static unsigned int ChainLeaves(Entry* subtree, Entry** out_first, Entry** out_last);
+		//puts the chain of leaves of just added new_child between the leaves around it.
+		void LinkLeaves(Entry* new_child, bool was_leaf, LeafList* leaves);
+		//takes the leaves of just removed child out of the list, this entry becomes a leaf if it has no more children.
+		void UnlinkLeaves(Entry* child, LeafList* leaves);
+	};
+
+	//this iterator moves through children and their children recursively. 
+	//(no real recursion e.g. calling fuction from the same function, is here)
+	//NOTE: on tree modification iterator may become unusable, so don't store it for a long time.
+	//use it only as a temporary object on stack.
+	class ChildrenIterator
+	{
+	public:
+		friend class BasicTree;
+		enum
+		{
+			INVALID = 0x1,
+			RETURN_TO_PARENTS = 0x2		//this means when iterator traverses the tree it goes throuh an entry (parent)
+										//and then goes to its children. when this flag is set, iterator returns to parent
+										//entry again after it passed through all children.
+		};
+		const unsigned int m_n_preallocated = 64;
+		//all parameters here have default values == NULL so that iterator can be created as a local variable 
+		//on stack an then be assigned to real iterator via GetChildrenIterator.
+		ChildrenIterator(BasicTree* tree = NULL,
+						 Entry* parent = NULL,
+						 Entry* child = NULL /*if child == NULL, then first child*/,
+						 unsigned int flags = 0):
+						 m_tree(tree),
+						 m_current_entry(NULL),
+						 m_prev_entry(NULL),
+						 m_flags(flags)
+		{
+			if ((m_tree == NULL) || (parent == NULL))
+			{
+				m_flags |= INVALID;
+			}
+			Entry* actual_child = child;
+			if (actual_child == NULL)
+			{
+				if (parent != NULL)
+				{
+					actual_child = parent->m_first_child;
+				}
+			}
+			if (actual_child == NULL)
+			{
+				m_flags |= INVALID;
+			}
+			m_current_entry = actual_child;
+		}
+		ChildrenIterator(const ChildrenIterator& another):
+			m_tree(another.m_tree),
+			m_current_entry(another.m_current_entry),
+			m_prev_entry(another.m_prev_entry),
+			m_flags(another.m_flags)
+		{
+			if (m_tree == NULL)
+			{
+				m_flags |= INVALID;
+			}
+
+		}
+		virtual ~ChildrenIterator()
+		{}
+		ChildrenIterator& operator = (const ChildrenIterator& another)
+		{
+			//bool unlock_this(false);
+			//bool unlock_another(false);
+			//unsigned int error = UTILS_ERROR_OK;
+			//const wchar_t* msg = NULL;
+			BasicReadWriteLock* this_rw_lock = NULL;
+			BasicReadWriteLock* another_rw_lock = NULL;
+			if (another.m_tree != NULL)
+			{
+				another_rw_lock = another.m_tree->m_rw_lock;
+			}
+			if (m_tree != NULL)
+			{
+				this_rw_lock = m_tree->m_rw_lock;
+			}
+			ReadSynchronizer read_synchronizer(another_rw_lock);
+			WriteSynchronizer write_synchronizer(this_rw_lock);
+			/*if ((another.m_tree != NULL) && (another.m_tree->m_rw_lock != NULL))
+			{
+				if (another.m_tree->m_rw_lock->LockForRead())
+				{
+					unlock_another = true;
+				} else {
+					error = SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ;
+					msg = L"cannot lock source tree for read";
+				}
+			}
+			if ((m_tree != NULL) && (m_tree->m_rw_lock != NULL))
+			{
+				if (m_tree->m_rw_lock->LockForWrite())
+				{
+					unlock_this = true;
+				} else {
+					error = SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE;
+					msg = L"cannot lock destination tree for write";
+				}
+			}*/
+			m_tree = another.m_tree;
+			m_current_entry = another.m_current_entry;
+			m_prev_entry = another.m_prev_entry;
+			m_flags = another.m_flags;
+			if (m_tree == NULL)
+			{
+				m_flags |= INVALID;
+			}
+			return *this;
+			/*if (unlock_this)
+			{
+				if (m_tree != NULL)
+				{
+					ASSERT(m_tree->m_rw_lock != NULL);
+					m_tree->m_rw_lock->Unlock();
+				}
+			}
+			if (unlock_another)
+			{
+				if (another.m_tree != NULL)
+				{
+					ASSERT(another.m_tree->m_rw_lock != NULL);
+					another.m_tree->m_rw_lock->Unlock();
+				}
+			}*/
+			/*if (error != UTILS_ERROR_OK)
+			{
+				ASSERT(msg != NULL);
+				throw Exception(error, msg, EXC_HERE);
+			}*/
+		}
+		bool IsValid() const
+			{ return ((m_flags & INVALID) == 0); }
+		bool Advance(bool forward = true);
+		ChildrenIterator& operator ++ ()
+		{
+			if (Advance(true) == false)
+			{
+				m_flags |= INVALID;
+			}
+			else {
+				m_flags &= (~INVALID);
+			}
+			return *this;
+		}
+		ChildrenIterator operator ++ (int i)
+		{
+			ChildrenIterator ret_val = *this;
+			if (Advance(true) == false)
+			{
+				m_flags |= INVALID;
+			} else {
+				m_flags &= (~INVALID);
+			}
+			return ret_val;
+		}
+		ChildrenIterator& operator -- ()
+		{
+			if (Advance(false) == false)
+			{
+				m_flags |= INVALID;
+			} else {
+				m_flags &= (~INVALID);
+			}
+			return *this;
+		}
+		ChildrenIterator operator -- (int i)
+		{
+			ChildrenIterator ret_val = *this;
+			if (Advance(false) == false)
+			{
+				m_flags |= INVALID;
+			} else {
+				m_flags &= (~INVALID);
+			}
+			return ret_val;
+		}
+		Entry* GetParent() const
+		{
+			return m_current_entry->GetParent();
+		}
+		Entry* GetCurrentChild() const
+		{
+			return m_current_entry;
+		}
+		unsigned int GetFlags() const
+		{
+			return m_flags; 
+		}
+		bool GetFlag(unsigned int mask) const
+		{
+			return (m_flags & mask); 
+		}
+		void SetFlag(unsigned int mask, bool value)
+		{
+			if (value)
+			{
+				m_flags |= mask;
+			} else {
+				m_flags &= (~mask);
+			}
+		}
+	protected:
+		Entry* FindGrandparentWithNextUnseenChild(bool forward, Entry** unseen);
+
+		BasicTree* m_tree;
+		Entry* m_current_entry;
+		Entry* m_prev_entry;
+		unsigned int m_flags;
+	};
+
+	//this is iterator to iterate througn tree leaves, not coming back to parent entries
+	class TopLevelIterator
+	{
+		friend class BasicTree;
+		enum
+		{
+			INVALID = 1
+		};
+	public:
+		TopLevelIterator():
+			m_flags(0),
+			m_rw_lock(NULL)
+			{}
+		TopLevelIterator(const ChildrenIterator& ch_it) :
+			m_it(ch_it),
+			m_flags(0),
+			m_rw_lock(NULL)
+			{
+				if (ch_it.m_tree != NULL)
+				{
+					m_rw_lock = ch_it.m_tree->m_rw_lock;
+				}
+			}
+		/*virtual ~TopLevelIterator()
+		{}*/
+		bool Advance(bool forward);
+		TopLevelIterator& operator ++ ()
+		{
+			/*if (m_rw_lock != NULL)
+			{
+				if (m_rw_lock->TryLockForRead() == false)
+				{
+					throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
+						L"tree is locked for reading",
+						EXC_HERE);
+				}
+			}*/
+			TryWriteSynchronizer write_sync(m_rw_lock);
+			if (Advance(true) == false)
+			{
+				m_flags |= INVALID;
+			} else {
+				m_flags &= (~INVALID);
+			}
+			return *this;
+		}
+		TopLevelIterator operator ++ (int)
+		{
+			/*if (m_rw_lock != NULL)
+			{
+				if (m_rw_lock->TryLockForRead() == false)
+				{
+					throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
+						L"tree is locked for reading",
+						EXC_HERE);
+				}
+			}*/
+			TryReadSynchronizer sync(m_rw_lock);
+			TopLevelIterator ret_val = *this;
+			if(Advance(true) == false)
+			{
+				m_flags |= INVALID;
+			}
+			else {
+				m_flags &= (~INVALID);
+			}
+			return ret_val;
+		}
+		TopLevelIterator& operator -- ()
+		{
+			/*if (m_rw_lock != NULL)
+			{
+				if (m_rw_lock->TryLockForRead() == false)
+				{
+					throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
+						L"tree is locked for reading",
+						EXC_HERE);
+				}
+			}*/
+			TryReadSynchronizer sync(m_rw_lock);
+			if (Advance(false) == false)
+			{
+				m_flags |= INVALID;
+			}
+			else {
+				m_flags &= (~INVALID);
+			}
+			return *this;
+		}
+		TopLevelIterator operator -- (int)
+		{
+			/*if (m_rw_lock != NULL)
+			{
+				if (m_rw_lock->TryLockForRead() == false)
+				{
+					throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
+						L"tree is locked for reading",
+						EXC_HERE);
+				}
+			}*/
+			TryReadSynchronizer sync(m_rw_lock);
+			TopLevelIterator ret_val = *this;
+			if(Advance(false) == false)
+			{
+				m_flags |= INVALID;
+			}
+			else {
+				m_flags &= (~INVALID);
+			}
+			return ret_val;
+		}
+		bool IsValid() const
+			{ return ((m_flags & INVALID) == 0); }
+		Entry* GetEntry() const
+			{ return m_it.GetCurrentChild(); }
+	protected:
+		inline void SetValid(bool is_valid)
+		{
+			if(is_valid)
+			{
+				m_flags &= (~INVALID);
+			} else {
+				m_flags |= INVALID;
+			}
+		}
+		ChildrenIterator m_it;
+		unsigned int m_flags;
+		BasicReadWriteLock* m_rw_lock;	//this is those lock that belongs to the tree
+	};
+
+	/*pre-order iterator through a branch for the entry locks mode, see EnableEntryLocks.
+	it holds read locks of the current entry and of all it's ancestors up to the branch, they are taken hand over hand
+	when it goes down or to the next sibling, so other branches may be changed while it goes.
+	the tree lock is held for read until the iterator is destroyed. do not change the branch from the same thread.*/
+	class BranchIterator
+	{
+	public:
+		BranchIterator(BasicTree* tree, Entry* branch = NULL);
+		~BranchIterator();
+		BranchIterator(const BranchIterator& another) = delete;
+		BranchIterator& operator = (const BranchIterator& another) = delete;
+		bool IsValid() const
+			{ return (m_current != NULL); }
+		Entry* GetEntry() const
+			{ return m_current; }
+		BranchIterator& operator ++ ()
+		{
+			Advance(true);
+			return *this;
+		}
+		//goes to the next entry that is not a child of the current one
+		void SkipChildren()
+			{ Advance(false); }
+	protected:
+		void Advance(bool into_children);
+		BasicReadWriteLock* m_rw_lock;
+		Entry* m_branch;
+		Entry* m_current;
+	};
+
+	//keeps aggregates cached in entries up to date, see AugmentedTree
+	class Aggregator
+	{
+	public:
+		virtual ~Aggregator()
+		{}
+		//recomputes the aggregate of entry from it's own data and aggregates of it's children
+		virtual void Update(Entry* entry) = 0;
+	};
+
+	BasicTree(BasicReadWriteLock* lock = NULL) :
+		m_root(NULL),
+		m_rw_lock(lock),
+		m_leaf_list_enabled(false),
+		m_aggregator(NULL),
+		m_batch_depth(0),
+		m_entry_locks_enabled(false)
+	{}
+	/*if parent == NULL, then root is parent. if child == NULL, then the first child of parent.*/
+	ChildrenIterator GetChildrenIterator(unsigned int flags = 0, 
+										 Entry* parent = NULL, 
+										 Entry* child = NULL,
+										 bool is_first = true);
+	//if basic_entry == NULL, then basic_entry is m_root
+	TopLevelIterator GetTopLevelIterator(bool is_begin, Entry* basic_entry = NULL);
+	//this method adds entry as a child to parent. entry may have it's own children.
+	//return value is a just added entry;
+	Entry* AddEntry(Entry* entry, Entry* parent, Entry* child_before = NULL);
+	//this method just cuts off the branch
+	//return value is a just removed entry
+	Entry* RemoveEntry(Entry* entry);
+	Entry* GetRoot()
+		{ return m_root; }
+	inline bool IsEmpty() const
+		{ return (m_root == NULL); }
+	//fills view with the flattened structure of the tree (or of the subtree), see BasicFrozenTree.
+	void Freeze(BasicFrozenTree* view, Entry* subtree_root = NULL);
+	/*with the leaf list, leaves are linked one to another in the tree order and the list is kept up to date by
+	AddEntry and RemoveEntry, so TopLevelIterator goes from leaf to leaf in O(1) and GetLeafCount is O(1).
+	adding or removing a branch costs it's depth plus the number of it's leaves.
+	while the list is enabled, the tree must be changed only through AddEntry and RemoveEntry.
+	enabling it and adding branches allocate Entry::Links for entries that have none.*/
+	void EnableLeafList(bool enable);
+	bool IsLeafListEnabled() const
+		{ return m_leaf_list_enabled; }
+	//O(1) with the leaf list, otherwise the whole tree is walked
+	unsigned int GetLeafCount();
+	/*between BeginBatch and EndBatch AddEntry and RemoveEntry only mark the ancestors of changed entries,
+	and EndBatch updates every marked entry once, under one write lock. batches may be nested.
+	aggregates of the marked entries are not valid until the batch ends.*/
+	void BeginBatch();
+	void EndBatch();
+	//call it after the data of entry is changed, so aggregates of entry and it's ancestors are updated
+	void UpdateAggregates(Entry* entry);
+	/*with entry locks, AddEntry takes the tree lock for read and locks only the parent entry for write,
+	RemoveEntry locks the parent and then the removed entry, so branches that don't contain one another are changed
+	in parallel. setting and removing the root and switching modes still lock the whole tree for write.
+	use BranchIterator to go through a branch while other branches change, other iterators don't take entry locks.
+	leaf list and aggregates change entries outside of the branch, so they can't be used with entry locks.
+	like the leaf list, entry locks are in Entry::Links allocated on enabling and on adding branches.*/
+	void EnableEntryLocks(bool enable);
+	bool IsEntryLocksEnabled() const
+		{ return m_entry_locks_enabled; }
+	bool LockForRead();
+	bool LockForWrite();
+	void Unlock();
+protected:
+	void SetAggregator(Aggregator* aggregator)
+		{ m_aggregator = aggregator; }
+	//updates all entries of branch, children before parents
+	void UpdateBranchAggregates(Entry* branch);
+	//updates entry and it's ancestors, or marks them if a batch is going on
+	void UpdatePathAggregates(Entry* entry);
+	//updates marked entries, children before parents
+	void UpdateDirtyAggregates();
+
+	Entry* m_root;
+	BasicReadWriteLock* m_rw_lock;
+	bool m_leaf_list_enabled;
+	LeafList m_leaves;
+	Aggregator* m_aggregator;
+	unsigned int m_batch_depth;
+	bool m_entry_locks_enabled;
+};
+
+template <class DataType>
+class Tree: public BasicTree
+{
+public:
+	class Entry: public BasicTree::Entry
+	{
+		friend class Tree;
+	public:
+		//Entry()
+		//{}
+		Entry(const DataType& data):
+			m_data(data)
+		{}
+		//virtual ~Entry();
+		Entry& operator = (const DataType& data)
+			{ m_data = data; }
+		operator DataType& ()
+			{ return m_data; }
+		Entry* GetNextSibling() const
+			{ return reinterpret_cast<Entry*>(m_next_sibling); }
+	protected:
+		DataType m_data;
+	};
+
+	/*Tree(BasicTree::Allocator* allocator) :
+		BasicTree(allocator)
+	{}*/
+	//virtual ~Tree();
+	Tree(BasicReadWriteLock* lock = NULL) :
+		BasicTree(lock)
+		{}
+	Entry* GetRoot() const
+	{
+		if (m_root == NULL)
+		{
+			return NULL;
+		}
+		return reinterpret_cast<Entry*>(m_root); 
+	}
+	
+protected:
+	
+};
+
+/*aggregates for AugmentedTree. an aggregate has a ValueType, Lift makes a value of one entry and Combine adds
+the value of a child subtree to it. Combine must not depend on the order of children.*/
+template <class DataType>
+struct SizeAggregate
+{
+	typedef unsigned int ValueType;
+	static ValueType Lift(const DataType& data)
+		{ return 1; }
+	static void Combine(ValueType& value, const ValueType& child_value)
+		{ value += child_value; }
+};
+
+template <class DataType>
+struct SumAggregate
+{
+	typedef DataType ValueType;
+	static ValueType Lift(const DataType& data)
+		{ return data; }
+	static void Combine(ValueType& value, const ValueType& child_value)
+		{ value += child_value; }
+};
+
+template <class DataType>
+struct MinAggregate
+{
+	typedef DataType ValueType;
+	static ValueType Lift(const DataType& data)
+		{ return data; }
+	static void Combine(ValueType& value, const ValueType& child_value)
+	{
+		if (child_value < value)
+		{
+			value = child_value;
+		}
+	}
+};
+
+template <class DataType>
+struct MaxAggregate
+{
+	typedef DataType ValueType;
+	static ValueType Lift(const DataType& data)
+		{ return data; }
+	static void Combine(ValueType& value, const ValueType& child_value)
+	{
+		if (value < child_value)
+		{
+			value = child_value;
+		}
+	}
+};
+
+/*tree where every entry caches the aggregate of it's subtree, so subtree queries are O(1).
+AddEntry computes the aggregates of the added branch and updates the ancestors of it, RemoveEntry updates
+the ancestors of the removed branch, so a change costs the size of the branch plus the children of it's ancestors.
+use BeginBatch and EndBatch around many changes to update every ancestor only once.
+data of an entry must be changed through SetData, or UpdateAggregates must be called after the change.*/
+template <class DataType, class Aggregate>
+class AugmentedTree: public Tree<DataType>
+{
+public:
+	typedef typename Aggregate::ValueType AggregateType;
+	class Entry: public Tree<DataType>::Entry
+	{
+		friend class AugmentedTree;
+	public:
+		Entry(const DataType& data):
+			Tree<DataType>::Entry(data),
+			m_aggregate(Aggregate::Lift(data))
+		{}
+		//aggregate of the subtree of this entry
+		const AggregateType& GetAggregate() const
+			{ return m_aggregate; }
+		Entry* GetNextSibling() const
+			{ return static_cast<Entry*>(this->m_next_sibling); }
+	protected:
+		AggregateType m_aggregate;
+	};
+
+	AugmentedTree(BasicReadWriteLock* lock = NULL) :
+		Tree<DataType>(lock)
+	{
+		this->SetAggregator(&m_entry_aggregator);
+	}
+	Entry* GetRoot() const
+		{ return static_cast<Entry*>(this->m_root); }
+	void SetData(Entry* entry, const DataType& data)
+	{
+		ASSERT(entry != NULL);
+		WriteSynchronizer sync(this->m_rw_lock);
+		entry->m_data = data;
+		this->UpdatePathAggregates(entry);
+	}
+protected:
+	class EntryAggregator: public BasicTree::Aggregator
+	{
+	public:
+		void Update(BasicTree::Entry* basic_entry)
+		{
+			Entry* entry = static_cast<Entry*>(basic_entry);
+			AggregateType value = Aggregate::Lift(entry->m_data);
+			for (Entry* child = static_cast<Entry*>(entry->GetFirstChild()); child != NULL; child = child->GetNextSibling())
+			{
+				Aggregate::Combine(value, child->m_aggregate);
+			}
+			entry->m_aggregate = value;
+		}
+	};
+	EntryAggregator m_entry_aggregator;
+};
+
+//read-only copy of a tree structure in pre-order arrays, see BasicTree::Freeze. entries are not copied, only pointers
+//to them, so the view stays valid as long as the tree is not changed. every traversal goes through the arrays
+//forward and prefetches the entries ahead, instead of chasing entry links. FrozenTree<DataType> is the typed interface.
+class BasicFrozenTree
+{
+public:
+	typedef unsigned int NodeIndex;
+	enum
+	{
+		INVALID_INDEX = 0xFFFFFFFF,
+		PREFETCH_DISTANCE = 8	//in entries
+	};
+
+	//entries of a subtree in pre-order, it is just the index range [subtree, subtree + subtree size)
+	class PreorderIterator
+	{
+		friend class BasicFrozenTree;
+	public:
+		PreorderIterator():
+			m_view(NULL),
+			m_index(INVALID_INDEX),
+			m_end(0)
+			{}
+		bool IsValid() const
+			{ return (m_index < m_end); }
+		NodeIndex GetIndex() const
+			{ return m_index; }
+		BasicTree::Entry* GetEntry() const
+			{ return m_view->m_entries[m_index]; }
+		PreorderIterator& operator ++ ()
+		{
+			++ m_index;
+			if (m_index + PREFETCH_DISTANCE < m_end)
+			{
+				Prefetch(m_view->m_entries[m_index + PREFETCH_DISTANCE]);
+			}
+			return *this;
+		}
+	protected:
+		const BasicFrozenTree* m_view;
+		NodeIndex m_index;
+		NodeIndex m_end;
+	};
+
+	//entries of a subtree in post-order (children before their parent), like RETURN_TO_PARENTS iteration
+	//that returns each entry on the last visit. goes forward through the arrays except for the steps to parents.
+	class PostorderIterator
+	{
+		friend class BasicFrozenTree;
+	public:
+		PostorderIterator():
+			m_view(NULL),
+			m_index(INVALID_INDEX),
+			m_root(INVALID_INDEX)
+			{}
+		bool IsValid() const
+			{ return (m_index != INVALID_INDEX); }
+		NodeIndex GetIndex() const
+			{ return m_index; }
+		BasicTree::Entry* GetEntry() const
+			{ return m_view->m_entries[m_index]; }
+		PostorderIterator& operator ++ ();
+	protected:
+		const BasicFrozenTree* m_view;
+		NodeIndex m_index;
+		NodeIndex m_root;
+	};
+
+	//all entries level by level, from the root (or from a given depth) down, each level in the tree order.
+	class LevelOrderIterator
+	{
+		friend class BasicFrozenTree;
+	public:
+		LevelOrderIterator():
+			m_view(NULL),
+			m_position(0),
+			m_end(0)
+			{}
+		bool IsValid() const
+			{ return (m_position < m_end); }
+		NodeIndex GetIndex() const
+			{ return m_view->m_level_order[m_position]; }
+		BasicTree::Entry* GetEntry() const
+			{ return m_view->m_entries[GetIndex()]; }
+		LevelOrderIterator& operator ++ ()
+		{
+			++ m_position;
+			if (m_position + PREFETCH_DISTANCE < m_end)
+			{
+				Prefetch(m_view->m_entries[m_view->m_level_order[m_position + PREFETCH_DISTANCE]]);
+			}
+			return *this;
+		}
+	protected:
+		const BasicFrozenTree* m_view;
+		unsigned int m_position;	//in m_level_order
+		unsigned int m_end;
+	};
+
+	//leaves of a subtree in the tree order, taken from the leaf bitmap a word at a time.
+	class LeafIterator
+	{
+		friend class BasicFrozenTree;
+	public:
+		LeafIterator():
+			m_view(NULL),
+			m_index(INVALID_INDEX),
+			m_end(0)
+			{}
+		bool IsValid() const
+			{ return (m_index < m_end); }
+		NodeIndex GetIndex() const
+			{ return m_index; }
+		BasicTree::Entry* GetEntry() const
+			{ return m_view->m_entries[m_index]; }
+		LeafIterator& operator ++ ()
+		{
+			m_index = m_view->FindNextLeaf(m_index + 1, m_end);
+			return *this;
+		}
+	protected:
+		const BasicFrozenTree* m_view;
+		NodeIndex m_index;
+		NodeIndex m_end;
+	};
+
+	BasicFrozenTree(BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator());
+	virtual ~BasicFrozenTree();
+	BasicFrozenTree(const BasicFrozenTree& another) = delete;
+	BasicFrozenTree& operator = (const BasicFrozenTree& another) = delete;
+	//takes the structure of the subtree (whole tree if subtree_root == NULL), the tree is locked for read meanwhile.
+	//index 0 is subtree_root.
+	void Build(BasicTree* tree, BasicTree::Entry* subtree_root = NULL);
+	void Clear();
+	unsigned int GetCount() const
+		{ return m_count; }
+	inline BasicTree::Entry* GetEntry(NodeIndex entry) const
+		{ return m_entries[entry]; }
+	inline unsigned int GetSubtreeSize(NodeIndex entry) const
+		{ return m_subtree_sizes[entry]; }
+	inline unsigned int GetDepth(NodeIndex entry) const
+		{ return m_depths[entry]; }
+	inline NodeIndex GetParent(NodeIndex entry) const
+		{ return m_parents[entry]; }
+	inline bool IsLeaf(NodeIndex entry) const
+		{ return ((m_leaf_bits[entry >> 5] & (1U << (entry & 31))) != 0); }
+	inline NodeIndex GetFirstChild(NodeIndex entry) const
+		{ return (m_subtree_sizes[entry] > 1) ? entry + 1 : INVALID_INDEX; }
+	NodeIndex GetNextSibling(NodeIndex entry) const;
+	//number of levels, the deepest entry has depth GetLevelCount() - 1
+	unsigned int GetLevelCount() const
+		{ return m_level_count; }
+	unsigned int GetLevelSize(unsigned int depth) const
+		{ return m_level_starts[depth + 1] - m_level_starts[depth]; }
+	unsigned int GetLeafCount() const
+		{ return m_leaf_count; }
+	PreorderIterator GetPreorderIterator(NodeIndex subtree = 0) const;
+	PostorderIterator GetPostorderIterator(NodeIndex subtree = 0) const;
+	//if one_level is true, only entries of that depth
+	LevelOrderIterator GetLevelOrderIterator(unsigned int depth = 0, bool one_level = false) const;
+	LeafIterator GetLeafIterator(NodeIndex subtree = 0) const;
+protected:
+	//the first leaf in [from, end) or end
+	NodeIndex FindNextLeaf(NodeIndex from, NodeIndex end) const;
+	void* Allocate(unsigned int entry_size, unsigned int count);
+
+	BasicVector::Allocator* m_allocator;
+	unsigned int m_count;
+	BasicTree::Entry** m_entries;
+	unsigned int* m_subtree_sizes;
+	unsigned int* m_depths;
+	NodeIndex* m_parents;
+	unsigned int* m_leaf_bits;	//bit per entry
+	NodeIndex* m_level_order;	//indexes sorted by depth, then by index
+	unsigned int* m_level_starts;	//level d is m_level_order[m_level_starts[d] .. m_level_starts[d + 1])
+	unsigned int m_level_count;
+	unsigned int m_leaf_count;
+};
+
+template <class DataType>
+class FrozenTree: public BasicFrozenTree
+{
+public:
+	FrozenTree(BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator()):
+		BasicFrozenTree(allocator)
+	{}
+	DataType& operator [] (NodeIndex entry) const
+	{
+		ASSERT(entry < m_count);
+		return *static_cast<typename Tree<DataType>::Entry*>(m_entries[entry]);
+	}
+};
+
+//tree with all nodes in one array, linked by 32 bit indexes instead of pointers. a node keeps only its parent,
+//first child and next sibling (12 bytes), payloads are in a separate array, so walking the tree touches only links.
+//iterators work the same way as BasicTree ones. going backward and counting children walk through siblings.
+//like BasicVector, payloads are moved as bytes when arrays grow. CompactTree<DataType> is the typed interface.
+class BasicCompactTree
+{
+public:
+	typedef unsigned int NodeIndex;
+	enum
+	{
+		INVALID_INDEX = 0xFFFFFFFF,
+		DEFAULT_PREALLOCATED = 0xFF
+	};
+
+	struct Node
+	{
+		NodeIndex m_parent;
+		NodeIndex m_first_child;
+		NodeIndex m_next_sibling;	//next free node if this one is free
+	};
+
+	//see BasicTree::ChildrenIterator
+	class ChildrenIterator
+	{
+		friend class BasicCompactTree;
+	public:
+		enum
+		{
+			INVALID = 0x1,
+			RETURN_TO_PARENTS = 0x2
+		};
+		ChildrenIterator(const BasicCompactTree* tree = NULL,
+						 NodeIndex parent = INVALID_INDEX,
+						 NodeIndex child = INVALID_INDEX /*if child == INVALID_INDEX, then first child*/,
+						 unsigned int flags = 0);
+		bool IsValid() const
+			{ return ((m_flags & INVALID) == 0); }
+		bool Advance(bool forward = true);
+		ChildrenIterator& operator ++ ()
+		{
+			SetFlag(INVALID, Advance(true) == false);
+			return *this;
+		}
+		ChildrenIterator operator ++ (int)
+		{
+			ChildrenIterator ret_val = *this;
+			SetFlag(INVALID, Advance(true) == false);
+			return ret_val;
+		}
+		ChildrenIterator& operator -- ()
+		{
+			SetFlag(INVALID, Advance(false) == false);
+			return *this;
+		}
+		ChildrenIterator operator -- (int)
+		{
+			ChildrenIterator ret_val = *this;
+			SetFlag(INVALID, Advance(false) == false);
+			return ret_val;
+		}
+		NodeIndex GetParent() const
+			{ return m_tree->GetParent(m_current_entry); }
+		NodeIndex GetCurrentChild() const
+			{ return m_current_entry; }
+		unsigned int GetFlags() const
+			{ return m_flags; }
+		bool GetFlag(unsigned int mask) const
+			{ return ((m_flags & mask) != 0); }
+		void SetFlag(unsigned int mask, bool value)
+		{
+			if (value)
+			{
+				m_flags |= mask;
+			} else {
+				m_flags &= (~mask);
+			}
+		}
+	protected:
+		NodeIndex FindNextUnseenChild(bool forward) const;
+
+		const BasicCompactTree* m_tree;
+		NodeIndex m_current_entry;
+		NodeIndex m_prev_entry;
+		unsigned int m_flags;
+	};
+
+	//see BasicTree::TopLevelIterator
+	class TopLevelIterator
+	{
+		friend class BasicCompactTree;
+	public:
+		TopLevelIterator()
+			{ m_it.SetFlag(ChildrenIterator::INVALID, true); }
+		bool Advance(bool forward);
+		TopLevelIterator& operator ++ ()
+		{
+			m_it.SetFlag(ChildrenIterator::INVALID, Advance(true) == false);
+			return *this;
+		}
+		TopLevelIterator operator ++ (int)
+		{
+			TopLevelIterator ret_val = *this;
+			m_it.SetFlag(ChildrenIterator::INVALID, Advance(true) == false);
+			return ret_val;
+		}
+		TopLevelIterator& operator -- ()
+		{
+			m_it.SetFlag(ChildrenIterator::INVALID, Advance(false) == false);
+			return *this;
+		}
+		TopLevelIterator operator -- (int)
+		{
+			TopLevelIterator ret_val = *this;
+			m_it.SetFlag(ChildrenIterator::INVALID, Advance(false) == false);
+			return ret_val;
+		}
+		bool IsValid() const
+			{ return m_it.IsValid(); }
+		NodeIndex GetEntry() const
+			{ return m_it.GetCurrentChild(); }
+	protected:
+		ChildrenIterator m_it;
+	};
+
+	BasicCompactTree(unsigned int data_size,
+					 unsigned int n_preallocated = DEFAULT_PREALLOCATED,
+					 BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator(),
+					 BasicReadWriteLock* lock = NULL);
+	//descendants must call Clear in their destructors because payloads are destroyed through virtual methods.
+	virtual ~BasicCompactTree();
+	BasicCompactTree(const BasicCompactTree& another) = delete;
+	BasicCompactTree& operator = (const BasicCompactTree& another) = delete;
+	/*if parent == INVALID_INDEX, then root is parent. if child == INVALID_INDEX, then the first (or last) child of parent.*/
+	ChildrenIterator GetChildrenIterator(unsigned int flags = 0,
+										 NodeIndex parent = INVALID_INDEX,
+										 NodeIndex child = INVALID_INDEX,
+										 bool is_first = true) const;
+	//if basic_entry == INVALID_INDEX, then basic_entry is the root
+	TopLevelIterator GetTopLevelIterator(bool is_begin, NodeIndex basic_entry = INVALID_INDEX) const;
+	//unlike BasicTree, nodes belong to the tree, so the whole branch is destroyed.
+	//return value is the next sibling of removed entry.
+	NodeIndex RemoveEntry(NodeIndex entry);
+	void Clear();
+	//makes room for count nodes.
+	void Reserve(unsigned int count);
+	NodeIndex GetRoot() const
+		{ return m_root; }
+	inline bool IsEmpty() const
+		{ return (m_root == INVALID_INDEX); }
+	unsigned int GetCount() const
+		{ return m_count; }
+	inline NodeIndex GetParent(NodeIndex entry) const
+		{ return m_nodes[entry].m_parent; }
+	inline NodeIndex GetFirstChild(NodeIndex entry) const
+		{ return m_nodes[entry].m_first_child; }
+	inline NodeIndex GetNextSibling(NodeIndex entry) const
+		{ return m_nodes[entry].m_next_sibling; }
+	inline bool IsLeaf(NodeIndex entry) const
+		{ return (m_nodes[entry].m_first_child == INVALID_INDEX); }
+	//these walk through siblings.
+	NodeIndex GetPrevSibling(NodeIndex entry) const;
+	NodeIndex GetLastChild(NodeIndex entry) const;
+	unsigned int GetChildrenCount(NodeIndex entry) const;
+	bool IsValidEntry(NodeIndex entry) const
+		{ return ((entry < m_size) && (m_nodes[entry].m_parent != FREE_MARK)); }
+	bool LockForRead();
+	bool LockForWrite();
+	void Unlock();
+protected:
+	enum
+	{
+		FREE_MARK = 0xFFFFFFFE	//m_parent of a free node
+	};
+
+	//read-only view over nodes and payloads that belong to someone else (a snapshot image), see TreeSnapshot.
+	//there is no allocator, so nothing may be added or removed.
+	BasicCompactTree(unsigned int data_size, const Node* nodes, const char* data, unsigned int count);
+
+	inline char* GetDataPointer(NodeIndex entry) const
+		{ return (m_data + (size_t)entry * m_data_size); }
+	virtual void DestroyData(char* data) = 0;
+
+	//a new entry is added in three steps, so a payload constructor that throws leaves the tree as it was:
+	//FindPrevSibling checks parameters, AllocateNode takes a node, LinkNode puts it into the tree after
+	//the payload is constructed (or ReleaseNode gives it back).
+	//child_before == INVALID_INDEX means the end of children list. returns INVALID_INDEX for the first position.
+	NodeIndex FindPrevSibling(NodeIndex parent, NodeIndex child_before) const;
+	NodeIndex AllocateNode();
+	void ReleaseNode(NodeIndex entry);
+	void LinkNode(NodeIndex entry, NodeIndex parent, NodeIndex prev_sibling);
+	void FreeNode(NodeIndex entry);
+	void Grow(unsigned int capacity);
+
+	unsigned int m_data_size;
+	BasicVector::Allocator* m_allocator;
+	BasicReadWriteLock* m_rw_lock;
+	Node* m_nodes;
+	char* m_data;
+	unsigned int m_capacity;
+	unsigned int m_size;	//nodes after this one were never used
+	unsigned int m_count;
+	NodeIndex m_root;
+	NodeIndex m_free;
+};
+
+template <class DataType>
+class CompactTree: public BasicCompactTree
+{
+public:
+	CompactTree(unsigned int n_preallocated = DEFAULT_PREALLOCATED,
+				BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator(),
+				BasicReadWriteLock* lock = NULL):
+		BasicCompactTree(sizeof(DataType), n_preallocated, allocator, lock)
+	{}
+	virtual ~CompactTree()
+		{ Clear(); }
+	DataType& operator [] (NodeIndex entry) const
+	{
+		ASSERT(IsValidEntry(entry));
+		return *(DataType*)GetDataPointer(entry);
+	}
+	//if parent == INVALID_INDEX, a root is added. if child_before == INVALID_INDEX, entry becomes the last child.
+	//return value is the index of just added entry.
+	NodeIndex AddEntry(const DataType& data, NodeIndex parent, NodeIndex child_before = INVALID_INDEX)
+	{
+		WriteSynchronizer sync(m_rw_lock);
+		return InternalAdd(data, parent, FindPrevSibling(parent, child_before));
+	}
+	//adds entry right after prev_sibling without walking through siblings, this is the way to build big trees.
+	NodeIndex AddEntryAfter(const DataType& data, NodeIndex prev_sibling)
+	{
+		WriteSynchronizer sync(m_rw_lock);
+		if ((IsValidEntry(prev_sibling) == false) || (prev_sibling == m_root))
+		{
+			throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+				L"Cannot add entry after an entry which is not in the tree or is the root",
+				EXC_HERE);
+		}
+		return InternalAdd(data, GetParent(prev_sibling), prev_sibling);
+	}
+protected:
+	NodeIndex InternalAdd(const DataType& data, NodeIndex parent, NodeIndex prev_sibling)
+	{
+		NodeIndex ret_val = AllocateNode();
+		try
+		{
+			new (GetDataPointer(ret_val)) DataType(data);
+		}
+		catch (...)
+		{
+			ReleaseNode(ret_val);
+			throw;
+		}
+		LinkNode(ret_val, parent, prev_sibling);
+		return ret_val;
+	}
+	void DestroyData(char* data)
+		{ ((DataType*)data)->~DataType(); }
+};
+
+/*persistent tree: nodes that are in the tree are never changed. a change copies the changed node and the nodes on
+the path from it to the root, every other subtree is shared by the old and the new version, so Snapshot is O(1)
+and a snapshot never changes while the tree goes on. nodes are counted by reference, the last version that keeps
+a node frees it. a node is addressed by the path of child indexes from the root.
+changes are serialized by the tree lock, readers of a version take no locks at all.
+PersistentTree<DataType> is the typed interface.*/
+class BasicPersistentTree
+{
+public:
+	enum
+	{
+		INVALID_INDEX = 0xFFFFFFFF,
+		DATA_ALIGNMENT = 16	//payload of a node is aligned to this
+	};
+
+	class Node
+	{
+		friend class BasicPersistentTree;
+	public:
+		unsigned int GetChildrenCount() const
+			{ return m_children_count; }
+		const Node* GetChild(unsigned int index) const
+		{
+			ASSERT(index < m_children_count);
+			return GetChildren()[index];
+		}
+		const char* GetDataPointer() const
+			{ return (const char*)this + GetDataOffset(m_children_count); }
+	protected:
+		Node(unsigned int children_count):
+			m_ref_count(1),
+			m_children_count(children_count)
+		{}
+		//children pointers go right after the node, the payload goes after them.
+		Node* const* GetChildren() const
+			{ return (Node* const*)(this + 1); }
+		Node** GetChildren()
+			{ return (Node**)(this + 1); }
+		char* GetDataPointer()
+			{ return (char*)this + GetDataOffset(m_children_count); }
+		static size_t GetDataOffset(unsigned int children_count)
+		{
+			return ((sizeof(Node) + children_count * sizeof(Node*) + DATA_ALIGNMENT - 1) &
+					(~(size_t)(DATA_ALIGNMENT - 1)));
+		}
+		std::atomic<unsigned int> m_ref_count;
+		unsigned int m_children_count;
+	};
+
+	//a state of the tree, it keeps it's nodes alive and never changes. the tree must outlive it's versions.
+	class Version
+	{
+		friend class BasicPersistentTree;
+	public:
+		Version():
+			m_tree(NULL),
+			m_root(NULL)
+		{}
+		Version(const Version& another);
+		Version& operator = (const Version& another);
+		~Version()
+			{ Reset(); }
+		const Node* GetRoot() const
+			{ return m_root; }
+		bool IsEmpty() const
+			{ return (m_root == NULL); }
+		void Reset();
+	protected:
+		//takes the reference the caller has to root
+		Version(BasicPersistentTree* tree, Node* root):
+			m_tree(tree),
+			m_root(root)
+		{}
+		BasicPersistentTree* m_tree;
+		Node* m_root;
+	};
+
+	BasicPersistentTree(unsigned int data_size, BasicVector::Allocator* allocator, BasicReadWriteLock* lock);
+	virtual ~BasicPersistentTree();
+	BasicPersistentTree(const BasicPersistentTree& another) = delete;
+	BasicPersistentTree& operator = (const BasicPersistentTree& another) = delete;
+	Version Snapshot();
+	bool IsEmpty() const
+		{ return (m_root == NULL); }
+	//removes the entry at path with all it's children. depth == 0 removes the root.
+	void RemoveEntry(const unsigned int* path, unsigned int depth);
+	void Clear();
+protected:
+	enum ChildChange
+	{
+		CHILD_NONE,
+		CHILD_REPLACE,
+		CHILD_INSERT,
+		CHILD_REMOVE
+	};
+	//typed descendants implement these
+	virtual void CopyData(char* dst, const char* src) = 0;
+	virtual void DestroyData(char* data) = 0;
+
+	//adds the root if the tree is empty and depth == 0. returns the index of the new entry in it's parent.
+	unsigned int InternalAdd(const void* data, const unsigned int* parent_path, unsigned int depth,
+							 unsigned int child_before);
+	void InternalSetData(const void* data, const unsigned int* path, unsigned int depth);
+	//makes a node with data and children of node, where child at index is replaced, inserted or removed.
+	//new node takes the reference the caller has to child.
+	Node* NewNode(const char* data, const Node* node, ChildChange change, unsigned int index, Node* child);
+	void ReleaseNode(Node* node);
+	//fills m_path_nodes with the nodes from the root to the end of path, throws if there is no such entry.
+	void FindPath(const unsigned int* path, unsigned int depth);
+	//copies nodes of m_path_nodes above depth with replacement in place of the node at depth and publishes them.
+	void Publish(const unsigned int* path, unsigned int depth, Node* replacement);
+	void SetRoot(Node* root);
+
+	unsigned int m_data_size;
+	BasicVector::Allocator* m_allocator;
+	BasicReadWriteLock* m_rw_lock;	//writers are serialized by this one
+	SpinReadWriteLock m_root_lock;	//Snapshot takes a reference to m_root under it
+	Node* m_root;
+	Vector<Node*> m_path_nodes;
+};
+
+template <class DataType>
+class PersistentTree: public BasicPersistentTree
+{
+	static_assert(alignof(DataType) <= DATA_ALIGNMENT, "payload alignment is bigger than DATA_ALIGNMENT");
+public:
+	PersistentTree(BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator(),
+				   BasicReadWriteLock* lock = NULL):
+		BasicPersistentTree(sizeof(DataType), allocator, lock)
+	{}
+	virtual ~PersistentTree()
+		{ Clear(); }
+	static const DataType& GetData(const Node* node)
+		{ return *(const DataType*)node->GetDataPointer(); }
+	//the root is added to the empty tree with depth == 0 (parent_path may be NULL then).
+	//if child_before == INVALID_INDEX, entry becomes the last child.
+	//return value is the index of just added entry in it's parent.
+	unsigned int AddEntry(const DataType& data, const unsigned int* parent_path, unsigned int depth,
+						  unsigned int child_before = INVALID_INDEX)
+		{ return InternalAdd(&data, parent_path, depth, child_before); }
+	void SetData(const DataType& data, const unsigned int* path, unsigned int depth)
+		{ InternalSetData(&data, path, depth); }
+protected:
+	void CopyData(char* dst, const char* src)
+		{ new (dst) DataType(*(const DataType*)src); }
+	void DestroyData(char* data)
+		{ ((DataType*)data)->~DataType(); }
+};
+
+//bounded queue for many producers and many consumers, no lock is taken (Dmitry Vyukov's algorithm).
+//every cell has it's own sequence number, so producers and consumers meet only on the cell they touch and on
+//one atomic position counter each. capacity is rounded up to the power of two.
+//TryPush/TryPop never wait. Push/Pop are blocking variants, they sleep on an Event when queue is full/empty.
+template <class DataType>
+class MPMCQueue
+{
+public:
+	enum
+	{
+		DEFAULT_CAPACITY = 0x100
+	};
+	MPMCQueue(unsigned int capacity = DEFAULT_CAPACITY,
+			  BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator()) :
+		m_cells(NULL),
+		m_mask(0),
+		m_allocator(allocator),
+		m_enqueue_pos(0),
+		m_dequeue_pos(0),
+		m_waiting_producers(0),
+		m_waiting_consumers(0),
+		m_not_empty(false, false),
+		m_not_full(false, false)
+	{
+		if ((capacity == 0) || (m_allocator == NULL))
+		{
+			throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+				L"Cannot create MPMCQueue with zero capacity or without allocator",
+				EXC_HERE);
+		}
+		size_t actual_capacity = 1;
+		while (actual_capacity < capacity)
+		{
+			actual_capacity <<= 1;
+		}
+		m_cells = (Cell*)m_allocator->AllocateDataArray(sizeof(Cell), (unsigned int)actual_capacity);
+		if (m_cells == NULL)
+		{
+			throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+				L"Cannot allocate cells for MPMCQueue",
+				EXC_HERE);
+		}
+		for (size_t index = 0; index < actual_capacity; ++index)
+		{
+			new (&m_cells[index].m_sequence) std::atomic<size_t>(index);
+		}
+		m_mask = actual_capacity - 1;
+	}
+	MPMCQueue(const MPMCQueue& another) = delete;
+	MPMCQueue& operator = (const MPMCQueue& another) = delete;
+	virtual ~MPMCQueue()
+	{
+		//no one must use the queue at this moment, destroy entries that were not popped.
+		size_t pos = m_dequeue_pos.load(std::memory_order_acquire);
+		size_t end_pos = m_enqueue_pos.load(std::memory_order_acquire);
+		while (pos != end_pos)
+		{
+			Cell* cell = &m_cells[pos & m_mask];
+			ASSERT(cell->m_sequence.load(std::memory_order_relaxed) == pos + 1);
+			cell->GetData()->~DataType();
+			++pos;
+		}
+		m_allocator->FreeDataArray((char*)m_cells);
+	}
+	//returns false if the queue is full.
+	bool TryPush(const DataType& data)
+	{
+		Cell* cell = NULL;
+		size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			cell = &m_cells[pos & m_mask];
+			size_t sequence = cell->m_sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+			if (diff == 0)
+			{	//the cell is free for this lap, try to take it
+				if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			} else if (diff < 0) {
+				//consumers did not free this cell yet, so queue is full
+				return false;
+			} else {
+				//another producer took this cell, reload
+				pos = m_enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+		new (cell->GetData()) DataType(data);
+		cell->m_sequence.store(pos + 1, std::memory_order_release);
+		WakeUp(m_waiting_consumers, m_not_empty);
+		return true;
+	}
+	//returns false if the queue is empty.
+	bool TryPop(DataType* out_data)
+	{
+		ASSERT(out_data != NULL);
+		Cell* cell = NULL;
+		size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+		while (true)
+		{
+			cell = &m_cells[pos & m_mask];
+			size_t sequence = cell->m_sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+			if (diff == 0)
+			{
+				if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			} else if (diff < 0) {
+				//producer did not fill this cell yet, so queue is empty
+				return false;
+			} else {
+				pos = m_dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+		DataType* data = cell->GetData();
+		*out_data = *data;
+		data->~DataType();
+		//cell becomes free for the next lap
+		cell->m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+		WakeUp(m_waiting_producers, m_not_full);
+		return true;
+	}
+	//waits until there is a free cell. returns false if timeout elapsed and queue is still full.
+	//timeout is applied to every single wait, so total time may be longer if other producers win the race.
+	bool Push(const DataType& data, unsigned int timeout_milliseconds = Synch::WaitInfinite)
+	{
+		bool ok = TryPush(data);
+		while (ok == false)
+		{
+			BeginWait(m_waiting_producers);
+			//check again after the waiter is registered, otherwise a consumer may free a cell right now
+			//and will not know that somebody waits for it.
+			ok = TryPush(data);
+			unsigned int wait_result = SYNCH_WAIT_OK;
+			if (ok == false)
+			{
+				wait_result = m_not_full.Wait(timeout_milliseconds);
+			}
+			EndWait(m_waiting_producers);
+			if (wait_result != SYNCH_WAIT_OK)
+			{
+				ok = TryPush(data);
+				break;
+			}
+		}
+		if (ok)
+		{
+			ChainWakeUp(m_waiting_producers, m_not_full, GetCount() < GetCapacity());
+		}
+		return ok;
+	}
+	//waits until there is an entry to pop. returns false if timeout elapsed and queue is still empty.
+	bool Pop(DataType* out_data, unsigned int timeout_milliseconds = Synch::WaitInfinite)
+	{
+		bool ok = TryPop(out_data);
+		while (ok == false)
+		{
+			BeginWait(m_waiting_consumers);
+			ok = TryPop(out_data);
+			unsigned int wait_result = SYNCH_WAIT_OK;
+			if (ok == false)
+			{
+				wait_result = m_not_empty.Wait(timeout_milliseconds);
+			}
+			EndWait(m_waiting_consumers);
+			if (wait_result != SYNCH_WAIT_OK)
+			{
+				ok = TryPop(out_data);
+				break;
+			}
+		}
+		if (ok)
+		{
+			ChainWakeUp(m_waiting_consumers, m_not_empty, GetCount() > 0);
+		}
+		return ok;
+	}
+	//this is a snapshot only, it may be outdated right after return.
+	unsigned int GetCount() const
+	{
+		size_t enqueue_pos = m_enqueue_pos.load(std::memory_order_acquire);
+		size_t dequeue_pos = m_dequeue_pos.load(std::memory_order_acquire);
+		if (enqueue_pos <= dequeue_pos)
+		{
+			return 0;
+		}
+		return (unsigned int)(enqueue_pos - dequeue_pos);
+	}
+	unsigned int GetCapacity() const
+		{ return (unsigned int)(m_mask + 1); }
+	bool IsEmpty() const
+		{ return GetCount() == 0; }
+protected:
+	struct Cell
+	{
+		std::atomic<size_t> m_sequence;
+		alignas(DataType) char m_data[sizeof(DataType)];
+		DataType* GetData()
+			{ return reinterpret_cast<DataType*>(m_data); }
+	};
+	//waiter is registered before the last check, so the side that changes the queue either sees the waiter
+	//and sets the event, or the waiter sees the change.
+	inline void BeginWait(std::atomic<unsigned int>& waiting)
+	{
+		waiting.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+	inline void EndWait(std::atomic<unsigned int>& waiting)
+	{
+		waiting.fetch_sub(1, std::memory_order_relaxed);
+	}
+	inline void WakeUp(std::atomic<unsigned int>& waiting, Event& event)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed) != 0)
+		{
+			event.SetEvent();
+		}
+	}
+	//events are auto reset, several SetEvent calls may wake only one waiter. the one who woke up passes
+	//the signal further if there is still something for the others.
+	inline void ChainWakeUp(std::atomic<unsigned int>& waiting, Event& event, bool has_more)
+	{
+		if (has_more)
+		{
+			WakeUp(waiting, event);
+		}
+	}
+
+	Cell* m_cells;
+	size_t m_mask;
+	BasicVector::Allocator* m_allocator;
+	char m_pad0[CACHE_LINE_SIZE];
+	std::atomic<size_t> m_enqueue_pos;
+	char m_pad1[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> m_dequeue_pos;
+	char m_pad2[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+	std::atomic<unsigned int> m_waiting_producers;
+	std::atomic<unsigned int> m_waiting_consumers;
+	Event m_not_empty;
+	Event m_not_full;
+};
+
+//hash functions for HashMap keys. integers and pointers are mixed, other keys are hashed byte by byte,
+//so specialize HashFunction for keys that have pointers inside or padding.
+inline size_t MixHash(unsigned long long value)
+{
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdULL;
+	value ^= value >> 33;
+	value *= 0xc4ceb9fe1a85ec53ULL;
+	value ^= value >> 33;
+	return (size_t)value;
+}
+
+inline size_t HashBytes(const char* data, unsigned int size)
+{
+	unsigned long long ret_val = 0xcbf29ce484222325ULL;	//FNV-1a
+	for (unsigned int index = 0; index < size; ++index)
+	{
+		ret_val ^= (unsigned char)data[index];
+		ret_val *= 0x100000001b3ULL;
+	}
+	return MixHash(ret_val);
+}
+
+template <class KeyType>
+struct HashFunction
+{
+	static size_t Hash(const KeyType& key)
+		{ return HashBytes((const char*)&key, sizeof(KeyType)); }
+};
+
+template <class CharType>
+struct HashFunction<String<CharType> >
+{
+	static size_t Hash(const String<CharType>& key)
+		{ return HashBytes((const char*)key.GetCString(), key.GetLength() * sizeof(CharType)); }
+};
+
+template <class KeyType>
+struct HashFunction<KeyType*>
+{
+	static size_t Hash(KeyType* key)
+		{ return MixHash((unsigned long long)(size_t)key); }
+};
+
+#define SYNCTL_INTEGER_HASH_FUNCTION(IntegerType)		\
+	template <>											\
+	struct HashFunction<IntegerType>					\
+	{													\
+		static size_t Hash(IntegerType key)				\
+			{ return MixHash((unsigned long long)key); }	\
+	};
+
+SYNCTL_INTEGER_HASH_FUNCTION(char)
+SYNCTL_INTEGER_HASH_FUNCTION(unsigned char)
+SYNCTL_INTEGER_HASH_FUNCTION(short)
+SYNCTL_INTEGER_HASH_FUNCTION(unsigned short)
+SYNCTL_INTEGER_HASH_FUNCTION(int)
+SYNCTL_INTEGER_HASH_FUNCTION(unsigned int)
+SYNCTL_INTEGER_HASH_FUNCTION(long)
+SYNCTL_INTEGER_HASH_FUNCTION(unsigned long)
+SYNCTL_INTEGER_HASH_FUNCTION(long long)
+SYNCTL_INTEGER_HASH_FUNCTION(unsigned long long)
+SYNCTL_INTEGER_HASH_FUNCTION(wchar_t)
+
+//concurrent hash map with chained buckets.
+//buckets are protected by striped spin locks: readers take a stripe for read, writers take it for write,
+//so operations on keys from different stripes do not wait for each other.
+//when the map grows, a new bucket array is published and old buckets are moved one by one: every writer moves
+//the bucket it touches and a small chunk of others, so there is no moment when the whole map is rehashed at once.
+//like BasicVector, this class treats entries as bytes. HashMap<KeyType, ValueType> is the typed interface.
+class BasicHashMap
+{
+public:
+	//entries are allocated one by one with AllocateEntry, bucket arrays with AllocateDataArray.
+	//allocator methods are called from many threads at once.
+	class Allocator: public BasicVector::Allocator
+	{
+	public:
+		virtual void* AllocateEntry(unsigned int entry_size) = 0;
+		virtual void FreeEntry(void* entry) = 0;
+	};
+
+	class DefaultAllocator: public Allocator
+	{
+	public:
+		virtual char* AllocateDataArray(unsigned int entry_size, unsigned int count);
+		virtual void FreeDataArray(char* data_array);
+		virtual void* AllocateEntry(unsigned int entry_size);
+		virtual void FreeEntry(void* entry);
+	};
+
+	static Allocator* GetDefaultAllocator()
+	{
+		static DefaultAllocator def_allocator;
+		return &def_allocator;
+	}
+
+	class Entry
+	{
+		friend class BasicHashMap;
+	public:
+		size_t GetHash() const
+			{ return m_hash; }
+	protected:
+		Entry* m_next;
+		size_t m_hash;
+	};
+
+	//iterator is usable only while the map is locked by LockForRead or LockForWrite.
+	class Iterator
+	{
+		friend class BasicHashMap;
+	public:
+		Iterator(BasicHashMap* map = NULL):
+			m_map(map),
+			m_table_index(0),
+			m_bucket_index(0),
+			m_entry(NULL)
+		{}
+		bool IsValid() const
+			{ return (m_entry != NULL); }
+		Iterator& operator ++ ()
+		{
+			Advance();
+			return *this;
+		}
+		Iterator operator ++ (int)
+		{
+			Iterator ret_val = *this;
+			Advance();
+			return ret_val;
+		}
+		Entry* GetEntry() const
+			{ return m_entry; }
+	protected:
+		void Advance();
+		BasicHashMap* m_map;
+		unsigned int m_table_index;	//0 - old table (while it is moved), 1 - current table
+		unsigned int m_bucket_index;
+		Entry* m_entry;
+	};
+
+	enum
+	{
+		DEFAULT_BUCKET_COUNT = 0x40,
+		STRIPE_COUNT = 0x40,		//power of two, bucket count is never less than this.
+		MAX_LOAD_FACTOR = 2,		//entries per bucket when the map starts to grow.
+		MIGRATION_CHUNK = 0x10		//buckets moved to the new table by every writer while map grows.
+	};
+
+	BasicHashMap(unsigned int entry_size,
+				 unsigned int bucket_count = DEFAULT_BUCKET_COUNT,
+				 Allocator* allocator = GetDefaultAllocator());
+	//descendants must call Clear in their destructors because entries are deinitialized through virtual methods.
+	virtual ~BasicHashMap();
+	//this is a sum of per stripe counters, it may be outdated right after return.
+	unsigned int GetCount() const;
+	unsigned int GetBucketCount() const
+		{ return m_table.m_mask + 1; }
+	void Clear();
+	//these lock all stripes, e.g. to iterate through the map. do not modify the map from the same thread
+	//while it is locked for read.
+	bool LockForRead();
+	bool LockForWrite();
+	void Unlock();
+	Iterator Begin();
+protected:
+	struct Table
+	{
+		Entry** m_buckets;
+		size_t m_mask;
+	};
+
+	struct Stripe
+	{
+		SpinReadWriteLock m_lock;
+		std::atomic<int> m_count;	//entries in buckets of this stripe, changed under m_lock.
+		char m_pad[CACHE_LINE_SIZE - sizeof(SpinReadWriteLock) - sizeof(std::atomic<int>)];
+	};
+
+	//old bucket that is already moved to the new table holds this value.
+	static Entry* GetMovedMark()
+		{ return reinterpret_cast<Entry*>(0x1); }
+	inline Stripe& GetStripe(size_t hash)
+		{ return m_stripes[hash & (STRIPE_COUNT - 1)]; }
+
+	//typed descendants implement these. key and value are passed as pointers to KeyType and ValueType.
+	virtual bool IsEqualKey(const Entry* entry, const void* key) const = 0;
+	virtual void InitEntry(Entry* entry, const void* key, const void* value) = 0;
+	virtual void AssignValue(Entry* entry, const void* value) = 0;
+	virtual void CopyValue(const Entry* entry, void* out_value) const = 0;
+	virtual void DeinitEntry(Entry* entry) = 0;
+
+	bool InternalFind(size_t hash, const void* key, void* out_value /*may be NULL*/);
+	//returns true if a new entry was added, false if the key was there (value is replaced only if replace == true).
+	bool InternalInsert(size_t hash, const void* key, const void* value, bool replace);
+	bool InternalRemove(size_t hash, const void* key, void* out_value /*may be NULL*/);
+
+	//these are called with the stripe of the hash locked. out_all_moved is set when the last old bucket is moved,
+	//then caller must call FinishMoving after it unlocks the stripe.
+	Entry** FindBucket(size_t hash);
+	Entry** FindBucketForWrite(size_t hash, bool* out_all_moved);
+	bool /*all moved*/ MoveBucket(size_t old_bucket_index);
+	bool IsOverloaded(const Stripe& stripe) const
+		{ return ((size_t)stripe.m_count.load(std::memory_order_relaxed) >
+				  ((m_table.m_mask + 1) / STRIPE_COUNT) * MAX_LOAD_FACTOR); }
+	//these are called without any stripe locked.
+	void Grow();
+	void HelpToMove();
+	void FinishMoving();
+	void LockAllStripes(bool exclusive);
+	void UnlockAllStripes();
+	void AllocateTable(Table* table, size_t bucket_count);
+	void FreeTable(Table* table);
+
+	unsigned int m_entry_size;
+	Allocator* m_allocator;
+	//tables are changed only when all stripes are locked for write, so a stripe lock keeps them stable.
+	Table m_table;
+	Table m_old_table;	//m_buckets != NULL while entries are moved to m_table.
+	std::atomic<bool> m_is_moving;	//hint for writers, the truth is m_old_table under a stripe lock.
+	std::atomic<size_t> m_next_to_move;
+	std::atomic<size_t> m_moved_count;
+	Stripe m_stripes[STRIPE_COUNT];
+};
+
+template <class KeyType, class ValueType, class Hash = HashFunction<KeyType> >
+class HashMap: public BasicHashMap
+{
+public:
+	class Entry: public BasicHashMap::Entry
+	{
+		friend class HashMap;
+	public:
+		const KeyType& GetKey() const
+			{ return m_key; }
+		ValueType& GetValue()
+			{ return m_value; }
+	protected:
+		KeyType m_key;
+		ValueType m_value;
+	};
+
+	class Iterator: public BasicHashMap::Iterator
+	{
+	public:
+		Iterator(const BasicHashMap::Iterator& src):
+			BasicHashMap::Iterator(src)
+		{}
+		const KeyType& GetKey() const
+			{ return static_cast<Entry*>(m_entry)->GetKey(); }
+		ValueType& GetValue() const
+			{ return static_cast<Entry*>(m_entry)->GetValue(); }
+	};
+
+	HashMap(unsigned int bucket_count = DEFAULT_BUCKET_COUNT, Allocator* allocator = GetDefaultAllocator()):
+		BasicHashMap(sizeof(Entry), bucket_count, allocator)
+	{}
+	virtual ~HashMap()
+		{ Clear(); }
+	//out_value may be NULL, then it is just a check.
+	bool Find(const KeyType& key, ValueType* out_value = NULL)
+		{ return InternalFind(Hash::Hash(key), &key, out_value); }
+	bool Contains(const KeyType& key)
+		{ return InternalFind(Hash::Hash(key), &key, NULL); }
+	//returns false and keeps the old value if the key is already in the map.
+	bool Insert(const KeyType& key, const ValueType& value)
+		{ return InternalInsert(Hash::Hash(key), &key, &value, false); }
+	//inserts or replaces. returns true if the key was not in the map.
+	bool Set(const KeyType& key, const ValueType& value)
+		{ return InternalInsert(Hash::Hash(key), &key, &value, true); }
+	bool Remove(const KeyType& key, ValueType* out_value = NULL)
+		{ return InternalRemove(Hash::Hash(key), &key, out_value); }
+	Iterator Begin()
+		{ return Iterator(BasicHashMap::Begin()); }
+protected:
+	bool IsEqualKey(const BasicHashMap::Entry* entry, const void* key) const
+		{ return (static_cast<const Entry*>(entry)->m_key == *(const KeyType*)key); }
+	void InitEntry(BasicHashMap::Entry* entry, const void* key, const void* value)
+	{
+		Entry* typed_entry = static_cast<Entry*>(entry);
+		new (&typed_entry->m_key) KeyType(*(const KeyType*)key);
+		new (&typed_entry->m_value) ValueType(*(const ValueType*)value);
+	}
+	void AssignValue(BasicHashMap::Entry* entry, const void* value)
+		{ static_cast<Entry*>(entry)->m_value = *(const ValueType*)value; }
+	void CopyValue(const BasicHashMap::Entry* entry, void* out_value) const
+		{ *(ValueType*)out_value = static_cast<const Entry*>(entry)->m_value; }
+	void DeinitEntry(BasicHashMap::Entry* entry)
+	{
+		Entry* typed_entry = static_cast<Entry*>(entry);
+		typed_entry->m_key.~KeyType();
+		typed_entry->m_value.~ValueType();
+	}
+};
+
+
+//open addressing hash table for one thread (Swiss table layout).
+//every slot has a control byte: empty, deleted or 7 bits of the hash of the entry in the slot. control bytes are
+//checked GROUP_WIDTH at a time with SSE2, so a lookup usually touches one group of control bytes and one entry.
+//a slot is marked deleted only if some probe sequence could have passed through it without stopping,
+//otherwise it becomes empty again, so tables with many removals do not fill up with tombstones.
+//like BasicVector, this class treats entries as bytes. FlatHashMap and FlatHashSet are the typed interface.
+//it is not synchronized, lock it from outside if it is shared.
+class BasicFlatHashTable
+{
+public:
+	class Iterator
+	{
+		friend class BasicFlatHashTable;
+	public:
+		Iterator(BasicFlatHashTable* table = NULL, size_t index = 0):
+			m_table(table),
+			m_index(index)
+		{}
+		bool IsValid() const
+			{ return ((m_table != NULL) && (m_index < m_table->m_capacity)); }
+		Iterator& operator ++ ()
+		{
+			Advance();
+			return *this;
+		}
+		Iterator operator ++ (int)
+		{
+			Iterator ret_val = *this;
+			Advance();
+			return ret_val;
+		}
+		char* GetEntry() const
+			{ return m_table->GetSlot(m_index); }
+	protected:
+		void Advance();
+		BasicFlatHashTable* m_table;
+		size_t m_index;
+	};
+
+	enum
+	{
+		GROUP_WIDTH = 16,
+		MIN_CAPACITY = GROUP_WIDTH
+	};
+
+	BasicFlatHashTable(unsigned int entry_size,
+					   unsigned int count = 0,	//entries to make room for
+					   BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator());
+	//descendants must call Clear in their destructors because entries are destroyed through virtual methods.
+	virtual ~BasicFlatHashTable();
+	unsigned int GetCount() const
+		{ return (unsigned int)m_count; }
+	unsigned int GetCapacity() const
+		{ return (unsigned int)m_capacity; }
+	bool IsEmpty() const
+		{ return (m_count == 0); }
+	//makes room for count entries, so the table does not grow until it has more.
+	void Reserve(unsigned int count);
+	//destroys all entries, memory is kept.
+	void Clear();
+	Iterator Begin();
+protected:
+	//control byte values. full slots have 0..0x7F, so sign bit means the slot is free.
+	enum
+	{
+		CTRL_EMPTY = -128,
+		CTRL_DELETED = -2
+	};
+
+	//GROUP_WIDTH control bytes. MatchXXX return a bit mask, bit N is for control byte N.
+	class Group
+	{
+	public:
+		explicit Group(const signed char* ctrl)
+		{
+#ifdef SYNCTL_SSE2
+			m_ctrl = _mm_loadu_si128((const __m128i*)ctrl);
+#else
+			memcpy(m_ctrl, ctrl, GROUP_WIDTH);
+#endif //SYNCTL_SSE2
+		}
+		unsigned int Match(signed char value) const
+		{
+#ifdef SYNCTL_SSE2
+			return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(value), m_ctrl));
+#else
+			unsigned int ret_val = 0;
+			for (unsigned int index = 0; index < GROUP_WIDTH; ++index)
+			{
+				ret_val |= (unsigned int)(m_ctrl[index] == value) << index;
+			}
+			return ret_val;
+#endif //SYNCTL_SSE2
+		}
+		unsigned int MatchEmpty() const
+			{ return Match(CTRL_EMPTY); }
+		unsigned int MatchFree() const	//empty or deleted
+		{
+#ifdef SYNCTL_SSE2
+			return (unsigned int)_mm_movemask_epi8(m_ctrl);
+#else
+			unsigned int ret_val = 0;
+			for (unsigned int index = 0; index < GROUP_WIDTH; ++index)
+			{
+				ret_val |= (unsigned int)(m_ctrl[index] < 0) << index;
+			}
+			return ret_val;
+#endif //SYNCTL_SSE2
+		}
+	protected:
+#ifdef SYNCTL_SSE2
+		__m128i m_ctrl;
+#else
+		signed char m_ctrl[GROUP_WIDTH];
+#endif //SYNCTL_SSE2
+	};
+
+	//groups of a probe sequence start at any slot and go with growing steps, so every group is visited
+	//once when capacity is a power of two.
+	class ProbeSequence
+	{
+	public:
+		ProbeSequence(size_t hash, size_t mask):
+			m_mask(mask),
+			m_offset(GetH1(hash) & mask),
+			m_step(0)
+		{}
+		size_t GetOffset() const
+			{ return m_offset; }
+		size_t GetOffset(unsigned int index_in_group) const
+			{ return ((m_offset + index_in_group) & m_mask); }
+		void Next()
+		{
+			m_step += GROUP_WIDTH;
+			m_offset = (m_offset + m_step) & m_mask;
+		}
+	protected:
+		size_t m_mask;
+		size_t m_offset;
+		size_t m_step;
+	};
+
+	static size_t GetH1(size_t hash)
+		{ return (hash >> 7); }
+	static signed char GetH2(size_t hash)
+		{ return (signed char)(hash & 0x7F); }
+	inline char* GetSlot(size_t index) const
+		{ return (m_slots + index * m_entry_size); }
+
+	//typed descendants implement these, they are called when the table is rehashed or cleared.
+	virtual size_t HashEntry(const char* entry) const = 0;
+	//constructs dst from src and destroys src.
+	virtual void MoveEntry(char* dst, char* src) = 0;
+	virtual void DestroyEntry(char* entry) = 0;
+
+	//this is a hot path, so it is here and is not virtual. EntryType must have GetKey().
+	template <class EntryType, class KeyType>
+	EntryType* FindEntry(size_t hash, const KeyType& key) const
+	{
+		if (m_capacity == 0)
+		{
+			return NULL;
+		}
+		ProbeSequence seq(hash, m_capacity - 1);
+		signed char h2 = GetH2(hash);
+		while (true)
+		{
+			Group group(m_ctrl + seq.GetOffset());
+			for (unsigned int match = group.Match(h2); match != 0; match &= match - 1)
+			{
+				EntryType* entry = (EntryType*)GetSlot(seq.GetOffset(CountTrailingZeros(match)));
+				if (entry->GetKey() == key)
+				{
+					return entry;
+				}
+			}
+			if (group.MatchEmpty() != 0)
+			{
+				return NULL;
+			}
+			seq.Next();
+		}
+	}
+	//takes a free slot for a new entry with this hash (the table may be rehashed) and returns its index.
+	//the caller constructs the entry there or calls CancelInsert.
+	size_t PrepareInsert(size_t hash);
+	void CancelInsert(size_t index);
+	//entry must be destroyed already.
+	void EraseAt(size_t index);
+	size_t FindFreeSlot(size_t hash) const;
+	void SetCtrl(size_t index, signed char value);
+	void Rehash(size_t capacity);
+	static size_t GetCapacityFor(size_t count);
+	static size_t GetMaxCount(size_t capacity)
+		{ return (capacity - capacity / 8); }	//load factor is 7/8
+
+	unsigned int m_entry_size;
+	BasicVector::Allocator* m_allocator;
+	//m_capacity control bytes and a copy of the first GROUP_WIDTH of them, so any group can be loaded at once.
+	signed char* m_ctrl;
+	char* m_slots;
+	size_t m_capacity;	//0 or a power of two
+	size_t m_count;
+	size_t m_growth_left;	//free slots that can be taken before rehash, deleted slots are not counted.
+};
+
+template <class KeyType, class ValueType, class Hash = HashFunction<KeyType> >
+class FlatHashMap: public BasicFlatHashTable
+{
+public:
+	class Entry
+	{
+		friend class FlatHashMap;
+	public:
+		Entry(const KeyType& key, const ValueType& value):
+			m_key(key),
+			m_value(value)
+		{}
+		const KeyType& GetKey() const
+			{ return m_key; }
+		ValueType& GetValue()
+			{ return m_value; }
+	protected:
+		KeyType m_key;
+		ValueType m_value;
+	};
+
+	class Iterator: public BasicFlatHashTable::Iterator
+	{
+	public:
+		Iterator(const BasicFlatHashTable::Iterator& src):
+			BasicFlatHashTable::Iterator(src)
+		{}
+		const KeyType& GetKey() const
+			{ return ((Entry*)GetEntry())->GetKey(); }
+		ValueType& GetValue() const
+			{ return ((Entry*)GetEntry())->GetValue(); }
+	};
+
+	FlatHashMap(unsigned int count = 0, BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator()):
+		BasicFlatHashTable(sizeof(Entry), count, allocator)
+	{}
+	virtual ~FlatHashMap()
+		{ Clear(); }
+	//returns NULL if there is no such key. the pointer is valid until the next insert or remove.
+	ValueType* Get(const KeyType& key)
+	{
+		Entry* entry = FindEntry<Entry>(Hash::Hash(key), key);
+		return ((entry != NULL) ? &entry->m_value : NULL);
+	}
+	//out_value may be NULL, then it is just a check.
+	bool Find(const KeyType& key, ValueType* out_value = NULL)
+	{
+		ValueType* value = Get(key);
+		if ((value != NULL) && (out_value != NULL))
+		{
+			*out_value = *value;
+		}
+		return (value != NULL);
+	}
+	bool Contains(const KeyType& key)
+		{ return (FindEntry<Entry>(Hash::Hash(key), key) != NULL); }
+	//returns false and keeps the old value if the key is already in the map.
+	bool Insert(const KeyType& key, const ValueType& value)
+		{ return InternalInsert(key, value, false); }
+	//inserts or replaces. returns true if the key was not in the map.
+	bool Set(const KeyType& key, const ValueType& value)
+		{ return InternalInsert(key, value, true); }
+	bool Remove(const KeyType& key, ValueType* out_value = NULL)
+	{
+		Entry* entry = FindEntry<Entry>(Hash::Hash(key), key);
+		if (entry == NULL)
+		{
+			return false;
+		}
+		if (out_value != NULL)
+		{
+			*out_value = entry->m_value;
+		}
+		entry->~Entry();
+		EraseAt(((char*)entry - m_slots) / sizeof(Entry));
+		return true;
+	}
+	Iterator Begin()
+		{ return Iterator(BasicFlatHashTable::Begin()); }
+protected:
+	bool InternalInsert(const KeyType& key, const ValueType& value, bool replace)
+	{
+		size_t hash = Hash::Hash(key);
+		Entry* entry = FindEntry<Entry>(hash, key);
+		if (entry != NULL)
+		{
+			if (replace)
+			{
+				entry->m_value = value;
+			}
+			return false;
+		}
+		size_t index = PrepareInsert(hash);
+		try
+		{
+			new (GetSlot(index)) Entry(key, value);
+		}
+		catch (...)
+		{
+			CancelInsert(index);
+			throw;
+		}
+		return true;
+	}
+	size_t HashEntry(const char* entry) const
+		{ return Hash::Hash(((const Entry*)entry)->m_key); }
+	void MoveEntry(char* dst, char* src)
+	{
+		new (dst) Entry(std::move(*(Entry*)src));
+		((Entry*)src)->~Entry();
+	}
+	void DestroyEntry(char* entry)
+		{ ((Entry*)entry)->~Entry(); }
+};
+
+template <class KeyType, class Hash = HashFunction<KeyType> >
+class FlatHashSet: public BasicFlatHashTable
+{
+public:
+	class Entry
+	{
+		friend class FlatHashSet;
+	public:
+		Entry(const KeyType& key):
+			m_key(key)
+		{}
+		const KeyType& GetKey() const
+			{ return m_key; }
+	protected:
+		KeyType m_key;
+	};
+
+	class Iterator: public BasicFlatHashTable::Iterator
+	{
+	public:
+		Iterator(const BasicFlatHashTable::Iterator& src):
+			BasicFlatHashTable::Iterator(src)
+		{}
+		const KeyType& GetKey() const
+			{ return ((Entry*)GetEntry())->GetKey(); }
+	};
+
+	FlatHashSet(unsigned int count = 0, BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator()):
+		BasicFlatHashTable(sizeof(Entry), count, allocator)
+	{}
+	virtual ~FlatHashSet()
+		{ Clear(); }
+	bool Contains(const KeyType& key)
+		{ return (FindEntry<Entry>(Hash::Hash(key), key) != NULL); }
+	//returns false if the key is already in the set.
+	bool Insert(const KeyType& key)
+	{
+		size_t hash = Hash::Hash(key);
+		if (FindEntry<Entry>(hash, key) != NULL)
+		{
+			return false;
+		}
+		size_t index = PrepareInsert(hash);
+		try
+		{
+			new (GetSlot(index)) Entry(key);
+		}
+		catch (...)
+		{
+			CancelInsert(index);
+			throw;
+		}
+		return true;
+	}
+	bool Remove(const KeyType& key)
+	{
+		Entry* entry = FindEntry<Entry>(Hash::Hash(key), key);
+		if (entry == NULL)
+		{
+			return false;
+		}
+		entry->~Entry();
+		EraseAt(((char*)entry - m_slots) / sizeof(Entry));
+		return true;
+	}
+	Iterator Begin()
+		{ return Iterator(BasicFlatHashTable::Begin()); }
+protected:
+	size_t HashEntry(const char* entry) const
+		{ return Hash::Hash(((const Entry*)entry)->m_key); }
+	void MoveEntry(char* dst, char* src)
+	{
+		new (dst) Entry(std::move(*(Entry*)src));
+		((Entry*)src)->~Entry();
+	}
+	void DestroyEntry(char* entry)
+		{ ((Entry*)entry)->~Entry(); }
+};
+
+
+//in memory B+ tree. entries are kept sorted in leaves only, leaves are linked both ways for range scans,
+//inner nodes keep separator keys and children. a node is a few cache lines with its keys next to each other,
+//so a lookup costs about one cache miss per level instead of one per comparison as in a binary tree.
+//like BasicVector, entries are moved in and between nodes as bytes, so keys and values must be relocatable.
+//BPlusTreeMap and BPlusTreeSet are the typed interface. it is not synchronized, lock it from outside if it is shared.
+class BasicBPlusTree
+{
+public:
+	struct Node
+	{
+		unsigned int m_count;	//entries of a leaf or keys of an inner node (inner node has one child more)
+		bool m_is_leaf;
+	};
+
+	struct Leaf: public Node
+	{
+		Leaf* m_prev;
+		Leaf* m_next;
+	};
+
+	//iterator stays valid until the tree is changed.
+	class Iterator
+	{
+		friend class BasicBPlusTree;
+	public:
+		Iterator(const BasicBPlusTree* tree = NULL, Leaf* leaf = NULL, unsigned int index = 0):
+			m_tree(tree),
+			m_leaf(leaf),
+			m_index(index)
+		{}
+		bool IsValid() const
+			{ return (m_leaf != NULL); }
+		Iterator& operator ++ ()
+		{
+			Advance();
+			return *this;
+		}
+		Iterator operator ++ (int)
+		{
+			Iterator ret_val = *this;
+			Advance();
+			return ret_val;
+		}
+		Iterator& operator -- ()
+		{
+			Retreat();
+			return *this;
+		}
+		Iterator operator -- (int)
+		{
+			Iterator ret_val = *this;
+			Retreat();
+			return ret_val;
+		}
+		bool operator == (const Iterator& another) const
+			{ return ((m_leaf == another.m_leaf) && (m_index == another.m_index)); }
+		bool operator != (const Iterator& another) const
+			{ return !(*this == another); }
+		char* GetKey() const
+			{ return m_tree->GetLeafKey(m_leaf, m_index); }
+		char* GetValue() const
+			{ return m_tree->GetLeafValue(m_leaf, m_index); }
+	protected:
+		void Advance();
+		void Retreat();
+		const BasicBPlusTree* m_tree;
+		Leaf* m_leaf;
+		unsigned int m_index;
+	};
+
+	enum
+	{
+		DEFAULT_NODE_SIZE = 4 * CACHE_LINE_SIZE,	//node size is rounded up to cache lines
+		MIN_NODE_CAPACITY = 4,	//node grows beyond node_size if keys are big
+		MAX_HEIGHT = 40
+	};
+
+	BasicBPlusTree(unsigned int key_size,
+				   unsigned int key_alignment,
+				   unsigned int value_size,	//0 for sets
+				   unsigned int value_alignment,
+				   unsigned int node_size = DEFAULT_NODE_SIZE,
+				   BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator());
+	//descendants must call Clear in their destructors because entries are destroyed through virtual methods.
+	virtual ~BasicBPlusTree();
+	BasicBPlusTree(const BasicBPlusTree& another) = delete;
+	BasicBPlusTree& operator = (const BasicBPlusTree& another) = delete;
+	unsigned int GetCount() const
+		{ return m_count; }
+	bool IsEmpty() const
+		{ return (m_count == 0); }
+	unsigned int GetHeight() const
+		{ return m_height; }
+	unsigned int GetLeafCapacity() const
+		{ return m_leaf_capacity; }
+	unsigned int GetInnerCapacity() const
+		{ return m_inner_capacity; }
+	void Clear();
+	//the smallest and the biggest entry.
+	Iterator Begin() const
+		{ return Iterator(this, m_first_leaf, 0); }
+	Iterator Last() const
+		{ return Iterator(this, m_last_leaf, (m_last_leaf != NULL) ? m_last_leaf->m_count - 1 : 0); }
+protected:
+	//nodes from the root to a leaf. m_indexes are child indexes in inner nodes and entry index in the leaf.
+	struct Path
+	{
+		Node* m_nodes[MAX_HEIGHT];
+		unsigned int m_indexes[MAX_HEIGHT];
+	};
+
+	inline char* GetLeafKey(const Node* leaf, unsigned int index) const
+		{ return ((char*)leaf + m_leaf_keys_offset + index * m_key_size); }
+	inline char* GetLeafValue(const Node* leaf, unsigned int index) const
+		{ return ((char*)leaf + m_leaf_values_offset + index * m_value_size); }
+	inline char* GetInnerKey(const Node* node, unsigned int index) const
+		{ return ((char*)node + m_inner_keys_offset + index * m_key_size); }
+	inline Node** GetChildren(const Node* node) const
+		{ return (Node**)((char*)node + m_inner_children_offset); }
+
+	//binary search in keys of one node. lower bound is the first key not less than key,
+	//upper bound is the first key greater than key.
+	template <class KeyType, class Compare>
+	static unsigned int LowerBoundInNode(const KeyType* keys, unsigned int count, const KeyType& key)
+	{
+		unsigned int low = 0;
+		while (count > 0)
+		{
+			unsigned int half = count >> 1;
+			if (Compare::Less(keys[low + half], key))
+			{
+				low += half + 1;
+				count -= half + 1;
+			} else {
+				count = half;
+			}
+		}
+		return low;
+	}
+	template <class KeyType, class Compare>
+	static unsigned int UpperBoundInNode(const KeyType* keys, unsigned int count, const KeyType& key)
+	{
+		unsigned int low = 0;
+		while (count > 0)
+		{
+			unsigned int half = count >> 1;
+			if (Compare::Less(key, keys[low + half]) == false)
+			{
+				low += half + 1;
+				count -= half + 1;
+			} else {
+				count = half;
+			}
+		}
+		return low;
+	}
+	//the leaf where key is or should be. keys equal to a separator are in the right subtree of it.
+	template <class KeyType, class Compare>
+	Node* FindLeaf(const KeyType& key, Path* path /*may be NULL*/) const
+	{
+		Node* node = m_root;
+		for (unsigned int level = 0; level + 1 < m_height; ++level)
+		{
+			unsigned int index = UpperBoundInNode<KeyType, Compare>((const KeyType*)GetInnerKey(node, 0),
+																	  node->m_count, key);
+			if (path != NULL)
+			{
+				path->m_nodes[level] = node;
+				path->m_indexes[level] = index;
+			}
+			node = GetChildren(node)[index];
+		}
+		return node;
+	}
+	//returns true if key is there. path points to the entry or to the place where key should be inserted.
+	template <class KeyType, class Compare>
+	bool FindPath(const KeyType& key, Path* path) const
+	{
+		if (m_root == NULL)
+		{
+			return false;
+		}
+		Node* leaf = FindLeaf<KeyType, Compare>(key, path);
+		const KeyType* keys = (const KeyType*)GetLeafKey(leaf, 0);
+		unsigned int index = LowerBoundInNode<KeyType, Compare>(keys, leaf->m_count, key);
+		path->m_nodes[m_height - 1] = leaf;
+		path->m_indexes[m_height - 1] = index;
+		return ((index < leaf->m_count) && (Compare::Less(key, keys[index]) == false));
+	}
+	template <class KeyType, class Compare>
+	Iterator InternalLowerBound(const KeyType& key) const
+	{
+		if (m_root == NULL)
+		{
+			return Iterator(this);
+		}
+		Node* leaf = FindLeaf<KeyType, Compare>(key, NULL);
+		unsigned int index = LowerBoundInNode<KeyType, Compare>((const KeyType*)GetLeafKey(leaf, 0),
+																  leaf->m_count, key);
+		return MakeIterator(leaf, index);
+	}
+	template <class KeyType, class Compare>
+	Iterator InternalUpperBound(const KeyType& key) const
+	{
+		if (m_root == NULL)
+		{
+			return Iterator(this);
+		}
+		Node* leaf = FindLeaf<KeyType, Compare>(key, NULL);
+		unsigned int index = UpperBoundInNode<KeyType, Compare>((const KeyType*)GetLeafKey(leaf, 0),
+																  leaf->m_count, key);
+		return MakeIterator(leaf, index);
+	}
+	template <class KeyType, class Compare>
+	Iterator InternalFind(const KeyType& key) const
+	{
+		Iterator ret_val = InternalLowerBound<KeyType, Compare>(key);
+		if (ret_val.IsValid() && Compare::Less(key, *(const KeyType*)ret_val.GetKey()))
+		{
+			ret_val = Iterator(this);
+		}
+		return ret_val;
+	}
+	//position after the last entry of a leaf is the first entry of the next leaf.
+	Iterator MakeIterator(Node* leaf, unsigned int index) const
+	{
+		if (index < leaf->m_count)
+		{
+			return Iterator(this, (Leaf*)leaf, index);
+		}
+		return Iterator(this, ((Leaf*)leaf)->m_next, 0);
+	}
+
+	//typed descendants implement these.
+	//constructs an entry at key_dst and value_dst from key and value. value is NULL for sets.
+	virtual void ConstructEntry(char* key_dst, char* value_dst, const char* key, const char* value) = 0;
+	//constructs a copy of key at dst, it is a separator in an inner node.
+	virtual void CopyKey(char* dst, const char* key) = 0;
+	virtual void DestroyKey(char* key) = 0;
+	virtual void DestroyValue(char* value) = 0;
+
+	//key and value are constructed by the caller, they are moved into the tree as bytes.
+	//path is from FindPath. if an exception is thrown, the tree is not changed and key and value are not moved.
+	void InsertAt(Path* path, const char* key, const char* value);
+	//destroys the entry path points to.
+	void RemoveAt(Path* path);
+	//tree must be empty. keys must be sorted and unique, values is NULL for sets.
+	void InternalBulkLoad(const char* keys, const char* values, unsigned int count);
+
+	void ComputeLayout(unsigned int node_size, unsigned int key_alignment, unsigned int value_alignment);
+	Node* AllocateNode(bool is_leaf);
+	void FreeNode(Node* node);
+	void DestroySubtree(Node* node);
+	Node* GetLeftmostLeaf(Node* node) const;
+	void InsertIntoLeaf(Node* leaf, unsigned int index, const char* key, const char* value);
+	void InsertIntoInner(Node* node, unsigned int index, const char* key, Node* right);
+	void RemoveFromInner(Node* node, unsigned int key_index);
+	//inserts separator key and the new right node after path->m_nodes[level] into its parent, splitting up to the root.
+	void InsertIntoParent(Path* path, unsigned int level, char* key, Node* right, Node** new_nodes);
+	//true if path goes through the last children of all nodes above level.
+	bool IsRightmost(const Path* path, unsigned int level) const;
+	void Rebalance(Path* path, unsigned int level);
+	void BorrowFromLeft(Node* parent, unsigned int index, Node* left, Node* node);
+	void BorrowFromRight(Node* parent, unsigned int index, Node* node, Node* right);
+	void Merge(Node* parent, unsigned int separator_index, Node* left, Node* right);
+	//makes parents for count nodes of one level, they replace the nodes in the array.
+	void BuildLevel(Node** nodes, unsigned int count, unsigned int* out_count);
+
+	unsigned int m_key_size;
+	unsigned int m_value_size;
+	unsigned int m_node_size;
+	unsigned int m_leaf_capacity;
+	unsigned int m_inner_capacity;
+	unsigned int m_leaf_keys_offset;
+	unsigned int m_leaf_values_offset;
+	unsigned int m_inner_keys_offset;
+	unsigned int m_inner_children_offset;
+	BasicVector::Allocator* m_allocator;
+	Node* m_root;
+	Leaf* m_first_leaf;
+	Leaf* m_last_leaf;
+	unsigned int m_count;
+	unsigned int m_height;	//0 for an empty tree, 1 if the root is a leaf
+	//room for separator keys on their way up, so insertion does not fail in the middle.
+	char* m_separators;
+};
+
+template <class KeyType, class ValueType, class Compare = LessFunction<KeyType> >
+class BPlusTreeMap: public BasicBPlusTree
+{
+public:
+	class Iterator: public BasicBPlusTree::Iterator
+	{
+	public:
+		Iterator(const BasicBPlusTree::Iterator& src):
+			BasicBPlusTree::Iterator(src)
+		{}
+		const KeyType& GetKey() const
+			{ return *(const KeyType*)BasicBPlusTree::Iterator::GetKey(); }
+		ValueType& GetValue() const
+			{ return *(ValueType*)BasicBPlusTree::Iterator::GetValue(); }
+	};
+
+	BPlusTreeMap(unsigned int node_size = DEFAULT_NODE_SIZE,
+				 BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator()):
+		BasicBPlusTree(sizeof(KeyType), alignof(KeyType), sizeof(ValueType), alignof(ValueType), node_size, allocator)
+	{}
+	virtual ~BPlusTreeMap()
+		{ Clear(); }
+	//returns NULL if there is no such key. the pointer is valid until the tree is changed.
+	ValueType* Get(const KeyType& key) const
+	{
+		BasicBPlusTree::Iterator iter = InternalFind<KeyType, Compare>(key);
+		return (iter.IsValid() ? (ValueType*)iter.GetValue() : NULL);
+	}
+	//out_value may be NULL, then it is just a check.
+	bool Find(const KeyType& key, ValueType* out_value = NULL) const
+	{
+		ValueType* value = Get(key);
+		if ((value != NULL) && (out_value != NULL))
 		{
-			if (m_entry == NULL)
+			*out_value = *value;
+		}
+		return (value != NULL);
+	}
+	bool Contains(const KeyType& key) const
+		{ return InternalFind<KeyType, Compare>(key).IsValid(); }
+	//returns false and keeps the old value if the key is already in the map.
+	bool Insert(const KeyType& key, const ValueType& value)
+		{ return InternalInsert(key, value, false); }
+	//inserts or replaces. returns true if the key was not in the map.
+	bool Set(const KeyType& key, const ValueType& value)
+		{ return InternalInsert(key, value, true); }
+	bool Remove(const KeyType& key, ValueType* out_value = NULL)
+	{
+		Path path;
+		if (FindPath<KeyType, Compare>(key, &path) == false)
+		{
+			return false;
+		}
+		if (out_value != NULL)
+		{
+			Node* leaf = path.m_nodes[m_height - 1];
+			*out_value = *(ValueType*)GetLeafValue(leaf, path.m_indexes[m_height - 1]);
+		}
+		RemoveAt(&path);
+		return true;
+	}
+	//map must be empty, keys must be sorted and unique. leaves are filled up, so it is faster than inserting one by one.
+	void BulkLoad(const KeyType* keys, const ValueType* values, unsigned int count)
+	{
+		for (unsigned int index = 1; index < count; ++index)
+		{
+			if (Compare::Less(keys[index - 1], keys[index]) == false)
 			{
-				return NULL;
+				throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+					L"Cannot bulk load keys which are not sorted or not unique",
+					EXC_HERE);
 			}
-			Entry* entry = reinterpret_cast<Entry*>(m_entry);
-			if (entry != NULL)
+		}
+		InternalBulkLoad((const char*)keys, (const char*)values, count);
+	}
+	//range [from, to) is LowerBound(from) until the key is not less than to.
+	Iterator LowerBound(const KeyType& key) const
+		{ return Iterator(InternalLowerBound<KeyType, Compare>(key)); }
+	Iterator UpperBound(const KeyType& key) const
+		{ return Iterator(InternalUpperBound<KeyType, Compare>(key)); }
+	Iterator Begin() const
+		{ return Iterator(BasicBPlusTree::Begin()); }
+	Iterator Last() const
+		{ return Iterator(BasicBPlusTree::Last()); }
+protected:
+	bool InternalInsert(const KeyType& key, const ValueType& value, bool replace)
+	{
+		Path path;
+		if (FindPath<KeyType, Compare>(key, &path))
+		{
+			if (replace)
 			{
-				//return &(entry->operator DataType());
-				return &(entry->GetData());
+				Node* leaf = path.m_nodes[m_height - 1];
+				*(ValueType*)GetLeafValue(leaf, path.m_indexes[m_height - 1]) = value;
 			}
-			return NULL;
+			return false;
+		}
+		//the entry is made here, so if a constructor throws the tree is not touched.
+		alignas(KeyType) char key_buffer[sizeof(KeyType)];
+		alignas(ValueType) char value_buffer[sizeof(ValueType)];
+		KeyType* new_key = new (key_buffer) KeyType(key);
+		ValueType* new_value = NULL;
+		try
+		{
+			new_value = new (value_buffer) ValueType(value);
+			InsertAt(&path, key_buffer, value_buffer);
+		}
+		catch (...)
+		{
+			if (new_value != NULL)
+			{
+				new_value->~ValueType();
+			}
+			new_key->~KeyType();
+			throw;
+		}
+		return true;
+	}
+	void ConstructEntry(char* key_dst, char* value_dst, const char* key, const char* value)
+	{
+		KeyType* new_key = new (key_dst) KeyType(*(const KeyType*)key);
+		try
+		{
+			new (value_dst) ValueType(*(const ValueType*)value);
+		}
+		catch (...)
+		{
+			new_key->~KeyType();
+			throw;
 		}
+	}
+	void CopyKey(char* dst, const char* key)
+		{ new (dst) KeyType(*(const KeyType*)key); }
+	void DestroyKey(char* key)
+		{ ((KeyType*)key)->~KeyType(); }
+	void DestroyValue(char* value)
+		{ ((ValueType*)value)->~ValueType(); }
+};
+
+template <class KeyType, class Compare = LessFunction<KeyType> >
+class BPlusTreeSet: public BasicBPlusTree
+{
+public:
+	class Iterator: public BasicBPlusTree::Iterator
+	{
+	public:
+		Iterator(const BasicBPlusTree::Iterator& src):
+			BasicBPlusTree::Iterator(src)
+		{}
+		const KeyType& GetKey() const
+			{ return *(const KeyType*)BasicBPlusTree::Iterator::GetKey(); }
 	};
 
-	List(BasicReadWriteLock* lock = NULL) :
-		BasicList(lock)
+	BPlusTreeSet(unsigned int node_size = DEFAULT_NODE_SIZE,
+				 BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator()):
+		BasicBPlusTree(sizeof(KeyType), alignof(KeyType), 0, 1, node_size, allocator)
 	{}
+	virtual ~BPlusTreeSet()
+		{ Clear(); }
+	bool Contains(const KeyType& key) const
+		{ return InternalFind<KeyType, Compare>(key).IsValid(); }
+	//returns false if the key is already in the set.
+	bool Insert(const KeyType& key)
+	{
+		Path path;
+		if (FindPath<KeyType, Compare>(key, &path))
+		{
+			return false;
+		}
+		alignas(KeyType) char key_buffer[sizeof(KeyType)];
+		KeyType* new_key = new (key_buffer) KeyType(key);
+		try
+		{
+			InsertAt(&path, key_buffer, NULL);
+		}
+		catch (...)
+		{
+			new_key->~KeyType();
+			throw;
+		}
+		return true;
+	}
+	bool Remove(const KeyType& key)
+	{
+		Path path;
+		if (FindPath<KeyType, Compare>(key, &path) == false)
+		{
+			return false;
+		}
+		RemoveAt(&path);
+		return true;
+	}
+	//set must be empty, keys must be sorted and unique.
+	void BulkLoad(const KeyType* keys, unsigned int count)
+	{
+		for (unsigned int index = 1; index < count; ++index)
+		{
+			if (Compare::Less(keys[index - 1], keys[index]) == false)
+			{
+				throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+					L"Cannot bulk load keys which are not sorted or not unique",
+					EXC_HERE);
+			}
+		}
+		InternalBulkLoad((const char*)keys, NULL, count);
+	}
+	Iterator LowerBound(const KeyType& key) const
+		{ return Iterator(InternalLowerBound<KeyType, Compare>(key)); }
+	Iterator UpperBound(const KeyType& key) const
+		{ return Iterator(InternalUpperBound<KeyType, Compare>(key)); }
+	Iterator Begin() const
+		{ return Iterator(BasicBPlusTree::Begin()); }
+	Iterator Last() const
+		{ return Iterator(BasicBPlusTree::Last()); }
+protected:
+	void ConstructEntry(char* key_dst, char* value_dst, const char* key, const char* value)
+		{ new (key_dst) KeyType(*(const KeyType*)key); }
+	void CopyKey(char* dst, const char* key)
+		{ new (dst) KeyType(*(const KeyType*)key); }
+	void DestroyKey(char* key)
+		{ ((KeyType*)key)->~KeyType(); }
+	void DestroyValue(char* value)
+		{}
 };
 
-class BasicTree
+//epoch based reclamation for lock-free collections. a thread reads shared nodes only inside a Guard, a node that
+//was unlinked is retired and freed when every guard that could see it is gone, that is two epochs later.
+//a guard takes a free record from the list, records are not freed until the manager is destroyed.
+//guards must be short, one that stays holds back freeing for all threads.
+class EpochManager
 {
+protected:
+	struct Record;
 public:
-	//this allocator is needed here because tree itself is not responsible for memory and is not going on to
-	//manage memory for tree iterator (it needs to keep the stack of parent entries). Allocator is the way to
-	//delegate memory management to BasicTree user.
-	class Allocator: public BasicStack::Allocator
+	//header of a retired node, the collection puts it at the beginning of its nodes.
+	struct RetiredNode
+	{
+		RetiredNode* m_next_retired;
+		void (*m_free)(RetiredNode* node, void* context);
+		void* m_context;
+	};
+
+	class Guard
 	{
 	public:
-		Allocator(unsigned int stack_frame_size, unsigned int entry_size) :
-			m_stack_frame_size(stack_frame_size),
-			m_entry_size(entry_size)
-		{}
-		virtual char* AllocateDataArray(unsigned int entry_size, unsigned int count) = 0;
-		virtual void FreeDataArray(char* data_array) = 0;
-		virtual void* AllocateStackFrame() = 0;
-		virtual void* AllocateEntry() = 0;
-		virtual void FreeStackFrame(void* frame) = 0;
-		virtual void FreeEntry(void* entry) = 0;
+		Guard(EpochManager* manager);
+		~Guard();
+		Guard(const Guard& another) = delete;
+		Guard& operator = (const Guard& another) = delete;
+		//node must be unreachable for guards that come after this call. free_function is called later
+		//from some guard of the same manager or from FreeRetired.
+		void Retire(RetiredNode* node, void (*free_function)(RetiredNode* node, void* context), void* context);
 	protected:
-		unsigned int m_stack_frame_size;
-		unsigned int m_entry_size;
+		EpochManager* m_manager;
+		Record* m_record;
 	};
 
-	class ChildrenIterator;
-	class Entry
+	EpochManager();
+	//there must be no guards. retired nodes are freed.
+	virtual ~EpochManager();
+	EpochManager(const EpochManager& another) = delete;
+	EpochManager& operator = (const EpochManager& another) = delete;
+	//frees all retired nodes now. there must be no guards.
+	void FreeRetired();
+	unsigned long long GetEpoch() const
+		{ return m_epoch.load(std::memory_order_relaxed); }
+protected:
+	enum
+	{
+		BAG_COUNT = 3,	//nodes retired in the current epoch and in two before it
+		ADVANCE_PERIOD = 64	//retired nodes between tries to advance the epoch
+	};
+	struct Record
+	{
+		std::atomic<unsigned long long> m_state;	//(epoch << 1) | 1 inside a guard, 0 outside
+		std::atomic<bool> m_is_taken;
+		Record* m_next;
+		RetiredNode* m_bags[BAG_COUNT];
+		unsigned long long m_bag_epochs[BAG_COUNT];
+		unsigned int m_retired_count;
+		char m_pad[CACHE_LINE_SIZE];	//states of two records are not in one cache line
+	};
+	Record* TakeRecord();
+	void Enter(Record* record);
+	//the epoch goes further when all threads inside guards have seen the current one.
+	void TryAdvance();
+	//frees bags of record that are two epochs old.
+	void Collect(Record* record);
+	static void FreeBag(Record* record, unsigned int bag);
+
+	std::atomic<unsigned long long> m_epoch;
+	std::atomic<Record*> m_records;
+};
+
+//ordered map for many threads, no lock is taken (lock-free skip list of Fraser and Herlihy-Shavit).
+//a node is a part of the map when it is linked at the bottom level, upper levels are only shortcuts.
+//remove marks the links of a node from the top level down, the thread that marks the bottom link is the one who
+//removed it; marked nodes are unlinked by any thread that passes them and are freed by EpochManager, so a thread
+//that still stands on one does not crash. keys and values are not changed after insertion.
+//like BasicBPlusTree, keys and values are kept right in the nodes. SkipListMap and SkipListSet are the typed interface.
+class BasicSkipList
+{
+protected:
+	struct Node;
+public:
+	enum
+	{
+		MAX_HEIGHT = 24	//a level has half of the nodes of the level below, enough for 16M entries
+	};
+
+	//goes over the entries in order while other threads change the map. it sees entries that were in the map
+	//all the time it went, entries inserted or removed meanwhile may be seen or not.
+	//it holds an epoch guard, so it must not live long.
+	class Iterator
 	{
 	public:
-		friend class BasicTree::ChildrenIterator;
-		friend class BasicTree;
-		class ChildrenIterator
+		Iterator(const BasicSkipList* list):
+			m_list(list),
+			m_guard(&list->m_epochs),
+			m_node(NULL)
+		{}
+		bool IsValid() const
+			{ return (m_node != NULL); }
+		void SeekToFirst()
+			{ m_node = m_list->GetNextAlive(m_list->m_head); }
+		void Next()
 		{
-		public:
-			ChildrenIterator(const Entry* parent = NULL, const Entry* child = NULL) :
-				m_parent((Entry*)parent),
-				m_child((Entry*)child)
-			{}
-			bool IsValid() const
-				{ return ((m_parent != NULL) && (m_child != NULL));	}
-			Entry* GetParent() const
-				{ return m_parent; }
-			Entry* GetChild() const
-				{ return m_child; }
-			bool Advance(bool forward);
-			ChildrenIterator& operator ++ ()
+			ASSERT(m_node != NULL);
+			m_node = m_list->GetNextAlive(m_node);
+		}
+		const char* GetKey() const
+			{ return m_list->GetKey(m_node); }
+		const char* GetValue() const
+			{ return m_list->GetValue(m_node); }
+	protected:
+		template <class KeyType, class Compare>
+		void InternalSeek(const KeyType& key)
+			{ m_node = m_list->LowerBoundNode<KeyType, Compare>(key); }
+		const BasicSkipList* m_list;
+		EpochManager::Guard m_guard;
+		Node* m_node;
+	};
+
+	BasicSkipList(unsigned int key_size,
+				  unsigned int key_alignment,
+				  unsigned int value_size,	//0 for sets
+				  unsigned int value_alignment,
+				  BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator());
+	//descendants must call Clear in their destructors because entries are destroyed through virtual methods.
+	virtual ~BasicSkipList();
+	BasicSkipList(const BasicSkipList& another) = delete;
+	BasicSkipList& operator = (const BasicSkipList& another) = delete;
+	//exact only when no one changes the map.
+	unsigned int GetCount() const
+	{
+		int count = m_count.load(std::memory_order_relaxed);
+		return ((count > 0) ? (unsigned int)count : 0);
+	}
+	bool IsEmpty() const
+		{ return (GetCount() == 0); }
+	//no other thread may use the map.
+	void Clear();
+protected:
+	struct Node: public EpochManager::RetiredNode
+	{
+		std::atomic<unsigned int> m_owners;	//the inserter and the remover, the last one who leaves retires the node
+		unsigned int m_height;
+	};
+	//a link is the pointer to the next node, the lowest bit is set when the node that has the link is removed.
+	typedef std::atomic<uintptr_t> Link;
+
+	inline char* GetKey(const Node* node) const
+		{ return ((char*)node + m_key_offset); }
+	inline char* GetValue(const Node* node) const
+		{ return ((char*)node + m_value_offset); }
+	inline Link* GetLinks(const Node* node) const
+		{ return (Link*)((char*)node + m_links_offset); }
+	static inline Node* GetNode(uintptr_t link)
+		{ return (Node*)(link & ~(uintptr_t)1); }
+	static inline bool IsMarked(uintptr_t link)
+		{ return ((link & 1) != 0); }
+
+	//finds the nodes before and after key at every level and unlinks marked nodes on the way.
+	//succs[0] is the first node with key not less than key, returns true if its key is equal to key.
+	template <class KeyType, class Compare>
+	bool FindPosition(const KeyType& key, Node** preds, Node** succs)
+	{
+		Node* pred = m_head;
+		int level = MAX_HEIGHT - 1;
+		while (level >= 0)
+		{
+			Link* pred_link = &GetLinks(pred)[level];
+			Node* node = GetNode(pred_link->load(std::memory_order_acquire));
+			bool is_lost = false;
+			while (node != NULL)
 			{
-				if (Advance(true) == false)
-				{
-					m_child = NULL;	//this makes iterator invalid;
+				uintptr_t next = GetLinks(node)[level].load(std::memory_order_acquire);
+				if (IsMarked(next))
+				{	//node is removed, unlink it at this level. links of a marked node do not change any more.
+					uintptr_t expected = (uintptr_t)node;
+					if (pred_link->compare_exchange_strong(expected, next & ~(uintptr_t)1,
+														   std::memory_order_acq_rel, std::memory_order_acquire) == false)
+					{	//pred is removed too or something was inserted after it
+						is_lost = true;
+						break;
+					}
+					node = GetNode(next);
+					continue;
 				}
-				return *this;
-			}
-			ChildrenIterator operator ++ (int)
-			{
-				ChildrenIterator ret_val = *this;
-				if (Advance(false) == false)
+				if (Compare::Less(*(const KeyType*)GetKey(node), key) == false)
 				{
-					m_child = NULL;
+					break;
 				}
-				return ret_val;
+				pred = node;
+				pred_link = &GetLinks(pred)[level];
+				node = GetNode(next);
 			}
-			ChildrenIterator operator -- ()
+			if (is_lost)
 			{
-				if (Advance(false) == false)
-				{
-					m_child = NULL;
-				}
-				return *this;
+				pred = m_head;
+				level = MAX_HEIGHT - 1;
+				continue;
 			}
-			ChildrenIterator operator -- (int)
+			preds[level] = pred;
+			succs[level] = node;
+			--level;
+		}
+		return ((succs[0] != NULL) && (Compare::Less(key, *(const KeyType*)GetKey(succs[0])) == false));
+	}
+	//the first node with key not less than key that is not removed. nothing is written, so it is for readers.
+	template <class KeyType, class Compare>
+	Node* LowerBoundNode(const KeyType& key) const
+	{
+		Node* pred = m_head;
+		Node* node = NULL;
+		for (int level = MAX_HEIGHT - 1; level >= 0; --level)
+		{
+			node = GetNode(GetLinks(pred)[level].load(std::memory_order_acquire));
+			while (node != NULL)
 			{
-				ChildrenIterator ret_val = *this;
-				if (Advance(false) == false)
+				uintptr_t next = GetLinks(node)[level].load(std::memory_order_acquire);
+				if (IsMarked(next) == false)
 				{
-					m_child = NULL;
+					if (Compare::Less(*(const KeyType*)GetKey(node), key) == false)
+					{
+						break;
+					}
+					pred = node;
 				}
-				return ret_val;
+				node = GetNode(next);
 			}
-		protected:
-			Entry* m_parent;
-			Entry* m_child;
-			BasicReadWriteLock* m_rw_lock;	//this is those lock that belongs to the tree
-		};
-
-		Entry() :
-			m_parent(NULL),
-			m_first_child(NULL),
-			m_last_child(NULL),
-			m_children_count(0),
-			m_prev_sibling(NULL),
-			m_next_sibling(NULL)
-		{}
-		//destructor destroys all children as well.
-		virtual ~Entry();
-		unsigned int GetChildrenCount() const
-			{ return m_children_count; }
-		Entry* GetParent() const
-			{ return m_parent; }
-		/*child_before is a child entry before which a new_child will be inserted. may be NULL, 
-		then new entry is pushed back to the end of the children list.*/
-		bool AddChild(Entry* new_child, Entry* child_before = NULL);
-		Entry* /*next child*/ RemoveChild(Entry* child);
-		ChildrenIterator Begin() const
-			{ return ChildrenIterator(this, m_first_child);	}
-		Entry* GetNextSibling() const
-			{ return m_next_sibling; }
-		Entry* GetPrevSibling() const
-			{ return m_prev_sibling; }
-		Entry* GetFirstChild() const
-			{ return m_first_child;	}
-		Entry* GetLastChild() const
-			{ return m_last_child; }
-		//sibling setters are for internal use
-		void SetPrevSibling(Entry* e)
-			{ m_prev_sibling = e; }
-		void SetNextSibling(Entry* e)
-			{ m_next_sibling = e; }
-	protected:
-		Entry* m_parent;
-		Entry* m_first_child;
-		Entry* m_last_child;
-		unsigned int m_children_count;
-		//double linked list of children
-		Entry* m_prev_sibling;
-		Entry* m_next_sibling;
-	};
-
-	//this iterator moves through children and their children recursively. 
-	//(no real recursion e.g. calling fuction from the same function, is here)
-	//NOTE: on tree modification iterator may become unusable, so don't store it for a long time.
-	//use it only as a temporary object on stack.
-	class ChildrenIterator
+		}
+		return node;
+	}
+	template <class KeyType, class Compare>
+	Node* FindNode(const KeyType& key) const
 	{
-	public:
-		friend class BasicTree;
-		enum
+		Node* node = LowerBoundNode<KeyType, Compare>(key);
+		if ((node != NULL) && Compare::Less(key, *(const KeyType*)GetKey(node)))
 		{
-			INVALID = 0x1,
-			RETURN_TO_PARENTS = 0x2		//this means when iterator traverses the tree it goes throuh an entry (parent)
-										//and then goes to its children. when this flag is set, iterator returns to parent
-										//entry again after it passed through all children.
-		};
-		const unsigned int m_n_preallocated = 64;
-		//all parameters here have default values == NULL so that iterator can be created as a local variable 
-		//on stack an then be assigned to real iterator via GetChildrenIterator.
-		ChildrenIterator(BasicTree* tree = NULL,
-						 Entry* parent = NULL,
-						 Entry* child = NULL /*if child == NULL, then first child*/,
-						 unsigned int flags = 0):
-						 m_tree(tree),
-						 m_current_entry(NULL),
-						 m_prev_entry(NULL),
-						 m_flags(flags)
+			return NULL;
+		}
+		return node;
+	}
+	//value is NULL for sets. returns false if key is already in the map.
+	template <class KeyType, class Compare>
+	bool InternalInsert(const KeyType& key, const char* value)
+	{
+		EpochManager::Guard guard(&m_epochs);
+		Node* preds[MAX_HEIGHT];
+		Node* succs[MAX_HEIGHT];
+		if (FindPosition<KeyType, Compare>(key, preds, succs))
 		{
-			if ((m_tree == NULL) || (parent == NULL))
+			return false;
+		}
+		Node* node = CreateNode(GetRandomHeight(), (const char*)&key, value);
+		Link* links = GetLinks(node);
+		//the bottom level makes the node a part of the map
+		while (true)
+		{
+			for (unsigned int level = 0; level < node->m_height; ++level)
 			{
-				m_flags |= INVALID;
+				links[level].store((uintptr_t)succs[level], std::memory_order_relaxed);
 			}
-			Entry* actual_child = child;
-			if (actual_child == NULL)
+			uintptr_t expected = (uintptr_t)succs[0];
+			if (GetLinks(preds[0])[0].compare_exchange_strong(expected, (uintptr_t)node,
+															  std::memory_order_release, std::memory_order_relaxed))
 			{
-				if (parent != NULL)
-				{
-					actual_child = parent->m_first_child;
-				}
+				break;
 			}
-			if (actual_child == NULL)
-			{
-				m_flags |= INVALID;
+			if (FindPosition<KeyType, Compare>(key, preds, succs))
+			{	//another thread inserted the same key, no one has seen this node
+				DestroyNode(node);
+				return false;
 			}
-			m_current_entry = actual_child;
 		}
-		ChildrenIterator(const ChildrenIterator& another):
-			m_tree(another.m_tree),
-			m_current_entry(another.m_current_entry),
-			m_prev_entry(another.m_prev_entry),
-			m_flags(another.m_flags)
+		m_count.fetch_add(1, std::memory_order_relaxed);
+		LinkUpperLevels<KeyType, Compare>(node, preds, succs);
+		ReleaseOwner(node, &guard);
+		return true;
+	}
+	//stops when the node is removed meanwhile.
+	template <class KeyType, class Compare>
+	void LinkUpperLevels(Node* node, Node** preds, Node** succs)
+	{
+		Link* links = GetLinks(node);
+		const KeyType& key = *(const KeyType*)GetKey(node);
+		for (unsigned int level = 1; level < node->m_height; ++level)
 		{
-			if (m_tree == NULL)
+			while (true)
 			{
-				m_flags |= INVALID;
+				uintptr_t next = links[level].load(std::memory_order_acquire);
+				if (IsMarked(next))
+				{
+					return;
+				}
+				//only this thread writes unmarked links of the node, so it fails only when the link is marked
+				if ((GetNode(next) != succs[level]) &&
+					(links[level].compare_exchange_strong(next, (uintptr_t)succs[level], std::memory_order_acq_rel) == false))
+				{
+					return;
+				}
+				uintptr_t expected = (uintptr_t)succs[level];
+				if (GetLinks(preds[level])[level].compare_exchange_strong(expected, (uintptr_t)node,
+																		  std::memory_order_acq_rel))
+				{
+					if (IsMarked(links[level].load(std::memory_order_acquire)))
+					{	//removed while it was linked here, the remover could pass this level before
+						FindPosition<KeyType, Compare>(key, preds, succs);
+						return;
+					}
+					break;
+				}
+				FindPosition<KeyType, Compare>(key, preds, succs);
+				if (succs[0] != node)
+				{
+					return;	//removed and unlinked already
+				}
 			}
+		}
+	}
+	//out_value may be NULL.
+	template <class KeyType, class Compare>
+	bool InternalRemove(const KeyType& key, char* out_value)
+	{
+		EpochManager::Guard guard(&m_epochs);
+		Node* preds[MAX_HEIGHT];
+		Node* succs[MAX_HEIGHT];
+		if (FindPosition<KeyType, Compare>(key, preds, succs) == false)
+		{
+			return false;
+		}
+		Node* node = succs[0];
+		if (MarkLinks(node) == false)
+		{
+			return false;	//another thread removed it first
+		}
+		m_count.fetch_sub(1, std::memory_order_relaxed);
+		FindPosition<KeyType, Compare>(key, preds, succs);	//unlinks the node
+		ReleaseOwner(node, &guard);
+		//the node is not freed while this guard is here
+		if (out_value != NULL)
+		{
+			CopyValue(out_value, GetValue(node));
+		}
+		return true;
+	}
+
+	//marks the links of node from the top level down. returns false if the bottom one was marked by someone else.
+	bool MarkLinks(Node* node);
+	//the first node after node at the bottom level that is not removed. node may be the head.
+	Node* GetNextAlive(const Node* node) const;
+	//allocates the node and constructs the entry in it.
+	Node* CreateNode(unsigned int height, const char* key, const char* value);
+	Node* AllocateNode(unsigned int height);
+	//destroys the entry and frees the node.
+	void DestroyNode(Node* node);
+	static void FreeRetiredNode(EpochManager::RetiredNode* node, void* context);
+	void ReleaseOwner(Node* node, EpochManager::Guard* guard);
+	unsigned int GetRandomHeight();
+
+	//typed descendants implement these.
+	//constructs an entry at key_dst and value_dst from key and value. value is NULL for sets.
+	virtual void ConstructEntry(char* key_dst, char* value_dst, const char* key, const char* value) = 0;
+	//assigns value to an existing one at dst.
+	virtual void CopyValue(char* dst, const char* value) = 0;
+	virtual void DestroyEntry(char* key, char* value) = 0;
+
+	unsigned int m_key_offset;
+	unsigned int m_value_offset;
+	unsigned int m_links_offset;
+	BasicVector::Allocator* m_allocator;
+	Node* m_head;	//has all levels and no entry
+	mutable EpochManager m_epochs;
+	char m_pad0[CACHE_LINE_SIZE];
+	std::atomic<int> m_count;	//may be below 0 for a moment, a remover can count before the inserter
+	std::atomic<unsigned int> m_height_seed;
+	char m_pad1[CACHE_LINE_SIZE - sizeof(std::atomic<int>) - sizeof(std::atomic<unsigned int>)];
+};
+
+template <class KeyType, class ValueType, class Compare = LessFunction<KeyType> >
+class SkipListMap: public BasicSkipList
+{
+public:
+	class Iterator: public BasicSkipList::Iterator
+	{
+	public:
+		Iterator(const SkipListMap* map):
+			BasicSkipList::Iterator(map)
+		{}
+		//goes to the first entry with key not less than key.
+		void Seek(const KeyType& key)
+			{ InternalSeek<KeyType, Compare>(key); }
+		const KeyType& GetKey() const
+			{ return *(const KeyType*)BasicSkipList::Iterator::GetKey(); }
+		const ValueType& GetValue() const
+			{ return *(const ValueType*)BasicSkipList::Iterator::GetValue(); }
+	};
 
+	SkipListMap(BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator()):
+		BasicSkipList(sizeof(KeyType), alignof(KeyType), sizeof(ValueType), alignof(ValueType), allocator)
+	{}
+	virtual ~SkipListMap()
+		{ Clear(); }
+	//out_value may be NULL, then it is just a check.
+	bool Find(const KeyType& key, ValueType* out_value = NULL) const
+	{
+		EpochManager::Guard guard(&m_epochs);
+		Node* node = FindNode<KeyType, Compare>(key);
+		if ((node != NULL) && (out_value != NULL))
+		{
+			*out_value = *(const ValueType*)GetValue(node);
 		}
-		virtual ~ChildrenIterator()
+		return (node != NULL);
+	}
+	bool Contains(const KeyType& key) const
+		{ return Find(key); }
+	//returns false and keeps the old value if the key is already in the map.
+	bool Insert(const KeyType& key, const ValueType& value)
+		{ return InternalInsert<KeyType, Compare>(key, (const char*)&value); }
+	bool Remove(const KeyType& key, ValueType* out_value = NULL)
+		{ return InternalRemove<KeyType, Compare>(key, (char*)out_value); }
+protected:
+	void ConstructEntry(char* key_dst, char* value_dst, const char* key, const char* value)
+	{
+		KeyType* new_key = new (key_dst) KeyType(*(const KeyType*)key);
+		try
+		{
+			new (value_dst) ValueType(*(const ValueType*)value);
+		}
+		catch (...)
+		{
+			new_key->~KeyType();
+			throw;
+		}
+	}
+	void CopyValue(char* dst, const char* value)
+		{ *(ValueType*)dst = *(const ValueType*)value; }
+	void DestroyEntry(char* key, char* value)
+	{
+		((ValueType*)value)->~ValueType();
+		((KeyType*)key)->~KeyType();
+	}
+};
+
+template <class KeyType, class Compare = LessFunction<KeyType> >
+class SkipListSet: public BasicSkipList
+{
+public:
+	class Iterator: public BasicSkipList::Iterator
+	{
+	public:
+		Iterator(const SkipListSet* set):
+			BasicSkipList::Iterator(set)
 		{}
-		ChildrenIterator& operator = (const ChildrenIterator& another)
+		void Seek(const KeyType& key)
+			{ InternalSeek<KeyType, Compare>(key); }
+		const KeyType& GetKey() const
+			{ return *(const KeyType*)BasicSkipList::Iterator::GetKey(); }
+	};
+
+	SkipListSet(BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator()):
+		BasicSkipList(sizeof(KeyType), alignof(KeyType), 0, 1, allocator)
+	{}
+	virtual ~SkipListSet()
+		{ Clear(); }
+	bool Contains(const KeyType& key) const
+	{
+		EpochManager::Guard guard(&m_epochs);
+		return (FindNode<KeyType, Compare>(key) != NULL);
+	}
+	//returns false if the key is already in the set.
+	bool Insert(const KeyType& key)
+		{ return InternalInsert<KeyType, Compare>(key, NULL); }
+	bool Remove(const KeyType& key)
+		{ return InternalRemove<KeyType, Compare>(key, NULL); }
+protected:
+	void ConstructEntry(char* key_dst, char* value_dst, const char* key, const char* value)
+		{ new (key_dst) KeyType(*(const KeyType*)key); }
+	void CopyValue(char* dst, const char* value)
+		{}
+	void DestroyEntry(char* key, char* value)
+		{ ((KeyType*)key)->~KeyType(); }
+};
+
+//fast random number for spreading threads over shards, every thread has it's own xorshift state.
+unsigned int GetThreadRandom();
+
+//d-ary heap, Top is the entry that no other entry is bigger than by Compare (give a reversed Compare for the smallest
+//first). with ARITY children a node the heap is not as deep as a binary one and children of a node are next to each
+//other, so a sift down touches fewer cache lines. Push returns a handle that stays with the entry while it moves,
+//Update and Remove find the entry by it at once. a handle is reused after it's entry leaves the queue.
+//entries are in one array from the allocator, it doubles when it is full. it is not synchronized.
+template <class DataType, class Compare = LessFunction<DataType>, unsigned int ARITY = 4>
+class PriorityQueue
+{
+	static_assert(ARITY >= 2, "a heap node must have at least two children");
+public:
+	typedef unsigned int Handle;
+	enum
+	{
+		INVALID_HANDLE = 0xFFFFFFFF,
+		MIN_CAPACITY = 8
+	};
+	PriorityQueue(unsigned int n_preallocated = 0,
+				  BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator()):
+		m_slots(NULL),
+		m_count(0),
+		m_capacity(0),
+		m_positions(NULL),
+		m_handle_count(0),
+		m_handle_capacity(0),
+		m_free_handle(INVALID_HANDLE),
+		m_allocator(allocator)
+	{
+		if (m_allocator == NULL)
 		{
-			//bool unlock_this(false);
-			//bool unlock_another(false);
-			//unsigned int error = UTILS_ERROR_OK;
-			//const wchar_t* msg = NULL;
-			BasicReadWriteLock* this_rw_lock = NULL;
-			BasicReadWriteLock* another_rw_lock = NULL;
-			if (another.m_tree != NULL)
+			throw Exception(UTILS_ERROR_NO_ALLOCATOR,
+				L"Cannot create priority queue without allocator",
+				EXC_HERE);
+		}
+		if (n_preallocated > 0)
+		{
+			Reserve(n_preallocated);
+		}
+	}
+	PriorityQueue(const PriorityQueue& another) = delete;
+	PriorityQueue& operator = (const PriorityQueue& another) = delete;
+	virtual ~PriorityQueue()
+	{
+		Clear();
+		if (m_slots != NULL)
+		{
+			m_allocator->FreeDataArray((char*)m_slots);
+		}
+		if (m_positions != NULL)
+		{
+			m_allocator->FreeDataArray((char*)m_positions);
+		}
+	}
+	unsigned int GetCount() const
+		{ return m_count; }
+	bool IsEmpty() const
+		{ return (m_count == 0); }
+	//NULL if the queue is empty
+	const DataType* Top() const
+		{ return ((m_count > 0) ? &m_slots[0].m_data : NULL); }
+	Handle GetTopHandle() const
+		{ return ((m_count > 0) ? m_slots[0].m_handle : (Handle)INVALID_HANDLE); }
+	Handle Push(const DataType& data)
+	{
+		if (m_count == m_capacity)
+		{
+			Grow(m_count + 1);
+		}
+		Handle handle = TakeHandle();
+		try
+		{
+			new (&m_slots[m_count]) Slot(data, handle);
+		}
+		catch (...)
+		{
+			ReleaseHandle(handle);
+			throw;
+		}
+		m_positions[handle] = m_count;
+		++m_count;
+		SiftUp(m_count - 1);
+		return handle;
+	}
+	//this method throws exceptions
+	void Pop(DataType* out_data = NULL)
+	{
+		if (m_count == 0)
+		{
+			throw Exception(UTILS_ERROR_INDEX_BIGGER_THAN_ARRAY_SIZE,
+				L"Cannot pop entry because priority queue is empty",
+				EXC_HERE);
+		}
+		RemoveAt(0, out_data);
+	}
+	bool Contains(Handle handle) const
+	{
+		if (handle >= m_handle_count)
+		{
+			return false;
+		}
+		unsigned int index = m_positions[handle];
+		return ((index < m_count) && (m_slots[index].m_handle == handle));
+	}
+	//these methods throw exceptions if the handle is not in the queue.
+	const DataType& Get(Handle handle) const
+		{ return m_slots[GetIndex(handle)].m_data; }
+	//replaces the entry, it goes up or down to it's new place (decrease-key and increase-key).
+	void Update(Handle handle, const DataType& data)
+	{
+		unsigned int index = GetIndex(handle);
+		m_slots[index].m_data = data;
+		Restore(index);
+	}
+	void Remove(Handle handle, DataType* out_data = NULL)
+		{ RemoveAt(GetIndex(handle), out_data); }
+	//all handles become invalid, memory is kept.
+	void Clear()
+	{
+		for (unsigned int index = 0; index < m_count; ++index)
+		{
+			m_slots[index].~Slot();
+		}
+		m_count = 0;
+		m_handle_count = 0;
+		m_free_handle = INVALID_HANDLE;
+	}
+	void Reserve(unsigned int capacity)
+	{
+		if (capacity > m_capacity)
+		{
+			Grow(capacity);
+		}
+	}
+protected:
+	struct Slot
+	{
+		Slot(const DataType& data, Handle handle):
+			m_data(data),
+			m_handle(handle)
+		{}
+		DataType m_data;
+		Handle m_handle;
+	};
+	unsigned int GetIndex(Handle handle) const
+	{
+		if (Contains(handle) == false)
+		{
+			throw Exception(UTILS_ERROR_NOT_IN_COLLECTION,
+				L"Cannot find priority queue entry because handle is not in the queue",
+				EXC_HERE);
+		}
+		return m_positions[handle];
+	}
+	//free handles are chained through m_positions
+	Handle TakeHandle()
+	{
+		if (m_free_handle != INVALID_HANDLE)
+		{
+			Handle handle = m_free_handle;
+			m_free_handle = m_positions[handle];
+			return handle;
+		}
+		if (m_handle_count == m_handle_capacity)
+		{
+			unsigned int capacity = (m_handle_capacity < MIN_CAPACITY) ? (unsigned int)MIN_CAPACITY : m_handle_capacity * 2;
+			unsigned int* positions = (unsigned int*)m_allocator->AllocateDataArray(sizeof(unsigned int), capacity);
+			if (positions == NULL)
 			{
-				another_rw_lock = another.m_tree->m_rw_lock;
+				throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+					L"Cannot allocate handles of priority queue",
+					EXC_HERE);
 			}
-			if (m_tree != NULL)
+			if (m_positions != NULL)
 			{
-				this_rw_lock = m_tree->m_rw_lock;
+				memcpy(positions, m_positions, m_handle_count * sizeof(unsigned int));
+				m_allocator->FreeDataArray((char*)m_positions);
 			}
-			ReadSynchronizer read_synchronizer(another_rw_lock);
-			WriteSynchronizer write_synchronizer(this_rw_lock);
-			/*if ((another.m_tree != NULL) && (another.m_tree->m_rw_lock != NULL))
+			m_positions = positions;
+			m_handle_capacity = capacity;
+		}
+		return m_handle_count++;
+	}
+	void ReleaseHandle(Handle handle)
+	{
+		m_positions[handle] = m_free_handle;
+		m_free_handle = handle;
+	}
+	void Grow(unsigned int min_capacity)
+	{
+		unsigned int capacity = (m_capacity < MIN_CAPACITY) ? (unsigned int)MIN_CAPACITY : m_capacity * 2;
+		if (capacity < min_capacity)
+		{
+			capacity = min_capacity;
+		}
+		Slot* slots = (Slot*)m_allocator->AllocateDataArray(sizeof(Slot), capacity);
+		if (slots == NULL)
+		{
+			throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+				L"Cannot allocate priority queue",
+				EXC_HERE);
+		}
+		for (unsigned int index = 0; index < m_count; ++index)
+		{
+			new (&slots[index]) Slot(std::move(m_slots[index]));
+			m_slots[index].~Slot();
+		}
+		if (m_slots != NULL)
+		{
+			m_allocator->FreeDataArray((char*)m_slots);
+		}
+		m_slots = slots;
+		m_capacity = capacity;
+	}
+	inline void Place(unsigned int index, Slot&& slot)
+	{
+		m_slots[index] = std::move(slot);
+		m_positions[m_slots[index].m_handle] = index;
+	}
+	void SiftUp(unsigned int index)
+	{
+		Slot tmp(std::move(m_slots[index]));
+		while (index > 0)
+		{
+			unsigned int parent = (index - 1) / ARITY;
+			if (Compare::Less(m_slots[parent].m_data, tmp.m_data) == false)
 			{
-				if (another.m_tree->m_rw_lock->LockForRead())
-				{
-					unlock_another = true;
-				} else {
-					error = SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ;
-					msg = L"cannot lock source tree for read";
-				}
+				break;
 			}
-			if ((m_tree != NULL) && (m_tree->m_rw_lock != NULL))
-			{
-				if (m_tree->m_rw_lock->LockForWrite())
-				{
-					unlock_this = true;
-				} else {
-					error = SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_WRITE;
-					msg = L"cannot lock destination tree for write";
-				}
-			}*/
-			m_tree = another.m_tree;
-			m_current_entry = another.m_current_entry;
-			m_prev_entry = another.m_prev_entry;
-			m_flags = another.m_flags;
-			if (m_tree == NULL)
+			Place(index, std::move(m_slots[parent]));
+			index = parent;
+		}
+		Place(index, std::move(tmp));
+	}
+	void SiftDown(unsigned int index)
+	{
+		Slot tmp(std::move(m_slots[index]));
+		while (true)
+		{
+			unsigned int first_child = index * ARITY + 1;
+			if (first_child >= m_count)
 			{
-				m_flags |= INVALID;
+				break;
 			}
-			return *this;
-			/*if (unlock_this)
+			unsigned int end_child = (m_count - first_child > ARITY) ? first_child + ARITY : m_count;
+			unsigned int best = first_child;
+			for (unsigned int child = first_child + 1; child < end_child; ++child)
 			{
-				if (m_tree != NULL)
+				if (Compare::Less(m_slots[best].m_data, m_slots[child].m_data))
 				{
-					ASSERT(m_tree->m_rw_lock != NULL);
-					m_tree->m_rw_lock->Unlock();
+					best = child;
 				}
 			}
-			if (unlock_another)
-			{
-				if (another.m_tree != NULL)
-				{
-					ASSERT(another.m_tree->m_rw_lock != NULL);
-					another.m_tree->m_rw_lock->Unlock();
-				}
-			}*/
-			/*if (error != UTILS_ERROR_OK)
+			if (Compare::Less(tmp.m_data, m_slots[best].m_data) == false)
 			{
-				ASSERT(msg != NULL);
-				throw Exception(error, msg, EXC_HERE);
-			}*/
+				break;
+			}
+			Place(index, std::move(m_slots[best]));
+			index = best;
 		}
-		bool IsValid() const
-			{ return ((m_flags & INVALID) == 0); }
-		bool Advance(bool forward = true);
-		ChildrenIterator& operator ++ ()
+		Place(index, std::move(tmp));
+	}
+	//the entry at index was changed, it goes where it belongs.
+	void Restore(unsigned int index)
+	{
+		if ((index > 0) && Compare::Less(m_slots[(index - 1) / ARITY].m_data, m_slots[index].m_data))
 		{
-			if (Advance(true) == false)
-			{
-				m_flags |= INVALID;
-			}
-			else {
-				m_flags &= (~INVALID);
-			}
-			return *this;
+			SiftUp(index);
+		} else {
+			SiftDown(index);
 		}
-		ChildrenIterator operator ++ (int i)
+	}
+	void RemoveAt(unsigned int index, DataType* out_data)
+	{
+		if (out_data != NULL)
 		{
-			ChildrenIterator ret_val = *this;
-			if (Advance(true) == false)
-			{
-				m_flags |= INVALID;
-			} else {
-				m_flags &= (~INVALID);
-			}
-			return ret_val;
+			*out_data = std::move(m_slots[index].m_data);
 		}
-		ChildrenIterator& operator -- ()
+		ReleaseHandle(m_slots[index].m_handle);
+		--m_count;
+		if (index != m_count)
+		{	//the last entry takes the place
+			Place(index, std::move(m_slots[m_count]));
+			m_slots[m_count].~Slot();
+			Restore(index);
+		} else {
+			m_slots[m_count].~Slot();
+		}
+	}
+
+	Slot* m_slots;
+	unsigned int m_count;
+	unsigned int m_capacity;
+	unsigned int* m_positions;	//index of the entry of a handle, or the next free handle
+	unsigned int m_handle_count;
+	unsigned int m_handle_capacity;
+	Handle m_free_handle;
+	BasicVector::Allocator* m_allocator;
+};
+
+//relaxed priority queue for many threads (MultiQueue of Rihani, Sanders and Dementiev). entries are spread over
+//shards, each is a PriorityQueue under it's own spin lock. TryPop takes the better top of two random shards, so it
+//returns one of the best entries but not always the best one, that is what keeps threads off one lock.
+//with two or more shards a thread the locks are mostly free.
+template <class DataType, class Compare = LessFunction<DataType> >
+class MultiQueue
+{
+public:
+	enum
+	{
+		SHARDS_PER_THREAD = 2
+	};
+	MultiQueue(unsigned int shard_count,
+			   BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator()):
+		m_shards(NULL),
+		m_shard_count(shard_count),
+		m_allocator(allocator)
+	{
+		if ((shard_count == 0) || (m_allocator == NULL))
 		{
-			if (Advance(false) == false)
-			{
-				m_flags |= INVALID;
-			} else {
-				m_flags &= (~INVALID);
-			}
-			return *this;
+			throw Exception(UTILS_ERROR_INVALID_PARAMETERS,
+				L"Cannot create MultiQueue without shards or without allocator",
+				EXC_HERE);
 		}
-		ChildrenIterator operator -- (int i)
+		m_shards = (Shard*)m_allocator->AllocateDataArray(sizeof(Shard), shard_count);
+		if (m_shards == NULL)
 		{
-			ChildrenIterator ret_val = *this;
-			if (Advance(false) == false)
-			{
-				m_flags |= INVALID;
-			} else {
-				m_flags &= (~INVALID);
-			}
-			return ret_val;
+			throw Exception(UTILS_ERROR_NO_ALLOCATED_MEMORY,
+				L"Cannot allocate shards for MultiQueue",
+				EXC_HERE);
 		}
-		Entry* GetParent() const
+		for (unsigned int index = 0; index < shard_count; ++index)
 		{
-			return m_current_entry->GetParent();
+			new (&m_shards[index]) Shard(m_allocator);
 		}
-		Entry* GetCurrentChild() const
+	}
+	MultiQueue(const MultiQueue& another) = delete;
+	MultiQueue& operator = (const MultiQueue& another) = delete;
+	virtual ~MultiQueue()
+	{
+		//no one must use the queue at this moment
+		for (unsigned int index = 0; index < m_shard_count; ++index)
 		{
-			return m_current_entry;
+			m_shards[index].~Shard();
 		}
-		unsigned int GetFlags() const
+		m_allocator->FreeDataArray((char*)m_shards);
+	}
+	void Push(const DataType& data)
+	{
+		Shard* shard = NULL;
+		do
 		{
-			return m_flags; 
-		}
-		bool GetFlag(unsigned int mask) const
+			shard = GetRandomShard();
+		} while (shard->m_lock.TryLockForWrite() == false);
+		try
 		{
-			return (m_flags & mask); 
+			shard->m_queue.Push(data);
 		}
-		void SetFlag(unsigned int mask, bool value)
+		catch (...)
 		{
-			if (value)
-			{
-				m_flags |= mask;
-			} else {
-				m_flags &= (~mask);
-			}
+			shard->m_lock.Unlock();
+			throw;
 		}
-	protected:
-		Entry* FindGrandparentWithNextUnseenChild(bool forward, Entry** unseen);
-
-		BasicTree* m_tree;
-		Entry* m_current_entry;
-		Entry* m_prev_entry;
-		unsigned int m_flags;
-	};
-
-	//this is iterator to iterate througn tree leaves, not coming back to parent entries
-	class TopLevelIterator
+		shard->m_count.store(shard->m_queue.GetCount(), std::memory_order_relaxed);
+		shard->m_lock.Unlock();
+	}
+	//returns false if all shards were empty.
+	bool TryPop(DataType* out_data)
 	{
-		friend class BasicTree;
-		enum
+		for (unsigned int attempt = 0; attempt < m_shard_count; ++attempt)
 		{
-			INVALID = 1
-		};
-	public:
-		TopLevelIterator():
-			m_flags(0),
-			m_rw_lock(NULL)
-			{}
-		TopLevelIterator(const ChildrenIterator& ch_it) :
-			m_it(ch_it),
-			m_flags(0),
-			m_rw_lock(NULL)
+			Shard* first = GetRandomShard();
+			Shard* second = GetRandomShard();
+			if (first->m_count.load(std::memory_order_relaxed) == 0)
 			{
-				if (ch_it.m_tree != NULL)
-				{
-					m_rw_lock = ch_it.m_tree->m_rw_lock;
-				}
+				std::swap(first, second);
 			}
-		/*virtual ~TopLevelIterator()
-		{}*/
-		bool Advance(bool forward);
-		TopLevelIterator& operator ++ ()
-		{
-			/*if (m_rw_lock != NULL)
-			{
-				if (m_rw_lock->TryLockForRead() == false)
-				{
-					throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
-						L"tree is locked for reading",
-						EXC_HERE);
-				}
-			}*/
-			TryWriteSynchronizer write_sync(m_rw_lock);
-			if (Advance(true) == false)
+			if (first->m_count.load(std::memory_order_relaxed) == 0)
 			{
-				m_flags |= INVALID;
-			} else {
-				m_flags &= (~INVALID);
+				continue;	//both look empty
 			}
-			return *this;
-		}
-		TopLevelIterator operator ++ (int)
-		{
-			/*if (m_rw_lock != NULL)
+			if ((second == first) || (second->m_count.load(std::memory_order_relaxed) == 0))
 			{
-				if (m_rw_lock->TryLockForRead() == false)
-				{
-					throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
-						L"tree is locked for reading",
-						EXC_HERE);
-				}
-			}*/
-			TryReadSynchronizer sync(m_rw_lock);
-			TopLevelIterator ret_val = *this;
-			if(Advance(true) == false)
+				second = NULL;
+			}
+			if (first->m_lock.TryLockForWrite() == false)
 			{
-				m_flags |= INVALID;
+				continue;
 			}
-			else {
-				m_flags &= (~INVALID);
+			if ((second != NULL) && (second->m_lock.TryLockForWrite() == false))
+			{
+				second = NULL;
 			}
-			return ret_val;
-		}
-		TopLevelIterator& operator -- ()
-		{
-			/*if (m_rw_lock != NULL)
+			//locks are taken only by try, so two shards may be held at once without ordering
+			Shard* best = first;
+			if ((second != NULL) && (second->m_queue.IsEmpty() == false) &&
+				((first->m_queue.IsEmpty()) || Compare::Less(*first->m_queue.Top(), *second->m_queue.Top())))
 			{
-				if (m_rw_lock->TryLockForRead() == false)
-				{
-					throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
-						L"tree is locked for reading",
-						EXC_HERE);
-				}
-			}*/
-			TryReadSynchronizer sync(m_rw_lock);
-			if (Advance(false) == false)
+				best = second;
+			}
+			bool ret_val = PopLocked(best, out_data);
+			if (second != NULL)
 			{
-				m_flags |= INVALID;
+				second->m_lock.Unlock();
 			}
-			else {
-				m_flags &= (~INVALID);
+			first->m_lock.Unlock();
+			if (ret_val)
+			{
+				return true;
 			}
-			return *this;
 		}
-		TopLevelIterator operator -- (int)
+		//random shards were empty or busy, go through all of them before saying the queue is empty
+		for (unsigned int index = 0; index < m_shard_count; ++index)
 		{
-			/*if (m_rw_lock != NULL)
-			{
-				if (m_rw_lock->TryLockForRead() == false)
-				{
-					throw Exception(SYNCHRONIZATION_ERROR_CANNOT_GET_LOCK_FOR_READ,
-						L"tree is locked for reading",
-						EXC_HERE);
-				}
-			}*/
-			TryReadSynchronizer sync(m_rw_lock);
-			TopLevelIterator ret_val = *this;
-			if(Advance(false) == false)
+			Shard* shard = &m_shards[index];
+			if (shard->m_count.load(std::memory_order_relaxed) == 0)
 			{
-				m_flags |= INVALID;
+				continue;
 			}
-			else {
-				m_flags &= (~INVALID);
+			shard->m_lock.LockForWrite();
+			bool ret_val = PopLocked(shard, out_data);
+			shard->m_lock.Unlock();
+			if (ret_val)
+			{
+				return true;
 			}
-			return ret_val;
 		}
-		bool IsValid() const
-			{ return ((m_flags & INVALID) == 0); }
-		Entry* GetEntry() const
-			{ return m_it.GetCurrentChild(); }
-	protected:
-		inline void SetValid(bool is_valid)
+		return false;
+	}
+	//exact only when no one changes the queue.
+	unsigned int GetCount() const
+	{
+		unsigned int ret_val = 0;
+		for (unsigned int index = 0; index < m_shard_count; ++index)
 		{
-			if(is_valid)
-			{
-				m_flags &= (~INVALID);
-			} else {
-				m_flags |= INVALID;
-			}
+			ret_val += m_shards[index].m_count.load(std::memory_order_relaxed);
 		}
-		ChildrenIterator m_it;
-		unsigned int m_flags;
-		BasicReadWriteLock* m_rw_lock;	//this is those lock that belongs to the tree
+		return ret_val;
+	}
+	bool IsEmpty() const
+		{ return (GetCount() == 0); }
+	unsigned int GetShardCount() const
+		{ return m_shard_count; }
+protected:
+	struct Shard
+	{
+		Shard(BasicVector::Allocator* allocator):
+			m_count(0),
+			m_queue(0, allocator)
+		{}
+		SpinReadWriteLock m_lock;
+		std::atomic<unsigned int> m_count;	//entries in m_queue, it is read without the lock
+		PriorityQueue<DataType, Compare> m_queue;
+		char m_pad[CACHE_LINE_SIZE];
 	};
+	inline Shard* GetRandomShard() const
+		{ return &m_shards[((unsigned long long)GetThreadRandom() * m_shard_count) >> 32]; }
+	bool PopLocked(Shard* shard, DataType* out_data)
+	{
+		if (shard->m_queue.IsEmpty())
+		{
+			return false;
+		}
+		shard->m_queue.Pop(out_data);
+		shard->m_count.store(shard->m_queue.GetCount(), std::memory_order_relaxed);
+		return true;
+	}
 
-	BasicTree(BasicReadWriteLock* lock = NULL) :
-		m_root(NULL),
-		m_rw_lock(lock)
-	{}
-	/*if parent == NULL, then root is parent. if child == NULL, then the first child of parent.*/
-	ChildrenIterator GetChildrenIterator(unsigned int flags = 0, 
-										 Entry* parent = NULL, 
-										 Entry* child = NULL,
-										 bool is_first = true);
-	//if basic_entry == NULL, then basic_entry is m_root
-	TopLevelIterator GetTopLevelIterator(bool is_begin, Entry* basic_entry = NULL);
-	//this method adds entry as a child to parent. entry may have it's own children.
-	//return value is a just added entry;
-	Entry* AddEntry(Entry* entry, Entry* parent, Entry* child_before = NULL);
-	//this method just cuts off the branch
-	//return value is a just removed entry
-	Entry* RemoveEntry(Entry* entry);
-	Entry* GetRoot()
-		{ return m_root; }
-	inline bool IsEmpty() const
-		{ return (m_root == NULL); }
-	bool LockForRead();
-	bool LockForWrite();
-	void Unlock();
-protected:
-	Entry* m_root;
-	BasicReadWriteLock* m_rw_lock;
+	Shard* m_shards;
+	unsigned int m_shard_count;
+	BasicVector::Allocator* m_allocator;
 };
 
-template <class DataType>
-class Tree: public BasicTree
+//array of bits in 64 bit words. bits past the size in the last word are always clear.
+//whole-set operations go word by word, the compiler makes SSE2 out of them. Count and the Find methods use AVX2
+//when the cpu has it and go through 256 bits at a time, Count uses POPCNT otherwise if it is there.
+class Bitset
 {
 public:
-	class Entry: public BasicTree::Entry
+	typedef unsigned long long Word;
+	enum
 	{
-		friend class Tree;
-	public:
-		//Entry()
-		//{}
-		Entry(const DataType& data):
-			m_data(data)
-		{}
-		//virtual ~Entry();
-		Entry& operator = (const DataType& data)
-			{ m_data = data; }
-		operator DataType& ()
-			{ return m_data; }
-		Entry* GetNextSibling() const
-			{ return reinterpret_cast<Entry*>(m_next_sibling); }
-	protected:
-		DataType m_data;
+		WORD_BITS = 64,
+		NOT_FOUND = 0xFFFFFFFF
 	};
+	//all bits are clear
+	Bitset(unsigned int size = 0, BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator());
+	//bits are kept in GetWordCount(size) words of the caller, for sets that live in a block of their owner.
+	//the set does not free them and cannot grow beyond them. all bits are clear.
+	Bitset(Word* words, unsigned int size);
+	Bitset(const Bitset& another);
+	virtual ~Bitset();
+	Bitset& operator = (const Bitset& another);
+	unsigned int GetSize() const
+		{ return m_size; }
+	unsigned int GetWordCount() const
+		{ return GetWordCount(m_size); }
+	const Word* GetWords() const
+		{ return m_words; }
+	//new bits are clear
+	void Resize(unsigned int size);
+	bool Test(unsigned int index) const
+	{
+		ASSERT(index < m_size);
+		return (((m_words[index / WORD_BITS] >> (index % WORD_BITS)) & 1) != 0);
+	}
+	void Set(unsigned int index)
+	{
+		ASSERT(index < m_size);
+		m_words[index / WORD_BITS] |= (Word)1 << (index % WORD_BITS);
+	}
+	void Reset(unsigned int index)
+	{
+		ASSERT(index < m_size);
+		m_words[index / WORD_BITS] &= ~((Word)1 << (index % WORD_BITS));
+	}
+	void Flip(unsigned int index)
+	{
+		ASSERT(index < m_size);
+		m_words[index / WORD_BITS] ^= (Word)1 << (index % WORD_BITS);
+	}
+	void SetAll();
+	void ResetAll();
+	void FlipAll();
+	//number of set bits
+	unsigned int Count() const;
+	bool Any() const
+		{ return (FindFirstSet() != NOT_FOUND); }
+	//these methods return NOT_FOUND if there is no such bit. Next ones look after index, so
+	//for (index = FindFirstSet(); index != NOT_FOUND; index = FindNextSet(index)) goes through set bits.
+	unsigned int FindFirstSet() const
+		{ return FindBit(0, 0); }
+	unsigned int FindNextSet(unsigned int index) const
+		{ return ((index < m_size) ? FindBit(index + 1, 0) : (unsigned int)NOT_FOUND); }
+	unsigned int FindFirstClear() const
+		{ return FindBit(0, ~(Word)0); }
+	unsigned int FindNextClear(unsigned int index) const
+		{ return ((index < m_size) ? FindBit(index + 1, ~(Word)0) : (unsigned int)NOT_FOUND); }
+	//this methods throw exceptions if sizes of the sets differ
+	Bitset& operator &= (const Bitset& another);
+	Bitset& operator |= (const Bitset& another);
+	Bitset& operator ^= (const Bitset& another);
+	//clears bits that are set in another
+	Bitset& AndNot(const Bitset& another);
+	bool operator == (const Bitset& another) const;
+	bool operator != (const Bitset& another) const
+		{ return !(*this == another); }
+	static unsigned int GetWordCount(unsigned int size)
+		{ return ((size + WORD_BITS - 1) / WORD_BITS); }
+protected:
+	//the first bit from from on that is set after xor with flip
+	unsigned int FindBit(unsigned int from, Word flip) const;
+	void ClearTail();
+	void CheckSize(const Bitset& another) const;
+	void Reallocate(unsigned int word_count);
 
-	/*Tree(BasicTree::Allocator* allocator) :
-		BasicTree(allocator)
-	{}*/
-	//virtual ~Tree();
-	Tree(BasicReadWriteLock* lock = NULL) :
-		BasicTree(lock)
-		{}
-	Entry* GetRoot() const
+	Word* m_words;
+	unsigned int m_size;
+	unsigned int m_capacity;	//in words
+	BasicVector::Allocator* m_allocator;	//NULL if words are not owned by the set
+};
+
+//bitset of a fixed size for many threads. every bit is changed by one atomic operation, Set and Reset return what
+//the bit was, so a thread knows if it was the one who changed it. Count and the Find methods read words one by one,
+//their result is exact only if no one changes the set meanwhile.
+class AtomicBitset
+{
+public:
+	typedef Bitset::Word Word;
+	enum
 	{
-		if (m_root == NULL)
-		{
-			return NULL;
-		}
-		return reinterpret_cast<Entry*>(m_root); 
+		WORD_BITS = Bitset::WORD_BITS,
+		NOT_FOUND = Bitset::NOT_FOUND
+	};
+	//all bits are clear
+	AtomicBitset(unsigned int size, BasicVector::Allocator* allocator = BasicVector::GetDefaultAllocator());
+	virtual ~AtomicBitset();
+	AtomicBitset(const AtomicBitset& another) = delete;
+	AtomicBitset& operator = (const AtomicBitset& another) = delete;
+	unsigned int GetSize() const
+		{ return m_size; }
+	bool Test(unsigned int index) const
+	{
+		ASSERT(index < m_size);
+		return (((m_words[index / WORD_BITS].load(std::memory_order_acquire) >> (index % WORD_BITS)) & 1) != 0);
 	}
-	
+	//returns the previous value of the bit
+	bool Set(unsigned int index)
+	{
+		ASSERT(index < m_size);
+		Word mask = (Word)1 << (index % WORD_BITS);
+		return ((m_words[index / WORD_BITS].fetch_or(mask, std::memory_order_acq_rel) & mask) != 0);
+	}
+	bool Reset(unsigned int index)
+	{
+		ASSERT(index < m_size);
+		Word mask = (Word)1 << (index % WORD_BITS);
+		return ((m_words[index / WORD_BITS].fetch_and(~mask, std::memory_order_acq_rel) & mask) != 0);
+	}
+	void ResetAll();
+	unsigned int Count() const;
+	unsigned int FindFirstSet() const
+		{ return FindBit(0, 0); }
+	unsigned int FindNextSet(unsigned int index) const
+		{ return ((index < m_size) ? FindBit(index + 1, 0) : (unsigned int)NOT_FOUND); }
+	unsigned int FindFirstClear() const
+		{ return FindBit(0, ~(Word)0); }
+	unsigned int FindNextClear(unsigned int index) const
+		{ return ((index < m_size) ? FindBit(index + 1, ~(Word)0) : (unsigned int)NOT_FOUND); }
+	//finds a clear bit and sets it, the search starts from the word of hint and wraps around.
+	//returns NOT_FOUND if all bits are set.
+	unsigned int SetFirstClear(unsigned int hint = 0);
 protected:
-	
+	unsigned int GetWordCount() const
+		{ return ((m_size + WORD_BITS - 1) / WORD_BITS); }
+	//bits of the word that are inside the set
+	Word GetValidMask(unsigned int word_index) const;
+	unsigned int FindBit(unsigned int from, Word flip) const;
+
+	std::atomic<Word>* m_words;
+	unsigned int m_size;
+	BasicVector::Allocator* m_allocator;
 };
 
 } //end namespace SyncTL